@@ -0,0 +1,99 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Memory accesses of a thread waiting to be checked (ETSAN_BATCHED_ACCESSES).
+//
+// Between two synchronizations the epoch of a thread does not change, so
+// its accesses give the same results whether they are checked one by one
+// or all at once before its next synchronization. The access callbacks
+// only append to the batch of the thread; ft_flush_accesses (fasttrack.h)
+// checks it when it fills, at every synchronization of the thread and
+// when the thread is joined. A batch is checked in address order, one
+// access per address, size and type, which keeps the variable states
+// touched together and skips the repeated accesses of loops.
+
+#ifndef ETSAN_ACCESS_BATCH_H_
+#define ETSAN_ACCESS_BATCH_H_
+
+#include <stdint.h>
+#include <algorithm>
+
+#ifndef ETSAN_BATCH_SIZE
+#define ETSAN_BATCH_SIZE 256
+#endif
+
+namespace etsan {
+
+  struct BatchedAccess {
+    const void   *addr;
+    unsigned int  siteId;
+    uint16_t      size;
+    bool          isWrite;
+  };
+
+  class AccessBatch {
+  public:
+    static constexpr unsigned kCapacity = ETSAN_BATCH_SIZE;
+
+    // Appends an access; returns true when the batch is full
+    bool push(const void *addr, uint16_t size, bool isWrite,
+              unsigned int siteId) {
+      BatchedAccess & a = accesses[count++];
+      a.addr = addr;
+      a.siteId = siteId;
+      a.size = size;
+      a.isWrite = isWrite;
+      return count == kCapacity;
+    }
+
+    bool empty() const { return !count; }
+
+    // Sorts the accesses by address, those of one address in program
+    // order, and drops the repeated ones; returns the number left
+    unsigned sortUnique() {
+      std::stable_sort(accesses, accesses + count,
+          [](const BatchedAccess & a, const BatchedAccess & b) {
+            return a.addr < b.addr;
+          });
+      unsigned n = 0;
+      for (unsigned i = 0; i < count; i++) {
+        if (n && seenSince(n, accesses[i])) continue;
+        accesses[n++] = accesses[i];
+      }
+      count = n;
+      return n;
+    }
+
+    const BatchedAccess & operator[](unsigned i) const { return accesses[i]; }
+
+    void clear() { count = 0; }
+
+  private:
+    // True if an access kept so far at the address of "a" equals it
+    bool seenSince(unsigned n, const BatchedAccess & a) const {
+      for (unsigned i = n; i-- > 0 && accesses[i].addr == a.addr;) {
+        if (accesses[i].size == a.size && accesses[i].isWrite == a.isWrite) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    BatchedAccess accesses[kCapacity];
+    unsigned count = 0;
+  };
+
+  constexpr unsigned AccessBatch::kCapacity;
+
+} // etsan
+
+#endif // ETSAN_ACCESS_BATCH_H_
@@ -0,0 +1,242 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Memory of the runtime metadata, kept apart from the application heap.
+//
+// Vector clocks, map nodes and race records are carved out of mmap-ed
+// chunks in power-of-two size classes, from 8 bytes up to kMaxSmall; a
+// freed block goes to a free list of its class, first the one of the
+// freeing thread, which takes no lock, then the shared one when the
+// thread's list is full or the thread exits. Chunks are never unmapped,
+// so the footprint is the peak of the metadata, in a few large mappings
+// which never fragment the application heap nor call its malloc. Larger
+// blocks (vector clocks of hundreds of threads) are mapped one by one.
+//
+// With ETSAN_HUGE_PAGES the chunks are huge pages (page_backing.h). With
+// ETSAN_NUMA each NUMA node carves from its own chunk, bound to it, so
+// the clocks and map nodes a thread allocates stay on its node.
+
+#ifndef ETSAN_ARENA_H_
+#define ETSAN_ARENA_H_
+
+#include <sys/mman.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include "page_backing.h"
+
+namespace etsan {
+
+  // Zero-initialized and trivially destructible: usable from any static
+  // constructor or destructor, in any order.
+  class MetadataArena {
+  public:
+    static constexpr unsigned kMinShift  = 3;  // 8 bytes
+    static constexpr unsigned kNumClasses = 9; // up to 2 KB
+    static constexpr size_t   kMaxSmall  = size_t(1) << (kMinShift +
+                                                        kNumClasses - 1);
+    static constexpr size_t   kChunkSize = sizeof(void *) == 4 ? 64 << 10
+                                                               : 1 << 20;
+    static constexpr unsigned kThreadCacheBlocks = 64; // per size class
+
+    void *allocate(size_t size) {
+      if (size > kMaxSmall) return mapBlock(size);
+
+      unsigned c = sizeClass(size);
+      ThreadCache & cache = threadCache();
+      FreeBlock *block = cache.lists[c];
+      if (block) {
+        cache.lists[c] = block->next;
+        cache.counts[c]--;
+        return block;
+      }
+
+      lock();
+      block = lists[c];
+      if (block) {
+        lists[c] = block->next;
+      } else {
+        block = static_cast<FreeBlock *>(carve(classSize(c)));
+      }
+      unlock();
+      return block;
+    }
+
+    void deallocate(void *p, size_t size) {
+      if (!p) return;
+      if (size > kMaxSmall) {
+        unmapBlock(p, size);
+        return;
+      }
+
+      unsigned c = sizeClass(size);
+      FreeBlock *block = static_cast<FreeBlock *>(p);
+      ThreadCache & cache = threadCache();
+      if (!cache.exited && cache.counts[c] < kThreadCacheBlocks) {
+        block->next = cache.lists[c];
+        cache.lists[c] = block;
+        cache.counts[c]++;
+        return;
+      }
+
+      lock();
+      block->next = lists[c];
+      lists[c] = block;
+      unlock();
+    }
+
+    // Bytes mapped for metadata so far
+    size_t bytes() const { return __atomic_load_n(&mapped, __ATOMIC_RELAXED); }
+
+  private:
+    struct FreeBlock {
+      FreeBlock *next;
+    };
+
+    // Free blocks of one thread. Trivially destructible, so it stays
+    // usable by the destructors which run after the thread is done.
+    struct ThreadCache {
+      FreeBlock *lists[kNumClasses];
+      unsigned   counts[kNumClasses];
+      bool       registered; // for the hand-over at thread exit
+      bool       exited;
+    };
+
+    // Hands the blocks of the exiting thread over to the shared lists
+    struct ThreadCacheFlusher {
+      MetadataArena *arena;
+      ~ThreadCacheFlusher() { arena->flush(cache()); }
+    };
+
+    static ThreadCache & cache() {
+      static thread_local ThreadCache threadCache;
+      return threadCache;
+    }
+
+    ThreadCache & threadCache() {
+      ThreadCache & c = cache();
+      if (!c.registered) {
+        static thread_local ThreadCacheFlusher flusher{this};
+        (void)flusher;
+        c.registered = true;
+      }
+      return c;
+    }
+
+    void flush(ThreadCache & c) {
+      c.exited = true; // later deallocations go to the shared lists
+      lock();
+      for (unsigned i = 0; i < kNumClasses; i++) {
+        while (FreeBlock *block = c.lists[i]) {
+          c.lists[i] = block->next;
+          block->next = lists[i];
+          lists[i] = block;
+        }
+        c.counts[i] = 0;
+      }
+      unlock();
+    }
+
+    static unsigned sizeClass(size_t size) {
+      unsigned c = 0;
+      while ((size_t(1) << (kMinShift + c)) < size) c++;
+      return c;
+    }
+
+    static size_t classSize(unsigned c) { return size_t(1) << (kMinShift + c); }
+
+    // Returns "size" bytes of the current chunk, aligned to the size up
+    // to 16 bytes. Called with the lock held.
+    void *carve(size_t size) {
+      unsigned node = numaAware() ? currentNumaNode() : 0;
+      uintptr_t &next = cursors[node].next, &end = cursors[node].end;
+      size_t align = size < 16 ? size : 16;
+      uintptr_t p = (next + align - 1) & ~uintptr_t(align - 1);
+      if (!next || p + size > end) {
+        size_t chunkSize = hugePages() && kChunkSize < kHugePageSize
+                               ? kHugePageSize : kChunkSize;
+        void *chunk = mapBlock(chunkSize);
+        if (numaAware()) preferNumaNode(chunk, chunkSize, node);
+        next = reinterpret_cast<uintptr_t>(chunk);
+        end = next + chunkSize;
+        p = next;
+      }
+      next = p + size;
+      return reinterpret_cast<void *>(p);
+    }
+
+    void *mapBlock(size_t size) {
+      void *mem = mapPages(size);
+      if (mem == MAP_FAILED) throw std::bad_alloc();
+      __atomic_add_fetch(&mapped, mappingSize(size), __ATOMIC_RELAXED);
+      return mem;
+    }
+
+    void unmapBlock(void *p, size_t size) {
+      unmapPages(p, size);
+      __atomic_sub_fetch(&mapped, mappingSize(size), __ATOMIC_RELAXED);
+    }
+
+    void lock() {
+      while (__atomic_test_and_set(&guard, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&guard, __ATOMIC_RELAXED)) {} // spin on read
+      }
+    }
+
+    void unlock() { __atomic_clear(&guard, __ATOMIC_RELEASE); }
+
+    // Unused part of the current chunk, per NUMA node
+    struct Cursor {
+      uintptr_t next;
+      uintptr_t end;
+    };
+
+    FreeBlock     *lists[kNumClasses];
+    Cursor         cursors[kMaxNumaNodes];
+    size_t         mapped;
+    unsigned char  guard;
+  };
+
+  constexpr unsigned MetadataArena::kMinShift;
+  constexpr unsigned MetadataArena::kNumClasses;
+  constexpr size_t   MetadataArena::kMaxSmall;
+  constexpr size_t   MetadataArena::kChunkSize;
+  constexpr unsigned MetadataArena::kThreadCacheBlocks;
+
+  static MetadataArena metadataArena; // zero-initialized, see above
+
+  // Allocator of the metadata containers, from metadataArena
+  template <typename T>
+  class ArenaAllocator {
+  public:
+    typedef T value_type;
+
+    ArenaAllocator() = default;
+    template <typename U> ArenaAllocator(const ArenaAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+      return static_cast<T *>(metadataArena.allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+      metadataArena.deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &) const { return false; }
+  };
+
+} // etsan
+
+#endif // ETSAN_ARENA_H_
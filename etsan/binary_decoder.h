@@ -0,0 +1,181 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Host side decoder of the binary race report and trace stream, see
+// binary_report.h.
+
+#ifndef ETSAN_BINARY_DECODER_H_
+#define ETSAN_BINARY_DECODER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "binary_report.h"
+#include "race.h"
+#include "trace.h"
+
+namespace etsan {
+
+  // Renders a binary stream as the text output of the runtime: race
+  // reports as Race::createRaceMessage, trace events as trace.h. Runs on
+  // the host.
+  class BinaryDecoder {
+  public:
+    // Decodes "in" into "out". Returns false and sets "error" if the
+    // stream is malformed or truncated.
+    bool decode(FILE *in, std::ostream &out, std::string &error) {
+      char magic[sizeof(kBinaryMagic)];
+      if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+          memcmp(magic, kBinaryMagic, sizeof(magic))) {
+        error = "not an EmbedSanitizer binary report";
+        return false;
+      }
+      int version = fgetc(in);
+      if (version != kBinaryVersion) {
+        error = "unsupported binary report version";
+        return false;
+      }
+
+      for (int tag; (tag = fgetc(in)) != EOF;) {
+        bool ok = false;
+        switch (tag) {
+        case BinarySite:    ok = site(in); break;
+        case BinaryName:    ok = name(in); break;
+        case BinaryRace:    ok = race(in, out); break;
+        case BinarySummary: ok = summary(in, out); break;
+        case BinaryEvent:   ok = event(in, out); break;
+        }
+        if (!ok) {
+          error = "malformed record at offset " + std::to_string(ftell(in));
+          return false;
+        }
+      }
+      return true;
+    }
+
+  private:
+    struct SiteDef {
+      uint64_t    line;
+      uint64_t    column;
+      std::string fileName;
+      std::string objName;
+    };
+
+    static bool getNumber(FILE *in, uint64_t &value) {
+      value = 0;
+      for (unsigned shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(in);
+        if (byte == EOF) return false;
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+      }
+      return false;
+    }
+
+    static bool getString(FILE *in, std::string &s) {
+      uint64_t length;
+      if (!getNumber(in, length) || length > (1 << 20)) return false;
+      s.resize(length);
+      return fread(&s[0], 1, length, in) == length;
+    }
+
+    bool site(FILE *in) {
+      uint64_t id;
+      SiteDef def;
+      if (!getNumber(in, id) || !getNumber(in, def.line) ||
+          !getNumber(in, def.column) || !getString(in, def.fileName) ||
+          !getString(in, def.objName)) {
+        return false;
+      }
+      sites[id] = def;
+      return true;
+    }
+
+    bool name(FILE *in) {
+      uint64_t id;
+      return getNumber(in, id) && getString(in, names[id]);
+    }
+
+    bool race(FILE *in, std::ostream &out) {
+      uint64_t siteId, tid, numFrames;
+      int isWrite;
+      if (!getNumber(in, siteId) || (isWrite = fgetc(in)) == EOF ||
+          !getNumber(in, tid) || !getNumber(in, numFrames)) {
+        return false;
+      }
+
+      auto def = sites.find(siteId);
+      if (def == sites.end()) return false;
+      Site s = {makeSiteLoc(0, def->second.line, def->second.column),
+                def->second.objName.c_str(), def->second.fileName.c_str()};
+      Race r((unsigned int)tid, s, isWrite != 0);
+
+      std::vector<char *> frames;
+      for (uint64_t i = 0; i < numFrames; i++) {
+        uint64_t id;
+        if (!getNumber(in, id)) return false;
+        auto frame = names.find(id);
+        if (frame == names.end()) return false;
+        frames.push_back(&frame->second[0]);
+      }
+      r.trace = frames.data();
+      r.numFrames = frames.size();
+
+      std::string msg;
+      r.createRaceMessage(msg);
+      out << msg;
+      return true;
+    }
+
+    bool summary(FILE *in, std::ostream &out) {
+      uint64_t uniqueRaces, dropped;
+      if (!getNumber(in, uniqueRaces) || !getNumber(in, dropped)) {
+        return false;
+      }
+      out << "EmbedSanitizer: " << uniqueRaces << " unique data races\n";
+      if (dropped) {
+        out << "EmbedSanitizer: " << dropped
+            << " reports dropped, the report queue was full\n";
+      }
+      return true;
+    }
+
+    bool event(FILE *in, std::ostream &out) {
+      uint64_t tid, addr, lineNo, nameId;
+      int kind;
+      if (!getNumber(in, tid) || (kind = fgetc(in)) == EOF ||
+          !getNumber(in, addr) || !getNumber(in, lineNo) ||
+          !getNumber(in, nameId) || kind >= NumTraceKinds) {
+        return false;
+      }
+
+      auto eventName = names.find(nameId);
+      char hexAddr[24];
+      snprintf(hexAddr, sizeof(hexAddr), "0x%llx", (unsigned long long)addr);
+      out << "EmbedSanitizer: [" << tid << "] " << traceNames[kind] << " "
+          << (addr ? hexAddr : "(nil)") << " line " << (int)lineNo << " "
+          << (eventName != names.end() ? eventName->second : "") << "\n";
+      return true;
+    }
+
+    std::unordered_map<uint64_t, SiteDef>     sites;
+    std::unordered_map<uint64_t, std::string> names;
+  };
+
+} // etsan
+
+#endif // ETSAN_BINARY_DECODER_H_
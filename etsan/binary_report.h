@@ -0,0 +1,197 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Compact binary stream of race reports and trace events
+// (ETSAN_BINARY_REPORTS), decoded on the host by etsan-decode, see
+// binary_decoder.h.
+//
+// The device formats nothing: it writes tagged records of LEB128 numbers
+// through a buffer flushed with write(2), to a file or an inherited
+// socket. A site is sent once, with its table entry, the first time a
+// race refers to it, and a function or variable name once, the first
+// time a stack or trace event refers to it; later records carry IDs.
+//
+//   stream   := "ETSB" version:u8 record*
+//   record   := tag:u8 fields
+//   Site     := siteId line column file:str obj:str
+//   Name     := nameId name:str
+//   Race     := siteId isWrite:u8 tid numFrames nameId*
+//   Summary  := uniqueRaces dropped
+//   Event    := tid kind:u8 addr lineNo nameId      (0: no name)
+//   str      := length byte*
+//
+// Site 0 stands for races reported without a site ID and is sent again
+// before each of them.
+
+#ifndef ETSAN_BINARY_REPORT_H_
+#define ETSAN_BINARY_REPORT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "flags.h"
+#include "sites.h"
+
+namespace etsan {
+
+  constexpr char    kBinaryMagic[4] = {'E', 'T', 'S', 'B'};
+  constexpr uint8_t kBinaryVersion  = 1;
+
+  enum BinaryTag : uint8_t {
+    BinarySite = 1,
+    BinaryName,
+    BinaryRace,
+    BinarySummary,
+    BinaryEvent
+  };
+
+  // Writes records to a file descriptor through a buffer. Not thread
+  // safe, callers serialize.
+  class BinaryWriter {
+  public:
+    static constexpr unsigned kBufferSize = 1024;
+
+    // Writes to "fd", closed at destruction if "ownsFd"
+    BinaryWriter(int fd, bool ownsFd) : fd(fd), ownsFd(ownsFd) {
+      memcpy(buffer, kBinaryMagic, sizeof(kBinaryMagic));
+      buffer[4] = kBinaryVersion;
+      size = 5;
+    }
+
+    // Writes to the descriptor ETSAN_REPORT_FD if set (e.g. a socket set
+    // up by the launcher), else to the file ETSAN_REPORT_FILE, else to
+    // standard output
+    BinaryWriter() : BinaryWriter(STDOUT_FILENO, false) {
+      long reportFd = (long)getFlag("ETSAN_REPORT_FD", ~0UL);
+      const char *path = getenv("ETSAN_REPORT_FILE");
+      if (reportFd >= 0) {
+        fd = reportFd;
+      } else if (path && (reportFd = open(path, O_WRONLY | O_CREAT | O_TRUNC,
+                                          0644)) >= 0) {
+        fd = reportFd;
+        ownsFd = true;
+      }
+    }
+
+    ~BinaryWriter() {
+      flush();
+      if (ownsFd) close(fd);
+    }
+
+    // A race at "site", known by "siteId", with the call stack "frames"
+    void race(unsigned int siteId, SiteLoc loc, const char *objName,
+              const char *fileName, bool isWrite, unsigned int tid,
+              char *const *frames, unsigned int numFrames) {
+      if (!siteId || sites.insert(siteId).second) {
+        putByte(BinarySite);
+        putNumber(siteId);
+        putNumber(siteLine(loc));
+        putNumber(siteColumn(loc));
+        putString(fileName);
+        putString(objName);
+      }
+
+      for (unsigned int i = 0; i < numFrames; i++) {
+        nameId(frames[i]); // names go before the race
+      }
+
+      putByte(BinaryRace);
+      putNumber(siteId);
+      putByte(isWrite);
+      putNumber(tid);
+      putNumber(numFrames);
+      for (unsigned int i = 0; i < numFrames; i++) {
+        putNumber(nameId(frames[i]));
+      }
+    }
+
+    void summary(uint64_t uniqueRaces, uint64_t dropped) {
+      putByte(BinarySummary);
+      putNumber(uniqueRaces);
+      putNumber(dropped);
+    }
+
+    // A trace event, see trace.h
+    void event(unsigned int tid, uint8_t kind, const void *addr,
+               int lineNo, const char *name) {
+      uint64_t id = name ? nameId(name) : 0;
+      putByte(BinaryEvent);
+      putNumber(tid);
+      putByte(kind);
+      putNumber((uintptr_t)addr);
+      putNumber((uint32_t)lineNo);
+      putNumber(id);
+    }
+
+    void flush() {
+      const uint8_t *p = buffer;
+      while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0) break; // output lost, don't stall the program
+        p += n;
+        size -= n;
+      }
+      size = 0;
+    }
+
+  private:
+    // Returns the ID of "name", sending it the first time
+    uint64_t nameId(const char *name) {
+      auto it = names.find(name);
+      if (it != names.end()) return it->second;
+
+      uint64_t id = names.size() + 1;
+      names.emplace(name, id);
+      putByte(BinaryName);
+      putNumber(id);
+      putString(name);
+      return id;
+    }
+
+    void putByte(uint8_t byte) {
+      if (size == kBufferSize) flush();
+      buffer[size++] = byte;
+    }
+
+    void putNumber(uint64_t value) {
+      do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        putByte(value ? byte | 0x80 : byte);
+      } while (value);
+    }
+
+    void putString(const char *s) {
+      size_t length = strlen(s);
+      putNumber(length);
+      for (size_t i = 0; i < length; i++) putByte(s[i]);
+    }
+
+    int      fd;
+    bool     ownsFd;
+    uint8_t  buffer[kBufferSize];
+    unsigned size;
+
+    std::unordered_set<unsigned int>             sites;
+    std::unordered_map<const char *, uint64_t>   names;
+  };
+
+  constexpr unsigned BinaryWriter::kBufferSize;
+
+} // etsan
+
+#endif // ETSAN_BINARY_REPORT_H_
@@ -25,14 +25,82 @@
 #include <atomic>
 #include <algorithm>
 
+#include <memory>
+#include "arena.h"
+#include "epoch.h"
+#include "flags.h"
+#include "frozen.h"
+#include "lock_profile.h"
+#include "read_clock.h"
+#include "stats.h"
+
+#include "shadow.h"
+
+#ifdef ETSAN_FIXED_VECTOR_CLOCKS
+#include "vector_clock.h"
+#endif
+
+#ifdef ETSAN_TREE_CLOCKS
+#ifdef ETSAN_FIXED_VECTOR_CLOCKS
+#error "ETSAN_TREE_CLOCKS and ETSAN_FIXED_VECTOR_CLOCKS are exclusive"
+#endif
+#include "tree_clock.h"
+#endif
+
+#ifdef ETSAN_INLINE_FASTPATH
+#include "inline_abi.h"
+#endif
+
+#ifdef ETSAN_BATCHED_ACCESSES
+#include "access_batch.h"
+#endif
+
+#ifdef ETSAN_LOCKSET
+#include "lockset.h"
+#endif
+
+#if defined(ETSAN_SHADOW_MEMORY) && defined(ETSAN_STRIPED_VSTATES)
+#error "ETSAN_SHADOW_MEMORY and ETSAN_STRIPED_VSTATES are exclusive"
+#endif
+
 using Address     = const void *;
 using ThreadID    = unsigned int;
-using VectorClock = std::vector<int>;
+using Epoch       = etsan::Epochs::Type;
+#ifdef ETSAN_FIXED_VECTOR_CLOCKS
+// Inline clocks of threads and locks, joined with SIMD kernels
+using VectorClock = etsan::FixedVectorClock<etsan::Epochs,
+                                           ETSAN_MAX_THREADS>;
+#elif defined(ETSAN_TREE_CLOCKS)
+// Clocks of threads and locks joined and copied in the time of the
+// entries that change
+using VectorClock = etsan::TreeClock<etsan::Epochs, etsan::ArenaAllocator>;
+#else
+using VectorClock = std::vector<Epoch, etsan::ArenaAllocator<Epoch>>;
+#endif
 
-#define TID(x) ((x & 0xFF000000) >> 24)
-#define CLOCK(x) (x & (0x00FFFFFF))
+// C[t] := epoch
+inline void SetVectorClock(VectorClock & C, std::size_t t, Epoch epoch) {
+#ifdef ETSAN_TREE_CLOCKS
+  C.set(t, epoch);
+#else
+  C[t] = epoch;
+#endif
+}
+// Read clocks of shared variables are sized by their readers: one exists
+// per read-shared variable, so a clock of every thread would bloat them.
+using ReadVectorClock = etsan::ReadClock<etsan::Epochs>;
 
-#define READ_SHARED 0XEFFFFFFF
+// Hash map of metadata, with its nodes and buckets in the arena
+template <typename Key, typename Value>
+using MetadataMap = std::unordered_map<
+    Key, Value, std::hash<Key>, std::equal_to<Key>,
+    etsan::ArenaAllocator<std::pair<const Key, Value>>>;
+
+#define TID(x) (etsan::Epochs::tid(x))
+#define CLOCK(x) (etsan::Epochs::clock(x))
+#define EPOCH(tid, clock) (etsan::Epochs::make(tid, clock))
+
+#define READ_SHARED (etsan::Epochs::kReadShared)
 
 #define REPORT_RACES 1
 
@@ -47,19 +115,76 @@ using VectorClock = std::vector<int>;
     race_message(msg);	\
     x.Racy = true;    	\
   }               			\
-  VS.mGuard.unlock(); 	\
+  unlockVarState(x); 	\
   return;           		\
  }
 
-#define FastPathReturn { VS.mGuard.unlock(); return reportIsRacy;}
+#define FastPathReturn { unlockVarState(x); return reportIsRacy;}
 
 // Maybe unnecessary but keeps track of number of parallel
-// threads in the program. Invariant: NumThreads == C.size()
+// threads in the program. Invariant: NumThreads == TS.slots
 static unsigned int NumThreads = 0;
 
-// This variable tracks availability of multiple threads in the program
-// No race is detected if there are no multithreads in the program
-std::atomic_int isConcurrent{0};
+// Threads started and still running, but the first one: counted at
+// their creation until they exit (finishThread), or are joined if they
+// never made a callback, see startRunning. Guarded by TS.mGuard.
+static unsigned int liveThreads = 0;
+
+namespace etsan {
+
+  // A flag read by every access callback: on a cache line of its own and
+  // written only when it changes, so that each core keeps reading it from
+  // its own cache
+  struct alignas(kCacheLineSize) PhaseFlag {
+    int on = 0;
+    explicit operator bool() const {
+      return __atomic_load_n(&on, __ATOMIC_RELAXED);
+    }
+  };
+
+  // Stores "value" into "flag" unless it holds it already
+  static inline void setPhaseFlag(int & flag, int value) {
+    if (__atomic_load_n(&flag, __ATOMIC_RELAXED) != value)
+      __atomic_store_n(&flag, value, __ATOMIC_RELAXED);
+  }
+
+} // etsan
+
+// Whether other threads run, i.e. liveThreads is not zero: set exactly
+// when the program goes from single- to multithreaded and back. No race
+// is detected while a single thread runs.
+etsan::PhaseFlag isConcurrent;
+
+// Mirror of isConcurrent read by the code instrumented with
+// -embedsan-concurrency-guard or -embedsan-inline-fast-path, which skips
+// the access callbacks while it is zero
+extern "C" int __etsan_concurrent;
+alignas(etsan::kCacheLineSize) int __etsan_concurrent = 0;
+
+namespace etsan {
+
+  // Modes of detection (__etsan_mode): accesses are checked in full mode
+  // only, synchronization is tracked but when off. Forks, joins and
+  // barriers are tracked in every mode.
+  enum DetectionMode { ModeFull, ModeSyncOnly, ModeOff };
+
+} // etsan
+
+// Mode of all threads, set by ETSAN_MODE and __etsan_set_mode
+static int initialDetectionMode() {
+  unsigned long mode = etsan::getFlag("ETSAN_MODE", etsan::ModeFull);
+  return mode <= etsan::ModeOff ? int(mode) : etsan::ModeFull;
+}
+std::atomic_int detectionMode ETSAN_EARLY_INIT {initialDetectionMode()};
+
+// Publishes the phase of liveThreads, with __etsan_concurrent zero but
+// in full mode, so the guarded code makes no calls either. Under
+// TS.mGuard, which orders the changes.
+void publishConcurrent() {
+  etsan::setPhaseFlag(isConcurrent.on, liveThreads != 0);
+  etsan::setPhaseFlag(__etsan_concurrent,
+                      detectionMode == etsan::ModeFull && liveThreads);
+}
 
 //////////////////////////////////////////////
 /// Thread state related metadata           //
@@ -68,12 +193,33 @@ class ThreadState {
   public:
     unsigned int tid;
     VectorClock C;
-    int epoch; // invariant: epoch == C[tid]
+    Epoch epoch; // invariant: epoch == C[tid]
+    etsan::ThreadStats stats; // updated by this thread only
+
+    // Stack of the thread, known once it has run instrumented code
+    uintptr_t stackLo = 0;
+    size_t    stackSize = 0;
+
+#ifdef ETSAN_BATCHED_ACCESSES
+    etsan::AccessBatch batch; // accesses of the epoch not checked yet
+#endif
+
+#ifdef ETSAN_LOCKSET
+    etsan::Lockset held = 0; // bits of the locks it holds, see lockset.h
+#endif
+
+#ifndef ETSAN_SHADOW_MEMORY
+    // The variable state last returned to this thread, which it may be
+    // updating: eviction keeps it, see evictVarStates
+    const void *pinned = nullptr;
+#endif
+
+    bool running = false; // counted in liveThreads
 
     void updateEpoch() { epoch = C[tid]; }
     void increment() {
       epoch++;
-      C[tid] = epoch;
+      SetVectorClock(C, tid, epoch);
       assert(C[tid] == epoch);
     }
 };
@@ -85,31 +231,100 @@ class TStates {
 public:
 
   // A lock to acquire before accesing thread states C
-  std::mutex mGuard; // lock
+  ETSAN_RUNTIME_MUTEX(mGuard, "TS.mGuard"); // lock
 
   // Threads states
-  std::unordered_map<ThreadID, ThreadState> C;
+  MetadataMap<ThreadID, ThreadState> C;
+
+  // Final states of the threads that exited and are not joined yet, see
+  // finishThread. Nodes never move.
+  MetadataMap<ThreadID, ThreadState> exited;
+
+  // Bumped whenever thread states are discarded, so that ThreadState
+  // pointers cached by threads (see getThreadState) become stale.
+  std::atomic<unsigned int> generation{0};
+
+  // Vector clock slots of joined threads, free for reuse. "last" is the
+  // first epoch a new owner of the slot may use.
+  struct RetiredSlot {
+    unsigned int tid;
+    Epoch        last;
+  };
+  std::vector<RetiredSlot> freeSlots;
+
+  unsigned int slots{0};      // vector clock slots ever allocated
+  unsigned int clockCapacity{0}; // reserved in each clock, see __tsan_init
+  unsigned long created{0};   // threads ever seen
+  etsan::ThreadStats retired; // statistics of joined threads
+
+  // Discards all thread states
+  void clear() {
+    C.clear();
+    exited.clear();
+    freeSlots.clear();
+    slots = 0;
+    created = 0;
+    retired.clear();
+    generation++;
+    liveThreads = 0; // with the states of the threads counted
+    publishConcurrent();
+  }
 //#ifdef STATS
   ~TStates() {
-    printf("Threads: %lu\n", C.size());
+    printf("Threads: %lu\n", created);
   }
 //#endif
 };
 
-TStates TS; // instance for threads states
+TStates TS ETSAN_EARLY_INIT; // instance for threads states
+
+// Counts thread "u" in liveThreads from its fork until it exits or is
+// joined, whichever comes first. Under TS.mGuard.
+void startRunning(ThreadState & u) {
+  if (u.running) return;
+  u.running = true;
+  liveThreads++;
+  publishConcurrent();
+}
+
+void stopRunning(ThreadState & u) {
+  if (!u.running) return;
+  u.running = false;
+  liveThreads--;
+  publishConcurrent();
+}
+
+// Updates vector clock to accomodate epochs of new dynamically created threads
+template <typename Clock>
+void ExtendVectorClock(Clock& C, int totalThreads) {
 
-// Updates vector clocks to accomodate vectors of all threads.
+  int tid = C.size();
+  for (; tid < totalThreads; tid++) {
+    Epoch epoch = EPOCH(tid, 0);
+    C.push_back(epoch);
+  }
+}
+
+#ifdef ETSAN_FIXED_VECTOR_CLOCKS
+void ExtendVectorClock(VectorClock& C, int totalThreads) {
+  // slots past the size already hold zero epochs
+  if (C.size() < (std::size_t)totalThreads) C.resize(totalThreads);
+}
+#endif
+
+// Updates vector clocks to accomodate vectors of all threads. New
+// threads no longer do it, see getState.
 // NOTE: This is a utility function and thus not protected.
 //       Use inside a critical section with the TS lock.
 void UpdateThreadClocks() {
 
-  auto nThreads =  TS.C.size();
+  auto nThreads =  TS.slots;
 
   for (auto tv = TS.C.begin(); tv != TS.C.end(); tv++) {
 
     ThreadState& t = tv->second;
     for (auto idx = t.C.size(); idx < nThreads; idx++) {
-      int epoch = idx << 24;
+      Epoch epoch = EPOCH(idx, 0);
       if (t.tid == idx) {
         epoch = epoch + 1;
       }
@@ -118,8 +333,49 @@ void UpdateThreadClocks() {
   } // end for
 }
 
-// Returns the State of a thread whose id is tid
-ThreadState & getState(ThreadID tid) {
+// Gives new thread state "st" the slot of a joined thread, if "parent"
+// has seen that thread's last epoch. Every later epoch of the slot then
+// happens after all epochs of the joined thread, so its old epochs left
+// in variable and lock states are still ordered correctly.
+// NOTE: Use inside a critical section with the TS lock.
+bool reuseThreadSlot(ThreadState & st, const ThreadState * parent) {
+  if (!parent) return false;
+
+  for (std::size_t i = 0; i < TS.freeSlots.size(); i++) {
+    const TStates::RetiredSlot & slot = TS.freeSlots[i];
+    if (slot.tid < parent->C.size() &&
+        CLOCK(parent->C[slot.tid]) + 1 >= CLOCK(slot.last)) {
+      st.tid = slot.tid;
+      st.epoch = slot.last;
+      TS.freeSlots[i] = TS.freeSlots.back();
+      TS.freeSlots.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+// Frees the slot of exited thread "tid", whose id a new thread reuses:
+// it was joined without __tsan_thread_join, or by nobody.
+// NOTE: Use inside a critical section with the TS lock.
+void dropExitedThread(ThreadID tid) {
+  auto it = TS.exited.find(tid);
+  if (it == TS.exited.end()) return;
+  ThreadState & u = it->second;
+  TS.retired.add(u.stats);
+  u.increment(); // as the join would
+  TS.freeSlots.push_back({u.tid, u.epoch});
+  TS.exited.erase(it);
+}
+
+// Returns the State of a thread whose id is tid. A new thread created
+// by "parent" may take over the vector clock slot of a joined thread.
+//
+// Registration touches no other thread: the clock of the new thread has
+// the slots up to its own, and every clock grows when its thread joins
+// a longer one (ExtendVectorClocks). A slot past the end of a clock
+// holds the zero epoch, see clockEntry.
+ThreadState & getState(ThreadID tid, const ThreadState * parent = nullptr) {
 
   ThreadState* st;
 
@@ -127,15 +383,23 @@ ThreadState & getState(ThreadID tid) {
 
   if (TS.C.find(tid) == TS.C.end()) {
 
+    dropExitedThread(tid);
     TS.C[tid] = ThreadState();
     st = &TS.C[tid];
-    NumThreads = TS.C.size(); //
-    st->tid = NumThreads;
-    st->epoch = ((st->tid << 24) + 1);
+    st->C.reserve(TS.clockCapacity);
+    TS.created++;
+    if (!reuseThreadSlot(*st, parent)) {
+      st->tid = TS.slots++;
+      st->epoch = EPOCH(st->tid, 1);
+      assert(Epoch(st->tid) < TID(READ_SHARED)); // keep READ_SHARED unique
+    }
 
-    UpdateThreadClocks();
-    ( st->C )[ st->tid ] = st->epoch;
-    NumThreads = TS.C.size() + 1; // track # of threads
+    ExtendVectorClock(st->C, st->tid + 1);
+    SetVectorClock(st->C, st->tid, st->epoch);
+#ifdef ETSAN_TREE_CLOCKS
+    st->C.own(st->tid);
+#endif
+    NumThreads = TS.slots; // track # of threads
   } else {
     st = &TS.C[tid];
   }
@@ -144,10 +408,195 @@ ThreadState & getState(ThreadID tid) {
   return *st;
 }
 
-// Returns the State of the current thread
+void resetVarStates(Address addr, size_t size);
+
+// Returns the epoch of thread "u" in clock "C": the zero epoch of "u" if
+// the clock has no slot for it, as its thread has not synchronized since
+// "u" was created
+inline Epoch clockEntry(const VectorClock & C, unsigned int u) {
+  return u < C.size() ? C[u] : EPOCH(u, 0);
+}
+
+// Discards the state of joined thread "tid" and frees its vector clock
+// slot, so that vector clocks grow with live threads, not all threads.
+// The states of the variables on its stack go too: the stack may be
+// given to the next thread created.
+void retireThread(ThreadID tid) {
+
+  uintptr_t stackLo = 0;
+  size_t stackSize = 0;
+
+  TS.mGuard.lock(); // protect
+
+  auto it = TS.C.find(tid);
+  if (it != TS.C.end()) {
+    ThreadState & u = it->second;
+    stopRunning(u); // e.g. never started
+    TS.retired.add(u.stats);
+    TS.freeSlots.push_back({u.tid, u.epoch});
+    stackLo = u.stackLo;
+    stackSize = u.stackSize;
+    TS.C.erase(it);
+  } else if ((it = TS.exited.find(tid)) != TS.exited.end()) {
+    // its stack went when it exited, with its statistics up to then
+    TS.retired.add(it->second.stats);
+    TS.freeSlots.push_back({it->second.tid, it->second.epoch});
+    TS.exited.erase(it);
+  }
+
+  TS.mGuard.unlock(); // release protection
+
+  if (stackSize) resetVarStates(reinterpret_cast<Address>(stackLo), stackSize);
+}
+
+// Records the stack bounds of the calling thread in its state "t"
+void recordThreadStack(ThreadState & t) {
+  pthread_attr_t attr;
+  if (pthread_getattr_np(pthread_self(), &attr)) return;
+
+  void *lo;
+  size_t size;
+  if (!pthread_attr_getstack(&attr, &lo, &size)) {
+    t.stackLo = reinterpret_cast<uintptr_t>(lo);
+    t.stackSize = size;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+// Per-thread cache of the calling thread's state in TS.C
+struct CachedThreadState {
+  ThreadState* state = nullptr;
+  unsigned int generation = 0;
+};
+
+static thread_local CachedThreadState cachedThreadState;
+
+// Caches "st" as the state of the calling thread
+void cacheThreadState(ThreadState & st) {
+  CachedThreadState & cache = cachedThreadState;
+  cache.state = &st;
+  cache.generation = TS.generation.load(std::memory_order_relaxed);
+#ifdef ETSAN_INLINE_FASTPATH
+  // stays valid until the thread is joined; TS.clear() is for tests only
+  __etsan_thread_epoch = &st.epoch;
+#endif
+}
+
+// True if the calling thread is detached, so that nobody joins it
+bool isDetachedThread() {
+  pthread_attr_t attr;
+  int state = PTHREAD_CREATE_JOINABLE;
+  if (!pthread_getattr_np(pthread_self(), &attr)) {
+    pthread_attr_getdetachstate(&attr, &state);
+    pthread_attr_destroy(&attr);
+  }
+  return state == PTHREAD_CREATE_DETACHED;
+}
+
+// Finalizes the calling thread as it exits, from the destructor of its
+// threadExitKey: its statistics are added up, the states of the variables
+// on its stack go, and its state leaves TS.C, which only holds running
+// threads, for TS.exited, where its final clock waits for the join. The
+// thread keeps using that state in the destructors that run after. A
+// detached thread is retired at once, as nobody joins it.
+void finishThread(void *) {
+  ThreadID tid = (ThreadID)pthread_self();
+  uintptr_t stackLo = 0;
+  size_t stackSize = 0;
+  bool detached = isDetachedThread();
+
+  TS.mGuard.lock(); // protect
+
+  auto it = TS.C.find(tid);
+  if (it != TS.C.end()) {
+    ThreadState & u = it->second;
+    stopRunning(u);
+    TS.retired.add(u.stats);
+    u.stats.clear();
+    stackLo = u.stackLo;
+    stackSize = u.stackSize;
+    u.stackSize = 0;
+    if (detached) {
+      u.increment(); // as the join would
+      TS.freeSlots.push_back({u.tid, u.epoch});
+      cachedThreadState.state = nullptr;
+#ifdef ETSAN_INLINE_FASTPATH
+      __etsan_thread_epoch = &__etsan_no_epoch; // no access matches it
+#endif
+    } else {
+      TS.exited.erase(tid);
+      cacheThreadState(TS.exited[tid] = std::move(u));
+    }
+    TS.C.erase(it);
+  }
+
+  TS.mGuard.unlock(); // release protection
+
+  if (stackSize) resetVarStates(reinterpret_cast<Address>(stackLo), stackSize);
+}
+
+// Key of the threads with a state, to finish them when they exit
+pthread_key_t threadExitKey() {
+  static pthread_key_t key = [] {
+    pthread_key_t k;
+    pthread_key_create(&k, finishThread);
+    return k;
+  }();
+  return key;
+}
+
+// Caches "st" as the state of the calling thread, which has not made an
+// access yet, records its stack, and has the thread finished at its exit
+void installThreadState(ThreadState & st) {
+  cacheThreadState(st);
+  if (!st.stackSize) recordThreadStack(st);
+  pthread_setspecific(threadExitKey(), &st);
+}
+
+// Returns the State of the current thread. The first call of each
+// thread looks it up in TS.C; later calls are a TLS read.
 ThreadState & getThreadState() {
+  CachedThreadState & cache = cachedThreadState;
+  unsigned int generation = TS.generation.load(std::memory_order_relaxed);
+
+  if (cache.state && cache.generation == generation) {
+    return *cache.state;
+  }
+
   ThreadID tid = ( ThreadID )pthread_self();
-  return getState(tid);
+  installThreadState(getState(tid));
+  return *cache.state;
+}
+
+// The state of thread "tid" for the thread joining it: its final state if
+// it has exited, see finishThread
+ThreadState & getJoinedState(ThreadID tid) {
+  TS.mGuard.lock(); // protect
+  auto it = TS.exited.find(tid);
+  ThreadState * u = it != TS.exited.end() ? &it->second : nullptr;
+  TS.mGuard.unlock(); // release protection
+  return u ? *u : getState(tid);
+}
+
+// Files the state a parent registered under the provisional id "key"
+// under the id "tid" of its thread, see __etsan_thread_create. A state
+// left under "tid" is of an exited thread that was never joined, whose
+// pthread_t the new thread reuses.
+ThreadState & adoptThreadState(ThreadID key, ThreadID tid) {
+
+  TS.mGuard.lock(); // protect
+
+  auto it = TS.C.find(key);
+  assert(it != TS.C.end());
+  ThreadState st = std::move(it->second);
+  TS.C.erase(it);
+  auto old = TS.C.find(tid);
+  if (old != TS.C.end()) TS.retired.add(old->second.stats);
+  dropExitedThread(tid);
+  ThreadState & adopted = TS.C[tid] = std::move(st);
+
+  TS.mGuard.unlock(); // release protection
+  return adopted;
 }
 
 //////////////////////////////////////////////
@@ -155,66 +604,393 @@ ThreadState & getThreadState() {
 //////////////////////////////////////////////
 class VarState {
   public:
-    int W, R;
-    VectorClock Rvc; // used iff R == READ_SHARED
+    Epoch W, R;
+    ReadVectorClock Rvc; // used iff R == READ_SHARED
     bool Racy = false;
+#ifdef ETSAN_LOCKFREE_FASTPATH
+    unsigned char Lock = 0; // spinlock guarding the slow path
+#endif
+#ifdef ETSAN_STRIPED_VSTATES
+    unsigned int Shard = 0; // index of the VStates shard holding it
+#endif
+#ifndef ETSAN_SHADOW_MEMORY
+    unsigned char Referenced = 0; // since the last eviction sweep
+#endif
+#ifdef ETSAN_LOCKSET
+    // Locks some access did not hold: not in its candidate lockset
+    etsan::Lockset Unguarded = 0;
+#endif
 };
 
+#ifdef ETSAN_INLINE_FASTPATH
+static_assert(offsetof(VarState, W) == etsan::kInlineOffsetW &&
+              offsetof(VarState, R) == etsan::kInlineOffsetR &&
+              sizeof(VarState) == etsan::kInlineSlotSize,
+              "VarState layout differs from the one the pass inlines");
+#endif
+
 class VStates {
 
 public:
 
   // A lock to acquire before accesing VariableStates
-  std::mutex mGuard;
+  ETSAN_RUNTIME_MUTEX(mGuard, "VS.mGuard");
+
+#ifdef ETSAN_SHADOW_MEMORY
+  // Variables states, one shadow slot per application word
+  ShadowMemory<VarState> shadow;
 
+#ifdef ETSAN_INLINE_FASTPATH
+  VStates() { __etsan_shadow_dir = shadow.directory(); }
+#endif
+#elif defined(ETSAN_STRIPED_VSTATES)
+  // A stripe of the variables states with its own lock and table
+  class Shard {
+  public:
+    std::mutex mGuard;
+    MetadataMap<Address, VarState> Vstates;
+    std::size_t hand{0};        // bucket of the next eviction sweep
+    unsigned long acquired{0};  // lock acquisitions
+    unsigned long contended{0}; // acquisitions which had to wait
+
+    void lock() {
+      if (!mGuard.try_lock()) {
+        mGuard.lock();
+        contended++;
+      }
+      acquired++;
+    }
+
+    void unlock() { mGuard.unlock(); }
+  };
+
+  // Number of stripes unless ETSAN_VS_SHARDS says otherwise
+  static constexpr unsigned int kDefaultShards = 64;
+
+  // Variables states, striped by address
+  std::unique_ptr<Shard[]> shards;
+  unsigned int numShards{0};
+
+  VStates() {
+    setShards(etsan::getFlag("ETSAN_VS_SHARDS", kDefaultShards));
+  }
+
+  // Replaces all stripes by "n" empty ones. Call before any access.
+  void setShards(unsigned int n) {
+    numShards = n ? n : 1;
+    shards.reset(new Shard[numShards]);
+  }
+
+  // Returns the stripe index of "addr". Words of one cache line share
+  // a stripe, so threads contend only on nearby addresses.
+  unsigned int shardOf(Address addr) const {
+    return (reinterpret_cast<uintptr_t>(addr) >> 6) % numShards;
+  }
+#else
   // Variables states
-  std::unordered_map<Address, VarState> Vstates;
+  MetadataMap<Address, VarState> Vstates;
+  std::size_t hand{0}; // bucket of the next eviction sweep
+#endif
 
-//#ifdef STATS
-  unsigned int reads{0};
-  unsigned int writes{0};
+#ifndef ETSAN_SHADOW_MEMORY
+  // Metadata budget in bytes, ETSAN_MAX_METADATA_MB, 0 if unbounded.
+  // Once the arena maps more, each table is capped at 7/8 of the states
+  // it holds, and again for every chunk the arena maps beyond that.
+  std::size_t budget{etsan::getFlag("ETSAN_MAX_METADATA_MB", 0) << 20};
+  std::size_t maxStates{SIZE_MAX}; // per table
+  std::size_t cappedAt{0};         // arena bytes when maxStates was set
+
+  // No table is capped below that many states
+  static constexpr std::size_t kMinStates = 256;
+
+  void setBudget(std::size_t bytes) {
+    budget = bytes;
+    maxStates = SIZE_MAX;
+    cappedAt = 0;
+  }
+#endif
 
+//#ifdef STATS
   ~VStates() {
-    printf("Addresses: %lu\n", Vstates.size());
-    printf("Reads: %u\n", (unsigned int)reads);
-    printf("Writes: %u\n", (unsigned int)writes);
+    unsigned long addresses = 0;
     int races = 0;
+#ifdef ETSAN_SHADOW_MEMORY
+    // a slot never accessed still holds the all-zero initial state
+    shadow.forEachSlot([&](VarState & x) {
+      if (x.W || x.R) addresses++;
+      if (x.Racy) races++;
+    });
+#elif defined(ETSAN_STRIPED_VSTATES)
+    for (unsigned int i = 0; i < numShards; i++) {
+      addresses += shards[i].Vstates.size();
+      for (auto & addr : shards[i].Vstates) {
+        if (addr.second.Racy) races++;
+      }
+    }
+#else
+    addresses = Vstates.size();
     for (auto addr = Vstates.begin(); addr != Vstates.end(); addr++) {
        if ( ( addr->second ).Racy ) races++;
     }
+#endif
+    // TS outlives VS: it is defined first, so destroyed last.
+    etsan::ThreadStats total = TS.retired;
+    for (auto & thread : TS.C) {
+      total.add(thread.second.stats);
+    }
+
+    printf("Addresses: %lu\n", addresses);
+    total.print();
+#ifdef ETSAN_SAMPLING
+    // share of the accesses that were checked
+    unsigned long checked = total.get(etsan::StatReads) +
+                            total.get(etsan::StatWrites);
+    unsigned long all = checked + total.get(etsan::StatSampledOut);
+    printf("Sampling coverage: %.1f%%\n", all ? 100.0 * checked / all : 100.0);
+#endif
     printf("Races: %d\n", races);
+    printf("Metadata bytes: %lu\n", (unsigned long)etsan::metadataArena.bytes());
+#ifdef ETSAN_STRIPED_VSTATES
+    // contended/acquired lock count of every stripe
+    printf("Shards: %u\n", numShards);
+    printf("Shard contention:");
+    for (unsigned int i = 0; i < numShards; i++) {
+      printf(" %lu/%lu", shards[i].contended, shards[i].acquired);
+    }
+    printf("\n");
+#endif
   }
 //#endif
 };
 
-VStates VS; // instance for variables states
+VStates VS ETSAN_EARLY_INIT; // instance for variables states
+
+#ifndef ETSAN_SHADOW_MEMORY
+constexpr std::size_t VStates::kMinStates;
+
+// Evicts cold states of "Vstates" until it holds 3/4 of "maxStates": a
+// clock sweep over its buckets, from "hand" on, clears the Referenced
+// bit of the states looked up since its last pass and evicts the others.
+// The state each thread last looked up may be in use and stays. An
+// evicted variable starts over at its next access, so its races with the
+// accesses before are missed. Returns the number of states evicted.
+// NOTE: Use with the lock of the table held.
+unsigned long evictVarStates(MetadataMap<Address, VarState> & Vstates,
+                             std::size_t & hand, std::size_t maxStates) {
+  std::vector<const void *, etsan::ArenaAllocator<const void *>> pinned;
+  TS.mGuard.lock(); // protect
+  for (auto & t : TS.C) {
+    pinned.push_back(__atomic_load_n(&t.second.pinned, __ATOMIC_RELAXED));
+  }
+  for (auto & t : TS.exited) { // maybe still in thread-exit destructors
+    pinned.push_back(__atomic_load_n(&t.second.pinned, __ATOMIC_RELAXED));
+  }
+  TS.mGuard.unlock(); // release protection
 
-// Returns VarState instance for a memory address "addr".
-// If none exists already, it creates one and stores in Vstates.
-VarState & getVarState(Address addr, bool isWrite) {
+  std::size_t target = maxStates / 4 * 3;
+  std::size_t buckets = Vstates.bucket_count();
+  std::vector<Address, etsan::ArenaAllocator<Address>> victims;
+  unsigned long evicted = 0;
+  // two rounds: the second evicts the states the first found referenced
+  for (std::size_t n = 0; n < 2 * buckets && Vstates.size() > target; n++) {
+    hand = (hand + 1) % buckets;
+    for (auto it = Vstates.begin(hand); it != Vstates.end(hand); ++it) {
+      VarState & x = it->second;
+      if (std::find(pinned.begin(), pinned.end(), &x) != pinned.end()) {
+        continue;
+      }
+      if (x.Referenced) {
+        x.Referenced = 0;
+      } else {
+        victims.push_back(it->first);
+      }
+    }
+    for (Address addr : victims) Vstates.erase(addr);
+    evicted += victims.size();
+    victims.clear();
+  }
+  return evicted;
+}
 
+// Before a state is added to "Vstates": caps the tables once the arena
+// exceeds the budget, and evicts from "Vstates" if it is full. The
+// evictions are counted in the statistics of "t".
+// NOTE: Use with the lock of the table held.
+void limitVarStates(MetadataMap<Address, VarState> & Vstates,
+                    std::size_t & hand, ThreadState & t) {
+  std::size_t bytes = etsan::metadataArena.bytes();
+  // other tables may lower the cap concurrently, with their own lock
+  std::size_t cappedAt = __atomic_load_n(&VS.cappedAt, __ATOMIC_RELAXED);
+  std::size_t maxStates = __atomic_load_n(&VS.maxStates, __ATOMIC_RELAXED);
+  if (bytes > VS.budget && bytes > cappedAt) {
+    maxStates = std::min(maxStates, std::max(Vstates.size() / 8 * 7,
+                                             VStates::kMinStates));
+    __atomic_store_n(&VS.maxStates, maxStates, __ATOMIC_RELAXED);
+    __atomic_store_n(&VS.cappedAt, bytes, __ATOMIC_RELAXED);
+  }
+  if (Vstates.size() >= maxStates) {
+    t.stats.counter[etsan::StatEvictions] +=
+        evictVarStates(Vstates, hand, maxStates);
+  }
+}
+#endif
+
+// Serializes FastTrack updates of variable state "x". By default all
+// variables share VS.mGuard; with ETSAN_LOCKFREE_FASTPATH each variable
+// has its own spinlock, taken only on the slow path, and with
+// ETSAN_STRIPED_VSTATES it is the lock of the variable's stripe.
+void lockVarState(VarState & x) {
+#ifdef ETSAN_LOCKFREE_FASTPATH
+  while (__atomic_test_and_set(&x.Lock, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&x.Lock, __ATOMIC_RELAXED)) {} // spin on read
+  }
+#elif defined(ETSAN_STRIPED_VSTATES)
+  VS.shards[x.Shard].lock();
+#else
+  VS.mGuard.lock();
+#endif
+}
+
+void unlockVarState(VarState & x) {
+#ifdef ETSAN_LOCKFREE_FASTPATH
+  __atomic_clear(&x.Lock, __ATOMIC_RELEASE);
+#elif defined(ETSAN_STRIPED_VSTATES)
+  VS.shards[x.Shard].unlock();
+#else
+  VS.mGuard.unlock();
+#endif
+}
+
+// Returns VarState instance for a memory address "addr".
+// If none exists already, it creates one and stores in Vstates, in the
+// epoch of the accessing thread "accessor" (default: the calling one).
+VarState & getVarState(Address addr, bool isWrite,
+                       ThreadState * accessor = nullptr) {
+
+#ifdef ETSAN_SHADOW_MEMORY
+  // A fresh slot is all zeros: W = R = 0@0, which happens-before
+  // every thread, so it needs no per-thread initialization.
+  return *VS.shadow.slot(addr);
+#else
   VarState* vstt;
 
+#ifdef ETSAN_STRIPED_VSTATES
+  unsigned int shard = VS.shardOf(addr);
+  VStates::Shard & stripe = VS.shards[shard];
+  MetadataMap<Address, VarState> & Vstates = stripe.Vstates;
+  std::size_t & hand = stripe.hand;
+  stripe.lock(); // protect the stripe only
+#else
+  MetadataMap<Address, VarState> & Vstates = VS.Vstates;
+  std::size_t & hand = VS.hand;
   VS.mGuard.lock(); // protect
+#endif
 
-  if (VS.Vstates.find(addr) == VS.Vstates.end()) {
-    ThreadState & t = getThreadState();
+  if (Vstates.find(addr) == Vstates.end()) {
+    ThreadState & t = accessor ? *accessor : getThreadState();
+    if (VS.budget) limitVarStates(Vstates, hand, t);
     VarState vs;
-    vs.W = (t.tid << 24);
-    vs.R = (t.tid << 24);
+    vs.W = EPOCH(t.tid, 0);
+    vs.R = EPOCH(t.tid, 0);
     if (isWrite) {
       vs.W = t.epoch;
     } else {
       vs.R = t.epoch;
     }
-    VS.Vstates[addr] = vs;
-    vstt = &VS.Vstates[addr];
+#ifdef ETSAN_STRIPED_VSTATES
+    vs.Shard = shard;
+#endif
+    Vstates[addr] = vs;
+    vstt = &Vstates[addr];
   } else {
-    vstt = &VS.Vstates[addr];
+    vstt = &Vstates[addr];
+  }
+
+  if (VS.budget) {
+    ThreadState & t = accessor ? *accessor : getThreadState();
+    vstt->Referenced = 1;
+    __atomic_store_n(&t.pinned, static_cast<const void *>(vstt),
+                     __ATOMIC_RELAXED);
   }
+
+#ifdef ETSAN_STRIPED_VSTATES
+  stripe.unlock(); // release protection
+#else
   VS.mGuard.unlock(); // release protection
+#endif
 
   return *vstt;
+#endif
+}
+
+// Erases the keys of "Vstates" in [begin, end): by lookups of its bytes
+// if the range is smaller than the table, else by one sweep.
+void eraseVarStates(MetadataMap<Address, VarState> & Vstates,
+                    uintptr_t begin, uintptr_t end) {
+  if (end - begin < Vstates.size()) {
+    for (uintptr_t a = begin; a < end; a++) {
+      Vstates.erase(reinterpret_cast<Address>(a));
+    }
+    return;
+  }
+  for (auto it = Vstates.begin(); it != Vstates.end();) {
+    uintptr_t a = reinterpret_cast<uintptr_t>(it->first);
+    it = a >= begin && a < end ? Vstates.erase(it) : std::next(it);
+  }
+}
+
+// Forgets the states of the variables in [addr, addr + size), e.g. of a
+// heap block being freed: a later block at the same addresses starts
+// fresh instead of racing with the accesses to the old one, and the
+// metadata kept stays bounded by the live memory.
+void resetVarStates(Address addr, size_t size) {
+  uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+  uintptr_t end = begin + size;
+  if (end < begin) end = UINTPTR_MAX; // wraps around
+  etsan::frozenRegions.reset(addr, end - begin);
+
+#ifdef ETSAN_SHADOW_MEMORY
+  typedef ShadowMemory<VarState> Shadow;
+  const uintptr_t word = uintptr_t(1) << Shadow::kWordShift;
+  const uintptr_t page = word << Shadow::kPageShift;
+  uintptr_t a = begin & ~(word - 1);
+  while (a < end) {
+    VarState *x = VS.shadow.find(reinterpret_cast<Address>(a));
+    if (!x) {
+      // never touched: skip to the next shadow page
+      uintptr_t next = (a & ~(page - 1)) + page;
+      if (next <= a) break;
+      a = next;
+      continue;
+    }
+    *x = VarState();
+    if (a + word <= a) break;
+    a += word;
+  }
+#elif defined(ETSAN_STRIPED_VSTATES)
+  // The words of one cache line share a stripe: lock each stripe once
+  // per line, or once in all for a sweep of its whole table.
+  if (end - begin >= VS.numShards * 64) {
+    for (unsigned int i = 0; i < VS.numShards; i++) {
+      VS.shards[i].lock();
+      eraseVarStates(VS.shards[i].Vstates, begin, end);
+      VS.shards[i].unlock();
+    }
+    return;
+  }
+  for (uintptr_t line = begin & ~uintptr_t(63); line < end; line += 64) {
+    VStates::Shard & stripe = VS.shards[VS.shardOf(
+        reinterpret_cast<Address>(line))];
+    stripe.lock();
+    eraseVarStates(stripe.Vstates, std::max(line, begin),
+                   std::min(line + 64, end));
+    stripe.unlock();
+    if (line + 64 < line) break;
+  }
+#else
+  std::lock_guard<etsan::RuntimeMutex> guard(VS.mGuard);
+  eraseVarStates(VS.Vstates, begin, end);
+#endif
 }
 
 //////////////////////////////////////////////
@@ -223,17 +999,61 @@ VarState & getVarState(Address addr, bool isWrite) {
 class LockState {
   public:
     VectorClock L;
+    unsigned char Lock = 0; // spinlock guarding L
+
+    // The epoch of the thread whose clock L is a copy of, or kMixed if L
+    // is not known to be one. A thread whose clock has that epoch knows
+    // L, as a thread clock is copied once per epoch, then incremented.
+    static constexpr Epoch kMixed = READ_SHARED;
+    Epoch released = kMixed;
+
+    // Of reader-writer locks only: the releases of readers, which only
+    // writers acquire, and 1 + tid of the writer holding the lock
+    VectorClock R;
+    unsigned int writer = 0;
+
+#ifdef ETSAN_LOCKSET
+    etsan::Lockset bit = 0; // in the locksets, see lockset.h
+#endif
+
+    // Serializes joins and copies of L. Different locks never contend.
+    void lock() {
+      while (__atomic_test_and_set(&Lock, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&Lock, __ATOMIC_RELAXED)) {} // spin on read
+      }
+    }
+
+    void unlock() { __atomic_clear(&Lock, __ATOMIC_RELEASE); }
+
+    // True if clock "C" covers L: L need not be joined into it
+    bool knownTo(const VectorClock & C) const {
+      return (size_t)TID(released) < C.size() && released <= C[TID(released)];
+    }
 };
 
+constexpr Epoch LockState::kMixed;
+
 class LStates {
 
 public:
 
-  // A lock to acquire before accesing LockStates
-  std::mutex mGuard;
+  // A lock to acquire before inserting into LockStates
+  ETSAN_RUNTIME_MUTEX(mGuard, "LS.mGuard");
 
   // Locks states
-  std::unordered_map<Address, LockState> L;
+  MetadataMap<Address, LockState> L;
+
+  // Lock-free lookup of L: the state of each lock, by its address
+  ShadowMemory<std::atomic<LockState *>> index;
+
+  // Discards all lock states
+  void clear() {
+    std::lock_guard<etsan::RuntimeMutex> guard(mGuard);
+    index.forEachSlot([](std::atomic<LockState *> & slot) {
+      slot.store(nullptr, std::memory_order_relaxed);
+    });
+    L.clear();
+  }
 
 //#ifdef STATS
   ~LStates() {
@@ -242,24 +1062,79 @@ public:
 //#endif
 };
 
-LStates LS; // instance for locks states metadata
+LStates LS ETSAN_EARLY_INIT; // instance for locks states metadata
 
-// Initializes clocks in the vector clock to 0
-// for all threads 0 ... size-1 for a vector clock VC
-void newVectorClock(VectorClock& VC, int size) {
-  VC.resize( size );
-  for (int t = 0; t < size; t++) {
-    VC[t] = (t << 24); // =0?
+//////////////////////////////////////////////
+/// Barriers state related metadata        //
+//////////////////////////////////////////////
+class BarrierState {
+  public:
+    std::mutex mGuard;
+
+    // Join of the clocks of the threads arrived in the episodes with
+    // even, respectively odd numbers. Only episodes next to each other
+    // can overlap: a thread leaves an episode before it arrives at the
+    // next one.
+    VectorClock C[2];
+
+    unsigned int count   = 0; // threads per episode, 0 if unknown
+    unsigned int arrived = 0; // threads arrived in the current episode
+    unsigned int episode = 0;
+};
+
+class BStates {
+public:
+  ETSAN_RUNTIME_MUTEX(mGuard, "BS.mGuard");
+  MetadataMap<Address, BarrierState> B; // nodes never move
+};
+
+BStates BS ETSAN_EARLY_INIT; // instance for barriers states metadata
+
+// Sizes the metadata maps for "threads" threads, "vars" variables and
+// "locks" locks, and the clocks of threads for "threads" entries, so that
+// the program's first accesses do not rehash the maps nor regrow clocks.
+// The shadow memory needs nothing: its directory is mapped already.
+void reserveMetadata(unsigned int threads, size_t vars, size_t locks) {
+  TS.mGuard.lock(); // protect
+  TS.C.reserve(threads);
+  TS.freeSlots.reserve(threads);
+#ifndef ETSAN_FIXED_VECTOR_CLOCKS
+  TS.clockCapacity = threads; // fixed clocks have room for all threads
+  for (auto & t : TS.C) t.second.C.reserve(threads);
+#endif
+  TS.mGuard.unlock(); // release protection
+
+#if defined(ETSAN_STRIPED_VSTATES)
+  for (unsigned int i = 0; i < VS.numShards; i++) {
+    VS.shards[i].lock();
+    VS.shards[i].Vstates.reserve(vars / VS.numShards + 1);
+    VS.shards[i].unlock();
   }
+#elif !defined(ETSAN_SHADOW_MEMORY)
+  VS.mGuard.lock(); // protect
+  VS.Vstates.reserve(vars);
+  VS.mGuard.unlock(); // release protection
+#else
+  (void)vars;
+#endif
+
+  std::lock_guard<etsan::RuntimeMutex> guard(LS.mGuard);
+  LS.L.reserve(locks);
 }
 
-// Updates vector clock to accomodate epochs of new dynamically created threads
-void ExtendVectorClock(VectorClock& C, int totalThreads) {
+// Returns the state of the barrier whose address is "barrier"
+BarrierState& getBarrierState(Address barrier) {
+  std::lock_guard<etsan::RuntimeMutex> guard(BS.mGuard);
+  return BS.B[barrier];
+}
 
-  int tid = C.size();
-  for (; tid < totalThreads; tid++) {
-    int epoch = tid << 24;
-    C.push_back(epoch);
+// Initializes clocks in the vector clock to 0
+// for all threads 0 ... size-1 for a vector clock VC
+template <typename Clock>
+void newVectorClock(Clock& VC, int size) {
+  VC.resize( size );
+  for (int t = 0; t < size; t++) {
+    SetVectorClock(VC, t, EPOCH(t, 0)); // =0?
   }
 }
 
@@ -275,19 +1150,66 @@ void ExtendVectorClocks(VectorClock& C1, VectorClock& C2) {
   ExtendVectorClock(C2, size);
 }
 
-// Returns vector clock state of a lock whose address is "lock"
+// Join: C1 := C1 U C2. Both clocks must have the same length.
+void JoinVectorClock(VectorClock& C1, const VectorClock& C2) {
+#if defined(ETSAN_FIXED_VECTOR_CLOCKS) || defined(ETSAN_TREE_CLOCKS)
+  C1.join(C2);
+#else
+  for (std::size_t i = 0; i < C1.size(); i++) {
+    C1[i] = std::max(C1[i], C2[i]);
+  }
+#endif
+}
+
+// Copy: C1 := C2. Both clocks must have the same length.
+void CopyVectorClock(VectorClock& C1, const VectorClock& C2) {
+#if defined(ETSAN_FIXED_VECTOR_CLOCKS) || defined(ETSAN_TREE_CLOCKS)
+  C1.copy(C2);
+#else
+  for (std::size_t i = 0; i < C1.size(); i++) {
+    C1[i] = C2[i];
+  }
+#endif
+}
+
+// Copy: C1 := C2, where C1 <= C2, i.e. C2 has seen all of C1
+void CopyLessVectorClock(VectorClock& C1, const VectorClock& C2) {
+#ifdef ETSAN_TREE_CLOCKS
+  C1.copyLess(C2);
+#else
+  CopyVectorClock(C1, C2);
+#endif
+}
+
+// C := the zero epoch of every thread
+void ResetVectorClock(VectorClock& C) {
+#ifdef ETSAN_TREE_CLOCKS
+  C.reset();
+#else
+  for (std::size_t i = 0; i < C.size(); i++) C[i] = EPOCH(i, 0);
+#endif
+}
+
+// Returns vector clock state of a lock whose address is "lock".
+// Only the first call for a lock takes the LS lock.
 LockState& getLockState(Address lock) {
 
-  LockState* lockS;
+  std::atomic<LockState *> & slot = *LS.index.slot(lock);
+  LockState* lockS = slot.load(std::memory_order_acquire);
+  if (lockS) return *lockS;
 
   LS.mGuard.lock(); // protect access
 
   if (LS.L.find(lock) == LS.L.end()) {
     LS.L[lock] = LockState();
     newVectorClock(LS.L[lock].L, NumThreads);
+#ifdef ETSAN_LOCKSET
+    LS.L[lock].bit = etsan::newLockBit();
+#endif
   }
 
-  lockS = &LS.L[lock];
+  lockS = &LS.L[lock]; // map nodes never move
+  slot.store(lockS, std::memory_order_release);
 
   LS.mGuard.unlock(); // release lock
 
@@ -0,0 +1,75 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Epoch representation: a thread id and a clock packed into one word.
+//
+// The layout is a template over the word type and the number of thread id
+// bits. By default an epoch is a 32-bit int with an 8-bit tid and a 24-bit
+// clock; ETSAN_EPOCH64 selects a 64-bit word with a 16-bit tid and a 48-bit
+// clock for long-running programs on 64-bit targets.
+
+#ifndef ETSAN_EPOCH_H_
+#define ETSAN_EPOCH_H_
+
+#include <stdint.h>
+#include <type_traits>
+
+namespace etsan {
+
+  template <typename Word, unsigned TidBits>
+  struct EpochLayout {
+
+    using Type = Word;
+    using UWord = typename std::make_unsigned<Word>::type;
+
+    static constexpr unsigned kTidBits   = TidBits;
+    static constexpr unsigned kClockBits = sizeof(Word) * 8 - TidBits;
+
+    static constexpr Word kTidMask   = (Word(1) << TidBits) - 1;
+    static constexpr Word kClockMask = (Word(1) << kClockBits) - 1;
+
+    // Reserved epoch of a read-shared variable. Its tid is 16 below the
+    // largest one, like the original 0xEFFFFFFF of the 32-bit layout.
+    static constexpr Word kReadShared =
+        Word((UWord(kTidMask - 0x10) << kClockBits) | UWord(kClockMask));
+
+    static constexpr Word tid(Word e) { return (e >> kClockBits) & kTidMask; }
+    static constexpr Word clock(Word e) { return e & kClockMask; }
+
+    // Returns the epoch clock@tid
+    // (shifted unsigned: large tids set the sign bit)
+    static constexpr Word make(Word tid, Word clock) {
+      return Word((UWord(tid) << kClockBits) | UWord(clock));
+    }
+  };
+
+  // Definitions of the constants, for when they are bound to references
+  template <typename W, unsigned T>
+  constexpr unsigned EpochLayout<W, T>::kTidBits;
+  template <typename W, unsigned T>
+  constexpr unsigned EpochLayout<W, T>::kClockBits;
+  template <typename W, unsigned T>
+  constexpr W EpochLayout<W, T>::kTidMask;
+  template <typename W, unsigned T>
+  constexpr W EpochLayout<W, T>::kClockMask;
+  template <typename W, unsigned T>
+  constexpr W EpochLayout<W, T>::kReadShared;
+
+#ifdef ETSAN_EPOCH64
+  using Epochs = EpochLayout<int64_t, 16>;
+#else
+  using Epochs = EpochLayout<int32_t, 8>;
+#endif
+
+} // etsan
+
+#endif // ETSAN_EPOCH_H_
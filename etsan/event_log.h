@@ -0,0 +1,261 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Event logs of the recording mode (ETSAN_RECORD), analyzed on the host
+// by etsan-analyze, see event_replay.h.
+//
+// The device checks nothing: each thread appends its memory accesses and
+// synchronizations to its own file, ETSAN_LOG_DIR/etsan-<pid>-<n>.log
+// (default directory: the current one), through a window of the file
+// mapped in memory, so that recording takes no system call but when the
+// window is full. Numbers are LEB128, addresses and sites deltas from
+// the previous access of the thread, zigzag encoded, so that the accesses
+// of a loop take a few bytes each.
+//
+//   log      := "ETSL" version:u8 tid record*
+//   record   := tag:u8 fields
+//   Site     := siteId line column file:str obj:str   before its first use
+//   Read     := addr:delta site:delta [size]          size in the tag
+//   Write    := addr:delta site:delta [size]
+//   Reset    := addr:delta size                        stack frame exit
+//   Sync     := seq:delta object [arg]
+//   str      := length byte*
+//
+// The tag of an access keeps log2(size) + 1 in its high nibble, or 0 if
+// the size follows: a range of memory, checked word by word. Sync records
+// (locks, atomics, forks, joins, barriers and frees) carry a process-wide
+// sequence number, which orders them as they happened: a release is
+// numbered before the synchronization is done, an acquire after. Between two of its sync records the epoch of a
+// thread does not change, so the analyzer replays the sync records of all
+// threads in sequence order and the accesses of each thread in between.
+
+#ifndef ETSAN_EVENT_LOG_H_
+#define ETSAN_EVENT_LOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <unordered_set>
+#include "sites.h"
+
+namespace etsan {
+
+  constexpr char    kLogMagic[4] = {'E', 'T', 'S', 'L'};
+  constexpr uint8_t kLogVersion  = 1;
+
+  enum LogTag : uint8_t {
+    LogSite = 1,
+    LogRead,
+    LogWrite,
+    LogReset,
+    // numbered: sync records and frees
+    LogAcquire,       // lock, read lock, wait, acquire of an atomic
+    LogWriteAcquire,  // write lock
+    LogRelease,       // unlock, release store of an atomic
+    LogReleaseJoin,   // signal, post, release RMW of an atomic
+    LogRwRelease,     // unlock of a reader-writer lock
+    LogFork,          // object: child tid
+    LogJoin,          // object: child tid
+    LogBarrierInit,   // arg: count
+    LogBarrierArrive,
+    LogBarrierDepart,
+    LogFree,          // arg: size
+    NumLogTags
+  };
+
+  constexpr bool isNumbered(uint8_t tag) {
+    return tag >= LogAcquire && tag < NumLogTags;
+  }
+
+  constexpr bool hasArg(uint8_t tag) {
+    return tag == LogBarrierInit || tag == LogFree;
+  }
+
+  constexpr uint64_t zigzag(int64_t v) {
+    return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+  }
+
+  constexpr int64_t unzigzag(uint64_t v) {
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+  }
+
+  // Sequence numbers of the sync records of all threads
+  static std::atomic<uint64_t> logSequence{0};
+
+  // Log of one thread
+  class EventLogWriter {
+  public:
+    static constexpr size_t kWindowSize = sizeof(void *) == 4 ? 256 << 10
+                                                              : 1 << 20;
+
+    ~EventLogWriter() { close(); }
+
+    // Creates the log of thread "tid" at "path"
+    bool open(const char *path, uint64_t tid) {
+      fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) return false;
+      if (!mapWindow(0)) {
+        ::close(fd);
+        return false;
+      }
+      for (char c : kLogMagic) putByte(c);
+      putByte(kLogVersion);
+      putNumber(tid);
+      return true;
+    }
+
+    bool isOpen() const { return window; }
+
+    // An access, or with "isRange" one of every word of the range
+    void access(bool isWrite, const void *addr, size_t size,
+                unsigned int siteId, bool isRange = false) {
+      if (!window) return;
+      if (siteId && sites.insert(siteId).second) site(siteId);
+
+      unsigned int code = isRange ? 0 : sizeCode(size);
+      putByte((isWrite ? LogWrite : LogRead) | code << 4);
+      putAddress(addr);
+      putNumber(zigzag(int64_t(siteId) - lastSite));
+      lastSite = siteId;
+      if (!code) putNumber(size);
+    }
+
+    void reset(const void *addr, size_t size) {
+      if (!window) return;
+      putByte(LogReset);
+      putAddress(addr);
+      putNumber(size);
+    }
+
+    // A sync record, numbered now
+    void sync(LogTag tag, uint64_t object, uint64_t arg = 0) {
+      if (!window) return;
+      uint64_t seq = logSequence.fetch_add(1, std::memory_order_seq_cst);
+      putByte(tag);
+      putNumber(seq - lastSeq);
+      lastSeq = seq;
+      putNumber(object);
+      if (hasArg(tag)) putNumber(arg);
+    }
+
+    // Unmaps the window and cuts the file to the records written
+    void close() {
+      if (!window) return;
+      munmap(window, kWindowSize);
+      window = nullptr;
+      if (ftruncate(fd, offset + used)) {} // keep the log as it is
+      ::close(fd);
+    }
+
+  private:
+    static unsigned int sizeCode(size_t size) {
+      for (unsigned int log = 0; log <= 4; log++) {
+        if (size == size_t(1) << log) return log + 1;
+      }
+      return 0;
+    }
+
+    void site(unsigned int siteId) {
+      Site s = getSite(siteId);
+      putByte(LogSite);
+      putNumber(siteId);
+      putNumber(s.line());
+      putNumber(s.column());
+      putString(s.fileName);
+      putString(s.objName);
+    }
+
+    bool mapWindow(uint64_t at) {
+      if (ftruncate(fd, at + kWindowSize)) return false;
+      void *mem = mmap(nullptr, kWindowSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, at);
+      if (mem == MAP_FAILED) {
+        window = nullptr;
+        return false;
+      }
+      window = static_cast<uint8_t *>(mem);
+      offset = at;
+      used = 0;
+      return true;
+    }
+
+    void putByte(uint8_t byte) {
+      if (!window) return;
+      if (used == kWindowSize) {
+        munmap(window, kWindowSize);
+        if (!mapWindow(offset + kWindowSize)) {
+          ::close(fd); // disk full: the log ends here
+          return;
+        }
+      }
+      window[used++] = byte;
+    }
+
+    void putNumber(uint64_t value) {
+      do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        putByte(value ? byte | 0x80 : byte);
+      } while (value);
+    }
+
+    void putAddress(const void *addr) {
+      uintptr_t a = reinterpret_cast<uintptr_t>(addr);
+      putNumber(zigzag(int64_t(intptr_t(a - lastAddr))));
+      lastAddr = a;
+    }
+
+    void putString(const char *s) {
+      size_t length = strlen(s);
+      putNumber(length);
+      for (size_t i = 0; i < length; i++) putByte(s[i]);
+    }
+
+    int       fd = -1;
+    uint8_t  *window = nullptr;
+    uint64_t  offset = 0; // of the window in the file
+    size_t    used = 0;   // bytes of the window written
+
+    uintptr_t lastAddr = 0;
+    int64_t   lastSite = 0;
+    uint64_t  lastSeq = 0;
+    std::unordered_set<unsigned int> sites; // defined in the log already
+  };
+
+  constexpr size_t EventLogWriter::kWindowSize;
+
+  // Returns the log of the calling thread, created at its first event
+  EventLogWriter & threadLog(uint64_t tid) {
+    static std::atomic<unsigned int> numLogs{0};
+    static thread_local EventLogWriter log;
+    static thread_local bool opened = false;
+    if (!opened) {
+      opened = true;
+      const char *dir = getenv("ETSAN_LOG_DIR");
+      char path[512];
+      snprintf(path, sizeof(path), "%s/etsan-%d-%u.log", dir ? dir : ".",
+               (int)getpid(), numLogs.fetch_add(1));
+      if (!log.open(path, tid)) {
+        fprintf(stderr, "EmbedSanitizer: cannot record to %s\n", path);
+      }
+    }
+    return log;
+  }
+
+} // etsan
+
+#endif // ETSAN_EVENT_LOG_H_
@@ -0,0 +1,552 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Host side analysis of the event logs of ETSAN_RECORD, see event_log.h:
+// the FastTrack engine of fasttrack.h run over the logs of all threads.
+//
+// The sync records of all threads are replayed in sequence order. Each
+// thread then replays its accesses up to its next sync record, in its
+// epoch after the previous one. A thread starts at the fork naming it,
+// so that its clock is the one it got from its parent; threads created
+// out of sight of the instrumentation start at once.
+//
+// Parallel runs replay the sync records alone first, and keep the clock
+// of each thread at each of its segments of accesses (the accesses
+// between two of its sync records). The workers then go through all
+// segments in that order, each checking the accesses of its own pages
+// with variable states of its own. Built with ETSAN_LOCKFREE_FASTPATH,
+// as etsan-analyze is, they share no lock but the arena's. Each worker
+// decodes all logs.
+
+#ifndef ETSAN_EVENT_REPLAY_H_
+#define ETSAN_EVENT_REPLAY_H_
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "event_log.h"
+#include "fasttrack.h"
+#include "race.h"
+
+namespace etsan {
+
+  // One record of a log, but sites
+  struct LogEvent {
+    uint8_t      tag;
+    uint64_t     seq;      // numbered records only
+    uint64_t     addr;     // accesses, resets; object of sync records
+    uint64_t     size;     // accesses, resets; arg of sync records
+    unsigned int siteId;
+    bool         isRange;  // accesses of every word of [addr, addr + size)
+  };
+
+  struct LoggedSite {
+    unsigned int line;
+    unsigned int column;
+    std::string  fileName;
+    std::string  objName;
+  };
+
+  // Reads the records of one log, mapped in memory
+  class EventLogReader {
+  public:
+    // A position in the log, from which to decode its records again
+    struct Cursor {
+      const uint8_t *p = nullptr;
+      uint64_t lastAddr = 0;
+      uint64_t lastSite = 0;
+      uint64_t lastSeq = 0;
+    };
+
+    ~EventLogReader() {
+      if (begin) munmap(const_cast<uint8_t *>(begin), end - begin);
+    }
+
+    // Opens the log at "path". Returns false and sets "error" if it is
+    // not a log.
+    bool open(const char *path, std::string &error) {
+      int fd = ::open(path, O_RDONLY);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) || st.st_size < 6) {
+        if (fd >= 0) ::close(fd);
+        error = std::string(path) + ": not an EmbedSanitizer event log";
+        return false;
+      }
+      void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (mem == MAP_FAILED) {
+        error = std::string(path) + ": cannot map the log";
+        return false;
+      }
+      begin = static_cast<const uint8_t *>(mem);
+      end = begin + st.st_size;
+      at.p = begin;
+
+      if (memcmp(at.p, kLogMagic, sizeof(kLogMagic)) ||
+          at.p[sizeof(kLogMagic)] != kLogVersion) {
+        error = std::string(path) + ": not an EmbedSanitizer event log";
+        return false;
+      }
+      at.p += sizeof(kLogMagic) + 1;
+      if (!getNumber(at, tid)) {
+        error = std::string(path) + ": truncated log";
+        return false;
+      }
+      return true;
+    }
+
+    // Thread id on the device
+    uint64_t threadId() const { return tid; }
+
+    // Position of the next record
+    const Cursor & cursor() const { return at; }
+
+    // Reads the next record into "e", the sites on the way into "sites".
+    // Returns false at the end of the log; a truncated last record, cut
+    // by the end of the program, ends it too.
+    bool next(LogEvent &e,
+              std::unordered_map<unsigned int, LoggedSite> &sites) {
+      return next(at, e, sites);
+    }
+
+    // Same from "c", which it moves on; safe in concurrent threads
+    bool next(Cursor &c, LogEvent &e,
+              std::unordered_map<unsigned int, LoggedSite> &sites) const {
+      const uint8_t *&p = c.p;
+      while (p < end) {
+        uint8_t byte = *p++;
+        uint8_t tag = byte & 0xF;
+        uint64_t a, b, d;
+        if (byte == LogSite) {
+          LoggedSite s;
+          if (!getNumber(c, a) || !getNumber(c, b) || !getNumber(c, d) ||
+              !getString(c, s.fileName) || !getString(c, s.objName)) {
+            break;
+          }
+          s.line = b;
+          s.column = d;
+          sites[a] = s;
+          continue;
+        }
+        e.tag = tag;
+        if (tag == LogRead || tag == LogWrite) {
+          unsigned int code = byte >> 4;
+          if (!getNumber(c, a) || !getNumber(c, b)) break;
+          c.lastAddr += unzigzag(a);
+          c.lastSite += unzigzag(b);
+          e.addr = c.lastAddr;
+          e.siteId = c.lastSite;
+          e.size = code ? uint64_t(1) << (code - 1) : 0;
+          e.isRange = !code;
+          if (!code && !getNumber(c, e.size)) break;
+          return true;
+        }
+        if (tag == LogReset) {
+          if (!getNumber(c, a) || !getNumber(c, e.size)) break;
+          c.lastAddr += unzigzag(a);
+          e.addr = c.lastAddr;
+          return true;
+        }
+        if (isNumbered(byte)) {
+          e.tag = byte;
+          e.size = 0;
+          if (!getNumber(c, a) || !getNumber(c, e.addr) ||
+              (hasArg(byte) && !getNumber(c, e.size))) {
+            break;
+          }
+          c.lastSeq += a;
+          e.seq = c.lastSeq;
+          return true;
+        }
+        break; // unknown record: what follows cannot be decoded
+      }
+      p = end;
+      return false;
+    }
+
+  private:
+    bool getNumber(Cursor &c, uint64_t &value) const {
+      value = 0;
+      for (unsigned shift = 0; shift < 64 && c.p < end; shift += 7) {
+        uint8_t byte = *c.p++;
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+      }
+      return false;
+    }
+
+    bool getString(Cursor &c, std::string &s) const {
+      uint64_t length;
+      if (!getNumber(c, length) || length > uint64_t(end - c.p)) return false;
+      s.assign(reinterpret_cast<const char *>(c.p), length);
+      c.p += length;
+      return true;
+    }
+
+    const uint8_t *begin = nullptr;
+    const uint8_t *end = nullptr;
+    Cursor at;
+    uint64_t tid = 0;
+  };
+
+  // Runs FastTrack over the logs of one run
+  class Replayer {
+  public:
+    // Adds the log at "path". Returns false and sets "error" if it cannot
+    // be read.
+    bool addLog(const char *path, std::string &error) {
+      std::unique_ptr<Thread> t(new Thread());
+      if (!t->log.open(path, error)) return false;
+      t->id = threads.size() + 1;
+      threads.push_back(std::move(t));
+      paths.push_back(path);
+      return true;
+    }
+
+    // Replays all logs; call once. With more than one worker the sync
+    // records are replayed first, keeping the clock of each segment of
+    // accesses between two of them, then the accesses by "workers"
+    // threads, each over its own share of the address space.
+    void run(unsigned int workers = 1) {
+      parallel = workers > 1;
+      bindForks();
+
+      for (auto & t : threads) {
+        if (!t->forked) start(*t, nullptr);
+      }
+      while (!heap.empty()) {
+        Thread & t = *threads[heap.top().second];
+        heap.pop();
+        replaySync(t);
+        advance(t);
+      }
+
+      if (parallel) checkSegments(workers);
+    }
+
+    // Unique races found, in the format of the runtime
+    void print(std::ostream &out) {
+      for (auto & race : races) {
+        std::string msg;
+        race.second.createRaceMessage(msg);
+        out << msg;
+      }
+      out << "EmbedSanitizer: " << races.size() << " unique data races\n";
+    }
+
+    size_t numRaces() const { return races.size(); }
+
+  private:
+    struct Thread {
+      EventLogReader  log;
+      ThreadID        id;              // in the replay
+      ThreadState    *state = nullptr;
+      LogEvent        pending;         // next sync record
+      bool            hasPending = false;
+      bool            forked = false;  // started by a fork of the logs
+      bool            started = false;
+      unsigned int    episode = 0;     // of the last barrier arrival
+    };
+
+    typedef std::pair<uint64_t, size_t> HeapEntry; // seq, thread
+
+    // Accesses of a thread up to its next sync record, in one epoch, or a
+    // free. Kept in replay order by parallel runs.
+    struct Segment {
+      size_t                  thread;   // index in "threads"
+      unsigned int            tid;      // clock of the segment
+      Epoch                   epoch;
+      std::vector<Epoch>      C;
+      EventLogReader::Cursor  begin;
+      bool                    isFree;
+      uint64_t                addr;     // of the block freed
+      uint64_t                size;
+    };
+
+    // Size of the shares of the address space: pages, dealt out to the
+    // workers in turn
+    static constexpr unsigned int kShareShift = 12;
+
+    // Pairs the forks of each device thread id with the logs of that id,
+    // in order, since ids are reused once threads are joined
+    void bindForks() {
+      std::map<uint64_t, std::vector<uint64_t>> forks; // child -> seqs
+      std::map<uint64_t, std::vector<std::pair<uint64_t, size_t>>> logs;
+
+      for (size_t i = 0; i < threads.size(); i++) {
+        EventLogReader scan;
+        std::string error;
+        scan.open(paths[i].c_str(), error);
+        LogEvent e;
+        uint64_t first = UINT64_MAX;
+        while (scan.next(e, sites)) {
+          if (!isNumbered(e.tag)) continue;
+          if (first == UINT64_MAX) first = e.seq;
+          if (e.tag == LogFork) forks[e.addr].push_back(e.seq);
+        }
+        logs[threads[i]->log.threadId()].push_back(std::make_pair(first, i));
+      }
+
+      for (auto & f : forks) {
+        std::vector<uint64_t> & seqs = f.second;
+        std::vector<std::pair<uint64_t, size_t>> & candidates = logs[f.first];
+        std::sort(seqs.begin(), seqs.end());
+        std::sort(candidates.begin(), candidates.end());
+        for (size_t k = 0; k < seqs.size() && k < candidates.size(); k++) {
+          size_t child = candidates[k].second;
+          children[seqs[k]] = child;
+          threads[child]->forked = true;
+        }
+      }
+    }
+
+    void start(Thread & t, ThreadState * parent) {
+      t.state = &getState(t.id, parent);
+      t.started = true;
+      advance(t);
+    }
+
+    // Replays the accesses of "t" up to its next sync record. Parallel
+    // runs only keep their segment.
+    void advance(Thread & t) {
+      LogEvent e;
+      t.hasPending = false;
+      EventLogReader::Cursor begin = t.log.cursor();
+      bool kept = false;
+      while (t.log.next(e, sites)) {
+        if (isNumbered(e.tag)) {
+          t.pending = e;
+          t.hasPending = true;
+          heap.push(HeapEntry(e.seq, t.id - 1));
+          return;
+        }
+        if (parallel) {
+          if (!kept) keepSegment(t, begin);
+          kept = true;
+          continue;
+        }
+        Address addr = reinterpret_cast<Address>(e.addr);
+        if (e.tag == LogReset) {
+          resetVarStates(addr, e.size);
+          continue;
+        }
+        bool isWrite = e.tag == LogWrite;
+        bool isRace;
+        if (e.isRange) {
+          isRace = isWrite ? ft_write_range(addr, e.size, *t.state)
+                           : ft_read_range(addr, e.size, *t.state);
+        } else {
+          isRace = isWrite ? ft_write_access(addr, e.size, *t.state)
+                           : ft_read_access(addr, e.size, *t.state);
+        }
+        if (isRace) report(t, e.siteId, isWrite);
+      }
+    }
+
+    void replaySync(Thread & t) {
+      const LogEvent & e = t.pending;
+      ThreadState & st = *t.state;
+      Address object = reinterpret_cast<Address>(e.addr);
+
+      switch (e.tag) {
+      case LogAcquire:      ft_acquire(st, getLockState(object)); break;
+      case LogWriteAcquire: ft_write_acquire(st, getLockState(object)); break;
+      case LogRelease:      ft_release(st, getLockState(object)); break;
+      case LogReleaseJoin:  ft_release_join(st, getLockState(object)); break;
+      case LogRwRelease:    ft_rw_release(st, getLockState(object)); break;
+      case LogFork: {
+        auto child = children.find(e.seq);
+        if (child == children.end()) break; // not instrumented
+        Thread & c = *threads[child->second];
+        ThreadState & u = getState(c.id, &st);
+        ft_fork(st, u);
+        start(c, &st);
+        running[e.addr] = child->second;
+        break;
+      }
+      case LogJoin: {
+        auto child = running.find(e.addr);
+        if (child == running.end()) break;
+        Thread & c = *threads[child->second];
+        running.erase(child);
+        ft_join(st, *c.state);
+        retireThread(c.id);
+        break;
+      }
+      case LogBarrierInit: {
+        BarrierState & b = getBarrierState(object);
+        b.count = e.size;
+        b.arrived = 0;
+        break;
+      }
+      case LogBarrierArrive:
+        t.episode = ft_barrier_arrive(st, getBarrierState(object));
+        break;
+      case LogBarrierDepart:
+        ft_barrier_depart(st, getBarrierState(object), t.episode);
+        break;
+      case LogFree:
+        if (!parallel) {
+          resetVarStates(object, e.size);
+          break;
+        }
+        segments.push_back(Segment());
+        segments.back().isFree = true;
+        segments.back().addr = e.addr;
+        segments.back().size = e.size;
+        break;
+      }
+    }
+
+    void keepSegment(Thread & t, const EventLogReader::Cursor & begin) {
+      segments.push_back(Segment());
+      Segment & s = segments.back();
+      s.thread = t.id - 1;
+      s.tid = t.state->tid;
+      s.epoch = t.state->epoch;
+      s.C.assign(t.state->C.begin(), t.state->C.end());
+      s.begin = begin;
+      s.isFree = false;
+    }
+
+    // Worker "me" of "n": checks the accesses of its share of the address
+    // space in all segments, in order, with variable states of its own.
+    // Keeps the first segment of each race found.
+    void checkShare(unsigned int me, unsigned int n,
+                    std::map<uint64_t, size_t> & found) {
+      MetadataMap<Address, VarState> states;
+      std::unordered_map<unsigned int, LoggedSite> ignored;
+      ThreadState t;
+      auto mine = [&](uintptr_t a) { return (a >> kShareShift) % n == me; };
+
+      for (size_t i = 0; i < segments.size(); i++) {
+        const Segment & s = segments[i];
+        if (s.isFree) {
+          eraseVarStates(states, s.addr, s.addr + s.size);
+          continue;
+        }
+        t.tid = s.tid;
+        t.epoch = s.epoch;
+        t.C.assign(s.C.begin(), s.C.end());
+
+        const EventLogReader & log = threads[s.thread]->log;
+        EventLogReader::Cursor c = s.begin;
+        LogEvent e;
+        while (log.next(c, e, ignored) && !isNumbered(e.tag)) {
+          uintptr_t lo = e.addr, hi = e.addr + e.size;
+          if (e.tag == LogReset) {
+            eraseVarStates(states, lo, hi);
+            continue;
+          }
+          bool isWrite = e.tag == LogWrite, isRace = false;
+#ifdef ETSAN_GRANULARITY
+          e.isRange = true; // as ft_read_access
+#endif
+          if (!e.isRange) {
+            if (!mine(lo)) continue;
+            isRace = check(states, lo, isWrite, t);
+          } else {
+            for (uintptr_t p = lo & ~(kRangeWord - 1); p < hi;
+                 p += kRangeWord) {
+              if (mine(p)) isRace |= check(states, p, isWrite, t);
+            }
+          }
+          uint64_t key = uint64_t(e.siteId) << 1 | isWrite;
+          if (isRace && !found.count(key)) found[key] = i;
+        }
+      }
+    }
+
+    // ft_read or ft_write of the state of "a" in "states", created as
+    // by getVarState
+    static bool check(MetadataMap<Address, VarState> & states, uintptr_t a,
+                      bool isWrite, ThreadState & t) {
+      Address addr = reinterpret_cast<Address>(a);
+      auto x = states.find(addr);
+      if (x == states.end()) {
+        VarState vs;
+        vs.W = vs.R = EPOCH(t.tid, 0);
+        (isWrite ? vs.W : vs.R) = t.epoch;
+        x = states.insert(std::make_pair(addr, vs)).first;
+      }
+      return isWrite ? ft_write(x->second, t) : ft_read(x->second, t);
+    }
+
+    // Runs the workers, then keeps the races in replay order
+    void checkSegments(unsigned int n) {
+      std::vector<std::map<uint64_t, size_t>> found(n);
+      std::vector<std::thread> workers;
+      for (unsigned int i = 0; i < n; i++) {
+        workers.push_back(std::thread([this, i, n, &found] {
+          checkShare(i, n, found[i]);
+        }));
+      }
+      for (auto & w : workers) w.join();
+
+      std::map<uint64_t, size_t> first;
+      for (auto & f : found) {
+        for (auto & race : f) {
+          auto r = first.find(race.first);
+          if (r == first.end() || race.second < r->second) {
+            first[race.first] = race.second;
+          }
+        }
+      }
+      for (auto & race : first) {
+        Thread & t = *threads[segments[race.second].thread];
+        report(t, race.first >> 1, race.first & 1);
+      }
+      segments.clear();
+    }
+
+    void report(Thread & t, unsigned int siteId, bool isWrite) {
+      uint64_t key = uint64_t(siteId) << 1 | isWrite;
+      if (races.count(key)) return;
+
+      auto s = sites.find(siteId);
+      LoggedSite unknown = {0, 0, "Unknown", "unknown"};
+      const LoggedSite & def = s != sites.end() ? s->second : unknown;
+      Site site = {makeSiteLoc(0, def.line, def.column),
+                   def.objName.c_str(), def.fileName.c_str()};
+      races.insert(std::make_pair(key, Race(t.log.threadId(), site,
+                                            isWrite)));
+    }
+
+    std::vector<std::unique_ptr<Thread>> threads;
+    std::vector<std::string> paths;
+    std::unordered_map<unsigned int, LoggedSite> sites;
+    std::unordered_map<uint64_t, size_t> children; // fork seq -> thread
+    std::unordered_map<uint64_t, size_t> running;  // device tid -> thread
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>,
+                        std::greater<HeapEntry>> heap;
+    std::map<uint64_t, Race> races; // by site and access type
+    bool parallel = false;
+    std::vector<Segment> segments;  // of parallel runs
+  };
+
+  constexpr unsigned int Replayer::kShareShift;
+
+} // etsan
+
+#endif // ETSAN_EVENT_REPLAY_H_
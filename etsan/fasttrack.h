@@ -17,6 +17,40 @@
 
 bool ft_read(VarState & x, ThreadState & t);
 bool ft_write(VarState & x, ThreadState & t);
+bool ft_read_range(Address addr, size_t size, ThreadState & t);
+bool ft_write_range(Address addr, size_t size, ThreadState & t);
+bool ft_read_access(Address addr, size_t size, ThreadState & t);
+bool ft_write_access(Address addr, size_t size, ThreadState & t);
+void ft_flush_accesses(ThreadState & t);
+
+#ifdef ETSAN_BATCHED_ACCESSES
+// Reports a race found in a batch of accesses, see access_batch.h.
+// Defined by tsan_interface.cc.
+void reportBatchedRace(unsigned int siteId, bool isWrite);
+#endif
+
+// Tracking granularity (ETSAN_GRANULARITY): 1 checks every byte an access
+// touches, 4 every word and 64 every cache line, for coarse and cheap
+// triage runs. Unset, an access is checked at its own address as one
+// variable (its word with ETSAN_SHADOW_MEMORY), whatever its size.
+#ifdef ETSAN_GRANULARITY
+static_assert(ETSAN_GRANULARITY == 1 || ETSAN_GRANULARITY == 4 ||
+              ETSAN_GRANULARITY == 64,
+              "ETSAN_GRANULARITY must be 1, 4 or 64");
+#if defined(ETSAN_SHADOW_MEMORY) && ETSAN_GRANULARITY < 4
+#error "ETSAN_SHADOW_MEMORY keeps one state per word, use ETSAN_GRANULARITY=4"
+#endif
+#endif
+
+#ifdef ETSAN_LOCKSET
+// Narrows the candidate lockset of "x" to the locks "t" holds; returns
+// true while a lock is left, so that the access is ordered after all
+// earlier ones, see lockset.h
+static inline bool ft_guarded(VarState & x, const ThreadState & t) {
+  x.Unguarded |= ~t.held;
+  return x.Unguarded != etsan::kAllLocks;
+}
+#endif
 
 // Performs race detection at read event
 // @param x memory address state
@@ -25,17 +59,42 @@ bool ft_write(VarState & x, ThreadState & t);
 bool ft_read(VarState & x, ThreadState & t) {
 
   bool reportIsRacy = false;
-  VS.mGuard.lock(); // protect
-// #ifdef STATS
-  VS.reads++;
-// #endif
+  t.stats.inc(etsan::StatReads);
+
+  // A variable is checked until its first race, which is reported: the
+  // accesses after it return without the lock
+  if (__atomic_load_n(&x.Racy, __ATOMIC_RELAXED)) return false;
+
+#ifdef ETSAN_LOCKFREE_FASTPATH
+  // Lock-free fast path: only this thread stores its own epoch into
+  // x.R, so seeing it means the read was already recorded. Aligned int
+  // stores are single-copy atomic on ARMv7 and x86.
+  if (__atomic_load_n(&x.R, __ATOMIC_RELAXED) == t.epoch) {
+    t.stats.inc(etsan::StatReadSameEpoch);
+    return false;
+  }
+#endif
+
+  lockVarState(x); // protect
 
   if (x.Racy) FastPathReturn;
 
-  if (x.R == t.epoch) FastPathReturn;  // Same epoch 63.4%
+  if (x.R == t.epoch) {               // Same epoch 63.4%
+    t.stats.inc(etsan::StatReadSameEpoch);
+    FastPathReturn;
+  }
+
+#ifdef ETSAN_LOCKSET
+  if (ft_guarded(x, t)) {             // Lock-protected
+    t.stats.inc(etsan::StatReadLocked);
+    if (x.R == READ_SHARED) x.Rvc.clear(); // all readers are before
+    x.R = t.epoch;
+    FastPathReturn;
+  }
+#endif
 
   // write-read race?
-  if ( TID(x.W) != t.tid && CLOCK(x.W) > CLOCK( t.C[TID(x.W)] ) ) {
+  if ( (unsigned int)TID(x.W) != t.tid && CLOCK(x.W) > CLOCK(clockEntry(t.C, TID(x.W))) ) {
 #ifdef DEBUG
     printf("x.tid: %d, t.tid: %d\n", TID(x.W), t.tid);
 #endif
@@ -45,26 +104,28 @@ bool ft_read(VarState & x, ThreadState & t) {
   // update read state
   if (x.R == READ_SHARED) {            // Shared     20.8%
 
-    x.Rvc[t.tid] = t.epoch;
+    t.stats.inc(etsan::StatReadShared);
+    x.Rvc.set(t.tid, t.epoch);
 
   } else {
 
-    if (x.R <= t.C[TID(x.R)]) {        // Exclusive  15.7%
+    if (x.R <= clockEntry(t.C, TID(x.R))) { // Exclusive  15.7%
 
+      t.stats.inc(etsan::StatReadExclusive);
       x.R = t.epoch;
 
     } else {                          // Share       0.1%
 
-      if(x.Rvc.size() == 0) {
-        newVectorClock(x.Rvc, NumThreads);     // (SLOW PATH)
-      }
-      x.Rvc[TID(x.R)] = x.R;
-      x.Rvc[t.tid] = t.epoch;
+      t.stats.inc(etsan::StatReadShare);
+
+      x.Rvc.set(TID(x.R), x.R);              // (SLOW PATH)
+      x.Rvc.set(t.tid, t.epoch);
       x.R = READ_SHARED;
     }
   }
 
-  VS.mGuard.unlock(); // release protection
+  if (reportIsRacy) __atomic_store_n(&x.Racy, true, __ATOMIC_RELAXED);
+  unlockVarState(x); // release protection
 
   return reportIsRacy;
 }
@@ -76,71 +137,266 @@ bool ft_read(VarState & x, ThreadState & t) {
 bool ft_write(VarState & x, ThreadState & t) {
 
   bool reportIsRacy = false;
-  VS.mGuard.lock(); // protection
+  t.stats.inc(etsan::StatWrites);
+
+  // Racy variables are not checked, see ft_read
+  if (__atomic_load_n(&x.Racy, __ATOMIC_RELAXED)) return false;
+
+#ifdef ETSAN_LOCKFREE_FASTPATH
+  // Lock-free fast path, see ft_read
+  if (__atomic_load_n(&x.W, __ATOMIC_RELAXED) == t.epoch) {
+    t.stats.inc(etsan::StatWriteSameEpoch);
+    return false;
+  }
+#endif
 
-// #ifdef STATS
-  VS.writes++;
-// #endif
+  lockVarState(x); // protection
 
   if (x.Racy) FastPathReturn; // should already have been reported
 
-  if (x.W == t.epoch) FastPathReturn;     // Same epoch 71.0%
+  if (x.W == t.epoch) {                  // Same epoch 71.0%
+    t.stats.inc(etsan::StatWriteSameEpoch);
+    FastPathReturn;
+  }
+
+#ifdef ETSAN_LOCKSET
+  if (ft_guarded(x, t)) {                // Lock-protected
+    t.stats.inc(etsan::StatWriteLocked);
+    if (x.R == READ_SHARED) {
+      x.R = EPOCH(TID(t.epoch), 0);
+      x.Rvc.clear();
+    }
+    x.W = t.epoch;
+    FastPathReturn;
+  }
+#endif
 
   // write-write race?
-  if ( TID(x.W) != t.tid && CLOCK(x.W) > CLOCK( t.C[TID(x.W)] ) ) {
+  if ( (unsigned int)TID(x.W) != t.tid && CLOCK(x.W) > CLOCK(clockEntry(t.C, TID(x.W))) ) {
     reportIsRacy = true;
   }
 
   // read-write race?
   if (x.R != READ_SHARED) {   // Write Exclusive 28.9%
-    if (TID(x.R) != t.tid && CLOCK(x.R) > CLOCK(t.C[TID(x.R)]) ) {
+    t.stats.inc(etsan::StatWriteExclusive);
+    if ((unsigned int)TID(x.R) != t.tid && CLOCK(x.R) > CLOCK(clockEntry(t.C, TID(x.R))) ) {
       reportIsRacy = true;
     }
   } else {                       // Write Shared       0.1%
-    for (std::size_t u = 0; u < /*NumThreads*/std::min(x.Rvc.size(), t.C.size()); u++) {
-      if (x.Rvc[u] > t.C[u]) {// (SLOW PATH)
+    t.stats.inc(etsan::StatWriteShared);
+    x.Rvc.forEach([&](unsigned int u, Epoch e) {
+      if (e > clockEntry(t.C, u)) { // (SLOW PATH)
         reportIsRacy = true; // RACE!
       }
-    }
+    });
     // also have to set R = epoch
-    x.R = (TID(t.epoch) << 24); // 0@tid
+    x.R = EPOCH(TID(t.epoch), 0); // 0@tid
+    x.Rvc.clear(); // exclusive again: the readers' clock goes
   } // a possible bug.
 
   x.W = t.epoch; // update write state
-  VS.mGuard.unlock(); // release protection
+  if (reportIsRacy) __atomic_store_n(&x.Racy, true, __ATOMIC_RELAXED);
+  unlockVarState(x); // release protection
 
   return reportIsRacy;
 }
 
 
+// Granularity of range checks: the shadow memory word, unless set
+#ifdef ETSAN_GRANULARITY
+constexpr uintptr_t kRangeWord = ETSAN_GRANULARITY;
+#else
+constexpr uintptr_t kRangeWord = 4;
+#endif
+
+// Checks a read of the granule at "p", unless its line is frozen
+static inline bool ft_read_granule(uintptr_t p, bool frozen, ThreadState & t) {
+  Address word = reinterpret_cast<Address>(p);
+  if (frozen && etsan::frozenRegions.isFrozen(word, 1)) {
+    t.stats.inc(etsan::StatReadFrozen);
+    return false;
+  }
+  bool isRace = ft_read(getVarState(word, false, &t), t);
+  if (frozen) etsan::frozenRegions.read(word);
+  return isRace;
+}
+
+// Performs race detection at a read of every word of [addr, addr + size),
+// in one pass over the shadow
+// @return true if any word races, false otherwise.
+bool ft_read_range(Address addr, size_t size, ThreadState & t) {
+
+  bool isRace = false;
+  bool frozen = etsan::frozenRegions.active();
+  uintptr_t end = reinterpret_cast<uintptr_t>(addr) + size;
+  for (uintptr_t p = reinterpret_cast<uintptr_t>(addr) & ~(kRangeWord - 1);
+       p < end; p += kRangeWord) {
+    isRace |= ft_read_granule(p, frozen, t);
+  }
+  return isRace;
+}
+
+// Performs race detection at a write of every word of [addr, addr + size)
+// @return true if any word races, false otherwise.
+bool ft_write_range(Address addr, size_t size, ThreadState & t) {
+
+  bool isRace = false;
+  if (etsan::frozenRegions.active()) etsan::frozenRegions.write(addr, size);
+  uintptr_t end = reinterpret_cast<uintptr_t>(addr) + size;
+  for (uintptr_t p = reinterpret_cast<uintptr_t>(addr) & ~(kRangeWord - 1);
+       p < end; p += kRangeWord) {
+    isRace |= ft_write(getVarState(reinterpret_cast<Address>(p), true, &t), t);
+  }
+  return isRace;
+}
+
+// Performs race detection at a read of "size" bytes at "addr", on each
+// granule it touches, see ETSAN_GRANULARITY. Reads of frozen lines are
+// not checked (frozen.h).
+bool ft_read_access(Address addr, size_t size, ThreadState & t) {
+#ifdef ETSAN_GRANULARITY
+  return ft_read_range(addr, size, t);
+#else
+  bool frozen = etsan::frozenRegions.active();
+  if (frozen && etsan::frozenRegions.isFrozen(addr, size)) {
+    t.stats.inc(etsan::StatReadFrozen);
+    return false;
+  }
+  bool isRace = ft_read(getVarState(addr, false, &t), t);
+  if (frozen) etsan::frozenRegions.read(addr);
+  return isRace;
+#endif
+}
+
+// Performs race detection at a write of "size" bytes at "addr", which
+// thaws the lines it touches
+bool ft_write_access(Address addr, size_t size, ThreadState & t) {
+#ifdef ETSAN_GRANULARITY
+  return ft_write_range(addr, size, t);
+#else
+  if (etsan::frozenRegions.active()) etsan::frozenRegions.write(addr, size);
+  return ft_write(getVarState(addr, true, &t), t);
+#endif
+}
+
+#ifdef ETSAN_GRANULARITY
+// Granules an access of "Size" bytes aligned to "Align" touches: exactly
+// Size / kRangeWord (or one) when they are aligned to a granule, else at
+// most enough to cover it from the last aligned offset of a granule
+template <size_t Size, size_t Align>
+struct Granules {
+  static constexpr bool exact = Align >= kRangeWord;
+  static constexpr unsigned int max =
+      exact ? (Size + kRangeWord - 1) / kRangeWord
+            : (kRangeWord - Align + Size + kRangeWord - 1) / kRangeWord;
+};
+#endif
+
+// Performs race detection at a read of "Size" bytes at "addr", aligned
+// to "Align" bytes: ft_read_access with the granules it can touch known
+// at compile time. The __tsan_readN and __tsan_unaligned_readN callbacks
+// are instances of it.
+template <size_t Size, size_t Align>
+bool ft_read_sized(Address addr, ThreadState & t) {
+#ifdef ETSAN_GRANULARITY
+  bool isRace = false;
+  bool frozen = etsan::frozenRegions.active();
+  uintptr_t first = reinterpret_cast<uintptr_t>(addr) & ~(kRangeWord - 1);
+  uintptr_t end = reinterpret_cast<uintptr_t>(addr) + Size;
+  for (unsigned int i = 0; i < Granules<Size, Align>::max; i++) {
+    uintptr_t p = first + i * kRangeWord;
+    if (!Granules<Size, Align>::exact && i && p >= end) break;
+    isRace |= ft_read_granule(p, frozen, t);
+  }
+  return isRace;
+#else
+  return ft_read_access(addr, Size, t);
+#endif
+}
+
+template <size_t Size, size_t Align>
+bool ft_write_sized(Address addr, ThreadState & t) {
+#ifdef ETSAN_GRANULARITY
+  bool isRace = false;
+  if (etsan::frozenRegions.active()) etsan::frozenRegions.write(addr, Size);
+  uintptr_t first = reinterpret_cast<uintptr_t>(addr) & ~(kRangeWord - 1);
+  uintptr_t end = reinterpret_cast<uintptr_t>(addr) + Size;
+  for (unsigned int i = 0; i < Granules<Size, Align>::max; i++) {
+    uintptr_t p = first + i * kRangeWord;
+    if (!Granules<Size, Align>::exact && i && p >= end) break;
+    isRace |= ft_write(getVarState(reinterpret_cast<Address>(p), true, &t), t);
+  }
+  return isRace;
+#else
+  return ft_write_access(addr, Size, t);
+#endif
+}
+
+// Records an access of "t" at site "siteId", checked at the latest at
+// the next synchronization of "t"
+void ft_batch_access(Address addr, size_t size, bool isWrite,
+                     unsigned int siteId, ThreadState & t) {
+#ifdef ETSAN_BATCHED_ACCESSES
+  if (t.batch.push(addr, size, isWrite, siteId)) ft_flush_accesses(t);
+#endif
+}
+
+// Checks the accesses batched by "t", in its current epoch: call before
+// any synchronization of "t" changes its clock
+void ft_flush_accesses(ThreadState & t) {
+#ifdef ETSAN_BATCHED_ACCESSES
+  if (t.batch.empty()) return;
+  unsigned int n = t.batch.sortUnique();
+  for (unsigned int i = 0; i < n; i++) {
+    const etsan::BatchedAccess & a = t.batch[i];
+    bool isRace = a.isWrite ? ft_write_access(a.addr, a.size, t)
+                            : ft_read_access(a.addr, a.size, t);
+    if (isRace) reportBatchedRace(a.siteId, a.isWrite);
+  }
+  t.batch.clear();
+#endif
+}
+
+
 void ft_acquire(ThreadState& t, LockState& lock) {
 
-  LS.mGuard.lock(); // protect
+  t.stats.inc(etsan::StatAcquires);
+  ft_flush_accesses(t);
+
+  lock.lock(); // protect this lock only
+
+  // Re-acquiring one's own release, or one already acquired: O(1)
+  if (lock.knownTo(t.C)) {
+    t.stats.inc(etsan::StatAcquireKnown);
+    lock.unlock();
+    return;
+  }
 
   ExtendVectorClocks(t.C, lock.L);
 
   // Join: Ct := Ct U Lm
-  for (std::size_t i = 0; i < lock.L.size(); i++) {
-    t.C[i] = std::max(t.C[i], lock.L[i]);
-  }
+  JoinVectorClock(t.C, lock.L);
 
-  LS.mGuard.unlock(); // release protection
+  lock.unlock(); // release protection
 
   t.updateEpoch(); // invariant
 }
 
 void ft_release(ThreadState& t, LockState& lock) {
 
-  LS.mGuard.lock(); // protect
+  t.stats.inc(etsan::StatReleases);
+  ft_flush_accesses(t);
+
+  lock.lock(); // protect this lock only
 
   ExtendVectorClocks(t.C, lock.L);
 
   // Copy: Lm := Ct
-  for (std::size_t i = 0; i < lock.L.size(); i++) {
-    lock.L[i] = t.C[i];
-  }
+  if (lock.knownTo(t.C)) CopyLessVectorClock(lock.L, t.C);
+  else CopyVectorClock(lock.L, t.C);
+  lock.released = t.epoch;
 
-  LS.mGuard.unlock(); // release protection
+  lock.unlock(); // release protection
 
   t.updateEpoch(); // invariant
   t.increment();
@@ -148,16 +404,17 @@ void ft_release(ThreadState& t, LockState& lock) {
 
 void ft_fork(ThreadState & t, ThreadState & u){
 
-  isConcurrent++;
+  t.stats.inc(etsan::StatForks);
+  ft_flush_accesses(t);
 
   TS.mGuard.lock();
 
+  startRunning(u);
+
   ExtendVectorClocks(t.C, u.C);
 
   // Join: Cu := Cu U Ct
-  for (std::size_t i = 0; i < u.C.size(); i++) {
-    u.C[i] = std::max(u.C[i], t.C[i]);
-  }
+  JoinVectorClock(u.C, t.C);
 
   u.updateEpoch(); // invariant
 
@@ -169,20 +426,22 @@ void ft_fork(ThreadState & t, ThreadState & u){
 
 void ft_join(ThreadState & t, ThreadState & u){
 
-  if ( isConcurrent ) isConcurrent--;
+  t.stats.inc(etsan::StatJoins);
+  ft_flush_accesses(t);
+  ft_flush_accesses(u); // the child has exited
+
+  TS.mGuard.lock();
+
+  stopRunning(u); // if it never made a callback
 
 #ifdef DEBUG
   if (!isConcurrent) printf("No MULTITHREADS\n");
 #endif
 
-  TS.mGuard.lock();
-
   ExtendVectorClocks(t.C, u.C);
 
   // Join: Ct := Ct U Cu
-  for (std::size_t i = 0; i < t.C.size(); i++) {
-    t.C[i] = std::max(t.C[i], u.C[i]);
-  }
+  JoinVectorClock(t.C, u.C);
 
   t.updateEpoch(); // invariant
   u.increment(); // child state
@@ -190,8 +449,120 @@ void ft_join(ThreadState & t, ThreadState & u){
   TS.mGuard.unlock(); // release protection
 }
 
-void ft_atomic_load() {
-  printf("EmbedSanitizer: Warning, atomic load not implemented!\n");
+// Release by an atomic read-modify-write. Unlike ft_release, it joins
+// instead of copying, so that the releases of a release sequence add up:
+// Lm := Lm U Ct. Acquires and release stores of atomics are ft_acquire
+// and ft_release on the sync clock of the atomic location.
+void ft_release_join(ThreadState& t, LockState& sync) {
+
+  t.stats.inc(etsan::StatReleases);
+  ft_flush_accesses(t);
+
+  sync.lock(); // protect this location only
+
+  ExtendVectorClocks(t.C, sync.L);
+
+  // Join: Lm := Lm U Ct, which is Ct if Ct covered Lm
+  sync.released = sync.knownTo(t.C) ? t.epoch : LockState::kMixed;
+  JoinVectorClock(sync.L, t.C);
+
+  sync.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+  t.increment();
+}
+
+// Write lock of a reader-writer lock: acquires the releases of the
+// writer and of all readers before it: Ct := Ct U Lm U Rm
+void ft_write_acquire(ThreadState& t, LockState& lock) {
+
+  t.stats.inc(etsan::StatAcquires);
+  ft_flush_accesses(t);
+
+  lock.lock(); // protect this lock only
+
+  ExtendVectorClocks(t.C, lock.L);
+  JoinVectorClock(t.C, lock.L);
+  ExtendVectorClocks(t.C, lock.R);
+  JoinVectorClock(t.C, lock.R);
+  lock.writer = t.tid + 1;
+
+  lock.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+}
+
+// Unlock of a reader-writer lock. A writer releases as ft_release, to
+// everyone; a reader joins into Rm, so that only writers get its clock
+// and concurrent readers are never ordered by one another. Read locks
+// acquire Lm only, as ft_acquire.
+void ft_rw_release(ThreadState& t, LockState& lock) {
+
+  t.stats.inc(etsan::StatReleases);
+  ft_flush_accesses(t);
+
+  lock.lock(); // protect this lock only
+
+  if (lock.writer == t.tid + 1) {
+    ExtendVectorClocks(t.C, lock.L);
+    CopyLessVectorClock(lock.L, t.C); // Lm := Ct, Ct covers Lm and Rm
+    lock.released = t.epoch;
+    lock.writer = 0;
+  } else {
+    ExtendVectorClocks(t.C, lock.R);
+    JoinVectorClock(lock.R, t.C); // Rm := Rm U Ct
+  }
+
+  lock.unlock(); // release protection
+
+  t.updateEpoch(); // invariant
+  t.increment();
+}
+
+// Arrival of thread t at barrier b: Bm := Bm U Ct, Bm being the clock of
+// the current episode. Returns the episode, to pass to ft_barrier_depart.
+// Each thread joins once into the episode clock and once out of it,
+// instead of once with every other thread.
+unsigned int ft_barrier_arrive(ThreadState& t, BarrierState& b) {
+
+  t.stats.inc(etsan::StatReleases);
+  ft_flush_accesses(t);
+
+  std::lock_guard<std::mutex> guard(b.mGuard);
+
+  unsigned int episode = b.episode;
+  VectorClock &clock = b.C[episode & 1];
+  ExtendVectorClocks(t.C, clock);
+  JoinVectorClock(clock, t.C);
+
+  if (b.count && ++b.arrived == b.count) {
+    // the last one: the next episode starts over, in the clock of the
+    // previous one, which everyone has left
+    b.arrived = 0;
+    b.episode++;
+    VectorClock &next = b.C[b.episode & 1];
+    ResetVectorClock(next);
+  }
+
+  t.increment();
+  return episode;
+}
+
+// Departure of thread t from barrier b after "episode":
+// Ct := Ct U Bm, once all threads of the episode have arrived.
+void ft_barrier_depart(ThreadState& t, BarrierState& b,
+                       unsigned int episode) {
+
+  t.stats.inc(etsan::StatAcquires);
+  ft_flush_accesses(t);
+
+  std::lock_guard<std::mutex> guard(b.mGuard);
+
+  VectorClock &clock = b.C[episode & 1];
+  ExtendVectorClocks(t.C, clock);
+  JoinVectorClock(t.C, clock);
+
+  t.updateEpoch(); // invariant
 }
 
 #endif // FASTTRACK_HPP_
@@ -10,34 +10,103 @@
 //            Email: hmatar@ku.edu.tr
 //===----------------------------------------------------------------------===//
 
+// Interned strings of the race reports: each file name, module path and
+// variable name is stored once, and races refer to it by a small ID or
+// by its canonical pointer. Strings are interned as modules register
+// their sites, i.e. at startup, and when a race is reported without a
+// site table; they stay for the whole process.
+
 #ifndef ETSAN_FILEDICTIONARY_H_
 #define ETSAN_FILEDICTIONARY_H_
 
-#include <unordered_set>
-#include <set>
+#include <atomic>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
+#include "flags.h"
 
 namespace etsan {
 
 // This class holds the list of files for debuggability of
 // races detected by EmbedSanitizer race detector.
 class FileDictionary {
-  std::set<std::string> module_paths;
-  std::unordered_set<char *> files;
+public:
+  // IDs fit the file index of a SiteLoc; 0 is the unknown file
+  static constexpr unsigned int kMaxFiles = 0xFFFF;
+
+  // Returns the ID of "fileName", 0 for none or when the dictionary is
+  // full. Equal names get the same ID, also from different modules.
+  unsigned int internFile(const char *fileName) {
+    if (!fileName || !*fileName) return 0;
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = files.find(fileName);
+    if (it != files.end()) return it->second;
+    if (numFiles == kMaxFiles) return 0;
+
+    unsigned int id = numFiles;
+    it = files.insert(std::make_pair(std::string(fileName), id)).first;
+    const char **&chunk = fileChunks[id >> kChunkShift];
+    if (!chunk) chunk = new const char *[kChunkSize];
+    chunk[id & (kChunkSize - 1)] = it->first.c_str(); // nodes do not move
+    published.store(++numFiles, std::memory_order_release);
+    return id;
+  }
 
-  void inserFile(char *file_name) {
-    files.insert(file_name);
+  // Name of file "id", "Unknown" for 0 or an ID not handed out. Lock-free.
+  const char *fileName(unsigned int id) const {
+    if (!id || id >= published.load(std::memory_order_acquire))
+      return "Unknown";
+    return fileChunks[id >> kChunkShift][id & (kChunkSize - 1)];
   }
 
-  bool exists(char *file_name) {
-    return files.find(file_name) != files.end();
+  unsigned int size() const {
+    return published.load(std::memory_order_acquire);
   }
 
-  void saveModule(char *module_path) {
-    std::string path(module_path);
-    module_paths.insert(path);
+  // Returns the stored copy of variable name "name"
+  const char *internName(const char *name) {
+    if (!name) return "unknown";
+    std::lock_guard<std::mutex> guard(lock);
+    return names.insert(std::make_pair(std::string(name), 0))
+        .first->first.c_str();
   }
+
+  // Returns the ID of module "path", from 0
+  unsigned int saveModule(const char *path) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = modules.insert(
+        std::make_pair(std::string(path ? path : ""), modulePaths.size()));
+    if (it.second) modulePaths.push_back(it.first->first.c_str());
+    return it.first->second;
+  }
+
+  const char *modulePath(unsigned int id) {
+    std::lock_guard<std::mutex> guard(lock);
+    return id < modulePaths.size() ? modulePaths[id] : "";
+  }
+
+private:
+  static constexpr unsigned int kChunkShift = 8;
+  static constexpr unsigned int kChunkSize = 1U << kChunkShift;
+
+  std::mutex lock;
+  std::unordered_map<std::string, unsigned int> files;
+  std::unordered_map<std::string, unsigned int> names;
+  std::unordered_map<std::string, unsigned int> modules;
+  std::vector<const char *> modulePaths;
+
+  // file names by ID, in chunks allocated as they fill
+  const char **fileChunks[(kMaxFiles >> kChunkShift) + 1] = {};
+  unsigned int numFiles = 1;             // under "lock"
+  std::atomic<unsigned int> published{1}; // for the readers without it
 }; // FileDictionary
 
+constexpr unsigned int FileDictionary::kMaxFiles;
+constexpr unsigned int FileDictionary::kChunkShift;
+constexpr unsigned int FileDictionary::kChunkSize;
+
+static FileDictionary fileDictionary ETSAN_EARLY_INIT;
+
 }; // etsan
 #endif // ETSAN_FILEDICTIONARY_H_
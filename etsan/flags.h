@@ -0,0 +1,46 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Runtime options of the race detector. They are read from ETSAN_*
+// environment variables when the runtime starts.
+
+#ifndef ETSAN_FLAGS_H_
+#define ETSAN_FLAGS_H_
+
+#include <stdlib.h>
+
+// Constructs a runtime object before the static constructors of the
+// program and before the module constructors calling __tsan_init, whose
+// priority is 102 (see ThreadSanitizer.cpp). Its destructor runs after
+// theirs: the object stays usable from any of them.
+#define ETSAN_EARLY_INIT __attribute__((init_priority(101)))
+
+namespace etsan {
+
+  // Returns the numeric value of environment variable "name",
+  // or "defaultValue" if it is unset or not a number.
+  unsigned long getFlag(const char *name, unsigned long defaultValue) {
+    const char *value = getenv(name);
+    if (!value || !*value) {
+      return defaultValue;
+    }
+
+    char *end = nullptr;
+    unsigned long number = strtoul(value, &end, 0);
+    if (*end != '\0') {
+      return defaultValue;
+    }
+    return number;
+  }
+
+} // etsan
+#endif // ETSAN_FLAGS_H_
@@ -0,0 +1,202 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Read-only regions: memory written while the program sets up, then only
+// read by all threads, e.g. input tables. Reads of a frozen 64-byte line
+// skip detection with one bit test, instead of growing the read clocks
+// of its variables; the first write to the line thaws it, and it is
+// checked in full from then on.
+//
+// Lines are frozen by __etsan_mark_readonly, and with ETSAN_AUTO_FREEZE=1
+// also by the first checked read of a line no checked write has touched,
+// i.e. none since the first thread was created. That read is checked and
+// recorded. The reads skipped are not: a write racing only with them is
+// missed, so the automatic mode trades such races for speed.
+
+#ifndef ETSAN_FROZEN_H_
+#define ETSAN_FROZEN_H_
+
+#include <sys/mman.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <atomic>
+#include <mutex>
+#include "flags.h"
+
+namespace etsan {
+
+  class FrozenRegions {
+  public:
+    static constexpr unsigned kLineShift = 6;
+    // Memory of one lazily allocated chunk of bits, 4 MiB
+    static constexpr unsigned kChunkShift = 22;
+    static constexpr size_t   kChunkLines =
+        size_t(1) << (kChunkShift - kLineShift);
+    static constexpr unsigned kAddressBits = sizeof(void *) == 4 ? 32 : 47;
+    static constexpr size_t   kDirEntries =
+        size_t(1) << (kAddressBits - kChunkShift);
+
+    FrozenRegions() : automatic(getFlag("ETSAN_AUTO_FREEZE", 0)) {
+      if (automatic) activate();
+    }
+
+    // True once a line may be frozen: before, the accesses skip the bits
+    bool active() const { return dir.load(std::memory_order_acquire); }
+
+    // Freezes the lines wholly within [addr, addr + size)
+    void freeze(const void *addr, size_t size) {
+      uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+      uintptr_t first = (begin + kLineMask) >> kLineShift;
+      uintptr_t end = (begin + size) >> kLineShift;
+      if (begin + size < begin) end = UINTPTR_MAX >> kLineShift;
+      activate();
+      for (uintptr_t line = first; line < end; line++) {
+        Chunk &c = chunk(line);
+        size_t i = line & (kChunkLines - 1);
+        __atomic_fetch_or(&c.frozen[i >> 5], 1U << (i & 31),
+                          __ATOMIC_RELAXED);
+      }
+    }
+
+    // True if the bytes of [addr, addr + size) are frozen
+    bool isFrozen(const void *addr, size_t size) const {
+      uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+      return test(begin >> kLineShift, &Chunk::frozen) &&
+             test((begin + size - 1) >> kLineShift, &Chunk::frozen);
+    }
+
+    // After a checked read: freezes the line if no checked write touched
+    // it, in the automatic mode
+    void read(const void *addr) {
+      if (!automatic) return;
+      uintptr_t line = reinterpret_cast<uintptr_t>(addr) >> kLineShift;
+      if (!test(line, &Chunk::written)) set(line, &Chunk::frozen);
+    }
+
+    // Before a checked write of [addr, addr + size): thaws its lines
+    void write(const void *addr, size_t size) {
+      uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+      uintptr_t last = (begin + (size ? size : 1) - 1) >> kLineShift;
+      for (uintptr_t line = begin >> kLineShift; line <= last; line++) {
+        if (test(line, &Chunk::frozen)) clear(line, &Chunk::frozen);
+        if (automatic && !test(line, &Chunk::written))
+          set(line, &Chunk::written);
+      }
+    }
+
+    // Forgets [addr, addr + size), e.g. a heap block being freed: its
+    // lines are thawed, and those wholly within it count as not written
+    void reset(const void *addr, size_t size) {
+      if (!active()) return;
+      uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+      uintptr_t last = (begin + (size ? size : 1) - 1) >> kLineShift;
+      for (uintptr_t line = begin >> kLineShift; line <= last; line++) {
+        if (!find(line)) {
+          // no bits for this chunk: skip to the next one
+          line |= kChunkLines - 1;
+          continue;
+        }
+        clear(line, &Chunk::frozen);
+        if ((line << kLineShift) >= begin &&
+            ((line + 1) << kLineShift) - 1 <= begin + size - 1)
+          clear(line, &Chunk::written);
+      }
+    }
+
+    void setAutomatic(bool on) {
+      automatic = on;
+      if (on) activate();
+    }
+
+  private:
+    static constexpr uintptr_t kLineMask = (uintptr_t(1) << kLineShift) - 1;
+
+    struct Chunk {
+      uint32_t frozen[kChunkLines / 32];
+      uint32_t written[kChunkLines / 32]; // by checked writes
+    };
+    typedef uint32_t (Chunk::*Bits)[kChunkLines / 32];
+
+    std::atomic<std::atomic<Chunk *> *> dir{nullptr};
+    std::mutex chunksGuard;
+    bool automatic;
+
+    void activate() {
+      std::lock_guard<std::mutex> guard(chunksGuard);
+      if (dir.load(std::memory_order_relaxed)) return;
+      void *mem = mmap(nullptr, kDirEntries * sizeof(std::atomic<Chunk *>),
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      assert(mem != MAP_FAILED);
+      dir.store(static_cast<std::atomic<Chunk *> *>(mem),
+                std::memory_order_release);
+    }
+
+    Chunk *find(uintptr_t line) const {
+      std::atomic<Chunk *> *d = dir.load(std::memory_order_acquire);
+      if (!d) return nullptr;
+      size_t idx = (line >> (kChunkShift - kLineShift)) & (kDirEntries - 1);
+      return d[idx].load(std::memory_order_acquire);
+    }
+
+    // The chunk of "line", allocated on first use. Chunks stay, as other
+    // threads may be testing them.
+    Chunk &chunk(uintptr_t line) {
+      if (Chunk *c = find(line)) return *c;
+      std::lock_guard<std::mutex> guard(chunksGuard);
+      std::atomic<Chunk *> *d = dir.load(std::memory_order_relaxed);
+      size_t idx = (line >> (kChunkShift - kLineShift)) & (kDirEntries - 1);
+      Chunk *c = d[idx].load(std::memory_order_relaxed);
+      if (!c) {
+        c = static_cast<Chunk *>(calloc(1, sizeof(Chunk)));
+        d[idx].store(c, std::memory_order_release);
+      }
+      return *c;
+    }
+
+    bool test(uintptr_t line, Bits bits) const {
+      Chunk *c = find(line);
+      if (!c) return false;
+      size_t i = line & (kChunkLines - 1);
+      return __atomic_load_n(&(c->*bits)[i >> 5], __ATOMIC_RELAXED) >>
+                 (i & 31) & 1;
+    }
+
+    void set(uintptr_t line, Bits bits) {
+      size_t i = line & (kChunkLines - 1);
+      __atomic_fetch_or(&(chunk(line).*bits)[i >> 5], 1U << (i & 31),
+                        __ATOMIC_RELAXED);
+    }
+
+    void clear(uintptr_t line, Bits bits) {
+      Chunk *c = find(line);
+      if (!c) return;
+      size_t i = line & (kChunkLines - 1);
+      __atomic_fetch_and(&(c->*bits)[i >> 5], ~(1U << (i & 31)),
+                         __ATOMIC_RELAXED);
+    }
+  };
+
+  constexpr unsigned FrozenRegions::kLineShift;
+  constexpr unsigned FrozenRegions::kChunkShift;
+  constexpr size_t FrozenRegions::kChunkLines;
+  constexpr unsigned FrozenRegions::kAddressBits;
+  constexpr size_t FrozenRegions::kDirEntries;
+  constexpr uintptr_t FrozenRegions::kLineMask;
+
+  static FrozenRegions frozenRegions ETSAN_EARLY_INIT;
+
+} // etsan
+
+#endif // ETSAN_FROZEN_H_
@@ -0,0 +1,70 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// What the inline access checks of the pass (-embedsan-inline-fast-path)
+// read from the runtime, built with ETSAN_INLINE_FASTPATH.
+//
+// Before an aligned access of at most 4 bytes the pass emits:
+//
+//   if (__etsan_concurrent) {
+//     page = __etsan_shadow_dir[(addr >> kWordShift >> kPageShift) & mask]
+//     slot = page + (addr >> kWordShift) % kPageSlots * kSlotSize
+//     if (!page ||
+//         *(slot + (isWrite ? kOffsetW : kOffsetR)) != *__etsan_thread_epoch)
+//       __tsan_readN / __tsan_writeN (addr, siteId)
+//   }
+//
+// so a same-epoch access, the most common case, costs a few loads and no
+// call. __etsan_concurrent is exported in every mode, see defs.h. The runtime then runs the lock-free same-epoch fast path of
+// ETSAN_LOCKFREE_FASTPATH on the shadow of ETSAN_SHADOW_MEMORY, whose
+// layout the pass hard-codes: keep EmbedSanitizerInline.h in sync with
+// the constants below. Accesses skipped inline are not counted in the
+// statistics, sampled nor traced.
+
+#ifndef ETSAN_INLINE_ABI_H_
+#define ETSAN_INLINE_ABI_H_
+
+#include <stddef.h>
+#include "epoch.h"
+
+#if !defined(ETSAN_SHADOW_MEMORY) || !defined(ETSAN_LOCKFREE_FASTPATH)
+#error "ETSAN_INLINE_FASTPATH needs ETSAN_SHADOW_MEMORY and ETSAN_LOCKFREE_FASTPATH"
+#endif
+#ifdef ETSAN_EPOCH64
+#error "ETSAN_INLINE_FASTPATH needs 32-bit epochs"
+#endif
+#if defined(ETSAN_GRANULARITY) && ETSAN_GRANULARITY != 4
+#error "ETSAN_INLINE_FASTPATH checks words, use ETSAN_GRANULARITY=4"
+#endif
+
+namespace etsan {
+
+  constexpr size_t kInlineOffsetW  = 0;
+  constexpr size_t kInlineOffsetR  = 4;
+  // W, R, the read clock pointer, Racy and Lock, padded to a pointer
+  constexpr size_t kInlineSlotSize = sizeof(void *) == 4 ? 16 : 24;
+
+} // etsan
+
+extern "C" {
+
+  // Directory of the shadow pages of the variable states
+  const void *__etsan_shadow_dir = nullptr;
+
+  // Epoch of the calling thread, once it has called into the runtime.
+  // Before, one no slot holds: tid 255 is never given (see getState).
+  const etsan::Epochs::Type __etsan_no_epoch = -1;
+  __thread const etsan::Epochs::Type *__etsan_thread_epoch = &__etsan_no_epoch;
+
+}
+
+#endif // ETSAN_INLINE_ABI_H_
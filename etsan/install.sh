@@ -8,13 +8,16 @@
 #
 #
 # This script builds and installs the EmbedSanitizer race detection runtime
-# for 32-bit ARM
+# for 32-bit ARM: the Release, RelWithDebInfo and LTO variants of
+# CMakeLists.txt in this directory
 #
 #########################################################################
 
 # Variables
-DEST=${HOME}/.embedsanitizer/lib/clang/4.0.1/lib/linux/
-tSanLib=libclang_rt.tsan_cxx-arm
+PREFIX=${HOME}/.embedsanitizer
+# Extra runtime build options, e.g. ETSAN_CXXFLAGS="-DETSAN_SHADOW_MEMORY"
+EXTRA_FLAGS=${ETSAN_CXXFLAGS}
+BUILD=build-arm
 
 # Function to Check if a prior command was successful
 checkIfActionOK() {
@@ -24,31 +27,14 @@ checkIfActionOK() {
   fi
 }
 
-# Compile and build static library
-arm-linux-gnueabi-g++ -c  tsan_interface.cc -o ${tSanLib}.o   \
-  -static -std=c++11 -pthread -fpermissive
+# Configure for the cross compilers, then build and install the libraries
+cmake -S . -B ${BUILD} -DCMAKE_TOOLCHAIN_FILE=arm-linux-gnueabi.cmake \
+  -DCMAKE_INSTALL_PREFIX=${PREFIX} -DETSAN_RUNTIME_FLAGS="${EXTRA_FLAGS}"
 checkIfActionOK
 
-#arm-linux-gnueabi-g++ -c tsan_fasttrack.cpp -o ${tSanLib}.o -static
-#../bin/bin/clang++ -c tsan_fasttrack.cpp -o ${tSanLib}.o -static  \
-#  -I/usr/arm-linux-gnueabi/include/c++/5/arm-linux-gnueabi  \
-#  -I/usr/arm-linux-gnueabi/include
-# Generate etsan as static library
-arm-linux-gnueabi-ar rcs ${tSanLib}.a ${tSanLib}.o
-checkIfActionOK
-
-# Dummy C library
-tSanLibc=libclang_rt.tsan-arm
-arm-linux-gnueabi-gcc -c  dummy.c -o ${tSanLibc}.o
-arm-linux-gnueabi-ar rcs ${tSanLibc}.a ${tSanLibc}.o
-checkIfActionOK
-
-# Copy library to destination
-mkdir -p $DEST
-mv ${tSanLib}.a $DEST
-mv ${tSanLibc}.a $DEST
+cmake --build ${BUILD} --target install -j"$(nproc)"
 checkIfActionOK
 
 # Finalize: remove temporary files
-rm -rf *.o *.a
+rm -rf ${BUILD}
 echo -e "\033[1;32m etsan runtime library successful installed.\033[m"
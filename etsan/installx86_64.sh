@@ -12,30 +12,19 @@
 #########################################################################
 
 # Variables
-DEST=../x86_64/lib/clang/5.0.0/lib/linux/
-tSanLib=libclang_rt.tsan_cxx-x86_64
+PREFIX=../x86_64
+# Extra runtime build options, e.g. ETSAN_CXXFLAGS="-DETSAN_SHADOW_MEMORY"
+EXTRA_FLAGS=${ETSAN_CXXFLAGS}
+BUILD=build-x86_64
 
-# Compile and build static library
-g++ -c  tsan_interface.cc -o ${tSanLib}.o -static -std=c++11 -pthread -fpermissive
-#arm-linux-gnueabi-g++ -c tsan_fasttrack.cpp -o ${tSanLib}.o -static
-#../bin/bin/clang++ -c tsan_fasttrack.cpp -o ${tSanLib}.o -static   \
-# -I/usr/arm-linux-gnueabi/include/c++/5/arm-linux-gnueabi  \
-# -I/usr/arm-linux-gnueabi/include
-ar rcs ${tSanLib}.a ${tSanLib}.o
-
-# Dummy C library
-tSanLibc=libclang_rt.tsan-x86_64
-gcc -c  dummy.c -o ${tSanLibc}.o
-ar rcs ${tSanLibc}.a ${tSanLibc}.o
-
-
-# Copy library to destination
-mkdir -p $DEST
-mv ${tSanLib}.a $DEST
-mv ${tSanLibc}.a $DEST
+# Build and install the libraries, see CMakeLists.txt
+cmake -S . -B ${BUILD} -DCMAKE_INSTALL_PREFIX=${PREFIX} \
+  -DETSAN_INSTALL_DIR=lib/clang/5.0.0/lib/linux \
+  -DETSAN_RUNTIME_FLAGS="${EXTRA_FLAGS}" &&
+  cmake --build ${BUILD} --target install -j"$(nproc)"
 
 # Check if everything is OK
 if [ $? -eq 0 ]; then
-    rm -rf *.o *.a
+    rm -rf ${BUILD}
     echo " tsan lib successful installed"
 fi
@@ -0,0 +1,198 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Live statistics of a running program, for processes that never reach
+// the exit statistics. With ETSAN_LIVE_STATS=<file>, e.g. /dev/shm/etsan,
+// a runtime thread maps the file as one shared page and rewrites it every
+// ETSAN_LIVE_STATS_MS milliseconds (default 1000) with the totals of the
+// counters; tools/etsan_top.cpp maps it read-only and derives the rates.
+// The instrumented threads are not involved: they only count into their
+// own ThreadStats, as without the page.
+//
+// The page is a seqlock: "seq" is odd while it is rewritten, and readers
+// retry until they copied it between two equal even values.
+
+#ifndef ETSAN_LIVE_STATS_H_
+#define ETSAN_LIVE_STATS_H_
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "flags.h"
+
+namespace etsan {
+
+  static const uint32_t kLiveStatsMagic = 0x4c535445; // "ETSL"
+  static const uint32_t kLiveStatsVersion = 1;
+
+  // Layout of the page, shared by the runtime and the readers of the same
+  // machine. Counters are totals since the start of the program.
+  struct LiveStatsPage {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;             // odd while being updated
+    uint32_t pid;
+    uint64_t timeNs;          // CLOCK_MONOTONIC of the last update
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t sameEpoch;       // reads and writes on the fast path
+    uint64_t metadataBytes;
+    uint64_t threads;         // not joined yet
+    uint64_t threadsCreated;
+    uint64_t locks;
+    uint64_t races;           // reported
+    uint64_t evictions;       // see ETSAN_MAX_METADATA_MB
+  };
+
+  // Copies the counters of "page" into "snapshot", consistently. Returns
+  // false if the page is not one of this version, or is being rewritten
+  // for too long.
+  bool readLiveStats(const LiveStatsPage *page, LiveStatsPage &snapshot) {
+    for (int attempt = 0; attempt < 1000; attempt++) {
+      uint32_t before = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+      if (before & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      memcpy(&snapshot, page, sizeof(snapshot));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == before) {
+        return snapshot.magic == kLiveStatsMagic &&
+               snapshot.version == kLiveStatsVersion;
+      }
+    }
+    return false;
+  }
+
+  // Maps the page published at "path" read-only, or returns nullptr
+  const LiveStatsPage *mapLiveStats(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+    void *mem = mmap(nullptr, sizeof(LiveStatsPage), PROT_READ, MAP_SHARED,
+                     fd, 0);
+    close(fd);
+    return mem == MAP_FAILED ? nullptr
+                             : static_cast<const LiveStatsPage *>(mem);
+  }
+
+  // Publisher of the page. "collect" fills in the counters, and runs on
+  // the publisher thread.
+  class LiveStats {
+  public:
+    typedef void (*Collector)(LiveStatsPage &counters);
+
+    ~LiveStats() { stop(); }
+
+    // Maps "path" and publishes into it every "intervalMs" milliseconds.
+    // Returns false if the file cannot be mapped.
+    bool start(const char *path, unsigned long intervalMs,
+               Collector collector) {
+      int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) return false;
+      void *mem = MAP_FAILED;
+      if (ftruncate(fd, sizeof(LiveStatsPage)) == 0) {
+        mem = mmap(nullptr, sizeof(LiveStatsPage), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+      }
+      close(fd);
+      if (mem == MAP_FAILED) {
+        unlink(path);
+        return false;
+      }
+
+      file = path;
+      page = static_cast<LiveStatsPage *>(mem);
+      collect = collector;
+      interval = intervalMs ? intervalMs : 1;
+      page->magic = kLiveStatsMagic;
+      page->version = kLiveStatsVersion;
+      page->pid = getpid();
+      publish();
+      thread = std::thread([this] { run(); });
+      return true;
+    }
+
+    // Rewrites the page with the current counters
+    void publish() {
+      LiveStatsPage counters = LiveStatsPage();
+      collect(counters);
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+
+      uint32_t seq = page->seq;
+      __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      page->timeNs = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+      page->reads = counters.reads;
+      page->writes = counters.writes;
+      page->sameEpoch = counters.sameEpoch;
+      page->metadataBytes = counters.metadataBytes;
+      page->threads = counters.threads;
+      page->threadsCreated = counters.threadsCreated;
+      page->locks = counters.locks;
+      page->races = counters.races;
+      page->evictions = counters.evictions;
+      __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+    }
+
+    // Publishes a last time, ends the thread and removes the page
+    void stop() {
+      if (!thread.joinable()) return;
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+      }
+      wakeup.notify_one();
+      thread.join();
+      publish();
+      munmap(page, sizeof(LiveStatsPage));
+      unlink(file.c_str());
+      page = nullptr;
+    }
+
+    const LiveStatsPage *published() const { return page; }
+
+  private:
+    void run() {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!wakeup.wait_for(lock, std::chrono::milliseconds(interval),
+                              [this] { return stopping; })) {
+        lock.unlock();
+        publish();
+        lock.lock();
+      }
+    }
+
+    std::string file;
+    LiveStatsPage *page = nullptr;
+    Collector collect = nullptr;
+    unsigned long interval = 1000;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+  };
+
+  static LiveStats liveStats ETSAN_EARLY_INIT;
+
+} // etsan
+
+#endif // ETSAN_LIVE_STATS_H_
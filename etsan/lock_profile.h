@@ -0,0 +1,179 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Contention profile of the runtime's own global locks (ETSAN_LOCK_PROFILE).
+//
+// The global locks of the metadata, VS.mGuard, TS.mGuard, LS.mGuard and
+// BS.mGuard, and racePrintLock are RuntimeMutexes: std::mutex, or with
+// ETSAN_LOCK_PROFILE a ProfiledMutex, which counts its acquisitions, the
+// ones that had to wait and for how long, and a histogram of how long it
+// was held. printLockProfile lists them at the end of main, to tell which
+// lock of the runtime limits the scaling of a program.
+
+#ifndef ETSAN_LOCK_PROFILE_H_
+#define ETSAN_LOCK_PROFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+
+namespace etsan {
+
+#ifdef ETSAN_LOCK_PROFILE
+  // Counts of the locks of one name. Updated by the holder of the lock.
+  struct LockProfile {
+    // Hold times below 64ns, below 128ns, ... and of 2^19ns (524us) or more
+    static constexpr unsigned int kBuckets = 15;
+    static constexpr unsigned int kFirstBucketShift = 6;
+
+    const char *  name;
+    unsigned long acquired;
+    unsigned long contended; // acquisitions which had to wait
+    uint64_t      waitNs;
+    uint64_t      holdNs;
+    uint64_t      maxHoldNs;
+    unsigned long holds[kBuckets];
+
+    void addHold(uint64_t ns) {
+      holdNs += ns;
+      if (ns > maxHoldNs) maxHoldNs = ns;
+      unsigned int bucket = 0;
+      while (bucket + 1 < kBuckets && ns >> (kFirstBucketShift + bucket))
+        bucket++;
+      holds[bucket]++;
+    }
+  };
+
+  constexpr unsigned int LockProfile::kBuckets;
+  constexpr unsigned int LockProfile::kFirstBucketShift;
+
+  // Profiles by lock name, in static storage so that they outlive the locks
+  static constexpr unsigned int kMaxLockProfiles = 16;
+  static LockProfile lockProfiles[kMaxLockProfiles];
+  static std::atomic<unsigned int> numLockProfiles{0};
+  static std::atomic_flag lockProfilesGuard = ATOMIC_FLAG_INIT;
+
+  // Returns the profile of the locks named "name", nullptr when full
+  LockProfile *lockProfileOf(const char *name) {
+    while (lockProfilesGuard.test_and_set(std::memory_order_acquire)) {}
+    LockProfile *profile = nullptr;
+    unsigned int n = numLockProfiles.load(std::memory_order_relaxed);
+    for (unsigned int i = 0; i < n && !profile; i++)
+      if (!strcmp(lockProfiles[i].name, name)) profile = &lockProfiles[i];
+    if (!profile && n < kMaxLockProfiles) {
+      profile = &lockProfiles[n];
+      profile->name = name;
+      numLockProfiles.store(n + 1, std::memory_order_release);
+    }
+    lockProfilesGuard.clear(std::memory_order_release);
+    return profile;
+  }
+
+  inline uint64_t lockProfileNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+  }
+
+  // A std::mutex which profiles its use under "name". Locks of the same
+  // name share a profile, looked up at the first acquisition, so that
+  // the lock is constant-initialized as std::mutex is.
+  class ProfiledMutex {
+  public:
+    constexpr explicit ProfiledMutex(const char *name)
+        : name(name), profile(nullptr), lockedAt(0) {}
+
+    void lock() {
+      uint64_t start = 0;
+      bool waited = !mutex.try_lock();
+      if (waited) {
+        start = lockProfileNow();
+        mutex.lock();
+      }
+      lockedAt = lockProfileNow();
+      if (!counted()) return;
+      profile->acquired++;
+      if (waited) {
+        profile->contended++;
+        profile->waitNs += lockedAt - start;
+      }
+    }
+
+    bool try_lock() {
+      if (!mutex.try_lock()) return false;
+      lockedAt = lockProfileNow();
+      if (counted()) profile->acquired++;
+      return true;
+    }
+
+    void unlock() {
+      if (profile) profile->addHold(lockProfileNow() - lockedAt);
+      mutex.unlock();
+    }
+
+  private:
+    // Called by the holder
+    bool counted() {
+      if (!profile) profile = lockProfileOf(name);
+      return profile;
+    }
+
+    std::mutex    mutex;
+    const char *  name;
+    LockProfile * profile;
+    uint64_t      lockedAt; // by the holder
+  };
+
+  typedef ProfiledMutex RuntimeMutex;
+
+#define ETSAN_RUNTIME_MUTEX(member, name) etsan::ProfiledMutex member{name}
+
+  // Prints the profile of each runtime lock used. The counts of locks
+  // held meanwhile may be torn.
+  void printLockProfile(FILE *out = stdout) {
+    unsigned int n = numLockProfiles.load(std::memory_order_acquire);
+    fprintf(out, "Lock profile:\n");
+    fprintf(out, "%-14s %12s %12s %7s %12s %12s %12s\n", "lock", "acquired",
+            "contended", "share", "wait ms", "hold ms", "max hold us");
+    for (unsigned int i = 0; i < n; i++) {
+      const LockProfile & p = lockProfiles[i];
+      if (!p.acquired) continue;
+      fprintf(out, "%-14s %12lu %12lu %6.1f%% %12.3f %12.3f %12.1f\n",
+              p.name, p.acquired, p.contended,
+              100.0 * p.contended / p.acquired, p.waitNs / 1e6,
+              p.holdNs / 1e6, p.maxHoldNs / 1e3);
+      fprintf(out, "%-14s", "  held");
+      for (unsigned int b = 0; b < LockProfile::kBuckets; b++) {
+        if (!p.holds[b]) continue;
+        unsigned long bound = 1UL << (LockProfile::kFirstBucketShift + b);
+        const char *op = b + 1 < LockProfile::kBuckets ? "<" : ">=";
+        if (b + 1 == LockProfile::kBuckets) bound >>= 1;
+        if (bound < 1000)
+          fprintf(out, " %s%luns:%lu", op, bound, p.holds[b]);
+        else
+          fprintf(out, " %s%luus:%lu", op, bound / 1000, p.holds[b]);
+      }
+      fprintf(out, "\n");
+    }
+  }
+#else
+  typedef std::mutex RuntimeMutex;
+
+#define ETSAN_RUNTIME_MUTEX(member, name) std::mutex member
+#endif
+
+} // etsan
+
+#endif // ETSAN_LOCK_PROFILE_H_
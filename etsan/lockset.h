@@ -0,0 +1,57 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Lockset pre-filter of the access checks (ETSAN_LOCKSET), in the style of
+// Eraser and RaceTrack.
+//
+// The first 32 locks the program takes each get a bit; later ones get
+// none. Each thread keeps the bits of the locks it holds exclusively:
+// mutexes and rwlocks held for writing, not for reading. Each variable
+// keeps the bits of the locks some access to it did not hold, the
+// complement of its candidate lockset, so that its zero-filled state
+// starts with all locks.
+//
+// While a lock is left in the candidate set, every access to the variable
+// so far held it, so each happens before the next one through that lock's
+// release and acquire. Thanks to that order there is no race to look for.
+// Recording the access as the one which dominates all earlier ones, x.W or
+// x.R without a read clock, suffices (see ft_read). Once the set is empty
+// the variable is checked by FastTrack from then on, against those
+// records. A recursive lock is dropped at its first unlock, which can only
+// empty the set early.
+
+#ifndef ETSAN_LOCKSET_H_
+#define ETSAN_LOCKSET_H_
+
+#include <stdint.h>
+#include <atomic>
+
+namespace etsan {
+
+  typedef uint32_t Lockset;
+
+  constexpr Lockset kAllLocks = ~Lockset(0);
+  constexpr unsigned int kLocksetBits = 32;
+
+  // Bit of a new lock, 0 once all are given: such a lock never guards
+  Lockset newLockBit() {
+    static std::atomic<unsigned int> next{0};
+    unsigned int bit = next.load(std::memory_order_relaxed);
+    while (bit < kLocksetBits &&
+           !next.compare_exchange_weak(bit, bit + 1,
+                                       std::memory_order_relaxed)) {}
+    return bit < kLocksetBits ? Lockset(1) << bit : 0;
+  }
+
+} // etsan
+
+#endif // ETSAN_LOCKSET_H_
@@ -0,0 +1,87 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Bounded lock-free queue of many producers and one consumer.
+//
+// Each cell carries a sequence number telling whose turn it is: a
+// producer claims the cell at the tail with one compare-and-swap, fills
+// it and publishes it by bumping the sequence; the consumer reads cells
+// in order. Pushes fail instead of waiting when the queue is full.
+
+#ifndef ETSAN_MPSC_QUEUE_H_
+#define ETSAN_MPSC_QUEUE_H_
+
+#include <atomic>
+
+namespace etsan {
+
+  // Queue of N (a power of two) elements of trivially copyable type T
+  template <typename T, unsigned N>
+  class MPSCQueue {
+    static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+
+  public:
+    MPSCQueue() {
+      for (unsigned i = 0; i < N; i++) {
+        cells[i].seq.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    // Copies "value" into the queue. Returns false if the queue is full.
+    bool push(const T &value) {
+      unsigned pos = tail.load(std::memory_order_relaxed);
+      for (;;) {
+        Cell &cell = cells[pos & (N - 1)];
+        unsigned seq = cell.seq.load(std::memory_order_acquire);
+        int diff = int(seq - pos);
+        if (diff == 0) {
+          if (tail.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+            cell.value = value;
+            cell.seq.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false; // the consumer has not freed the cell yet
+        } else {
+          pos = tail.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // Moves the oldest element into "value". Returns false if there is
+    // none. Called by the consumer only.
+    bool pop(T &value) {
+      Cell &cell = cells[head & (N - 1)];
+      unsigned seq = cell.seq.load(std::memory_order_acquire);
+      if (int(seq - (head + 1)) < 0) return false;
+
+      value = cell.value;
+      cell.seq.store(head + N, std::memory_order_release); // free the cell
+      head++;
+      return true;
+    }
+
+  private:
+    struct Cell {
+      std::atomic<unsigned> seq;
+      T                     value;
+    };
+
+    Cell                  cells[N];
+    std::atomic<unsigned> tail{0};
+    unsigned              head = 0; // owned by the consumer
+  };
+
+} // etsan
+
+#endif // ETSAN_MPSC_QUEUE_H_
@@ -0,0 +1,120 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Backing of the large metadata mappings, shadow pages and arena chunks,
+// for hosts where TLB misses and remote memory show in the overhead.
+//
+// ETSAN_HUGE_PAGES=1 asks for transparent huge pages (madvise), 2 maps
+// from the MAP_HUGETLB pool, falling back to 1 when the pool is empty.
+// Mappings of at least a huge page are then rounded up to whole huge
+// pages, and aligned to them. ETSAN_NUMA=1 binds each arena chunk to the
+// node of the thread that carves it, see MetadataArena. Both default to
+// 0, and are no-ops where Linux lacks them.
+
+#ifndef ETSAN_PAGE_BACKING_H_
+#define ETSAN_PAGE_BACKING_H_
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "flags.h"
+
+namespace etsan {
+
+  enum HugePages { HugePagesOff, HugePagesTransparent, HugePagesHugetlb };
+
+  constexpr size_t kHugePageSize = size_t(2) << 20;
+
+  // Most NUMA nodes the arena keeps a chunk for
+  constexpr unsigned kMaxNumaNodes = 8;
+
+  // ETSAN_HUGE_PAGES, read at the first mapping
+  unsigned hugePages() {
+    static const unsigned mode = getFlag("ETSAN_HUGE_PAGES", HugePagesOff);
+    return mode;
+  }
+
+  bool numaAware() {
+    static const bool on = getFlag("ETSAN_NUMA", 0) != 0;
+    return on;
+  }
+
+  // Length of the mapping of "size" bytes: whole huge pages when they
+  // are asked for and the mapping is large enough
+  size_t mappingSize(size_t size) {
+    if (hugePages() == HugePagesOff || size < kHugePageSize) return size;
+    return (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  }
+
+  // Maps "size" bytes of zeroed metadata, or returns MAP_FAILED. Unmap
+  // them with unmapPages and the same size.
+  void *mapPages(size_t size) {
+    size_t length = mappingSize(size);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (length == size || hugePages() == HugePagesOff) {
+      return mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    }
+
+#ifdef MAP_HUGETLB
+    if (hugePages() == HugePagesHugetlb) {
+      void *mem = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       flags | MAP_HUGETLB, -1, 0);
+      if (mem != MAP_FAILED) return mem;
+    }
+#endif
+
+    // aligned to a huge page, so that the kernel can back it with them
+    void *mem = mmap(nullptr, length + kHugePageSize, PROT_READ | PROT_WRITE,
+                     flags, -1, 0);
+    if (mem == MAP_FAILED) return mem;
+    uintptr_t begin = reinterpret_cast<uintptr_t>(mem);
+    uintptr_t aligned = (begin + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    if (aligned > begin) munmap(mem, aligned - begin);
+    munmap(reinterpret_cast<void *>(aligned + length),
+           begin + kHugePageSize - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void *>(aligned), length, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<void *>(aligned);
+  }
+
+  void unmapPages(void *p, size_t size) {
+    munmap(p, mappingSize(size));
+  }
+
+  // NUMA node of the calling thread, 0 if unknown
+  unsigned currentNumaNode() {
+#ifdef SYS_getcpu
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 &&
+        node < kMaxNumaNodes)
+      return node;
+#endif
+    return 0;
+  }
+
+  // Prefers node "node" for the pages of [p, p + size), as they are
+  // first touched
+  void preferNumaNode(void *p, size_t size, unsigned node) {
+#ifdef SYS_mbind
+    const int kMpolPreferred = 1; // MPOL_PREFERRED of linux/mempolicy.h
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, p, mappingSize(size), kMpolPreferred, &mask,
+            sizeof(mask) * 8, 0);
+#endif
+  }
+
+} // etsan
+
+#endif // ETSAN_PAGE_BACKING_H_
@@ -15,45 +15,75 @@
 #ifndef ETSAN_RACE_H_
 #define ETSAN_RACE_H_
 
-// This class saves information of race reported by the tool
+#include <sstream>
+#include <string>
+#include "file_dictionary.h"
+#include "sites.h"
+
+// This class saves information of race reported by the tool. A plain
+// record, cheap to copy and compare: the names are interned in the
+// FileDictionary, or static ones of the site tables, and the call stack
+// belongs to the caller until the race is printed.
 class Race {
 
 public:
   unsigned int          tid;
-  int                   lineNo;
-  std::string           accessType;
-  std::string           objName;
-  std::string           fileName;
-  std::vector<char *>   trace;
+  const char           *objName;
+  const char           *fileName;
+  char * const         *trace;     // call stack, outermost first
+  unsigned int          numFrames;
+
+  // Identity of the race: where and how the location was accessed. The
+  // file index of "loc" is the FileDictionary ID of the file.
+  etsan::SiteLoc        loc;
+  bool                  isWrite;
 
   // if true don't construct the string for printing
   bool                  isMessageCreated;
 
   Race(unsigned int _tid,
        int _lineNo,
-       std::string _accessType,
-       char *_objName,
-       char *_fileName) {
+       const char *_accessType,
+       const char *_objName,
+       const char *_fileName) {
+
+    unsigned int file = etsan::fileDictionary.internFile(_fileName);
 
     tid = _tid;
-    lineNo = _lineNo;
-    accessType = _accessType;
-    objName = _objName;
-    fileName = _fileName;
+    objName = etsan::fileDictionary.internName(_objName);
+    fileName = file ? etsan::fileDictionary.fileName(file)
+                    : etsan::fileDictionary.internName(_fileName);
+    trace = nullptr;
+    numFrames = 0;
+
+    loc = etsan::makeSiteLoc(file, _lineNo, 0);
+    isWrite = std::string(_accessType) == "write";
 
     isMessageCreated = false;
   }
 
+  // Race at a resolved access site, see sites.h. Sites of the host tools
+  // have no file index yet, and their names are interned.
+  Race(unsigned int _tid, const etsan::Site &site, bool _isWrite) {
+    if (etsan::siteFile(site.loc)) {
+      tid = _tid;
+      objName = site.objName;
+      fileName = site.fileName;
+      trace = nullptr;
+      numFrames = 0;
+      loc = site.loc;
+      isWrite = _isWrite;
+      isMessageCreated = false;
+    } else {
+      *this = Race(_tid, site.line(), _isWrite ? "write" : "read",
+                   site.objName, site.fileName);
+      loc |= etsan::makeSiteLoc(0, 0, site.column());
+    }
+  }
 
-// bool operator==(Race &rhs) {
-//   if(lineNo != rhs.lineNo)
-//     return false;
-//   if(accessType != rhs.accessType)
-//     return false;
-//   if(fileName != rhs.fileName)
-//     return false;
-//   return true;
-// }
+  unsigned int line() const { return etsan::siteLine(loc); }
+  unsigned int column() const { return etsan::siteColumn(loc); }
+  const char *accessType() const { return isWrite ? "write" : "read"; }
 
   // Prints the call stack of a thread when a race is found
   std::string printStack() const {
@@ -61,10 +91,10 @@ public:
     std::stringstream ss;
 
     int depth = 1;
-    for (char * func : trace) {
+    for (unsigned int i = 0; i < numFrames; i++) {
       std::string msg(depth, ' ');
       depth += 4;
-      ss << msg << " '--->" << func << "(...)" << std::endl;
+      ss << msg << " '--->" << trace[i] << "(...)" << std::endl;
     }
 
     return ss.str();
@@ -82,9 +112,13 @@ public:
     ss << "=============================================\n"  ;
     ss << "\033[1;32mEMBEDSANITIZER Race report\033[m\n"     ;
     ss << "\033[1;31m A race detected at: " << fileName << "\033[m\n";
-    ss << "  At line number: "     << lineNo        << "\n"  ;
+    if (line()) {                        // 0: no source line
+      ss << "  At line number: "   << line()                 ;
+      if (column()) ss << ", column " << column()            ;
+      ss << "\n"                                             ;
+    }
     ss << "  Thread (tid=" << tid << ") "                    ;
-    ss <<    accessType << " \"" << objName  << "\"     \n"  ;
+    ss <<    accessType() << " \"" << objName  << "\"     \n"  ;
     ss << "                                             \n"  ;
     ss << "\033[1;33m Call stack:   \033[m              \n"  ;
     ss << printStack();
@@ -95,23 +129,15 @@ public:
   }
 };
 
-// Comparison functor for comparing between two race reports
+// Comparison functor for comparing between two race reports: integer
+// compares only, as file names are interned.
 struct race_compare {
   bool operator() (const Race& lhs, const Race& rhs) const {
 
-    if (lhs.fileName == rhs.fileName) {
-      if (lhs.lineNo < rhs.lineNo) {
-        return -1;
-      } else if (lhs.lineNo > rhs.lineNo) {
-        return 1;
-      } else if (lhs.accessType == rhs.accessType) {
-        return 0;
-      } else {
-        return -1;
-      }
+    if (lhs.loc != rhs.loc) {
+      return lhs.loc < rhs.loc;
     }
-
-    return lhs.fileName < rhs.fileName;
+    return lhs.isWrite < rhs.isWrite;
   }
 };
 
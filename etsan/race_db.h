@@ -0,0 +1,186 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Database of the races known from earlier runs (ETSAN_RACE_DB), so that
+// soak runs report only new races.
+//
+// The file holds a 64-bit key per race: a hash of the file name, line,
+// column and variable name of its site, and of its access type. Site IDs
+// change from run to run, their locations do not. The file is mapped at
+// the first use and its keys loaded; as a module registers its sites,
+// those of known races join the suppressed sites (suppressions.h), so
+// their accesses are no longer checked and their races neither found nor
+// formatted. At the end of main the keys of the new races are appended
+// with one write(2), so runs sharing the file only add to it.
+//
+//   file  := "ETRD" version:u8 pad:u8[3] key:u64*   (in target byte order)
+
+#ifndef ETSAN_RACE_DB_H_
+#define ETSAN_RACE_DB_H_
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "sites.h"
+#include "suppressions.h"
+
+namespace etsan {
+
+  constexpr char    kRaceDbMagic[4] = {'E', 'T', 'R', 'D'};
+  constexpr uint8_t kRaceDbVersion  = 1;
+  constexpr size_t  kRaceDbHeader   = 8;
+
+  // Key of the races of type "isWrite" at a site, FNV-1a of its location
+  uint64_t raceKey(const char *fileName, unsigned int line,
+                   unsigned int column, const char *objName, bool isWrite) {
+    uint64_t h = 14695981039346656037ULL;
+    auto add = [&h](unsigned char c) { h = (h ^ c) * 1099511628211ULL; };
+    for (const char *c = fileName ? fileName : ""; *c; c++) add(*c);
+    add(0);
+    for (unsigned int i = 0; i < 4; i++) add(line >> (8 * i));
+    for (unsigned int i = 0; i < 2; i++) add(column >> (8 * i));
+    for (const char *c = objName ? objName : ""; *c; c++) add(*c);
+    add(0);
+    add(isWrite);
+    return h;
+  }
+
+  class RaceDb {
+  public:
+    // The database of file "path", or none if "path" is null or empty
+    explicit RaceDb(const char *path) : path(path ? path : "") {}
+
+    bool enabled() const { return !path.empty(); }
+
+    // Loads the keys of the file; returns false if it cannot be read or
+    // is none. A missing file is an empty database.
+    bool load() {
+      std::lock_guard<std::mutex> guard(lock);
+      if (path.empty()) return false;
+      int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) return errno == ENOENT;
+      struct stat st;
+      bool ok = fstat(fd, &st) == 0;
+      size_t size = ok ? st.st_size : 0;
+      if (ok && size) {
+        void *mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = mem != MAP_FAILED;
+        if (ok) {
+          const char *data = static_cast<const char *>(mem);
+          ok = size >= kRaceDbHeader &&
+               !memcmp(data, kRaceDbMagic, sizeof(kRaceDbMagic)) &&
+               data[4] == kRaceDbVersion;
+          for (size_t p = kRaceDbHeader; ok && p + 8 <= size; p += 8) {
+            uint64_t key;
+            memcpy(&key, data + p, sizeof(key));
+            known.insert(key);
+          }
+          munmap(mem, size);
+        }
+      }
+      close(fd);
+      return ok;
+    }
+
+    // True if the race of key "key" was found before this run
+    bool isKnown(uint64_t key) {
+      ensureLoaded();
+      std::lock_guard<std::mutex> guard(lock);
+      return known.count(key);
+    }
+
+    // Records a race found in this run, appended by save()
+    void add(uint64_t key) {
+      ensureLoaded();
+      std::lock_guard<std::mutex> guard(lock);
+      if (known.insert(key).second) added.push_back(key);
+    }
+
+    unsigned int numKnown() {
+      ensureLoaded();
+      std::lock_guard<std::mutex> guard(lock);
+      return known.size() - added.size();
+    }
+
+    // Suppresses the sites of the known races among the "count" sites
+    // from ID "base" on, just registered. Returns their number.
+    unsigned int suppressKnownSites(unsigned int base, unsigned int count) {
+      ensureLoaded();
+      std::lock_guard<std::mutex> guard(lock);
+      if (known.empty()) return 0;
+      return suppressSitesIf(base, count, [this](const Site &site) {
+        return known.count(raceKey(site.fileName, site.line(), site.column(),
+                                   site.objName, false)) ||
+               known.count(raceKey(site.fileName, site.line(), site.column(),
+                                   site.objName, true));
+      });
+    }
+
+    // Appends the races added since the last call to the file. Returns
+    // false if it cannot be written.
+    bool save() {
+      std::lock_guard<std::mutex> guard(lock);
+      if (path.empty() || added.empty()) return true;
+      int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                    0644);
+      if (fd < 0) return false;
+      std::string out;
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        out.append(kRaceDbMagic, sizeof(kRaceDbMagic));
+        out.append(1, char(kRaceDbVersion));
+        out.append(kRaceDbHeader - sizeof(kRaceDbMagic) - 1, '\0');
+      }
+      out.append(reinterpret_cast<const char *>(added.data()),
+                 added.size() * sizeof(uint64_t));
+      bool ok = write(fd, out.data(), out.size()) == (ssize_t)out.size();
+      close(fd);
+      if (ok) added.clear();
+      return ok;
+    }
+
+  private:
+    void ensureLoaded() {
+      std::call_once(loadOnce, [this] {
+        if (enabled() && !load())
+          fprintf(stderr, "EmbedSanitizer: cannot read race database %s\n",
+                  path.c_str());
+      });
+    }
+
+    std::string path;
+    std::mutex lock;
+    std::once_flag loadOnce;
+    std::unordered_set<uint64_t> known; // with those added
+    std::vector<uint64_t> added;
+  };
+
+  // The database of ETSAN_RACE_DB, if set. Never destroyed, as the
+  // reporter thread may still print races at exit.
+  RaceDb & raceDb() {
+    static RaceDb *db = new RaceDb(getenv("ETSAN_RACE_DB"));
+    return *db;
+  }
+
+} // etsan
+
+#endif // ETSAN_RACE_DB_H_
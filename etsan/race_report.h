@@ -23,91 +23,69 @@
 #include <thread>
 #include <unordered_map>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <set>
+#include "arena.h"
 #include "race.h"
+#include "binary_report.h"
 #include "file_dictionary.h"
+#include "flags.h"
+#include "lock_profile.h"
+#include "mpsc_queue.h"
+#include "race_db.h"
+#include "shadow_stack.h"
+#include "sites.h"
+#include "suppressions.h"
+#include "trace.h"
+#ifdef ETSAN_UNWIND_STACKS
+#include "unwind.h"
+#endif
 
 // Namespace which contains utility functions for manipulating data
 // race reporting metadata.
 namespace etsan
 {
 
-  static std::mutex racePrintLock;
-
-  static std::mutex stackFrameLock;
-
-  // Temporary location for Race reporting metadata:
-  static std::unordered_map<unsigned int, std::vector<char *>> callStack;
-
-  // Keeps list of races
-  static std::set<Race, race_compare> races;
-
-  // for printing all races in the list "races"
-  void printRaces()
-  {
-    std::string msg;
-    for (auto &race : races)
-    {
-      race.createRaceMessage(msg);
-    }
+  static ETSAN_RUNTIME_MUTEX(racePrintLock, "racePrintLock");
 
-    racePrintLock.lock();
-    printf("EmbedSanitizer: races: %s\n", msg.c_str());// print to standard output
-    racePrintLock.unlock();
-  }
+  // Keeps list of races, owned by the reporter thread
+  static std::set<Race, race_compare, ArenaAllocator<Race>> races
+      ETSAN_EARLY_INIT;
 
-  // Pushes a function name to a call stack of a thread
+  // Pushes a function name to the call stack of the current thread
   void pushFunction(char *funcName)
   {
+    trace_event(kTraceFunc, TraceFuncEntry, nullptr, 0, funcName);
 
-    unsigned int tid = (unsigned int)pthread_self();
-
-    stackFrameLock.lock();
-    callStack[tid].push_back(funcName);
-    printf("EmbedSanitizer: function entry: %s\n", funcName);
-    stackFrameLock.unlock();
+    shadowStack.push(funcName);
   }
 
   void popFunction(char *funcName)
   {
+    trace_event(kTraceFunc, TraceFuncExit, nullptr, 0, funcName);
 
-    unsigned int tid = (unsigned int)pthread_self();
-
-    stackFrameLock.lock();
-    std::vector<char *> &stackFrame = callStack[tid];
-    stackFrameLock.unlock();
-
-    if (stackFrame.size() && stackFrame.back() == funcName)
-    {
-      stackFrame.pop_back();
-    }
-    else
+    if (!shadowStack.pop(funcName))
     {
       std::cout << "Something wrong with Function Stack: " << funcName << "\n";
     }
   }
 
-  std::vector<char *> getStack(unsigned int tid)
+  // Returns a copy of the call stack of the current thread
+  std::vector<char *> getStack()
   {
-    stackFrameLock.lock();
-    std::vector<char *> &stackFrame = callStack[tid];
-    stackFrameLock.unlock();
-    return stackFrame;
+    return shadowStack.snapshot();
   }
 
-  // Prints the call stack of a thread when a race is found
+  // Prints the call stack of the current thread when a race is found
   std::string printStack()
   {
 
-    unsigned int tid = (unsigned int)pthread_self();
     std::stringstream ss;
 
-    stackFrameLock.lock();
-    std::vector<char *> &stackFrame = callStack[tid];
-    stackFrameLock.unlock();
-
     int depth = 1;
-    for (char *func : stackFrame)
+    for (char *func : getStack())
     {
       std::string msg(depth, ' ');
       depth += 4;
@@ -117,26 +95,336 @@ namespace etsan
     return ss.str();
   }
 
-  void reportRaceOnRead(int lineNo, void *objName, void *fileName)
+#ifdef ETSAN_BINARY_REPORTS
+  // Binary race reports, see binary_report.h. Written by the reporter
+  // thread under racePrintLock.
+  static BinaryWriter binaryReports ETSAN_EARLY_INIT;
+#endif
+
+  // A race as found by the detecting thread, resolved and printed by
+  // the reporter thread
+  struct RaceRecord {
+    unsigned int  siteId;   // 0: located by the fields below
+    unsigned int  tid;
+    bool          isWrite;
+    int           lineNo;
+    const char   *objName;
+    const char   *fileName;
+    const void   *pc;       // return address of the access callback
+    unsigned int  numFrames;
+    // Function names, outermost first, or with ETSAN_UNWIND_STACKS the
+    // return addresses until the reporter thread formats them
+    char         *frames[ShadowStack::kCapacity + 1];
+  };
+
+  // Races on their way to the reporter thread. Races found while the
+  // queue is full are dropped and counted; their site is reported again
+  // at its next race.
+  constexpr unsigned int kRaceQueueSize = 64;
+
+  // Sites whose races were already queued, per access type
+  constexpr unsigned int kReportedSlots = 1024;
+
+  // Reports races off the hot path.
+  //
+  // A detecting thread copies its race into a fixed-size record and
+  // queues it without taking a lock; races of a site it has seen already
+  // are not queued at all. A background thread, started at the first
+  // race, turns records into Race objects, drops the duplicates left and
+  // prints each unique race once.
+  //
+  // With a site race limit, ETSAN_SITE_RACE_LIMIT, a site is no longer
+  // checked once that many races were found at it (each of another
+  // variable, as racy variables are not checked again, see ft_read).
+  class RaceReporter {
+  public:
+    RaceReporter() : siteRaceLimit(getFlag("ETSAN_SITE_RACE_LIMIT", 0)) {}
+    ~RaceReporter() { stop(); }
+
+    // Queues the race of the current thread. Lock-free but for starting
+    // the reporter thread at the first race.
+    void report(RaceRecord &record) {
+      if (record.siteId && siteRaceLimit &&
+          countRace(record.siteId) == siteRaceLimit) {
+        demoteSite(record.siteId);
+      }
+      if (record.siteId && !firstReport(record.siteId, record.isWrite)) {
+        return;
+      }
+
+      record.tid = (unsigned int)pthread_self();
+#ifdef ETSAN_UNWIND_STACKS
+      uintptr_t pcs[ShadowStack::kCapacity + 1];
+      record.numFrames = unwindStack(record.pc, pcs, ShadowStack::kCapacity + 1);
+      for (unsigned int i = 0; i < record.numFrames; i++)
+        record.frames[i] = reinterpret_cast<char *>(pcs[i]);
+#else
+      record.numFrames = shadowStack.copyTo(record.frames);
+#endif
+      std::call_once(started, [this] {
+        thread = std::thread([this] { run(); });
+      });
+
+      if (!queue.push(record)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        if (record.siteId) forgetReport(record.siteId, record.isWrite);
+        return;
+      }
+      queued.fetch_add(1, std::memory_order_release);
+      wakeup.notify_one();
+    }
+
+    // Waits until the races queued so far are printed
+    void flush() {
+      if (!thread.joinable()) return;
+
+      while (printed.load(std::memory_order_acquire) !=
+             queued.load(std::memory_order_acquire)) {
+        wakeup.notify_one();
+        std::this_thread::yield();
+      }
+    }
+
+    // Prints the races left and ends the reporter thread
+    void stop() {
+      stopping.store(true, std::memory_order_release);
+      wakeup.notify_one();
+      if (thread.joinable()) thread.join();
+    }
+
+    unsigned int numDropped() const {
+      return dropped.load(std::memory_order_relaxed);
+    }
+
+    // Races queued for printing so far, from any thread
+    unsigned int numReported() const {
+      return queued.load(std::memory_order_relaxed);
+    }
+
+    // Races found at a site before it is demoted, 0 for never
+    void setSiteRaceLimit(unsigned long limit) { siteRaceLimit = limit; }
+
+  private:
+    static uint64_t reportKey(unsigned int siteId, bool isWrite) {
+      return ((uint64_t(siteId) << 1) | isWrite) + 1; // 0: empty
+    }
+
+    // Returns true the first time a race is reported at the site, also
+    // when the set is full and the reporter has to sort it out.
+    bool firstReport(unsigned int siteId, bool isWrite) {
+      uint64_t key = reportKey(siteId, isWrite);
+      unsigned int slot = (siteId * 2654435761U) % kReportedSlots;
+
+      for (unsigned int probe = 0; probe < 16; probe++) {
+        std::atomic<uint64_t> &entry =
+            reported[(slot + probe) % kReportedSlots];
+        uint64_t seen = entry.load(std::memory_order_relaxed);
+        if (seen == 0 && entry.compare_exchange_strong(
+                             seen, key, std::memory_order_relaxed)) {
+          return true;
+        }
+        if (seen == key) return false;
+      }
+      return true;
+    }
+
+    // Unmarks the site of a race that was not queued. A site marked past
+    // the freed entry may then be queued twice, which the reporter
+    // thread sorts out.
+    void forgetReport(unsigned int siteId, bool isWrite) {
+      uint64_t key = reportKey(siteId, isWrite);
+      unsigned int slot = (siteId * 2654435761U) % kReportedSlots;
+
+      for (unsigned int probe = 0; probe < 16; probe++) {
+        std::atomic<uint64_t> &entry =
+            reported[(slot + probe) % kReportedSlots];
+        uint64_t seen = key;
+        if (entry.compare_exchange_strong(seen, 0, std::memory_order_relaxed))
+          return;
+        if (seen == 0) return;
+      }
+    }
+
+    // Counts a race found at the site; returns the number so far, 0 when
+    // the table is full
+    unsigned int countRace(unsigned int siteId) {
+      unsigned int key = siteId; // 0: empty
+      unsigned int slot = (siteId * 2654435761U) % kReportedSlots;
+
+      for (unsigned int probe = 0; probe < 16; probe++) {
+        unsigned int i = (slot + probe) % kReportedSlots;
+        unsigned int seen = raceSites[i].load(std::memory_order_relaxed);
+        if (seen == 0 && raceSites[i].compare_exchange_strong(
+                             seen, key, std::memory_order_relaxed)) {
+          seen = key;
+        }
+        if (seen == key) {
+          return raceCounts[i].fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+      }
+      return 0;
+    }
+
+    void run() {
+      RaceRecord record;
+      for (;;) {
+        bool stop = stopping.load(std::memory_order_acquire);
+        while (queue.pop(record)) {
+          print(record);
+          printed.fetch_add(1, std::memory_order_release);
+        }
+        if (stop) return;
+#ifdef ETSAN_BINARY_REPORTS
+        {
+          std::lock_guard<RuntimeMutex> guard(racePrintLock);
+          binaryReports.flush(); // one write() per burst of races
+        }
+#endif
+
+        std::unique_lock<std::mutex> guard(wakeupLock);
+        wakeup.wait_for(guard, std::chrono::milliseconds(10));
+      }
+    }
+
+    void print(const RaceRecord &record) {
+      Race race = record.siteId
+          ? Race(record.tid, getSite(record.siteId), record.isWrite)
+          : Race(record.tid, record.lineNo, record.isWrite ? "write" : "read",
+                 record.objName, record.fileName);
+
+      std::lock_guard<RuntimeMutex> guard(racePrintLock);
+      if (raceDb().enabled()) { // known races of sites not suppressed
+        uint64_t key = raceKey(race.fileName, race.line(), race.column(),
+                               race.objName, race.isWrite);
+        if (raceDb().isKnown(key)) return;
+        raceDb().add(key);
+      }
+      if (!races.insert(race).second) return; // reported before
+#ifdef ETSAN_UNWIND_STACKS
+      char *frames[ShadowStack::kCapacity + 1];
+      for (unsigned int i = 0; i < record.numFrames; i++)
+        frames[i] = const_cast<char *>(
+            formatFrame(reinterpret_cast<uintptr_t>(record.frames[i])));
+#else
+      char * const *frames = record.frames;
+#endif
+      race.trace = frames; // kept for printing only
+      race.numFrames = record.numFrames;
+
+#ifdef ETSAN_BINARY_REPORTS
+      binaryReports.race(record.siteId, race.loc, race.objName,
+                         race.fileName, record.isWrite, record.tid,
+                         frames, record.numFrames);
+#else
+      std::string msg;
+      race.createRaceMessage(msg);
+      std::cout << msg << std::flush;
+#endif
+    }
+
+    MPSCQueue<RaceRecord, kRaceQueueSize> queue;
+    std::atomic<uint64_t>     reported[kReportedSlots];
+    std::atomic<unsigned int> raceSites[kReportedSlots];
+    std::atomic<unsigned int> raceCounts[kReportedSlots];
+    unsigned long             siteRaceLimit;
+    std::atomic<unsigned int> queued{0};
+    std::atomic<unsigned int> printed{0};
+    std::atomic<unsigned int> dropped{0};
+    std::atomic<bool>         stopping{false};
+
+    std::once_flag            started;
+    std::thread               thread;
+    std::mutex                wakeupLock;
+    std::condition_variable   wakeup;
+  };
+
+  // Declared after "races", so it is destroyed, printing the races left,
+  // before them
+  static RaceReporter raceReporter ETSAN_EARLY_INIT;
+
+  // Waits until the races reported so far are printed
+  void flushRaceReports()
+  {
+    raceReporter.flush();
+  }
+
+  // Prints the races left and a summary of all races found
+  void printRaces()
   {
+    raceReporter.flush();
+    if (!raceDb().save())
+      perror("EmbedSanitizer: cannot save the race database");
 
-    unsigned int tid = (unsigned int)pthread_self();
-    Race race(tid, lineNo, "read", (char *)objName, (char *)fileName);
-    race.trace = getStack(tid);
+    std::lock_guard<RuntimeMutex> guard(racePrintLock);
+#ifdef ETSAN_BINARY_REPORTS
+    binaryReports.summary(races.size(), raceReporter.numDropped());
+    binaryReports.flush();
+#else
+    std::cout << "EmbedSanitizer: " << races.size() << " unique data races\n";
+    if (raceReporter.numDropped()) {
+      std::cout << "EmbedSanitizer: " << raceReporter.numDropped()
+                << " reports dropped, the report queue was full\n";
+    }
+#endif
+  }
 
-    races.insert(race);
-    printRaces();
+  void reportRaceOnRead(int lineNo, void *objName, void *fileName)
+  {
+    RaceRecord record;
+    record.siteId   = 0;
+    record.isWrite  = false;
+    record.lineNo   = lineNo;
+    record.objName  = (const char *)objName;
+    record.fileName = (const char *)fileName;
+    record.pc       = nullptr;
+    raceReporter.report(record);
   }
 
   void reportRaceOnWrite(int lineNo, void *objName, void *fileName)
   {
+    RaceRecord record;
+    record.siteId   = 0;
+    record.isWrite  = true;
+    record.lineNo   = lineNo;
+    record.objName  = (const char *)objName;
+    record.fileName = (const char *)fileName;
+    record.pc       = nullptr;
+    raceReporter.report(record);
+  }
+
+  // Reports a race on the watched variable "name", see watchpoints.h, at
+  // the instruction "location" which trapped, as module+offset: there is
+  // no site, nor a source line
+  void reportWatchedRace(const char *name, const char *location, bool isWrite)
+  {
+    RaceRecord record;
+    record.siteId   = 0;
+    record.isWrite  = isWrite;
+    record.lineNo   = 0;
+    record.objName  = name;
+    record.fileName = location;
+    record.pc       = nullptr;
+    raceReporter.report(record);
+  }
 
-    unsigned int tid = (unsigned int)pthread_self();
-    Race race(tid, lineNo, "write", (char *)objName, (char *)fileName);
-    race.trace = getStack(tid);
+  // Reports a race at the access site "siteId", see sites.h, found by
+  // the access callback which returns to "pc"
+  void reportRaceOnRead(unsigned int siteId, const void *pc = nullptr)
+  {
+    RaceRecord record;
+    record.siteId  = siteId;
+    record.isWrite = false;
+    record.pc      = pc;
+    raceReporter.report(record);
+  }
 
-    races.insert(race);
-    printRaces();
+  void reportRaceOnWrite(unsigned int siteId, const void *pc = nullptr)
+  {
+    RaceRecord record;
+    record.siteId  = siteId;
+    record.isWrite = true;
+    record.pc      = pc;
+    raceReporter.report(record);
   }
 
 } // etsan
@@ -0,0 +1,208 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Read clock of a read-shared variable, sized by its readers.
+//
+// Most shared variables are read by a few threads only, so a clock of
+// every thread would mostly hold zero epochs. The clock is one pointer in
+// VarState, null until the variable is shared. Up to kSmallReaders
+// readers are kept as (tid, epoch) pairs in one small arena block; one
+// more reader promotes it to a full clock indexed by tid, which grows
+// with the highest reader tid. The block goes back to the arena when a
+// write makes the variable exclusive again (clear()).
+
+#ifndef ETSAN_READ_CLOCK_H_
+#define ETSAN_READ_CLOCK_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+namespace etsan {
+
+  template <typename EpochLayout>
+  class ReadClock {
+  public:
+    typedef typename EpochLayout::Type Type;
+
+    static constexpr unsigned kSmallReaders = 4;
+
+    ReadClock() = default;
+    ReadClock(const ReadClock &other) { copy(other); }
+    ReadClock(ReadClock &&other) : rep(other.rep) { other.rep = nullptr; }
+    ~ReadClock() { clear(); }
+
+    ReadClock & operator=(const ReadClock &other) {
+      if (this != &other) {
+        clear();
+        copy(other);
+      }
+      return *this;
+    }
+
+    ReadClock & operator=(ReadClock &&other) {
+      if (this != &other) {
+        clear();
+        rep = other.rep;
+        other.rep = nullptr;
+      }
+      return *this;
+    }
+
+    bool empty() const { return !rep; }
+
+    // True once the readers outgrew the pairs
+    bool isFull() const { return rep && rep->full; }
+
+    // Number of readers of a small clock, of slots of a full one
+    unsigned size() const { return rep ? rep->count : 0; }
+
+    // Epoch of the last read by "tid", 0 if it never read
+    Type operator[](unsigned tid) const {
+      if (!rep) return 0;
+      if (rep->full) return tid < rep->count ? clock()[tid] : 0;
+      for (unsigned i = 0; i < rep->count; i++) {
+        if (tids()[i] == tid) return clock()[i];
+      }
+      return 0;
+    }
+
+    // Records a read by "tid" at "epoch"
+    void set(unsigned tid, Type epoch) {
+      if (!rep) rep = allocate(false, kSmallReaders);
+
+      if (rep->full) {
+        if (tid >= rep->count) grow(tid + 1);
+        clock()[tid] = epoch;
+        return;
+      }
+
+      for (unsigned i = 0; i < rep->count; i++) {
+        if (tids()[i] == tid) {
+          clock()[i] = epoch;
+          return;
+        }
+      }
+      if (rep->count < kSmallReaders) {
+        tids()[rep->count] = tid;
+        clock()[rep->count] = epoch;
+        rep->count++;
+        return;
+      }
+      promote(tid);
+      clock()[tid] = epoch;
+    }
+
+    // Calls "visit(tid, epoch)" for every reader
+    template <typename Visitor>
+    void forEach(Visitor visit) const {
+      if (!rep) return;
+      for (unsigned i = 0; i < rep->count; i++) {
+        if (rep->full) {
+          if (clock()[i]) visit(i, clock()[i]);
+        } else {
+          visit(tids()[i], clock()[i]);
+        }
+      }
+    }
+
+    // Bytes taken from the arena
+    size_t memory() const {
+      return rep ? bytes(rep->full, rep->capacity) : 0;
+    }
+
+    // Returns the clock to the arena
+    void clear() {
+      if (!rep) return;
+      metadataArena.deallocate(rep, bytes(rep->full, rep->capacity));
+      rep = nullptr;
+    }
+
+  private:
+    // Followed by "capacity" epochs and, if not full, as many tids
+    struct Rep {
+      uint16_t count;
+      uint16_t capacity;
+      bool     full;
+    };
+
+    static size_t header() {
+      return (sizeof(Rep) + sizeof(Type) - 1) / sizeof(Type) * sizeof(Type);
+    }
+
+    static size_t bytes(bool full, unsigned capacity) {
+      return header() + capacity * sizeof(Type) +
+             (full ? 0 : capacity * sizeof(uint16_t));
+    }
+
+    Type *clock() const {
+      return reinterpret_cast<Type *>(reinterpret_cast<char *>(rep) +
+                                      header());
+    }
+
+    uint16_t *tids() const {
+      return reinterpret_cast<uint16_t *>(clock() + rep->capacity);
+    }
+
+    static Rep *allocate(bool full, unsigned capacity) {
+      Rep *r = static_cast<Rep *>(
+          metadataArena.allocate(bytes(full, capacity)));
+      r->count = full ? capacity : 0;
+      r->capacity = capacity;
+      r->full = full;
+      Type *slots = reinterpret_cast<Type *>(reinterpret_cast<char *>(r) +
+                                             header());
+      memset(slots, 0, capacity * sizeof(Type));
+      return r;
+    }
+
+    // Moves the pairs and "tid" to a full clock
+    void promote(unsigned tid) {
+      unsigned slots = tid + 1;
+      for (unsigned i = 0; i < rep->count; i++) {
+        if (tids()[i] >= slots) slots = tids()[i] + 1;
+      }
+      Rep *full = allocate(true, slots);
+      Type *fullClock = reinterpret_cast<Type *>(
+          reinterpret_cast<char *>(full) + header());
+      for (unsigned i = 0; i < rep->count; i++) {
+        fullClock[tids()[i]] = clock()[i];
+      }
+      clear();
+      rep = full;
+    }
+
+    // Extends a full clock to "slots" slots, for a thread created later
+    void grow(unsigned slots) {
+      Rep *larger = allocate(true, slots);
+      memcpy(reinterpret_cast<char *>(larger) + header(), clock(),
+             rep->count * sizeof(Type));
+      clear();
+      rep = larger;
+    }
+
+    void copy(const ReadClock &other) {
+      if (!other.rep) return;
+      size_t n = bytes(other.rep->full, other.rep->capacity);
+      rep = static_cast<Rep *>(metadataArena.allocate(n));
+      memcpy(rep, other.rep, n);
+    }
+
+    Rep *rep = nullptr;
+  };
+
+  template <typename EpochLayout>
+  constexpr unsigned ReadClock<EpochLayout>::kSmallReaders;
+
+} // etsan
+
+#endif // ETSAN_READ_CLOCK_H_
@@ -0,0 +1,84 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Sampling of memory access checks (ETSAN_SAMPLING), after LiteRace.
+//
+// Each thread keeps a sampling state per access site. A site is checked
+// in bursts of kBurst consecutive accesses; after each burst it skips
+// accesses so that its sampling rate drops tenfold, from 100% down to
+// the rate of ETSAN_SAMPLE_RATE (percent, default 10). Cold code, where
+// races hide, stays fully checked while hot loops cost little.
+// Synchronization is never sampled, so happens-before stays exact and
+// sampling only misses races, it never reports false ones.
+
+#ifndef ETSAN_SAMPLING_H_
+#define ETSAN_SAMPLING_H_
+
+#include "flags.h"
+
+namespace etsan {
+
+  class Sampler {
+  public:
+    static constexpr unsigned kBurst = 16;
+
+    // Sites are hashed into this many states per thread
+    static constexpr unsigned kSlots = 1024;
+
+    // Defaults to the ETSAN_SAMPLE_RATE environment variable
+    Sampler() : Sampler(getFlag("ETSAN_SAMPLE_RATE", 10)) {}
+
+    explicit Sampler(unsigned long ratePercent) {
+      if (ratePercent < 1) ratePercent = 1;
+      if (ratePercent > 100) ratePercent = 100;
+      maxPeriod = 100 / ratePercent;
+    }
+
+    // Returns true if the access at site "siteId" is checked
+    bool sample(unsigned int siteId) {
+      SiteState &s = slots[siteId & (kSlots - 1)];
+      if (s.burst) {
+        s.burst--;
+        return true;
+      }
+      if (s.skip) {
+        s.skip--;
+        return false;
+      }
+
+      // Start a burst and skip (period - 1) bursts after it
+      unsigned period = s.period ? s.period : 1;
+      s.burst  = kBurst - 1;
+      s.skip   = kBurst * (period - 1);
+      s.period = period * 10 < maxPeriod ? period * 10 : maxPeriod;
+      return true;
+    }
+
+  private:
+    struct SiteState {
+      unsigned burst;  // checks left in the current burst
+      unsigned skip;   // accesses left to skip
+      unsigned period; // 1 / sampling rate of the next burst, 0 == 1
+    };
+
+    unsigned  maxPeriod;
+    SiteState slots[kSlots] = {};
+  };
+
+  constexpr unsigned Sampler::kBurst;
+  constexpr unsigned Sampler::kSlots;
+
+  static thread_local Sampler sampler;
+
+} // etsan
+
+#endif // ETSAN_SAMPLING_H_
@@ -0,0 +1,140 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Direct-mapped shadow memory: every application word owns a fixed slot.
+//
+// The shadow is a two-level page table. The directory is one lazily
+// committed (MAP_NORESERVE) mmap region indexed by the high address bits;
+// each entry points to a page of slots that is mmap-ed the first time any
+// word in its range is touched. A lookup is therefore a shift, a load and
+// an add; the directory entry is installed with a CAS so no lock is needed.
+// The pages may be huge ones, see ETSAN_HUGE_PAGES in page_backing.h.
+
+#ifndef ETSAN_SHADOW_H_
+#define ETSAN_SHADOW_H_
+
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "page_backing.h"
+
+template <typename Slot>
+class ShadowMemory {
+
+public:
+
+  // One slot per 4-byte application word.
+  static constexpr unsigned kWordShift = 2;
+
+  // Slots per shadow page. Small pages on 32-bit boards keep the memory
+  // committed for sparse heaps low; larger ones on 64-bit keep the
+  // directory within a sane virtual size.
+  static constexpr unsigned kPageShift = sizeof(void *) == 4 ? 12 : 16;
+  static constexpr size_t   kPageSlots = size_t(1) << kPageShift;
+
+  // User-space address bits: the full 32 on ARM, 47 on x86_64.
+  static constexpr unsigned kAddressBits = sizeof(void *) == 4 ? 32 : 47;
+  static constexpr size_t   kDirEntries =
+      size_t(1) << (kAddressBits - kWordShift - kPageShift);
+
+  ShadowMemory() {
+    void *mem = mmap(nullptr, kDirEntries * sizeof(std::atomic<Slot *>),
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert(mem != MAP_FAILED);
+    dir = static_cast<std::atomic<Slot *> *>(mem); // zero == not committed
+  }
+
+  ~ShadowMemory() {
+    // Statistics destructors may still walk the shadow: keep pages mapped
+    // and let the process exit reclaim them.
+  }
+
+  // Returns the slot of the word containing "addr", committing its page
+  // on first touch.
+  Slot * slot(const void *addr) {
+    uintptr_t word = reinterpret_cast<uintptr_t>(addr) >> kWordShift;
+    size_t idx = (word >> kPageShift) & (kDirEntries - 1);
+
+    Slot *page = dir[idx].load(std::memory_order_acquire);
+    if (!page) {
+      page = commitPage(idx);
+    }
+    return page + (word & (kPageSlots - 1));
+  }
+
+  // Returns the slot of "addr" or nullptr if its page was never touched.
+  Slot * find(const void *addr) const {
+    uintptr_t word = reinterpret_cast<uintptr_t>(addr) >> kWordShift;
+    size_t idx = (word >> kPageShift) & (kDirEntries - 1);
+
+    Slot *page = dir[idx].load(std::memory_order_acquire);
+    return page ? page + (word & (kPageSlots - 1)) : nullptr;
+  }
+
+  // The page directory, indexed like in slot()
+  const void * directory() const { return dir; }
+
+  // Number of pages committed so far
+  size_t pages() {
+    std::lock_guard<std::mutex> guard(pagesGuard);
+    return committed.size();
+  }
+
+  // Calls "visit" for every slot of every committed page.
+  template <typename Visitor>
+  void forEachSlot(Visitor visit) {
+    std::lock_guard<std::mutex> guard(pagesGuard);
+    for (Slot *page : committed) {
+      for (size_t s = 0; s < kPageSlots; s++) {
+        visit(page[s]);
+      }
+    }
+  }
+
+private:
+
+  std::atomic<Slot *> *dir;
+
+  // Committed pages, so that statistics never walk the whole directory.
+  // Only touched on the (rare) page commit path.
+  std::mutex pagesGuard;
+  std::vector<Slot *> committed;
+
+  Slot * commitPage(size_t idx) {
+    void *mem = etsan::mapPages(kPageSlots * sizeof(Slot));
+    assert(mem != MAP_FAILED);
+    Slot *page = static_cast<Slot *>(mem);
+    for (size_t s = 0; s < kPageSlots; s++) {
+      new (page + s) Slot();
+    }
+
+    Slot *expected = nullptr;
+    if (!dir[idx].compare_exchange_strong(expected, page,
+                                          std::memory_order_acq_rel)) {
+      // another thread installed this page first
+      etsan::unmapPages(mem, kPageSlots * sizeof(Slot));
+      return expected;
+    }
+
+    std::lock_guard<std::mutex> guard(pagesGuard);
+    committed.push_back(page);
+    return page;
+  }
+};
+
+#endif // ETSAN_SHADOW_H_
@@ -0,0 +1,101 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Shadow call stack of a thread, for race reports.
+//
+// Every thread owns one in TLS, so function entries and exits take no
+// lock: a push is a store and an increment, a pop a compare and a
+// decrement. The frames live in a ring of ETSAN_STACK_DEPTH entries; on
+// deeper recursion the outermost frames are overwritten and reports show
+// the innermost ones only. The stack is copied only when a race is found.
+
+#ifndef ETSAN_SHADOW_STACK_H_
+#define ETSAN_SHADOW_STACK_H_
+
+#include <vector>
+
+// Frames kept per thread, a power of two
+#ifndef ETSAN_STACK_DEPTH
+#define ETSAN_STACK_DEPTH 64
+#endif
+
+namespace etsan {
+
+  class ShadowStack {
+  public:
+    static constexpr unsigned kCapacity = ETSAN_STACK_DEPTH;
+    static_assert((kCapacity & (kCapacity - 1)) == 0,
+                  "ETSAN_STACK_DEPTH must be a power of two");
+
+    // Placeholder of the overwritten frames in snapshots
+    static constexpr const char *kLostFrames = "...";
+
+    void push(char *funcName) {
+      if (depth >= kCapacity && depth - kCapacity + 1 > lowest) {
+        lowest = depth - kCapacity + 1; // frame depth - kCapacity is lost
+      }
+      frames[depth++ & (kCapacity - 1)] = funcName;
+    }
+
+    // Pops "funcName" off the stack. Returns false if it is not on top.
+    bool pop(char *funcName) {
+      if (!depth) return false;
+      unsigned top = depth - 1;
+      if (top >= lowest && frames[top & (kCapacity - 1)] != funcName) {
+        return false;
+      }
+      depth = top; // an overwritten frame can't be checked
+      if (depth < lowest) lowest = depth;
+      return true;
+    }
+
+    // Logical depth, including overwritten frames
+    unsigned size() const { return depth; }
+
+    void clear() { depth = lowest = 0; }
+
+    // Returns the frames from the outermost one kept to the top
+    std::vector<char *> snapshot() const {
+      std::vector<char *> stack;
+      stack.reserve(depth - lowest + 1);
+      if (lowest) stack.push_back(const_cast<char *>(kLostFrames));
+      for (unsigned i = lowest; i < depth; i++) {
+        stack.push_back(frames[i & (kCapacity - 1)]);
+      }
+      return stack;
+    }
+
+    // Same as snapshot(), into "out" of kCapacity + 1 frames. Returns
+    // the number of frames copied.
+    unsigned copyTo(char **out) const {
+      unsigned n = 0;
+      if (lowest) out[n++] = const_cast<char *>(kLostFrames);
+      for (unsigned i = lowest; i < depth; i++) {
+        out[n++] = frames[i & (kCapacity - 1)];
+      }
+      return n;
+    }
+
+  private:
+    char     *frames[kCapacity];
+    unsigned  depth  = 0;
+    unsigned  lowest = 0; // frames below this depth are overwritten
+  };
+
+  constexpr unsigned ShadowStack::kCapacity;
+  constexpr const char *ShadowStack::kLostFrames;
+
+  static thread_local ShadowStack shadowStack;
+
+} // etsan
+
+#endif // ETSAN_SHADOW_STACK_H_
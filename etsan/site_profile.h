@@ -0,0 +1,173 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Per-site profile of the cost of checking (ETSAN_SITE_PROFILE).
+//
+// Each thread counts the accesses it checks per access site, and those
+// which missed the same-epoch fast path, in a table of its own. The
+// tables of exited threads are added up; printSiteProfile lists the
+// sites checked most, to tell where scoping or suppressions pay off.
+
+#ifndef ETSAN_SITE_PROFILE_H_
+#define ETSAN_SITE_PROFILE_H_
+
+#include <stdio.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "flags.h"
+#include "sites.h"
+#include "stats.h"
+
+namespace etsan {
+
+  struct SiteCount {
+    unsigned int  siteId;
+    unsigned long calls;  // accesses checked, 0 for a free slot
+    unsigned long slow;   // of which past the same-epoch fast path
+  };
+
+  class SiteProfile;
+
+  static std::mutex siteProfilesLock;
+  // of the running threads
+  static std::vector<SiteProfile *> siteProfiles ETSAN_EARLY_INIT;
+  static std::unordered_map<unsigned int, SiteCount> exitedSiteCounts
+      ETSAN_EARLY_INIT;
+
+  // Counts of one thread
+  class SiteProfile {
+  public:
+    // Sites counted per thread; the accesses of others are counted as
+    // those of site kOtherSites
+    static constexpr unsigned kSlots = 1024;
+    static constexpr unsigned kOtherSites = ~0U;
+
+    SiteProfile() {
+      std::lock_guard<std::mutex> guard(siteProfilesLock);
+      siteProfiles.push_back(this);
+    }
+
+    // Adds the counts to those of exited threads
+    ~SiteProfile() {
+      std::lock_guard<std::mutex> guard(siteProfilesLock);
+      addTo(exitedSiteCounts);
+      siteProfiles.erase(std::find(siteProfiles.begin(), siteProfiles.end(),
+                                   this));
+    }
+
+    void count(unsigned int siteId, bool isSlow) {
+      unsigned int i = (siteId * 2654435761U) & (kSlots - 1);
+      for (unsigned int probe = 0; probe < kSlots / 8; probe++) {
+        SiteCount & c = slots[(i + probe) & (kSlots - 1)];
+        if (!c.calls) c.siteId = siteId;
+        if (c.siteId == siteId) {
+          c.calls++;
+          c.slow += isSlow;
+          return;
+        }
+      }
+      other.calls++;
+      other.slow += isSlow;
+    }
+
+    void addTo(std::unordered_map<unsigned int, SiteCount> & counts) const {
+      for (const SiteCount & c : slots) {
+        if (c.calls) add(counts, c.siteId, c);
+      }
+      if (other.calls) add(counts, kOtherSites, other);
+    }
+
+  private:
+    static void add(std::unordered_map<unsigned int, SiteCount> & counts,
+                    unsigned int siteId, const SiteCount & c) {
+      SiteCount & sum = counts[siteId];
+      sum.siteId = siteId;
+      sum.calls += c.calls;
+      sum.slow += c.slow;
+    }
+
+    SiteCount slots[kSlots] = {};
+    SiteCount other = {kOtherSites, 0, 0};
+  };
+
+  constexpr unsigned SiteProfile::kSlots;
+  constexpr unsigned SiteProfile::kOtherSites;
+
+  static thread_local SiteProfile siteProfile;
+
+  // Counts the check of an access at "siteId" by a thread with counters
+  // "stats", slow unless it hit the fast path "fast" (StatReadSameEpoch
+  // or StatWriteSameEpoch) before it goes out of scope
+  class ProfiledAccess {
+  public:
+    ProfiledAccess(unsigned int siteId, const ThreadStats & stats,
+                   StatCounter fast)
+        : siteId(siteId), stats(stats), fast(fast), before(stats.get(fast)) {}
+
+    ~ProfiledAccess() {
+      siteProfile.count(siteId, stats.get(fast) == before);
+    }
+
+  private:
+    unsigned int        siteId;
+    const ThreadStats & stats;
+    StatCounter         fast;
+    unsigned long       before;
+  };
+
+  // Prints the "top" sites with the most accesses checked, by default
+  // ETSAN_PROFILE_TOP of them (20). The counts of running threads are
+  // read as they are.
+  void printSiteProfile(FILE *out = stdout, unsigned long top =
+                        getFlag("ETSAN_PROFILE_TOP", 20)) {
+    std::unordered_map<unsigned int, SiteCount> counts;
+    {
+      std::lock_guard<std::mutex> guard(siteProfilesLock);
+      counts = exitedSiteCounts;
+      for (const SiteProfile *p : siteProfiles) p->addTo(counts);
+    }
+
+    std::vector<SiteCount> sites;
+    unsigned long total = 0;
+    for (auto & c : counts) {
+      sites.push_back(c.second);
+      total += c.second.calls;
+    }
+    std::sort(sites.begin(), sites.end(),
+              [](const SiteCount & a, const SiteCount & b) {
+                return a.calls != b.calls ? a.calls > b.calls
+                                          : a.siteId < b.siteId;
+              });
+    if (sites.size() > top) sites.resize(top);
+
+    fprintf(out, "Site profile: top %zu of %zu sites, %lu checks\n",
+            sites.size(), counts.size(), total);
+    fprintf(out, "%12s %7s %12s %7s  %s\n", "checks", "share", "slow path",
+            "slow", "site");
+    for (const SiteCount & c : sites) {
+      fprintf(out, "%12lu %6.1f%% %12lu %6.1f%%  ", c.calls,
+              100.0 * c.calls / total, c.slow, 100.0 * c.slow / c.calls);
+      if (c.siteId == SiteProfile::kOtherSites) {
+        fprintf(out, "(sites beyond the per-thread table)\n");
+        continue;
+      }
+      Site site = getSite(c.siteId);
+      fprintf(out, "%s:%u:%u %s\n", site.fileName, site.line(),
+              site.column(), site.objName);
+    }
+  }
+
+} // etsan
+
+#endif // ETSAN_SITE_PROFILE_H_
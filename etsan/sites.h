@@ -0,0 +1,141 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Static debug information of instrumented accesses ("sites").
+//
+// The compiler pass emits one table per module with the packed source
+// location and variable name of every instrumented access, deduplicated,
+// plus the table of the module's file names, and registers both from the
+// module constructor. Access callbacks then only carry a 32-bit site ID:
+// the base the module got at registration plus the index in its table.
+// IDs are resolved when a race is reported. File names are interned in
+// the FileDictionary as the modules register: a file shared by several
+// modules, e.g. a header, has one index.
+
+#ifndef ETSAN_SITES_H_
+#define ETSAN_SITES_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include "file_dictionary.h"
+
+namespace etsan {
+
+  // Source location of a site packed in one word:
+  //   | file index : 16 | line : 32 | column : 16 |
+  // Two sites are the same iff their locations are equal.
+  typedef uint64_t SiteLoc;
+
+  constexpr unsigned int kSiteLineShift = 16;
+  constexpr unsigned int kSiteFileShift = 48;
+
+  constexpr SiteLoc makeSiteLoc(unsigned int file, unsigned int line,
+                                unsigned int column) {
+    return (SiteLoc(file & 0xFFFF) << kSiteFileShift) |
+           (SiteLoc(line) << kSiteLineShift) | SiteLoc(column & 0xFFFF);
+  }
+
+  constexpr unsigned int siteFile(SiteLoc loc) {
+    return loc >> kSiteFileShift;
+  }
+  constexpr unsigned int siteLine(SiteLoc loc) {
+    return (loc >> kSiteLineShift) & 0xFFFFFFFF;
+  }
+  constexpr unsigned int siteColumn(SiteLoc loc) { return loc & 0xFFFF; }
+
+  // One entry of a module's site table. Must match the layout emitted
+  // by the pass: { i64, i8* }. The file index of "loc" is local to the
+  // module's file table.
+  struct SiteInfo {
+    SiteLoc      loc;
+    const char  *objName;
+  };
+
+  // A resolved site. The file index of "loc" is its ID in the
+  // FileDictionary, 0 for accesses without debug information.
+  struct Site {
+    SiteLoc      loc;
+    const char  *objName;
+    const char  *fileName;
+
+    unsigned int line() const { return siteLine(loc); }
+    unsigned int column() const { return siteColumn(loc); }
+  };
+
+  // Site of accesses without debug information, ID 0
+  static const Site unknownSite = {0, "unknown", "Unknown"};
+
+  struct SiteTable {
+    const SiteInfo     *sites;
+    unsigned int        count;
+    unsigned int        base;     // ID of sites[0]
+    const uint16_t     *fileIds;  // FileDictionary IDs of the files
+  };
+
+  // Modules with instrumented code in the process
+  constexpr unsigned int kMaxSiteTables = 256;
+
+  static SiteTable siteTables[kMaxSiteTables];
+  static std::atomic<unsigned int> numSiteTables{0};
+  static std::mutex siteTablesLock;
+  static unsigned int nextSiteId = 1;
+
+  // Registers the "count" sites of a module, whose locations index the
+  // "numFiles" names of "files", and returns the ID of the first site.
+  // Called from module constructors.
+  unsigned int registerSites(const SiteInfo *sites, unsigned int count,
+                             const char *const *files,
+                             unsigned int numFiles) {
+    std::lock_guard<std::mutex> guard(siteTablesLock);
+
+    unsigned int n = numSiteTables.load(std::memory_order_relaxed);
+    if (n == kMaxSiteTables) {
+      return 0; // IDs resolve to unknownSite
+    }
+
+    uint16_t *fileIds = new uint16_t[numFiles ? numFiles : 1]();
+    for (unsigned int i = 0; i < numFiles; i++) {
+      fileIds[i] = fileDictionary.internFile(files[i]);
+    }
+
+    SiteTable &table = siteTables[n];
+    table.sites    = sites;
+    table.count    = count;
+    table.base     = nextSiteId;
+    table.fileIds  = fileIds;
+    nextSiteId += count;
+
+    numSiteTables.store(n + 1, std::memory_order_release); // publish
+    return table.base;
+  }
+
+  // Returns the site of "id". Lock-free: tables are never removed.
+  Site getSite(unsigned int id) {
+    unsigned int n = numSiteTables.load(std::memory_order_acquire);
+    for (unsigned int i = 0; i < n; i++) {
+      const SiteTable &table = siteTables[i];
+      if (id >= table.base && id - table.base < table.count) {
+        const SiteInfo &info = table.sites[id - table.base];
+        unsigned int file = table.fileIds[siteFile(info.loc)];
+        Site site = {makeSiteLoc(file, siteLine(info.loc),
+                                 siteColumn(info.loc)),
+                     info.objName, fileDictionary.fileName(file)};
+        return site;
+      }
+    }
+    return unknownSite;
+  }
+
+} // etsan
+
+#endif // ETSAN_SITES_H_
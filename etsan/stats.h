@@ -0,0 +1,117 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Per-thread statistics counters of the race detector.
+// Every thread updates only its own counters, so counting costs a
+// plain increment on the hot path; they are summed up at exit.
+
+#ifndef ETSAN_STATS_H_
+#define ETSAN_STATS_H_
+
+#include <stdio.h>
+
+namespace etsan {
+
+  enum StatCounter {
+    StatReads,
+    StatWrites,
+    StatReadSameEpoch,      // fast path hits
+    StatReadExclusive,
+    StatReadShared,
+    StatReadShare,          // exclusive -> shared transition
+    StatReadFrozen,         // not checked, see frozen.h
+    StatWriteSameEpoch,     // fast path hits
+    StatWriteExclusive,
+    StatWriteShared,
+    StatAcquires,
+    StatAcquireKnown,       // of a clock the thread has already
+    StatReleases,
+    StatForks,
+    StatJoins,
+    StatEvictions,          // variable states, see ETSAN_MAX_METADATA_MB
+#ifdef ETSAN_SAMPLING
+    StatSampledOut,         // accesses not checked
+#endif
+#ifdef ETSAN_LOCKSET
+    StatReadLocked,         // guarded by a lock, see lockset.h
+    StatWriteLocked,
+#endif
+    NumStatCounters
+  };
+
+  // Labels of the summary lines. Keep "Reads: ", "Writes: " and the like
+  // unique: tests/parsec_benchmarks/run.sh greps for them.
+  static const char *const statNames[NumStatCounters] = {
+    "Reads",
+    "Writes",
+    "Read same epoch",
+    "Read exclusive",
+    "Read shared",
+    "Read share transitions",
+    "Reads of frozen lines",
+    "Write same epoch",
+    "Write exclusive",
+    "Write shared",
+    "Acquires",
+    "Acquires of known clocks",
+    "Releases",
+    "Forks",
+    "Joins",
+    "Evicted variable states",
+#ifdef ETSAN_SAMPLING
+    "Sampled out accesses",
+#endif
+#ifdef ETSAN_LOCKSET
+    "Reads guarded by a lock",
+    "Writes guarded by a lock",
+#endif
+  };
+
+  constexpr unsigned kCacheLineSize = 64;
+
+  // Counters of one thread, padded on both sides so that no two
+  // threads ever write to the same cache line.
+  class ThreadStats {
+    char padBefore[kCacheLineSize];
+
+  public:
+    unsigned long counter[NumStatCounters];
+
+  private:
+    char padAfter[kCacheLineSize];
+
+  public:
+    ThreadStats() { clear(); }
+
+    void inc(StatCounter c) { counter[c]++; }
+
+    unsigned long get(StatCounter c) const { return counter[c]; }
+
+    void clear() {
+      for (int c = 0; c < NumStatCounters; c++) counter[c] = 0;
+    }
+
+    // Adds counters of "other" to these
+    void add(const ThreadStats &other) {
+      for (int c = 0; c < NumStatCounters; c++) counter[c] += other.counter[c];
+    }
+
+    // Prints one "<name>: <value>" line per counter
+    void print() const {
+      for (int c = 0; c < NumStatCounters; c++) {
+        printf("%s: %lu\n", statNames[c], counter[c]);
+      }
+    }
+  };
+
+} // etsan
+#endif // ETSAN_STATS_H_
@@ -0,0 +1,222 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Suppressions of known benign races, read from the file named by the
+// ETSAN_SUPPRESSIONS environment variable:
+//
+//   # comment
+//   src:*/stats.c         the accesses of the files matching a glob
+//   src:*/init.c:42       of one line of them
+//   var:hit_count*        to the variables matching a glob
+//
+// The rules are matched once against the sites of each module when it
+// registers them, into a bitmap by site ID: the access callbacks of a
+// suppressed site skip detection with one bit test. Functions are
+// suppressed at compile time, by the "!fun:" entries of the scope file.
+// Sites demoted after their races (see RaceReporter), and those of the
+// races known from earlier runs (race_db.h), join the bitmap.
+
+#ifndef ETSAN_SUPPRESSIONS_H_
+#define ETSAN_SUPPRESSIONS_H_
+
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "sites.h"
+
+namespace etsan {
+
+  class Suppressions {
+  public:
+    struct Rule {
+      bool         isVariable; // var: rule, else src:
+      std::string  pattern;
+      unsigned int line;       // of src: rules, 0 for every line
+    };
+
+    // Adds the rules of "text", one per line. Returns the number of
+    // lines that are no rule, which are skipped.
+    unsigned int parse(const char *text) {
+      unsigned int invalid = 0;
+      while (*text) {
+        const char *eol = strchr(text, '\n');
+        std::string line(text, eol ? eol - text : strlen(text));
+        text = eol ? eol + 1 : text + line.size();
+
+        size_t begin = line.find_first_not_of(" \t\r");
+        size_t end = line.find_last_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#') continue;
+        line = line.substr(begin, end - begin + 1);
+
+        Rule rule = {false, "", 0};
+        if (!line.compare(0, 4, "var:")) {
+          rule.isVariable = true;
+          rule.pattern = line.substr(4);
+        } else if (!line.compare(0, 4, "src:")) {
+          rule.pattern = line.substr(4);
+          size_t colon = rule.pattern.rfind(':');
+          if (colon != std::string::npos && colon + 1 < rule.pattern.size() &&
+              strspn(rule.pattern.c_str() + colon + 1, "0123456789") ==
+                  rule.pattern.size() - colon - 1) {
+            rule.line = atoi(rule.pattern.c_str() + colon + 1);
+            rule.pattern.resize(colon);
+          }
+        }
+        if (rule.pattern.empty()) {
+          invalid++;
+          continue;
+        }
+        rules.push_back(rule);
+      }
+      return invalid;
+    }
+
+    // Reads the rules of file "path"; returns false if it cannot be read
+    bool load(const char *path) {
+      FILE *in = fopen(path, "r");
+      if (!in) return false;
+      std::string text;
+      char buffer[512];
+      size_t n;
+      while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        text.append(buffer, n);
+      }
+      fclose(in);
+      unsigned int invalid = parse(text.c_str());
+      if (invalid) {
+        fprintf(stderr, "EmbedSanitizer: %u invalid lines in %s\n", invalid,
+                path);
+      }
+      return true;
+    }
+
+    bool empty() const { return rules.empty(); }
+
+    bool matches(const Site & site) const {
+      for (const Rule & rule : rules) {
+        if (rule.isVariable) {
+          if (!fnmatch(rule.pattern.c_str(), site.objName, 0)) return true;
+        } else if ((!rule.line || rule.line == site.line()) &&
+                   !fnmatch(rule.pattern.c_str(), site.fileName, 0)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+  private:
+    std::vector<Rule> rules;
+  };
+
+  // Bits of the suppressed site IDs below "limit"
+  struct SuppressedSites {
+    unsigned int limit;
+    uint32_t     bits[1];
+  };
+
+  static std::atomic<SuppressedSites *> suppressedSites{nullptr};
+  static std::mutex suppressedSitesLock;
+
+  // The rules of ETSAN_SUPPRESSIONS, read at the first use
+  Suppressions & suppressions() {
+    static Suppressions rules;
+    static bool loaded = false;
+    if (!loaded) {
+      loaded = true;
+      const char *path = getenv("ETSAN_SUPPRESSIONS");
+      if (path && *path && !rules.load(path)) {
+        fprintf(stderr, "EmbedSanitizer: cannot read suppressions %s\n",
+                path);
+      }
+    }
+    return rules;
+  }
+
+  // A copy of the bitmap covering the IDs below "end", to be published.
+  // A new bitmap each time, as readers may be testing the old one, which
+  // is never freed. Called with suppressedSitesLock held.
+  SuppressedSites *growSuppressedSites(unsigned int end) {
+    SuppressedSites *old = suppressedSites.load(std::memory_order_relaxed);
+    unsigned int limit = (end + 31) & ~31U;
+    if (old && old->limit > limit) limit = old->limit;
+    SuppressedSites *sites = static_cast<SuppressedSites *>(
+        calloc(1, sizeof(SuppressedSites) + limit / 8));
+    sites->limit = limit;
+    if (old) memcpy(sites->bits, old->bits, old->limit / 8);
+    return sites;
+  }
+
+  // Suppresses those of the "count" sites from ID "base" on, just
+  // registered, for which "matches" holds. Returns their number.
+  template <typename Matcher>
+  unsigned int suppressSitesIf(unsigned int base, unsigned int count,
+                               Matcher matches) {
+    if (!base) return 0;
+    std::lock_guard<std::mutex> guard(suppressedSitesLock);
+
+    SuppressedSites *sites = growSuppressedSites(base + count);
+    unsigned int suppressed = 0;
+    for (unsigned int id = base; id < base + count; id++) {
+      if (matches(getSite(id))) {
+        sites->bits[id >> 5] |= 1U << (id & 31);
+        suppressed++;
+      }
+    }
+    suppressedSites.store(sites, std::memory_order_release);
+    return suppressed;
+  }
+
+  // Matches the "count" sites from ID "base" on, just registered, against
+  // "rules". Returns the number of them suppressed.
+  unsigned int suppressSites(unsigned int base, unsigned int count,
+                             const Suppressions & rules) {
+    if (rules.empty()) return 0;
+    return suppressSitesIf(base, count, [&rules](const Site & site) {
+      return rules.matches(site);
+    });
+  }
+
+  // Stops checking the accesses of site "siteId" from now on. The bit is
+  // set in place when the bitmap covers the site, as the callbacks may be
+  // testing it.
+  void demoteSite(unsigned int siteId) {
+    if (!siteId) return;
+    std::lock_guard<std::mutex> guard(suppressedSitesLock);
+
+    SuppressedSites *sites = suppressedSites.load(std::memory_order_relaxed);
+    if (sites && siteId < sites->limit) {
+      __atomic_fetch_or(&sites->bits[siteId >> 5], 1U << (siteId & 31),
+                        __ATOMIC_RELAXED);
+      return;
+    }
+    sites = growSuppressedSites(siteId + 1);
+    sites->bits[siteId >> 5] |= 1U << (siteId & 31);
+    suppressedSites.store(sites, std::memory_order_release);
+  }
+
+  // True if the accesses of site "siteId" are not checked
+  inline bool isSuppressed(unsigned int siteId) {
+    const SuppressedSites *s = suppressedSites.load(std::memory_order_acquire);
+    return s && siteId < s->limit &&
+           (__atomic_load_n(&s->bits[siteId >> 5], __ATOMIC_RELAXED) >>
+                (siteId & 31) & 1);
+  }
+
+} // etsan
+
+#endif // ETSAN_SUPPRESSIONS_H_
@@ -0,0 +1,156 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Debug tracing of runtime events.
+//
+// Tracing is compiled in only with ETSAN_TRACE; otherwise trace_event()
+// expands to nothing. When compiled in, events are recorded only if the
+// ETSAN_VERBOSITY environment variable is at least the event's level.
+// Each thread appends fixed-size records to its own buffer, which is
+// formatted and written to ETSAN_TRACE_FILE (default: stderr) only when
+// it fills up or the thread exits. Nothing is printed on the hot path.
+
+#ifndef ETSAN_TRACE_H_
+#define ETSAN_TRACE_H_
+
+#include <stdio.h>
+#include <pthread.h>
+#include <mutex>
+#include "flags.h"
+#ifdef ETSAN_BINARY_REPORTS
+#include "binary_report.h"
+#endif
+
+namespace etsan {
+
+  enum TraceKind {
+    TraceFuncEntry,
+    TraceFuncExit,
+    TraceRead,
+    TraceWrite,
+    TraceVariable,   // __tsan_print_variables
+    TraceLock,
+    TraceUnlock,
+    TraceFork,
+    TraceJoin,
+    NumTraceKinds
+  };
+
+  static const char *const traceNames[NumTraceKinds] = {
+    "func_entry", "func_exit", "read", "write", "variable",
+    "lock", "unlock", "fork", "join"
+  };
+
+  // Verbosity levels at which events are recorded
+  constexpr int kTraceSync   = 1; // synchronization events
+  constexpr int kTraceFunc   = 2; // function entries and exits
+  constexpr int kTraceAccess = 3; // every memory access
+
+  // Verbosity from ETSAN_VERBOSITY, 0 (quiet) by default
+  static int verbosity = (int)getFlag("ETSAN_VERBOSITY", 0);
+
+#ifdef ETSAN_TRACE
+  struct TraceEvent {
+    TraceKind    kind;
+    const void  *addr;
+    int          lineNo;
+    const char  *name;
+  };
+
+  static std::mutex traceOutputLock;
+
+  // Returns the trace output stream, opened on first use
+  FILE * traceOutput() {
+    static FILE *out = nullptr;
+    if (!out) {
+      const char *path = getenv("ETSAN_TRACE_FILE");
+      out = path ? fopen(path, "a") : nullptr;
+      if (!out) out = stderr;
+    }
+    return out;
+  }
+
+#ifdef ETSAN_BINARY_REPORTS
+  // Binary stream on the trace output, see binary_report.h
+  BinaryWriter & traceBinaryOutput() {
+    static BinaryWriter writer(fileno(traceOutput()), false);
+    return writer;
+  }
+#endif
+
+  // Trace buffer of one thread
+  class TraceBuffer {
+  public:
+    static constexpr int kCapacity = 1024;
+
+    TraceEvent events[kCapacity];
+    int        size = 0;
+
+    void append(TraceKind kind, const void *addr, int lineNo,
+                const char *name) {
+      if (size == kCapacity) flush();
+      TraceEvent &e = events[size++];
+      e.kind   = kind;
+      e.addr   = addr;
+      e.lineNo = lineNo;
+      e.name   = name;
+    }
+
+    // Formats the buffered events and writes them out in one go
+    void flush() {
+      if (!size) return;
+      unsigned int tid = (unsigned int)pthread_self();
+
+      std::lock_guard<std::mutex> guard(traceOutputLock);
+#ifdef ETSAN_BINARY_REPORTS
+      BinaryWriter &out = traceBinaryOutput();
+      for (int i = 0; i < size; i++) {
+        const TraceEvent &e = events[i];
+        out.event(tid, e.kind, e.addr, e.lineNo, e.name);
+      }
+      out.flush();
+#else
+      FILE *out = traceOutput();
+      for (int i = 0; i < size; i++) {
+        const TraceEvent &e = events[i];
+        fprintf(out, "EmbedSanitizer: [%u] %s %p line %d %s\n", tid,
+                traceNames[e.kind], e.addr, e.lineNo,
+                e.name ? e.name : "");
+      }
+      fflush(out);
+#endif
+      size = 0;
+    }
+
+    ~TraceBuffer() { flush(); } // at thread exit
+  };
+
+  static thread_local TraceBuffer traceBuffer;
+
+  void traceEvent(int level, TraceKind kind, const void *addr,
+                  int lineNo, const char *name) {
+    if (verbosity >= level) {
+      traceBuffer.append(kind, addr, lineNo, name);
+    }
+  }
+#endif // ETSAN_TRACE
+
+} // etsan
+
+#ifdef ETSAN_TRACE
+#define trace_event(level, kind, addr, lineNo, name) \
+  etsan::traceEvent(level, kind, addr, lineNo, name)
+#else
+#define trace_event(level, kind, addr, lineNo, name) { }
+#endif
+
+#endif // ETSAN_TRACE_H_
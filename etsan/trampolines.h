@@ -0,0 +1,118 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Register-preserving entries of the memory access callbacks, called by
+// the code built with -mllvm -embedsan-preserve-registers: the trampoline
+// __etsan_pm_<callback> saves the registers the C convention lets the
+// callback clobber, calls it, and restores them. The instrumented loop
+// then keeps its values in registers across the call.
+//
+// ARM: called by an inline "bl" with the address in r0 and the site in
+// r1; everything is kept but r12 (ip, which veneers and PLT entries may
+// use too), lr and the flags. The VFP registers are saved as well, when
+// the runtime is built for an FPU: d0-d7, and d16-d31 with NEON.
+//
+// x86-64: the preserve_most convention, i.e. all but r11 and the flags;
+// the vector registers stay caller-saved, as preserve_most has them.
+//
+// Include once, in the translation unit of the callbacks.
+
+#ifndef ETSAN_TRAMPOLINES_H_
+#define ETSAN_TRAMPOLINES_H_
+
+#if defined(__arm__) && (defined(__thumb2__) || !defined(__thumb__))
+
+#ifdef __thumb2__
+#define ETSAN_TRAMPOLINE_MODE ".thumb\n\t.thumb_func\n"
+#else
+#define ETSAN_TRAMPOLINE_MODE ".arm\n"
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ETSAN_TRAMPOLINE_SAVE_VFP "vpush {d0-d7}\n\tvpush {d16-d31}\n\t"
+#define ETSAN_TRAMPOLINE_LOAD_VFP "vpop {d16-d31}\n\tvpop {d0-d7}\n\t"
+#elif defined(__ARM_FP)
+#define ETSAN_TRAMPOLINE_SAVE_VFP "vpush {d0-d7}\n\t"
+#define ETSAN_TRAMPOLINE_LOAD_VFP "vpop {d0-d7}\n\t"
+#else
+#define ETSAN_TRAMPOLINE_SAVE_VFP ""
+#define ETSAN_TRAMPOLINE_LOAD_VFP ""
+#endif
+
+// six words keep the stack 8-byte aligned for the callback
+#define ETSAN_TRAMPOLINE(callback)                                       \
+  asm(".syntax unified\n"                                                \
+      ".pushsection .text\n"                                             \
+      ".globl __etsan_pm_" #callback "\n"                                \
+      ".type __etsan_pm_" #callback ", %function\n"                      \
+      ".p2align 2\n"                                                     \
+      ETSAN_TRAMPOLINE_MODE                                              \
+      "__etsan_pm_" #callback ":\n\t"                                    \
+      "push {r0-r3, r12, lr}\n\t"                                        \
+      ETSAN_TRAMPOLINE_SAVE_VFP                                          \
+      "bl __tsan_" #callback "\n\t"                                      \
+      ETSAN_TRAMPOLINE_LOAD_VFP                                          \
+      "pop {r0-r3, r12, pc}\n"                                           \
+      ".size __etsan_pm_" #callback ", . - __etsan_pm_" #callback "\n" \
+      ".popsection\n");
+
+#elif defined(__x86_64__)
+
+// eight pushes and the return address: 8 more bytes align the stack
+#define ETSAN_TRAMPOLINE(callback)                                       \
+  asm(".pushsection .text\n"                                             \
+      ".globl __etsan_pm_" #callback "\n"                                \
+      ".type __etsan_pm_" #callback ", @function\n"                      \
+      ".p2align 4\n"                                                     \
+      "__etsan_pm_" #callback ":\n\t"                                    \
+      ".cfi_startproc\n\t"                                               \
+      "pushq %rax\n\tpushq %rcx\n\tpushq %rdx\n\tpushq %rsi\n\t"         \
+      "pushq %rdi\n\tpushq %r8\n\tpushq %r9\n\tpushq %r10\n\t"           \
+      "subq $8, %rsp\n\t"                                                \
+      ".cfi_adjust_cfa_offset 72\n\t"                                    \
+      "call __tsan_" #callback "@PLT\n\t"                                \
+      "addq $8, %rsp\n\t"                                                \
+      "popq %r10\n\tpopq %r9\n\tpopq %r8\n\tpopq %rdi\n\t"               \
+      "popq %rsi\n\tpopq %rdx\n\tpopq %rcx\n\tpopq %rax\n\t"             \
+      ".cfi_adjust_cfa_offset -72\n\t"                                   \
+      "ret\n\t"                                                          \
+      ".cfi_endproc\n"                                                   \
+      ".size __etsan_pm_" #callback ", . - __etsan_pm_" #callback "\n" \
+      ".popsection\n");
+
+#endif
+
+#ifdef ETSAN_TRAMPOLINE
+
+ETSAN_TRAMPOLINE(read1)
+ETSAN_TRAMPOLINE(read2)
+ETSAN_TRAMPOLINE(read4)
+ETSAN_TRAMPOLINE(read8)
+ETSAN_TRAMPOLINE(read16)
+ETSAN_TRAMPOLINE(write1)
+ETSAN_TRAMPOLINE(write2)
+ETSAN_TRAMPOLINE(write4)
+ETSAN_TRAMPOLINE(write8)
+ETSAN_TRAMPOLINE(write16)
+ETSAN_TRAMPOLINE(unaligned_read2)
+ETSAN_TRAMPOLINE(unaligned_read4)
+ETSAN_TRAMPOLINE(unaligned_read8)
+ETSAN_TRAMPOLINE(unaligned_read16)
+ETSAN_TRAMPOLINE(unaligned_write2)
+ETSAN_TRAMPOLINE(unaligned_write4)
+ETSAN_TRAMPOLINE(unaligned_write8)
+ETSAN_TRAMPOLINE(unaligned_write16)
+
+#undef ETSAN_TRAMPOLINE
+#endif
+
+#endif // ETSAN_TRAMPOLINES_H_
@@ -0,0 +1,282 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Tree clocks: vector clocks whose join and copy take time in the number
+// of entries that change, not in the number of threads (Mathur et al.,
+// "A Tree Clock Data Structure for Causal Orderings in Concurrent
+// Executions", ASPLOS 2022).
+//
+// Besides its epochs a tree clock keeps how it learned them: an entry u
+// hangs below the entry p it was learned through, with the epoch p had
+// then (its attach epoch), and children are ordered by attach epoch, most
+// recent first. A clock that knows p at that epoch knows u too, so a join
+// descends only into the entries it gains and stops at the first child
+// attached before what it already knows of the parent.
+//
+// The clock of a thread is rooted at the thread itself (own()): what it
+// acquires hangs below it, at its current epoch. Lock clocks and joins
+// into them are of no single thread; their entries hang from a virtual
+// root, which every join visits in full. Epochs set directly (set(),
+// push_back(), tests) hang from the virtual root as well, so the tree
+// stays correct as long as the clocks hold real happens-before orders:
+// a clock that knows an epoch of a thread knows all that thread knew
+// then.
+
+#ifndef ETSAN_TREE_CLOCK_H_
+#define ETSAN_TREE_CLOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <initializer_list>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace etsan {
+
+  template <typename Layout,
+            template <typename> class Alloc = std::allocator>
+  class TreeClock {
+  public:
+
+    using E = typename Layout::Type;
+
+    TreeClock() = default;
+
+    TreeClock(std::initializer_list<E> epochs) { *this = epochs; }
+
+    TreeClock & operator=(std::initializer_list<E> epochs) {
+      clear();
+      for (E e : epochs) push_back(e);
+      return *this;
+    }
+
+    size_t size() const { return clk.size(); }
+    bool empty() const { return clk.empty(); }
+
+    void reserve(size_t n) {
+      clk.reserve(n);
+      nodes.reserve(n);
+    }
+
+    // Grows the clock with the zero epochs of new threads; shrinking
+    // forgets everything
+    void resize(size_t n) {
+      if (n < size()) clear();
+      while (size() < n) {
+        clk.push_back(Layout::make(size(), 0));
+        nodes.push_back(Node());
+      }
+    }
+
+    void push_back(E epoch) {
+      clk.push_back(epoch);
+      nodes.push_back(Node());
+      if (Layout::clock(epoch)) attach(size() - 1, kVirtual, kNever);
+    }
+
+    void clear() {
+      clk.clear();
+      nodes.clear();
+      top = kNone;
+      root = kNone;
+    }
+
+    // Sets every entry to the zero epoch of its thread
+    void reset() {
+      for (size_t t = 0; t < size(); t++) {
+        clk[t] = Layout::make(t, 0);
+        nodes[t] = Node();
+      }
+      top = kNone;
+      root = kNone;
+    }
+
+    template <typename It>
+    void assign(It first, It last) {
+      clear();
+      for (; first != last; ++first) push_back(*first);
+    }
+
+    // Entries are read only: set() keeps the tree right
+    const E & operator[](size_t t) const { return clk[t]; }
+
+    const E & at(size_t t) const {
+      if (t >= size()) throw std::out_of_range("TreeClock::at");
+      return clk[t];
+    }
+
+    const E * begin() const { return clk.data(); }
+    const E * end() const { return clk.data() + clk.size(); }
+
+    // Roots the clock at thread "t", whose clock it is
+    void own(size_t t) {
+      detach(t);
+      attach(t, kVirtual, kNever);
+      root = t;
+    }
+
+    // Entry t := epoch. The increments of the owner cost nothing; others
+    // are taken as not learned from anyone.
+    void set(size_t t, E epoch) {
+      clk[t] = epoch;
+      if (int(t) == root) return;
+      detach(t);
+      attach(t, kVirtual, kNever);
+    }
+
+    // this := this U other
+    void join(const TreeClock & other) {
+      if (size() < other.size()) resize(other.size());
+      std::vector<int> & gained = updated(other);
+      for (int u : gained) {
+        if (u != root) detach(u);
+      }
+      // in reverse, so that each list ends up in the order of "other"
+      for (size_t i = gained.size(); i-- > 0;) {
+        int u = gained[i];
+        clk[u] = other.clk[u];
+        if (u == root) continue;
+        int parent = other.nodes[u].parent;
+        E since = other.nodes[u].attached;
+        if (parent == kVirtual && root != kNone) {
+          parent = root; // learned now, by the owner
+          since = clk[root];
+        }
+        attach(u, parent, since);
+      }
+    }
+
+    // this := other, where this <= other: this clock was copied from or
+    // joined into "other" before and had nothing else since
+    void copyLess(const TreeClock & other) {
+      if (size() < other.size()) resize(other.size());
+      std::vector<int> & gained = updated(other);
+      for (int u : gained) detach(u);
+      for (size_t i = gained.size(); i-- > 0;) {
+        int u = gained[i];
+        clk[u] = other.clk[u];
+        attach(u, other.nodes[u].parent, other.nodes[u].attached);
+      }
+      root = kNone;
+    }
+
+    // this := other
+    void copy(const TreeClock & other) {
+      clk = other.clk;
+      nodes = other.nodes;
+      top = other.top;
+      root = kNone;
+    }
+
+    // Returns true if this <= other for every thread
+    bool leq(const TreeClock & other) const {
+      for (size_t t = 0; t < size(); t++) {
+        E mine = clk[t];
+        E theirs = t < other.size() ? other.clk[t] : Layout::make(t, 0);
+        if (mine > theirs) return false;
+      }
+      return true;
+    }
+
+  private:
+
+    static constexpr int kNone    = -1; // no entry, or not in the tree
+    static constexpr int kVirtual = -2; // the virtual root
+    // Attach epoch of the entries of the virtual root: none is known
+    static constexpr E kNever = std::numeric_limits<E>::max();
+
+    struct Node {
+      int parent = kNone;
+      int first  = kNone; // children, most recently attached first
+      int next   = kNone;
+      int prev   = kNone;
+      E   attached = 0;   // epoch of the parent when attached
+    };
+
+    std::vector<E, Alloc<E>>       clk;
+    std::vector<Node, Alloc<Node>> nodes;
+    int top  = kNone;  // first child of the virtual root
+    int root = kNone;  // the owner thread, if any
+
+    int & firstChild(int parent) {
+      return parent == kVirtual ? top : nodes[parent].first;
+    }
+
+    // Puts "u" first among the children of "parent"
+    void attach(int u, int parent, E since) {
+      Node & n = nodes[u];
+      int & first = firstChild(parent);
+      n.parent = parent;
+      n.attached = since;
+      n.prev = kNone;
+      n.next = first;
+      if (first != kNone) nodes[first].prev = u;
+      first = u;
+    }
+
+    // Takes "u", with its subtree, out of the list of its parent
+    void detach(int u) {
+      Node & n = nodes[u];
+      if (n.parent == kNone) return;
+      if (n.prev != kNone) nodes[n.prev].next = n.next;
+      else firstChild(n.parent) = n.next;
+      if (n.next != kNone) nodes[n.next].prev = n.prev;
+      n.parent = n.prev = n.next = kNone;
+    }
+
+    // The entries of "other" greater than those of this clock, parents
+    // before their children. Descends only into these entries, and in
+    // each list stops at the first child attached no later than this
+    // clock knows the parent. It always descends into the owner, as a
+    // thread given the clock slot of a joined one (see reuseThreadSlot)
+    // starts past the epochs of that thread before it knows them.
+    std::vector<int> & updated(const TreeClock & other) const {
+      static thread_local std::vector<int> gained, lists, parents;
+      gained.clear();
+      lists.assign(1, other.top); // the rest of each list being visited
+      parents.assign(1, kVirtual);
+
+      while (!lists.empty()) {
+        int u = lists.back();
+        int parent = parents.back();
+        if (u == kNone) {
+          lists.pop_back();
+          parents.pop_back();
+          continue;
+        }
+        lists.back() = other.nodes[u].next;
+        if (clk[u] < other.clk[u] || u == root) {
+          if (clk[u] < other.clk[u]) gained.push_back(u);
+          lists.push_back(other.nodes[u].first);
+          parents.push_back(u);
+        } else if (parent != kVirtual &&
+                   other.nodes[u].attached <= clk[parent]) {
+          lists.back() = kNone; // the older siblings are known too
+        }
+      }
+      return gained;
+    }
+  };
+
+  template <typename Layout, template <typename> class Alloc>
+  constexpr int TreeClock<Layout, Alloc>::kNone;
+  template <typename Layout, template <typename> class Alloc>
+  constexpr int TreeClock<Layout, Alloc>::kVirtual;
+  template <typename Layout, template <typename> class Alloc>
+  constexpr typename Layout::Type TreeClock<Layout, Alloc>::kNever;
+
+} // etsan
+
+#endif // ETSAN_TREE_CLOCK_H_
@@ -15,342 +15,473 @@
 #include "fasttrack.h"
 #include "race_report.h"
 #include "defs.h"
+#include "trace.h"
+#include "suppressions.h"
+#include "trampolines.h"
+#include "live_stats.h"
+#include "watchpoints.h"
+#ifdef ETSAN_SAMPLING
+#include "sampling.h"
+#endif
+#ifdef ETSAN_RECORD
+#include "event_log.h"
+#endif
+#ifdef ETSAN_SITE_PROFILE
+#if defined(ETSAN_BATCHED_ACCESSES) || defined(ETSAN_RECORD)
+#error "ETSAN_SITE_PROFILE profiles accesses checked as they happen"
+#endif
+#include "site_profile.h"
+#endif
+
+#include <signal.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <mutex>
 
 typedef unsigned long uptr; // NOLINT
 #define CALLERPC ((uptr)__builtin_return_address(0))
 
-void __tsan_init()
+static_assert(int(etsan::ModeFull) == __etsan_mode_full &&
+              int(etsan::ModeSyncOnly) == __etsan_mode_sync_only &&
+              int(etsan::ModeOff) == __etsan_mode_off,
+              "detection modes differ from those of tsan_interface.h");
+
+int __etsan_set_mode(int mode)
 {
+  if (mode < etsan::ModeFull || mode > etsan::ModeOff) return -1;
+  std::lock_guard<etsan::RuntimeMutex> guard(TS.mGuard);
+  int previous = detectionMode.exchange(mode);
+  publishConcurrent();
+  return previous;
+}
 
-  // create metadata for current thread
-  // ThreadState& st = getThreadState();
-  printf("EmbedSanitizer initializing\n");
-  //printf("Parent thread: %u = %d\n", (unsigned)pthread_self(), st.tid);
+int __etsan_get_mode()
+{
+  return detectionMode;
 }
 
-void __tsan_main_func_exit()
+void __etsan_mark_readonly(const void *addr, unsigned long size)
 {
-  etsan::printRaces();
+  etsan::frozenRegions.freeze(addr, size);
 }
 
-// 1. Callbacks for memory accesses
-void __tsan_read1(void *addr,
-                  int lineNo,
-                  void *objName,
-                  void *fileName)
+int __etsan_watch(const void *addr, unsigned long size, const char *name)
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_read(getVarState(addr, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnRead(lineNo, objName, fileName);
-    }
-  }
-  //  MemoryRead(cur_thread(), CALLERPC, (uptr)addr, kSizeLog1);
+  return etsan::watchpoints.watch(addr, size, name);
 }
 
-void __tsan_read2(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+int __etsan_unwatch(const void *addr)
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_read(getVarState(addr, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnRead(lineNo, objName, fileName);
-    }
-  }
+  return etsan::watchpoints.unwatch(addr);
 }
 
-void __tsan_read4(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+// Switches between full and sync-only detection on ETSAN_MODE_SIGNAL
+static void toggleDetectionMode(int)
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_read(getVarState(addr, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnRead(lineNo, objName, fileName);
-    }
-  }
+  int mode = detectionMode;
+  __etsan_set_mode(mode == etsan::ModeFull ? etsan::ModeSyncOnly
+                                           : etsan::ModeFull);
 }
 
-void __tsan_read8(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+// Totals of the live statistics page, see live_stats.h. The counters of
+// the running threads are read while they count.
+static void collectLiveStats(etsan::LiveStatsPage &page)
 {
-  if (isConcurrent)
+  etsan::ThreadStats total;
+  TS.mGuard.lock(); // protect
+  total = TS.retired;
+  for (auto &thread : TS.C)
   {
-    bool isRace = ft_read(getVarState(addr, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnRead(lineNo, objName, fileName);
-    }
+    const etsan::ThreadStats &stats = thread.second.stats;
+    for (int c = 0; c < etsan::NumStatCounters; c++)
+      total.counter[c] += __atomic_load_n(&stats.counter[c], __ATOMIC_RELAXED);
   }
+  page.threads = TS.C.size();
+  page.threadsCreated = TS.created;
+  TS.mGuard.unlock(); // release protection
+
+  page.reads = total.get(etsan::StatReads);
+  page.writes = total.get(etsan::StatWrites);
+  page.sameEpoch = total.get(etsan::StatReadSameEpoch) +
+                   total.get(etsan::StatWriteSameEpoch);
+  page.evictions = total.get(etsan::StatEvictions);
+  page.metadataBytes = etsan::metadataArena.bytes();
+  page.races = etsan::raceReporter.numReported();
+
+  std::lock_guard<etsan::RuntimeMutex> guard(LS.mGuard);
+  page.locks = LS.L.size();
 }
 
-void __tsan_read16(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+// Expected sizes of the program, to reserve the metadata for: up to
+// ETSAN_MAX_THREADS threads at once, ETSAN_MAX_VARS variables and
+// ETSAN_MAX_LOCKS locks. More only cost regrowing.
+static void initRuntime()
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_read(getVarState(addr, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnRead(lineNo, objName, fileName);
-    }
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int signo = (int)etsan::getFlag("ETSAN_MODE_SIGNAL", 0);
+  if (signo) signal(signo, toggleDetectionMode);
+
+  reserveMetadata(etsan::getFlag("ETSAN_MAX_THREADS", 64),
+                  etsan::getFlag("ETSAN_MAX_VARS", 1 << 14),
+                  etsan::getFlag("ETSAN_MAX_LOCKS", 256));
+
+  const char *watched = getenv("ETSAN_WATCH");
+  if (watched && *watched) etsan::watchpoints.watchAll(watched);
+
+  const char *liveStats = getenv("ETSAN_LIVE_STATS");
+  if (liveStats && *liveStats &&
+      !etsan::liveStats.start(liveStats,
+                              etsan::getFlag("ETSAN_LIVE_STATS_MS", 1000),
+                              collectLiveStats))
+    perror(liveStats);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (etsan::verbosity) {
+    printf("EmbedSanitizer initialized in %.3f ms\n",
+           (end.tv_sec - start.tv_sec) * 1e3 +
+           (end.tv_nsec - start.tv_nsec) / 1e6);
   }
 }
 
-void __tsan_write1(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+// Called by the constructor of each instrumented module, after those of
+// the runtime's structures (ETSAN_EARLY_INIT); the first call sets up
+void __tsan_init()
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_write(getVarState(addr, true), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
-    }
-  }
+  static std::once_flag initialized;
+  std::call_once(initialized, initRuntime);
 }
 
-void __tsan_write2(void *addr,
-                   int lineNo,
-                   void *objName,
-                   void *fileName)
+void __tsan_main_func_exit()
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_write(getVarState(addr, true), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
-    }
-  }
+#ifdef ETSAN_RECORD
+  etsan::threadLog((ThreadID)pthread_self()).close();
+#endif
+  ft_flush_accesses(getThreadState());
+  etsan::printRaces();
+#ifdef ETSAN_SITE_PROFILE
+  etsan::printSiteProfile();
+#endif
+#ifdef ETSAN_LOCK_PROFILE
+  etsan::printLockProfile();
+#endif
 }
 
-void __tsan_write4(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+unsigned int __tsan_register_sites(const void *sites, unsigned int count,
+                                   const char *const *files,
+                                   unsigned int numFiles)
 {
-  printf("EmbedSanitizer: Memory write at line: %p\n", CALLERPC);
-  if (isConcurrent)
-  {
-    bool isRace = ft_write(getVarState(addr, true), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
-    }
-  }
+  unsigned int base =
+      etsan::registerSites(static_cast<const etsan::SiteInfo *>(sites),
+                           count, files, numFiles);
+  unsigned int suppressed =
+      etsan::suppressSites(base, count, etsan::suppressions()) +
+      etsan::raceDb().suppressKnownSites(base, count);
+  if (etsan::verbosity && suppressed)
+    printf("EmbedSanitizer: %u of %u sites suppressed\n", suppressed, count);
+  return base;
 }
 
-void __tsan_write8(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+// Returns true if the access at "siteId" is checked: in full mode, unless
+// the site is suppressed (see suppressions.h) or ETSAN_SAMPLING samples
+// accesses (see sampling.h)
+static inline bool checkAccess(unsigned int siteId)
 {
-  if (isConcurrent)
+  if (detectionMode.load(std::memory_order_relaxed) != etsan::ModeFull)
+    return false;
+  if (etsan::isSuppressed(siteId)) return false;
+#ifdef ETSAN_SAMPLING
+  if (!etsan::sampler.sample(siteId))
   {
-    bool isRace = ft_write(getVarState(addr, true), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
-    }
+    getThreadState().stats.inc(etsan::StatSampledOut);
+    return false;
   }
+#endif
+  return true;
 }
 
-void __tsan_write16(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+// Returns true if synchronization is tracked: unless detection is off.
+// Each synchronization also brings the watchpoints of the thread up to
+// date, see watchpoints.h.
+static inline bool tracksSync()
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_write(getVarState(addr, true), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
-    }
-  }
+  etsan::watchpoints.refresh();
+  return detectionMode.load(std::memory_order_relaxed) != etsan::ModeOff;
 }
 
-// 2. Callbacks for unaligned memory accesses
-void __tsan_unaligned_read2(
-    const void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+#if defined(ETSAN_LOCKSET) && !defined(ETSAN_RECORD)
+// Keeps the lockset of the thread, see lockset.h, whether detection is on
+// or not: a lock released while it is off no longer guards afterwards
+static inline void holdLock(void *lock)
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_read(getVarState(addr, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnRead(lineNo, objName, fileName);
-    }
-  }
+  getThreadState().held |= getLockState(lock).bit;
 }
 
-void __tsan_unaligned_read4(
-    const void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+static inline void dropLock(void *lock)
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_read(getVarState(addr, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnRead(lineNo, objName, fileName);
-    }
-  }
+  getThreadState().held &= ~getLockState(lock).bit;
 }
+#else
+#define holdLock(lock) { }
+#define dropLock(lock) { }
+#endif
 
-void __tsan_unaligned_read8(
-    const void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+#ifdef ETSAN_RECORD
+// Appends a sync record to the log of the thread instead of doing it,
+// see event_log.h. Forks and joins still count the threads, which the
+// access callbacks test: without states, a thread runs until its join.
+static void recordSync(etsan::LogTag tag, uint64_t object, uint64_t arg)
 {
-  if (isConcurrent)
-  {
-    bool isRace = ft_read(getVarState(addr, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnRead(lineNo, objName, fileName);
-    }
+  if (tag == etsan::LogFork || tag == etsan::LogJoin) {
+    std::lock_guard<etsan::RuntimeMutex> guard(TS.mGuard);
+    if (tag == etsan::LogFork) liveThreads++;
+    else if (liveThreads) liveThreads--;
+    publishConcurrent();
   }
+  etsan::threadLog((ThreadID)pthread_self()).sync(tag, object, arg);
 }
 
-void __tsan_unaligned_read16(
-    const void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+#define record_sync(tag, object, arg) \
+  { recordSync(etsan::tag, (uintptr_t)(object), arg); return; }
+#else
+#define record_sync(tag, object, arg) { }
+#endif
+
+// Checks a read of "Size" bytes at "addr", aligned to "Align" bytes, or
+// with ETSAN_BATCHED_ACCESSES queues it to be checked at the next
+// synchronization (access_batch.h). ETSAN_RECORD logs it instead. "pc"
+// is the return address of the callback, where the stack of a race starts
+// with ETSAN_UNWIND_STACKS.
+template <size_t Size, size_t Align>
+static inline void checkRead(const void *addr, unsigned int siteId,
+                             const void *pc)
 {
-  if (isConcurrent)
+  void *p = const_cast<void *>(addr);
+#if defined(ETSAN_RECORD)
+  etsan::threadLog((ThreadID)pthread_self()).access(false, p, Size, siteId);
+#elif defined(ETSAN_BATCHED_ACCESSES)
+  ft_batch_access(p, Size, false, siteId, getThreadState());
+#else
+  ThreadState &t = getThreadState();
+#ifdef ETSAN_SITE_PROFILE
+  etsan::ProfiledAccess profiled(siteId, t.stats, etsan::StatReadSameEpoch);
+#endif
+  bool isRace = ft_read_sized<Size, Align>(p, t);
+  if (isRace)
   {
-    bool isRace = ft_read(getVarState(addr, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnRead(lineNo, objName, fileName);
-    }
+    etsan::reportRaceOnRead(siteId, pc);
   }
+#endif
 }
 
-void __tsan_unaligned_write2(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+template <size_t Size, size_t Align>
+static inline void checkWrite(const void *addr, unsigned int siteId,
+                              const void *pc)
 {
-  if (isConcurrent)
+  void *p = const_cast<void *>(addr);
+#if defined(ETSAN_RECORD)
+  etsan::threadLog((ThreadID)pthread_self()).access(true, p, Size, siteId);
+#elif defined(ETSAN_BATCHED_ACCESSES)
+  ft_batch_access(p, Size, true, siteId, getThreadState());
+#else
+  ThreadState &t = getThreadState();
+#ifdef ETSAN_SITE_PROFILE
+  etsan::ProfiledAccess profiled(siteId, t.stats, etsan::StatWriteSameEpoch);
+#endif
+  bool isRace = ft_write_sized<Size, Align>(p, t);
+  if (isRace)
   {
-    bool isRace = ft_write(getVarState(addr, true), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
-    }
+    etsan::reportRaceOnWrite(siteId, pc);
   }
+#endif
 }
 
-void __tsan_unaligned_write4(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+// Checks an access which trapped on a watched variable, see watchpoints.h:
+// in sync-only mode too, which only the watched accesses get past. Also
+// once no other thread runs, as the trap may be checked after the others
+// exited; the check is rare enough not to need isConcurrent.
+void etsan::checkWatchedAccess(const void *addr, size_t size,
+                               const char *name, const char *location,
+                               bool isWrite)
 {
-  if (isConcurrent)
+  if (detectionMode.load(std::memory_order_relaxed) == etsan::ModeOff)
+    return;
+  void *p = const_cast<void *>(addr);
+#ifdef ETSAN_RECORD
+  etsan::threadLog((ThreadID)pthread_self()).access(isWrite, p, size, 0);
+#else
+  ThreadState &t = getThreadState();
+  bool isRace = isWrite ? ft_write_access(p, size, t)
+                        : ft_read_access(p, size, t);
+  if (isRace) etsan::reportWatchedRace(name, location, isWrite);
+#endif
+}
+
+#ifdef ETSAN_BATCHED_ACCESSES
+void reportBatchedRace(unsigned int siteId, bool isWrite)
+{
+  if (isWrite)
+    etsan::reportRaceOnWrite(siteId);
+  else
+    etsan::reportRaceOnRead(siteId);
+}
+#endif
+
+// Body of the access callbacks: one instance per access kind, size and
+// alignment, so that the granules an access touches are resolved at
+// compile time, see ft_read_sized
+template <bool IsWrite, size_t Size, size_t Align>
+static inline void onAccess(const void *addr, unsigned int siteId,
+                            const void *pc)
+{
+  trace_event(etsan::kTraceAccess,
+              IsWrite ? etsan::TraceWrite : etsan::TraceRead, addr,
+              etsan::getSite(siteId).line(), etsan::getSite(siteId).objName);
+  if (isConcurrent && checkAccess(siteId))
   {
-    bool isRace = ft_write(getVarState(addr, true), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
-    }
+    if (IsWrite)
+      checkWrite<Size, Align>(addr, siteId, pc);
+    else
+      checkRead<Size, Align>(addr, siteId, pc);
   }
 }
 
-void __tsan_unaligned_write8(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+#define ETSAN_ACCESS_CALLBACK(name, ptr, isWrite, size, align)   \
+  void name(ptr addr, unsigned int siteId)                       \
+  {                                                              \
+    onAccess<isWrite, size, align>(addr, siteId,                 \
+                                   __builtin_return_address(0)); \
+  }
+
+// 1. Callbacks for memory accesses. LLVM emits them for accesses aligned
+// to their size, or to 8 bytes for the 16-byte ones.
+ETSAN_ACCESS_CALLBACK(__tsan_read1, void *, false, 1, 1)
+ETSAN_ACCESS_CALLBACK(__tsan_read2, void *, false, 2, 2)
+ETSAN_ACCESS_CALLBACK(__tsan_read4, void *, false, 4, 4)
+ETSAN_ACCESS_CALLBACK(__tsan_read8, void *, false, 8, 8)
+ETSAN_ACCESS_CALLBACK(__tsan_read16, void *, false, 16, 8)
+
+ETSAN_ACCESS_CALLBACK(__tsan_write1, void *, true, 1, 1)
+ETSAN_ACCESS_CALLBACK(__tsan_write2, void *, true, 2, 2)
+ETSAN_ACCESS_CALLBACK(__tsan_write4, void *, true, 4, 4)
+ETSAN_ACCESS_CALLBACK(__tsan_write8, void *, true, 8, 8)
+ETSAN_ACCESS_CALLBACK(__tsan_write16, void *, true, 16, 8)
+
+// 2. Callbacks for unaligned memory accesses
+ETSAN_ACCESS_CALLBACK(__tsan_unaligned_read2, const void *, false, 2, 1)
+ETSAN_ACCESS_CALLBACK(__tsan_unaligned_read4, const void *, false, 4, 1)
+ETSAN_ACCESS_CALLBACK(__tsan_unaligned_read8, const void *, false, 8, 1)
+ETSAN_ACCESS_CALLBACK(__tsan_unaligned_read16, const void *, false, 16, 1)
+
+ETSAN_ACCESS_CALLBACK(__tsan_unaligned_write2, void *, true, 2, 1)
+ETSAN_ACCESS_CALLBACK(__tsan_unaligned_write4, void *, true, 4, 1)
+ETSAN_ACCESS_CALLBACK(__tsan_unaligned_write8, void *, true, 8, 1)
+ETSAN_ACCESS_CALLBACK(__tsan_unaligned_write16, void *, true, 16, 1)
+
+#undef ETSAN_ACCESS_CALLBACK
+
+// 2b. Callbacks for ranges of memory
+void __tsan_read_range(const void *addr, unsigned long size,
+                       unsigned int siteId)
 {
-  if (isConcurrent)
+  trace_event(etsan::kTraceAccess, etsan::TraceRead, addr, etsan::getSite(siteId).line(),
+              etsan::getSite(siteId).objName);
+  if (isConcurrent && size && checkAccess(siteId))
   {
-    bool isRace = ft_write(getVarState(addr, true), getThreadState());
+#ifdef ETSAN_RECORD
+    etsan::threadLog((ThreadID)pthread_self()).access(false, addr, size,
+                                                      siteId, true);
+    return;
+#endif
+    ThreadState &t = getThreadState();
+#ifdef ETSAN_SITE_PROFILE
+    etsan::ProfiledAccess profiled(siteId, t.stats, etsan::StatReadSameEpoch);
+#endif
+    bool isRace = ft_read_range(addr, size, t);
     if (isRace)
     {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
+      etsan::reportRaceOnRead(siteId, __builtin_return_address(0));
     }
   }
 }
 
-void __tsan_unaligned_write16(
-    void *addr,
-    int lineNo,
-    void *objName,
-    void *fileName)
+void __tsan_write_range(void *addr, unsigned long size,
+                        unsigned int siteId)
 {
-  if (isConcurrent)
+  trace_event(etsan::kTraceAccess, etsan::TraceWrite, addr, etsan::getSite(siteId).line(),
+              etsan::getSite(siteId).objName);
+  if (isConcurrent && size && checkAccess(siteId))
   {
-    bool isRace = ft_write(getVarState(addr, true), getThreadState());
+#ifdef ETSAN_RECORD
+    etsan::threadLog((ThreadID)pthread_self()).access(true, addr, size,
+                                                      siteId, true);
+    return;
+#endif
+    ThreadState &t = getThreadState();
+#ifdef ETSAN_SITE_PROFILE
+    etsan::ProfiledAccess profiled(siteId, t.stats, etsan::StatWriteSameEpoch);
+#endif
+    bool isRace = ft_write_range(addr, size, t);
     if (isRace)
     {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
+      etsan::reportRaceOnWrite(siteId, __builtin_return_address(0));
     }
   }
 }
 
-// 3. Callbacks for virtual pointer accesses
+void *__tsan_memset(void *addr, int c, unsigned long size,
+                    unsigned int siteId)
+{
+  __tsan_write_range(addr, size, siteId);
+  return memset(addr, c, size);
+}
+
+void *__tsan_memcpy(void *dst, const void *src, unsigned long size,
+                    unsigned int siteId)
+{
+  __tsan_read_range(src, size, siteId);
+  __tsan_write_range(dst, size, siteId);
+  return memcpy(dst, src, size);
+}
+
+void *__tsan_memmove(void *dst, const void *src, unsigned long size,
+                     unsigned int siteId)
+{
+  __tsan_read_range(src, size, siteId);
+  __tsan_write_range(dst, size, siteId);
+  return memmove(dst, src, size);
+}
+
+// 3. Callbacks for virtual pointer accesses, as ThreadSanitizer has
+// them: a load of a vptr is a read, and a store only counts as a write
+// if it changes the vptr. The constructors and destructors of a class
+// hierarchy store each vptr once per level, mostly the value already
+// there; a store of a new value, e.g. a destructor running while
+// another thread makes a virtual call, races with the loads.
 void __tsan_vptr_read(void **vptr_p,
-                      int lineNo,
-                      void *objName,
-                      void *fileName)
+                      unsigned int siteId)
 {
-  if (isConcurrent)
+  trace_event(etsan::kTraceAccess, etsan::TraceRead, vptr_p, etsan::getSite(siteId).line(),
+              etsan::getSite(siteId).objName);
+  if (isConcurrent && checkAccess(siteId))
   {
-    bool isRace = ft_write(getVarState(vptr_p, false), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
-    }
+    checkRead<sizeof(void *), sizeof(void *)>(vptr_p, siteId,
+                                              __builtin_return_address(0));
   }
 }
 
 void __tsan_vptr_update(void **vptr_p, void *new_val,
-                        int lineNo,
-                        void *objName,
-                        void *fileName)
+                        unsigned int siteId)
 {
-  if (isConcurrent)
+  trace_event(etsan::kTraceAccess, etsan::TraceWrite, vptr_p, etsan::getSite(siteId).line(),
+              etsan::getSite(siteId).objName);
+  if (isConcurrent && checkAccess(siteId) &&
+      __atomic_load_n(vptr_p, __ATOMIC_RELAXED) != new_val)
   {
-    bool isRace = ft_write(getVarState(vptr_p, true), getThreadState());
-    if (isRace)
-    {
-      etsan::reportRaceOnWrite(lineNo, objName, fileName);
-    }
+    checkWrite<sizeof(void *), sizeof(void *)>(vptr_p, siteId,
+                                               __builtin_return_address(0));
   }
 }
 
@@ -358,49 +489,618 @@ void __tsan_vptr_update(void **vptr_p, void *new_val,
 void __tsan_thread_create(void *childIdAddr)
 {
   unsigned int child_id = *((unsigned int *)childIdAddr);
-  unsigned int parent_id = (unsigned int)pthread_self();
-  ft_fork(getState(parent_id), getState(child_id));
+  trace_event(etsan::kTraceSync, etsan::TraceFork, childIdAddr, 0, nullptr);
+  record_sync(LogFork, child_id, 0);
+  ThreadState & parent = getThreadState();
+  etsan::watchpoints.checkTraps();
+  ft_fork(parent, getState(child_id, &parent));
+}
+
+// What __etsan_thread_create hands over to the child
+struct ThreadStart {
+  void *(*routine)(void *);
+  void *arg;
+  ThreadID key; // of the child's state in TS.C until it starts
+};
+
+// Entry of the threads of __etsan_thread_create: files the state its
+// parent made under the id of the thread, and caches it
+static void *startThread(void *p)
+{
+  ThreadStart start = *static_cast<ThreadStart *>(p);
+  delete static_cast<ThreadStart *>(p);
+  installThreadState(adoptThreadState(start.key, (ThreadID)pthread_self()));
+  etsan::watchpoints.refresh();
+  void *ret = start.routine(start.arg);
+  etsan::watchpoints.checkTraps(); // before the parent joins it
+  return ret;
+}
+
+int __etsan_thread_create(void *thread, const void *attr,
+                          void *(*routine)(void *), void *arg)
+{
+  pthread_t *child = static_cast<pthread_t *>(thread);
+  const pthread_attr_t *childAttr = static_cast<const pthread_attr_t *>(attr);
+#ifdef ETSAN_RECORD
+  // the log numbers the fork after the call, as __tsan_thread_create
+  int ret = pthread_create(child, childAttr, routine, arg);
+  if (!ret) __tsan_thread_create(child);
+  return ret;
+#else
+  // odd, unlike the pthread_t of a thread
+  static std::atomic<ThreadID> provisional{0};
+  ThreadStart *start = new ThreadStart{routine, arg, 0};
+  start->key = (provisional.fetch_add(1) << 1) | 1;
+
+  trace_event(etsan::kTraceSync, etsan::TraceFork, thread, 0, nullptr);
+  ThreadState & parent = getThreadState();
+  etsan::watchpoints.checkTraps();
+  ft_fork(parent, getState(start->key, &parent));
+
+  int ret = pthread_create(child, childAttr, startThread, start);
+  if (ret) { // no child: forget its state, which stops running
+    retireThread(start->key);
+    delete start;
+  }
+  return ret;
+#endif
 }
 
 void __tsan_thread_join(void *childIdAddr)
 {
 
   unsigned int child_id = reinterpret_cast<unsigned int>(childIdAddr);
-  unsigned int parent_id = (unsigned int)pthread_self();
-  ft_join(getState(parent_id), getState(child_id));
+  trace_event(etsan::kTraceSync, etsan::TraceJoin, childIdAddr, 0, nullptr);
+  record_sync(LogJoin, child_id, 0);
+  etsan::watchpoints.checkTraps();
+  ft_join(getThreadState(), getJoinedState(child_id));
+  retireThread(child_id); // its clock slot may now be reused
 }
 
 void __tsan_thread_lock(void *lock)
 {
+  holdLock(lock);
+  if (!tracksSync()) return;
+  trace_event(etsan::kTraceSync, etsan::TraceLock, lock, 0, nullptr);
+  record_sync(LogAcquire, lock, 0);
   ft_acquire(getThreadState(), getLockState(lock));
 }
 
 void __tsan_thread_unlock(void *lock)
 {
+  dropLock(lock);
+  if (!tracksSync()) return;
+  trace_event(etsan::kTraceSync, etsan::TraceUnlock, lock, 0, nullptr);
+  record_sync(LogRelease, lock, 0);
   ft_release(getThreadState(), getLockState(lock));
 }
 
+// A signal releases into the clock of the condition variable; the
+// waiters woken up acquire it and then relock their mutex. Signals join
+// instead of copying, since a waiter may be woken up by any of them.
+void __tsan_cond_signal(void *cond)
+{
+  if (!tracksSync()) return;
+  trace_event(etsan::kTraceSync, etsan::TraceUnlock, cond, 0, nullptr);
+  record_sync(LogReleaseJoin, cond, 0);
+  ft_release_join(getThreadState(), getLockState(cond));
+}
+
+void __tsan_cond_wait(void *cond, void *mutex)
+{
+  holdLock(mutex);
+  if (!tracksSync()) return;
+  trace_event(etsan::kTraceSync, etsan::TraceLock, cond, 0, nullptr);
+#ifdef ETSAN_RECORD
+  recordSync(etsan::LogAcquire, (uintptr_t)cond, 0);
+  record_sync(LogAcquire, mutex, 0);
+#endif
+  ThreadState &t = getThreadState();
+  ft_acquire(t, getLockState(cond));
+  ft_acquire(t, getLockState(mutex));
+}
+
+void __tsan_rwlock_rdlock(void *rwlock)
+{
+  if (!tracksSync()) return;
+  trace_event(etsan::kTraceSync, etsan::TraceLock, rwlock, 0, nullptr);
+  record_sync(LogAcquire, rwlock, 0);
+  ft_acquire(getThreadState(), getLockState(rwlock));
+}
+
+// Readers share the lock: only writers hold it in their lockset
+void __tsan_rwlock_wrlock(void *rwlock)
+{
+  holdLock(rwlock);
+  if (!tracksSync()) return;
+  trace_event(etsan::kTraceSync, etsan::TraceLock, rwlock, 0, nullptr);
+  record_sync(LogWriteAcquire, rwlock, 0);
+  ft_write_acquire(getThreadState(), getLockState(rwlock));
+}
+
+void __tsan_rwlock_unlock(void *rwlock)
+{
+  dropLock(rwlock);
+  if (!tracksSync()) return;
+  trace_event(etsan::kTraceSync, etsan::TraceUnlock, rwlock, 0, nullptr);
+  record_sync(LogRwRelease, rwlock, 0);
+  ft_rw_release(getThreadState(), getLockState(rwlock));
+}
+
+void __tsan_barrier_init(void *barrier, unsigned int count)
+{
+  record_sync(LogBarrierInit, barrier, count);
+  BarrierState &b = getBarrierState(barrier);
+  std::lock_guard<std::mutex> guard(b.mGuard);
+  b.count   = count;
+  b.arrived = 0;
+}
+
+unsigned int __tsan_barrier_arrive(void *barrier)
+{
+  trace_event(etsan::kTraceSync, etsan::TraceUnlock, barrier, 0, nullptr);
+#ifdef ETSAN_RECORD
+  recordSync(etsan::LogBarrierArrive, (uintptr_t)barrier, 0);
+  return 0; // the analyzer keeps the episodes
+#endif
+  etsan::watchpoints.checkTraps();
+  return ft_barrier_arrive(getThreadState(), getBarrierState(barrier));
+}
+
+void __tsan_barrier_depart(void *barrier, unsigned int episode)
+{
+  trace_event(etsan::kTraceSync, etsan::TraceLock, barrier, 0, nullptr);
+  record_sync(LogBarrierDepart, barrier, 0);
+  etsan::watchpoints.checkTraps();
+  ft_barrier_depart(getThreadState(), getBarrierState(barrier), episode);
+}
+
+// Posts join, as concurrent posts may each let a waiter in
+void __tsan_sem_post(void *sem)
+{
+  if (!tracksSync()) return;
+  trace_event(etsan::kTraceSync, etsan::TraceUnlock, sem, 0, nullptr);
+  record_sync(LogReleaseJoin, sem, 0);
+  ft_release_join(getThreadState(), getLockState(sem));
+}
+
+void __tsan_sem_wait(void *sem)
+{
+  if (!tracksSync()) return;
+  trace_event(etsan::kTraceSync, etsan::TraceLock, sem, 0, nullptr);
+  record_sync(LogAcquire, sem, 0);
+  ft_acquire(getThreadState(), getLockState(sem));
+}
+
+// 5. Callbacks for atomic operations
+//
+// Each operation is done for real, sequentially consistent whatever its
+// memory order: stronger than asked, never weaker. Acquires and releases
+// are modeled on the sync clock of the atomic location, as on locks;
+// relaxed operations and single threaded programs skip the clocks.
+
+static inline bool isAcquire(__tsan_memory_order mo)
+{
+  return mo != __tsan_memory_order_relaxed &&
+         mo != __tsan_memory_order_release;
+}
+
+static inline bool isRelease(__tsan_memory_order mo)
+{
+  return mo == __tsan_memory_order_release ||
+         mo == __tsan_memory_order_acq_rel ||
+         mo == __tsan_memory_order_seq_cst;
+}
+
+// Acquire part of an operation on "a", after the operation
+static inline void atomicAcquire(const volatile void *a,
+                                 __tsan_memory_order mo)
+{
+  if (isConcurrent && isAcquire(mo) && tracksSync())
+  {
+    record_sync(LogAcquire, a, 0);
+    ft_acquire(getThreadState(), getLockState((Address)a));
+  }
+}
+
+// Release part of an operation on "a", before the operation, so that
+// a thread that sees its effect also gets the clock. Stores replace
+// the clock, read-modify-writes add to it (release sequences).
+static inline void atomicRelease(const volatile void *a,
+                                 __tsan_memory_order mo, bool isStore)
+{
+  if (isConcurrent && isRelease(mo) && tracksSync())
+  {
+#ifdef ETSAN_RECORD
+    recordSync(isStore ? etsan::LogRelease : etsan::LogReleaseJoin,
+               (uintptr_t)a, 0);
+    return;
+#endif
+    if (isStore)
+      ft_release(getThreadState(), getLockState((Address)a));
+    else
+      ft_release_join(getThreadState(), getLockState((Address)a));
+  }
+}
+
+template <typename T>
+static inline T atomicLoad(const volatile T *a, __tsan_memory_order mo)
+{
+  T v = __atomic_load_n(a, __ATOMIC_SEQ_CST);
+  atomicAcquire(a, mo);
+  return v;
+}
+
+template <typename T>
+static inline void atomicStore(volatile T *a, T v, __tsan_memory_order mo)
+{
+  atomicRelease(a, mo, true);
+  __atomic_store_n(a, v, __ATOMIC_SEQ_CST);
+}
+
+enum AtomicOp
+{
+  AtomicExchange,
+  AtomicAdd,
+  AtomicSub,
+  AtomicAnd,
+  AtomicOr,
+  AtomicXor,
+  AtomicNand
+};
+
+template <AtomicOp op, typename T>
+static inline T atomicRMW(volatile T *a, T v, __tsan_memory_order mo)
+{
+  atomicRelease(a, mo, false);
+  T old = 0;
+  switch (op)
+  {
+  case AtomicExchange: old = __atomic_exchange_n(a, v, __ATOMIC_SEQ_CST); break;
+  case AtomicAdd:      old = __atomic_fetch_add(a, v, __ATOMIC_SEQ_CST); break;
+  case AtomicSub:      old = __atomic_fetch_sub(a, v, __ATOMIC_SEQ_CST); break;
+  case AtomicAnd:      old = __atomic_fetch_and(a, v, __ATOMIC_SEQ_CST); break;
+  case AtomicOr:       old = __atomic_fetch_or(a, v, __ATOMIC_SEQ_CST); break;
+  case AtomicXor:      old = __atomic_fetch_xor(a, v, __ATOMIC_SEQ_CST); break;
+  case AtomicNand:     old = __atomic_fetch_nand(a, v, __ATOMIC_SEQ_CST); break;
+  }
+  atomicAcquire(a, mo);
+  return old;
+}
+
+// Returns the value found at "a", "c" if "v" was stored. The release
+// is modeled even if the exchange fails: a spurious edge may hide a
+// race but never makes one up.
+template <typename T>
+static inline T atomicCAS(volatile T *a, T c, T v, __tsan_memory_order mo,
+                          __tsan_memory_order fmo)
+{
+  atomicRelease(a, mo, false);
+  T cur = c;
+  bool stored = __atomic_compare_exchange_n(a, &cur, v, false,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_SEQ_CST);
+  atomicAcquire(a, stored ? mo : fmo);
+  return cur;
+}
+
 __tsan_atomic8 __tsan_atomic8_load(const volatile __tsan_atomic8 *a,
                                    __tsan_memory_order mo)
 {
-  ft_atomic_load();
+  return atomicLoad(a, mo);
 }
+
+void __tsan_atomic8_store(volatile __tsan_atomic8 *a, __tsan_atomic8 v,
+                          __tsan_memory_order mo)
+{
+  atomicStore(a, v, mo);
+}
+
+__tsan_atomic8 __tsan_atomic8_exchange(volatile __tsan_atomic8 *a,
+                                       __tsan_atomic8 v,
+                                       __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicExchange>(a, v, mo);
+}
+
+__tsan_atomic8 __tsan_atomic8_fetch_add(volatile __tsan_atomic8 *a,
+                                        __tsan_atomic8 v,
+                                        __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicAdd>(a, v, mo);
+}
+
+__tsan_atomic8 __tsan_atomic8_fetch_sub(volatile __tsan_atomic8 *a,
+                                        __tsan_atomic8 v,
+                                        __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicSub>(a, v, mo);
+}
+
+__tsan_atomic8 __tsan_atomic8_fetch_and(volatile __tsan_atomic8 *a,
+                                        __tsan_atomic8 v,
+                                        __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicAnd>(a, v, mo);
+}
+
+__tsan_atomic8 __tsan_atomic8_fetch_or(volatile __tsan_atomic8 *a,
+                                       __tsan_atomic8 v,
+                                       __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicOr>(a, v, mo);
+}
+
+__tsan_atomic8 __tsan_atomic8_fetch_xor(volatile __tsan_atomic8 *a,
+                                        __tsan_atomic8 v,
+                                        __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicXor>(a, v, mo);
+}
+
+__tsan_atomic8 __tsan_atomic8_fetch_nand(volatile __tsan_atomic8 *a,
+                                         __tsan_atomic8 v,
+                                         __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicNand>(a, v, mo);
+}
+
+__tsan_atomic8 __tsan_atomic8_compare_exchange_val(
+    volatile __tsan_atomic8 *a, __tsan_atomic8 c, __tsan_atomic8 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo)
+{
+  return atomicCAS(a, c, v, mo, fmo);
+}
+
 __tsan_atomic16 __tsan_atomic16_load(const volatile __tsan_atomic16 *a,
                                      __tsan_memory_order mo)
 {
-  ft_atomic_load();
+  return atomicLoad(a, mo);
+}
+
+void __tsan_atomic16_store(volatile __tsan_atomic16 *a, __tsan_atomic16 v,
+                           __tsan_memory_order mo)
+{
+  atomicStore(a, v, mo);
+}
+
+__tsan_atomic16 __tsan_atomic16_exchange(volatile __tsan_atomic16 *a,
+                                         __tsan_atomic16 v,
+                                         __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicExchange>(a, v, mo);
+}
+
+__tsan_atomic16 __tsan_atomic16_fetch_add(volatile __tsan_atomic16 *a,
+                                          __tsan_atomic16 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicAdd>(a, v, mo);
+}
+
+__tsan_atomic16 __tsan_atomic16_fetch_sub(volatile __tsan_atomic16 *a,
+                                          __tsan_atomic16 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicSub>(a, v, mo);
+}
+
+__tsan_atomic16 __tsan_atomic16_fetch_and(volatile __tsan_atomic16 *a,
+                                          __tsan_atomic16 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicAnd>(a, v, mo);
+}
+
+__tsan_atomic16 __tsan_atomic16_fetch_or(volatile __tsan_atomic16 *a,
+                                         __tsan_atomic16 v,
+                                         __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicOr>(a, v, mo);
+}
+
+__tsan_atomic16 __tsan_atomic16_fetch_xor(volatile __tsan_atomic16 *a,
+                                          __tsan_atomic16 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicXor>(a, v, mo);
+}
+
+__tsan_atomic16 __tsan_atomic16_fetch_nand(volatile __tsan_atomic16 *a,
+                                           __tsan_atomic16 v,
+                                           __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicNand>(a, v, mo);
+}
+
+__tsan_atomic16 __tsan_atomic16_compare_exchange_val(
+    volatile __tsan_atomic16 *a, __tsan_atomic16 c, __tsan_atomic16 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo)
+{
+  return atomicCAS(a, c, v, mo, fmo);
 }
 
 __tsan_atomic32 __tsan_atomic32_load(const volatile __tsan_atomic32 *a,
                                      __tsan_memory_order mo)
 {
-  ft_atomic_load();
+  return atomicLoad(a, mo);
+}
+
+void __tsan_atomic32_store(volatile __tsan_atomic32 *a, __tsan_atomic32 v,
+                           __tsan_memory_order mo)
+{
+  atomicStore(a, v, mo);
+}
+
+__tsan_atomic32 __tsan_atomic32_exchange(volatile __tsan_atomic32 *a,
+                                         __tsan_atomic32 v,
+                                         __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicExchange>(a, v, mo);
+}
+
+__tsan_atomic32 __tsan_atomic32_fetch_add(volatile __tsan_atomic32 *a,
+                                          __tsan_atomic32 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicAdd>(a, v, mo);
+}
+
+__tsan_atomic32 __tsan_atomic32_fetch_sub(volatile __tsan_atomic32 *a,
+                                          __tsan_atomic32 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicSub>(a, v, mo);
+}
+
+__tsan_atomic32 __tsan_atomic32_fetch_and(volatile __tsan_atomic32 *a,
+                                          __tsan_atomic32 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicAnd>(a, v, mo);
+}
+
+__tsan_atomic32 __tsan_atomic32_fetch_or(volatile __tsan_atomic32 *a,
+                                         __tsan_atomic32 v,
+                                         __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicOr>(a, v, mo);
+}
+
+__tsan_atomic32 __tsan_atomic32_fetch_xor(volatile __tsan_atomic32 *a,
+                                          __tsan_atomic32 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicXor>(a, v, mo);
+}
+
+__tsan_atomic32 __tsan_atomic32_fetch_nand(volatile __tsan_atomic32 *a,
+                                           __tsan_atomic32 v,
+                                           __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicNand>(a, v, mo);
+}
+
+__tsan_atomic32 __tsan_atomic32_compare_exchange_val(
+    volatile __tsan_atomic32 *a, __tsan_atomic32 c, __tsan_atomic32 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo)
+{
+  return atomicCAS(a, c, v, mo, fmo);
+}
+
+__tsan_atomic64 __tsan_atomic64_load(const volatile __tsan_atomic64 *a,
+                                     __tsan_memory_order mo)
+{
+  return atomicLoad(a, mo);
+}
+
+void __tsan_atomic64_store(volatile __tsan_atomic64 *a, __tsan_atomic64 v,
+                           __tsan_memory_order mo)
+{
+  atomicStore(a, v, mo);
+}
+
+__tsan_atomic64 __tsan_atomic64_exchange(volatile __tsan_atomic64 *a,
+                                         __tsan_atomic64 v,
+                                         __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicExchange>(a, v, mo);
+}
+
+__tsan_atomic64 __tsan_atomic64_fetch_add(volatile __tsan_atomic64 *a,
+                                          __tsan_atomic64 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicAdd>(a, v, mo);
+}
+
+__tsan_atomic64 __tsan_atomic64_fetch_sub(volatile __tsan_atomic64 *a,
+                                          __tsan_atomic64 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicSub>(a, v, mo);
 }
 
-a8 __tsan_atomic32_fetch_add(volatile a8 *a, a8 v,
-                             __tsan_memory_order mo)
+__tsan_atomic64 __tsan_atomic64_fetch_and(volatile __tsan_atomic64 *a,
+                                          __tsan_atomic64 v,
+                                          __tsan_memory_order mo)
 {
-  printf("EmbedSanitizer: atomic_fetch_add not implemented\n");
+  return atomicRMW<AtomicAnd>(a, v, mo);
+}
+
+__tsan_atomic64 __tsan_atomic64_fetch_or(volatile __tsan_atomic64 *a,
+                                         __tsan_atomic64 v,
+                                         __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicOr>(a, v, mo);
+}
+
+__tsan_atomic64 __tsan_atomic64_fetch_xor(volatile __tsan_atomic64 *a,
+                                          __tsan_atomic64 v,
+                                          __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicXor>(a, v, mo);
+}
+
+__tsan_atomic64 __tsan_atomic64_fetch_nand(volatile __tsan_atomic64 *a,
+                                           __tsan_atomic64 v,
+                                           __tsan_memory_order mo)
+{
+  return atomicRMW<AtomicNand>(a, v, mo);
+}
+
+__tsan_atomic64 __tsan_atomic64_compare_exchange_val(
+    volatile __tsan_atomic64 *a, __tsan_atomic64 c, __tsan_atomic64 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo)
+{
+  return atomicCAS(a, c, v, mo, fmo);
+}
+
+// Fences only order the program's accesses: they are no edges in the
+// happens-before model, as in ThreadSanitizer.
+void __tsan_atomic_thread_fence(__tsan_memory_order mo)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void __tsan_atomic_signal_fence(__tsan_memory_order mo)
+{
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+// 6. Callbacks for heap memory
+//
+// Blocks are forgotten when they are freed, before the allocator can hand
+// their memory out again. Their size is the usable size of the block, so
+// malloc, calloc and operator new need no callback.
+void __tsan_free(void *ptr)
+{
+  if (!ptr) return;
+  record_sync(LogFree, ptr, malloc_usable_size(ptr));
+#ifdef ETSAN_BATCHED_ACCESSES
+  // the accesses queued to the block must not outlive it
+  if (isConcurrent) ft_flush_accesses(getThreadState());
+#endif
+  resetVarStates(ptr, malloc_usable_size(ptr));
+}
+
+// The old block is forgotten even if it is resized in place: realloc
+// reads it all and writes the new one, as if the thread allocated it.
+void *__tsan_realloc(void *ptr, unsigned long size)
+{
+  __tsan_free(ptr);
+  return realloc(ptr, size);
+}
+
+// Before a function returns, for each of its locals whose address
+// escapes, see -embedsan-reset-stack-frames
+void __tsan_stack_reset(void *addr, unsigned long size)
+{
+#ifdef ETSAN_RECORD
+  etsan::threadLog((ThreadID)pthread_self()).reset(addr, size);
+  return;
+#endif
+  resetVarStates(addr, size);
 }
 
 void __tsan_func_entry(void *funcName)
@@ -420,12 +1120,8 @@ void __tsan_func_exit(void *funcName)
 void __tsan_print_variables(
     int id,
     void *addr,
-    int lineNo,
-    void *objName) 
-{
-  std::stringstream ss;
-  ss << "  Report ID: "     << id        << "\n"  ;
-  ss << "  At line number: "     << lineNo        << "\n"  ;
-  ss << "  ADDR: "     <<   addr << " OBJ: \"" << objName  << "\"     \n"  ;
-  printf("EmbedSanitizer: print var: %s\n", ss.str().c_str());
-}
\ No newline at end of file
+    unsigned int siteId)
+{
+  trace_event(etsan::kTraceAccess, etsan::TraceVariable, addr,
+              etsan::getSite(siteId).line(), etsan::getSite(siteId).objName);
+}
@@ -28,50 +28,137 @@ void __tsan_init();
 // Useful for printing the collected races.
 void __tsan_main_func_exit();
 
-void __tsan_read1(void *addr, int lineNo, void* objName, void * fileName);
+// Registers the table of "count" access sites of a module and the
+// "numFiles" file names they refer to, and returns the site ID of its
+// first entry. Called from module constructors; the access callbacks
+// below then take site IDs instead of debug strings.
+unsigned int __tsan_register_sites(const void *sites, unsigned int count,
+                                   const char *const *files,
+                                   unsigned int numFiles);
+
+// Modes of detection, the same for all threads. Sync-only mode keeps the
+// happens-before state current at the cost of the synchronization
+// callbacks, so detection is exact again once switched back to full.
+// Off mode skips these too, but for thread creations, joins and barriers:
+// accesses checked after it may be reported as races though ordered.
+typedef enum {
+  __etsan_mode_full,      // accesses checked and synchronization tracked
+  __etsan_mode_sync_only, // synchronization tracked only
+  __etsan_mode_off        // neither
+} __etsan_mode;
+
+// Switches all threads to "mode", e.g. to check only the phases of a
+// program that matter. Returns the previous mode, or -1 if "mode" is
+// none. The initial one is that of ETSAN_MODE, full by default.
+int __etsan_set_mode(int mode);
+int __etsan_get_mode();
+
+// Freezes the 64-byte lines wholly within [addr, addr + size), e.g. the
+// tables a program has filled before it creates its threads: reads of
+// them are not checked until the next write to each line, which is.
+void __etsan_mark_readonly(const void *addr, unsigned long size);
+
+// Watches the "size" bytes at "addr", at most 8, with a hardware
+// watchpoint of each thread, as variable "name": each access to them is
+// checked, whether the code that makes it is instrumented or not, and in
+// sync-only mode too. Up to 4 variables; returns the slot taken, or -1
+// if none is left or the host has no breakpoints to give.
+int __etsan_watch(const void *addr, unsigned long size, const char *name);
+
+// Stops watching "addr". Returns 0 if it was not watched.
+int __etsan_unwatch(const void *addr);
 
-void __tsan_read2(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read1(void *addr, unsigned int siteId);
 
-void __tsan_read4(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read2(void *addr, unsigned int siteId);
 
-void __tsan_read8(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read4(void *addr, unsigned int siteId);
 
-void __tsan_read16(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read8(void *addr, unsigned int siteId);
 
-void __tsan_write1(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_read16(void *addr, unsigned int siteId);
 
-void __tsan_write2(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_write1(void *addr, unsigned int siteId);
 
-void __tsan_write4(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_write2(void *addr, unsigned int siteId);
 
-void __tsan_write8(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_write4(void *addr, unsigned int siteId);
 
-void __tsan_write16(void *addr, int lineNo, void* objName, void * fileName);
+void __tsan_write8(void *addr, unsigned int siteId);
+
+void __tsan_write16(void *addr, unsigned int siteId);
 
 void __tsan_func_entry(void *call_pc);
 void __tsan_func_exit(void *call_pc);
 
+// Forgets the states of a local of the returning function, whose address
+// escaped, so that the next frame at its addresses starts fresh
+void __tsan_stack_reset(void *addr, unsigned long size);
+
 void __tsan_thread_create(void * child_id);
 
+// Stands for pthread_create(thread, attr, routine, arg), which the pass
+// replaces with it. The child's state is made from the parent's clock
+// before the child starts, and cached by the child before it runs the
+// routine: no __tsan_thread_create follows.
+int __etsan_thread_create(void *thread, const void *attr,
+                          void *(*routine)(void *), void *arg);
+
 void __tsan_thread_join(void * child_id);
 
 void __tsan_thread_lock(void * lock);
 
 void __tsan_thread_unlock(void * lock);
 
+// Other synchronization primitives. Each callback goes after the call
+// it stands for, except releases, which go before it: signals, unlocks,
+// barrier arrivals and posts. A wait on a condition variable is an
+// unlock of its mutex before the call and __tsan_cond_wait after it.
+void __tsan_cond_signal(void * cond); // signal and broadcast
+void __tsan_cond_wait(void * cond, void * mutex);
+
+void __tsan_rwlock_rdlock(void * rwlock);
+void __tsan_rwlock_wrlock(void * rwlock);
+void __tsan_rwlock_unlock(void * rwlock);
+
+void __tsan_barrier_init(void * barrier, unsigned int count);
+unsigned int __tsan_barrier_arrive(void * barrier);
+void __tsan_barrier_depart(void * barrier, unsigned int episode);
+
+void __tsan_sem_post(void * sem);
+void __tsan_sem_wait(void * sem);
+
+// Range checks: one call for all the bytes of [addr, addr + size), e.g.
+// the elements a loop sweeps, checked word by word in one pass. At most
+// one race is reported per call.
+void __tsan_read_range(const void *addr, unsigned long size,
+                       unsigned int siteId);
+void __tsan_write_range(void *addr, unsigned long size,
+                        unsigned int siteId);
+
+// Checked versions of the memory intrinsics, which the pass redirects to
+void *__tsan_memset(void *addr, int c, unsigned long size,
+                    unsigned int siteId);
+void *__tsan_memcpy(void *dst, const void *src, unsigned long size,
+                    unsigned int siteId);
+void *__tsan_memmove(void *dst, const void *src, unsigned long size,
+                     unsigned int siteId);
+
+// Heap deallocation: __tsan_free goes before free and operator delete,
+// and the pass redirects realloc to __tsan_realloc
+void __tsan_free(void *ptr);
+void *__tsan_realloc(void *ptr, unsigned long size);
+
 void __tsan_vptr_update(void **vptr_p, void *new_val ,
-                        int lineNo, void* objName, void * fileName);
+                        unsigned int siteId);
 void __tsan_vptr_read(void **vptr_p,
-                      int lineNo, void* objName, void * fileName);
+                      unsigned int siteId);
 
 // Code adapted from tsan of LLVM
-typedef char  __tsan_atomic8;
-typedef short __tsan_atomic16;  // NOLINT
-typedef int   __tsan_atomic32;
-
-typedef unsigned char   a8;
-typedef unsigned short  a16;  // NOLINT
-typedef unsigned int    a32;
+typedef char      __tsan_atomic8;
+typedef short     __tsan_atomic16;  // NOLINT
+typedef int       __tsan_atomic32;
+typedef long long __tsan_atomic64;  // NOLINT
 
 
 typedef enum {
@@ -83,24 +170,70 @@ typedef enum {
   __tsan_memory_order_seq_cst
 } __tsan_memory_order;
 
-__tsan_atomic8  __tsan_atomic8_load(const volatile  __tsan_atomic8 *a,  __tsan_memory_order mo);
-__tsan_atomic16 __tsan_atomic16_load(const volatile __tsan_atomic16 *a, __tsan_memory_order mo);
-__tsan_atomic32 __tsan_atomic32_load(const volatile __tsan_atomic32 *a, __tsan_memory_order mo);
-
-void __tsan_unaligned_read2(const void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_read4(const void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_read8(const void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_read16(const void *addr, int lineNo, void* objName, void * fileName);
-
-void __tsan_unaligned_write2(void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_write4(void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_write8(void *addr, int lineNo, void* objName, void * fileName);
-void __tsan_unaligned_write16(void *addr, int lineNo, void* objName, void * fileName);
-
-a8 __tsan_atomic32_fetch_add(volatile a8 *a, a8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_load(const volatile __tsan_atomic8 *a, __tsan_memory_order mo);
+void __tsan_atomic8_store(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_exchange(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_add(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_sub(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_and(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_or(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_xor(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_fetch_nand(volatile __tsan_atomic8 *a, __tsan_atomic8 v, __tsan_memory_order mo);
+__tsan_atomic8 __tsan_atomic8_compare_exchange_val(volatile __tsan_atomic8 *a, __tsan_atomic8 c, __tsan_atomic8 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo);
 
+__tsan_atomic16 __tsan_atomic16_load(const volatile __tsan_atomic16 *a, __tsan_memory_order mo);
+void __tsan_atomic16_store(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_exchange(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_add(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_sub(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_and(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_or(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_xor(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_fetch_nand(volatile __tsan_atomic16 *a, __tsan_atomic16 v, __tsan_memory_order mo);
+__tsan_atomic16 __tsan_atomic16_compare_exchange_val(volatile __tsan_atomic16 *a, __tsan_atomic16 c, __tsan_atomic16 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo);
 
-void __tsan_print_variables(int id, void *addr, int lineNo, void* objName);
+__tsan_atomic32 __tsan_atomic32_load(const volatile __tsan_atomic32 *a, __tsan_memory_order mo);
+void __tsan_atomic32_store(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_exchange(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_add(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_sub(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_and(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_or(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_xor(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_fetch_nand(volatile __tsan_atomic32 *a, __tsan_atomic32 v, __tsan_memory_order mo);
+__tsan_atomic32 __tsan_atomic32_compare_exchange_val(volatile __tsan_atomic32 *a, __tsan_atomic32 c, __tsan_atomic32 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo);
+
+__tsan_atomic64 __tsan_atomic64_load(const volatile __tsan_atomic64 *a, __tsan_memory_order mo);
+void __tsan_atomic64_store(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_exchange(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_add(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_sub(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_and(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_or(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_xor(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_fetch_nand(volatile __tsan_atomic64 *a, __tsan_atomic64 v, __tsan_memory_order mo);
+__tsan_atomic64 __tsan_atomic64_compare_exchange_val(volatile __tsan_atomic64 *a, __tsan_atomic64 c, __tsan_atomic64 v,
+    __tsan_memory_order mo, __tsan_memory_order fmo);
+
+void __tsan_atomic_thread_fence(__tsan_memory_order mo);
+void __tsan_atomic_signal_fence(__tsan_memory_order mo);
+
+void __tsan_unaligned_read2(const void *addr, unsigned int siteId);
+void __tsan_unaligned_read4(const void *addr, unsigned int siteId);
+void __tsan_unaligned_read8(const void *addr, unsigned int siteId);
+void __tsan_unaligned_read16(const void *addr, unsigned int siteId);
+
+void __tsan_unaligned_write2(void *addr, unsigned int siteId);
+void __tsan_unaligned_write4(void *addr, unsigned int siteId);
+void __tsan_unaligned_write8(void *addr, unsigned int siteId);
+void __tsan_unaligned_write16(void *addr, unsigned int siteId);
+
+
+
+void __tsan_print_variables(int id, void *addr, unsigned int siteId);
 #ifdef __cplusplus
 }  // extern "C"
 #endif
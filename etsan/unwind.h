@@ -0,0 +1,133 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Call stacks of races taken by unwinding (ETSAN_UNWIND_STACKS), for
+// programs built without the function entry and exit callbacks (-mllvm
+// -embedsan-unwind-stacks).
+//
+// The shadow stack (shadow_stack.h) costs two callbacks on every call,
+// while a stack is only needed once per racy site. Instead, the thread
+// which finds a race unwinds its own stack with _Unwind_Backtrace, from
+// the unwind tables, .eh_frame or ARM EHABI's .ARM.exidx, so neither the
+// program nor the runtime needs frame pointers. The frames of the runtime,
+// up to the access callback, are dropped. The reporter thread formats each
+// return address as
+//
+//   symbol+0x1c (module+0x8a4)
+//
+// and tools/etsan-symbolize turns "(module+0x8a4)" into a source line.
+
+#ifndef ETSAN_UNWIND_H_
+#define ETSAN_UNWIND_H_
+
+#include <sys/auxv.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <limits.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <unwind.h>
+#include <string>
+#include "file_dictionary.h"
+
+namespace etsan {
+
+  struct UnwindState {
+    uintptr_t     from;  // first frame kept, 0 for all
+    uintptr_t    *pcs;
+    unsigned int  max;
+    unsigned int  n;
+  };
+
+  static _Unwind_Reason_Code unwindFrame(struct _Unwind_Context *context,
+                                         void *arg) {
+    UnwindState &s = *static_cast<UnwindState *>(arg);
+    uintptr_t pc = _Unwind_GetIP(context);
+    if (!pc) return _URC_END_OF_STACK;
+    if (s.from && pc != s.from) return _URC_NO_REASON; // in the runtime
+    s.from = 0;
+    s.pcs[s.n++] = pc;
+    return s.n == s.max ? _URC_END_OF_STACK : _URC_NO_REASON;
+  }
+
+  // Stores the return addresses of the calling thread's stack, outermost
+  // first, into "pcs" of "max" entries; the innermost ones if they do not
+  // fit. Starts at return address "from", that of the access callback, or
+  // with all frames if it is null or not found. Returns their number.
+  unsigned int unwindStack(const void *from, uintptr_t *pcs,
+                           unsigned int max) {
+    UnwindState s = {reinterpret_cast<uintptr_t>(from), pcs, max, 0};
+    if (max) _Unwind_Backtrace(unwindFrame, &s);
+    if (!s.n && from) return unwindStack(nullptr, pcs, max);
+    for (unsigned int i = 0; i < s.n / 2; i++) {
+      uintptr_t pc = pcs[i];
+      pcs[i] = pcs[s.n - 1 - i];
+      pcs[s.n - 1 - i] = pc;
+    }
+    return s.n;
+  }
+
+  // Absolute path of the main executable, which dladdr names as it was
+  // run, if at all
+  const char *executablePath() {
+    static const std::string path = [] {
+      char buffer[PATH_MAX];
+      ssize_t n = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+      return std::string(buffer, n > 0 ? n : 0);
+    }();
+    return path.c_str();
+  }
+
+  // Load address of the main executable
+  const void *executableBase() {
+    static const void *base = [] {
+      Dl_info info;
+      void *phdr = reinterpret_cast<void *>(getauxval(AT_PHDR));
+      return phdr && dladdr(phdr, &info) ? info.dli_fbase : nullptr;
+    }();
+    return base;
+  }
+
+  // Formats return address "pc" as its symbol, if exported, and its module
+  // and offset: from the load address in a shared object or position
+  // independent executable, the address itself in a fixed one, as
+  // addr2line takes them. Interned, see FileDictionary.
+  const char *formatFrame(uintptr_t pc) {
+    char frame[512];
+    Dl_info info;
+    if (!dladdr(reinterpret_cast<void *>(pc), &info) || !info.dli_fbase) {
+      snprintf(frame, sizeof(frame), "(0x%lx)", (unsigned long)pc);
+      return fileDictionary.internName(frame);
+    }
+    uintptr_t base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+    const ElfW(Ehdr) *header = static_cast<const ElfW(Ehdr) *>(info.dli_fbase);
+    uintptr_t offset = header->e_type == ET_EXEC ? pc : pc - base;
+    const char *module = info.dli_fbase == executableBase() || !info.dli_fname
+        ? executablePath() : info.dli_fname;
+
+    int n = 0;
+    if (info.dli_sname) {
+      n = snprintf(frame, sizeof(frame), "%s+0x%lx ", info.dli_sname,
+                   (unsigned long)(pc - (uintptr_t)info.dli_saddr));
+      if (n < 0 || n >= (int)sizeof(frame)) n = 0;
+    }
+    snprintf(frame + n, sizeof(frame) - n, "(%s+0x%lx)", module,
+             (unsigned long)offset);
+    return fileDictionary.internName(frame);
+  }
+
+} // etsan
+
+#endif // ETSAN_UNWIND_H_
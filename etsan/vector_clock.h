@@ -0,0 +1,244 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Fixed-width vector clocks with SIMD join, copy and compare.
+//
+// A FixedVectorClock stores the epochs of all N threads inline. Slots
+// beyond size() always hold the zero epoch of their thread (0@t), so
+// growing the clock only bumps size() and the kernels below can always
+// process all N slots: a zero epoch never changes a join. The kernels use
+// NEON on ARMv7 and SSE2/AVX2 on x86_64 for 32-bit epochs; 64-bit epochs
+// (ETSAN_EPOCH64) use the scalar fallback.
+
+#ifndef ETSAN_VECTOR_CLOCK_H_
+#define ETSAN_VECTOR_CLOCK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ETSAN_VC_NEON
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define ETSAN_VC_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ETSAN_VC_SSE2
+#endif
+
+// Maximum number of threads of a fixed-width vector clock
+#ifndef ETSAN_MAX_THREADS
+#define ETSAN_MAX_THREADS 64
+#endif
+
+namespace etsan {
+
+  // Kernels over n epochs. The generic versions are scalar; the 32-bit
+  // overloads are vectorized and n must be a multiple of 8.
+
+  template <typename E>
+  void vcJoin(E *a, const E *b, unsigned n) {
+    for (unsigned t = 0; t < n; t++) a[t] = std::max(a[t], b[t]);
+  }
+
+  template <typename E>
+  void vcCopy(E *a, const E *b, unsigned n) {
+    std::copy(b, b + n, a);
+  }
+
+  template <typename E>
+  bool vcLeq(const E *a, const E *b, unsigned n) {
+    for (unsigned t = 0; t < n; t++) {
+      if (a[t] > b[t]) return false;
+    }
+    return true;
+  }
+
+#if defined(ETSAN_VC_NEON)
+  inline void vcJoin(int32_t *a, const int32_t *b, unsigned n) {
+    for (unsigned t = 0; t < n; t += 4) {
+      vst1q_s32(a + t, vmaxq_s32(vld1q_s32(a + t), vld1q_s32(b + t)));
+    }
+  }
+
+  inline void vcCopy(int32_t *a, const int32_t *b, unsigned n) {
+    for (unsigned t = 0; t < n; t += 4) {
+      vst1q_s32(a + t, vld1q_s32(b + t));
+    }
+  }
+
+  inline bool vcLeq(const int32_t *a, const int32_t *b, unsigned n) {
+    uint32x4_t gt = vdupq_n_u32(0);
+    for (unsigned t = 0; t < n; t += 4) {
+      gt = vorrq_u32(gt, vcgtq_s32(vld1q_s32(a + t), vld1q_s32(b + t)));
+    }
+    uint32x2_t half = vorr_u32(vget_low_u32(gt), vget_high_u32(gt));
+    return (vget_lane_u32(half, 0) | vget_lane_u32(half, 1)) == 0;
+  }
+#elif defined(ETSAN_VC_AVX2)
+  inline void vcJoin(int32_t *a, const int32_t *b, unsigned n) {
+    for (unsigned t = 0; t < n; t += 8) {
+      __m256i x = _mm256_loadu_si256((const __m256i *)(a + t));
+      __m256i y = _mm256_loadu_si256((const __m256i *)(b + t));
+      _mm256_storeu_si256((__m256i *)(a + t), _mm256_max_epi32(x, y));
+    }
+  }
+
+  inline void vcCopy(int32_t *a, const int32_t *b, unsigned n) {
+    for (unsigned t = 0; t < n; t += 8) {
+      _mm256_storeu_si256((__m256i *)(a + t),
+          _mm256_loadu_si256((const __m256i *)(b + t)));
+    }
+  }
+
+  inline bool vcLeq(const int32_t *a, const int32_t *b, unsigned n) {
+    __m256i gt = _mm256_setzero_si256();
+    for (unsigned t = 0; t < n; t += 8) {
+      __m256i x = _mm256_loadu_si256((const __m256i *)(a + t));
+      __m256i y = _mm256_loadu_si256((const __m256i *)(b + t));
+      gt = _mm256_or_si256(gt, _mm256_cmpgt_epi32(x, y));
+    }
+    return _mm256_testz_si256(gt, gt);
+  }
+#elif defined(ETSAN_VC_SSE2)
+  // SSE2 has no signed 32-bit max: select with a compare mask
+  inline void vcJoin(int32_t *a, const int32_t *b, unsigned n) {
+    for (unsigned t = 0; t < n; t += 4) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(a + t));
+      __m128i y = _mm_loadu_si128((const __m128i *)(b + t));
+      __m128i gt = _mm_cmpgt_epi32(y, x);
+      _mm_storeu_si128((__m128i *)(a + t),
+          _mm_or_si128(_mm_and_si128(gt, y), _mm_andnot_si128(gt, x)));
+    }
+  }
+
+  inline void vcCopy(int32_t *a, const int32_t *b, unsigned n) {
+    for (unsigned t = 0; t < n; t += 4) {
+      _mm_storeu_si128((__m128i *)(a + t),
+          _mm_loadu_si128((const __m128i *)(b + t)));
+    }
+  }
+
+  inline bool vcLeq(const int32_t *a, const int32_t *b, unsigned n) {
+    __m128i gt = _mm_setzero_si128();
+    for (unsigned t = 0; t < n; t += 4) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(a + t));
+      __m128i y = _mm_loadu_si128((const __m128i *)(b + t));
+      gt = _mm_or_si128(gt, _mm_cmpgt_epi32(x, y));
+    }
+    return _mm_movemask_epi8(gt) == 0;
+  }
+#endif
+
+  // Vector clock of up to N threads with epochs of the given Layout
+  // (see epoch.h)
+  template <typename Layout, unsigned N>
+  class alignas(64) FixedVectorClock {
+
+    static_assert(N % 8 == 0, "N must be a multiple of the widest kernel");
+
+  public:
+
+    using E = typename Layout::Type;
+
+    static constexpr unsigned kCapacity = N;
+
+    FixedVectorClock() : count(0) { reset(0); }
+
+    FixedVectorClock(std::initializer_list<E> epochs) { *this = epochs; }
+
+    FixedVectorClock & operator=(std::initializer_list<E> epochs) {
+      assert(epochs.size() <= N);
+      reset(0);
+      std::copy(epochs.begin(), epochs.end(), clocks);
+      count = epochs.size();
+      return *this;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Storage is inline: nothing to reserve
+    void reserve(size_t n) { assert(n <= N); }
+
+    void resize(size_t n) {
+      assert(n <= N);
+      if (n < count) reset(n);
+      count = n;
+    }
+
+    void push_back(E epoch) {
+      assert(count < N);
+      clocks[count++] = epoch;
+    }
+
+    void clear() {
+      reset(0);
+      count = 0;
+    }
+
+    E & operator[](size_t t) { return clocks[t]; }
+    const E & operator[](size_t t) const { return clocks[t]; }
+
+    E & at(size_t t) {
+      if (t >= count) throw std::out_of_range("FixedVectorClock::at");
+      return clocks[t];
+    }
+    const E & at(size_t t) const {
+      if (t >= count) throw std::out_of_range("FixedVectorClock::at");
+      return clocks[t];
+    }
+
+    E * begin() { return clocks; }
+    E * end() { return clocks + count; }
+    const E * begin() const { return clocks; }
+    const E * end() const { return clocks + count; }
+
+    // this := this U other
+    void join(const FixedVectorClock & other) {
+      count = std::max(count, other.count);
+      vcJoin(clocks, other.clocks, N);
+    }
+
+    // this := other
+    void copy(const FixedVectorClock & other) {
+      count = std::max(count, other.count);
+      vcCopy(clocks, other.clocks, N);
+    }
+
+    // Returns true if this <= other for every thread, i.e. everything
+    // this clock has seen happens before "other".
+    bool leq(const FixedVectorClock & other) const {
+      return vcLeq(clocks, other.clocks, N);
+    }
+
+  private:
+
+    E      clocks[N];
+    size_t count;
+
+    // Sets slots from "from" on to the zero epoch of their thread
+    void reset(size_t from) {
+      for (size_t t = from; t < N; t++) {
+        clocks[t] = Layout::make(t, 0);
+      }
+    }
+  };
+
+} // etsan
+
+#endif // ETSAN_VECTOR_CLOCK_H_
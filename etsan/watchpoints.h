@@ -0,0 +1,397 @@
+//===-- Runtime race detection module of EmbedSanitizer - for Embeded ARM--===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Hardware watchpoints on a few suspect variables, for hunting a known
+// race under production-like load at near-native speed.
+//
+// The program is built without access callbacks (-mllvm
+// -tsan-instrument-memory-accesses=false) or runs in sync-only mode, so
+// the runtime only tracks synchronization. Each variable watched, by
+// __etsan_watch or ETSAN_WATCH, takes a debug register of every thread,
+// armed as a perf_event breakpoint: an access to it traps, and only then
+// is it checked, by checkWatchedAccess. x86 and ARM have 4 of them; a
+// watch covers up to 8 aligned bytes.
+//
+// The debug registers are per thread. A thread arms or drops its own at
+// its next synchronization after the watches change, and a thread made
+// by __etsan_thread_create arms them before it starts. Breakpoints trap
+// on reads and writes alike: an access which changes the value since the
+// last trap is taken as a write, others, with same-value stores, as reads.
+//
+// The trap may interrupt the thread anywhere, in malloc or holding a lock
+// of the runtime, so the signal handler only queues the address and the
+// value it loaded for the thread, without locks. The thread checks the
+// queued accesses at its next synchronization, before the runtime
+// handles it, and a thread of __etsan_thread_create also as it ends; up
+// to kPendingTraps of them, the others are counted lost.
+
+#ifndef ETSAN_WATCHPOINTS_H_
+#define ETSAN_WATCHPOINTS_H_
+
+#include <linux/hw_breakpoint.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include "file_dictionary.h"
+#include "flags.h"
+#include "unwind.h"
+
+namespace etsan {
+
+  // Checks an access to watched variable "name" of "size" bytes at
+  // "addr", after it trapped at instruction "location", see trapLocation.
+  // Defined by tsan_interface.cc.
+  void checkWatchedAccess(const void *addr, size_t size, const char *name,
+                          const char *location, bool isWrite);
+
+  // Program counter of the signal context "context", 0 where unknown
+  static inline uintptr_t contextPc(void *context) {
+    const ucontext_t *uc = static_cast<const ucontext_t *>(context);
+#if defined(__x86_64__)
+    return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__arm__)
+    return uc->uc_mcontext.arm_pc;
+#elif defined(__aarch64__)
+    return uc->uc_mcontext.pc;
+#else
+    (void)uc;
+    return 0;
+#endif
+  }
+
+  // Where the access at "pc" trapped, see formatFrame: the breakpoint
+  // stops right after the access
+  const char *trapLocation(uintptr_t pc) {
+    return pc ? formatFrame(pc) : fileDictionary.internName("watchpoint");
+  }
+
+  // Debug registers of ARM and x86 for data
+  constexpr unsigned int kMaxWatchpoints = 4;
+
+  // Traps a thread queues until its next synchronization
+  constexpr unsigned int kPendingTraps = 16;
+
+  class Watchpoints {
+  public:
+    // Watches the "size" bytes at "addr", at most the 8 aligned ones it
+    // starts with, as variable "name". Returns the watch's slot, or -1 if
+    // all are taken or the calling thread cannot arm it.
+    int watch(const void *addr, size_t size, const char *name) {
+      uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+      size_t len = 8;
+      while (len > 1 && (len > size || begin % len)) len >>= 1;
+      if (!addr) return -1;
+
+      int slot = -1;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        installHandler();
+        for (unsigned int i = 0; i < kMaxWatchpoints && slot < 0; i++) {
+          if (slots[i].addr) continue;
+          slot = i;
+          slots[i].size = len;
+          slots[i].name = fileDictionary.internName(name ? name : "watched");
+          slots[i].last = load(begin, len);
+          slots[i].addr = begin;
+          generation.fetch_add(1, std::memory_order_release);
+        }
+      }
+      if (slot < 0) return -1;
+      refresh();
+      if (local().fds[slot] < 0) {
+        unwatch(addr);
+        return -1;
+      }
+      return slot;
+    }
+
+    // Stops watching "addr". Returns false if it was not watched.
+    bool unwatch(const void *addr) {
+      uintptr_t begin = reinterpret_cast<uintptr_t>(addr);
+      bool found = false;
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        for (unsigned int i = 0; i < kMaxWatchpoints; i++) {
+          if (slots[i].addr != begin) continue;
+          slots[i].addr = 0;
+          found = true;
+        }
+        if (found) generation.fetch_add(1, std::memory_order_release);
+      }
+      refresh();
+      return found;
+    }
+
+    // Watches the variables of "spec", comma-separated: global symbols,
+    // whose size is that of the symbol, or addresses as 0x1234:4
+    void watchAll(const char *spec) {
+      char entry[256];
+      while (spec && *spec) {
+        const char *end = strchr(spec, ',');
+        size_t n = end ? end - spec : strlen(spec);
+        if (n && n < sizeof(entry)) {
+          memcpy(entry, spec, n);
+          entry[n] = '\0';
+          if (watchEntry(entry) < 0)
+            fprintf(stderr, "EmbedSanitizer: cannot watch %s\n", entry);
+        }
+        spec = end ? end + 1 : nullptr;
+      }
+    }
+
+    // Checks the accesses which trapped in the calling thread since it
+    // last did, then arms its watches, or drops them, if they changed
+    // since. Cheap when neither happened.
+    void refresh() {
+      ThreadWatches &w = local();
+      checkTraps(w);
+      unsigned int g = generation.load(std::memory_order_acquire);
+      if (g != w.generation) rearm(w, g);
+    }
+
+    // Checks the accesses which trapped in the calling thread, before a
+    // synchronization which does not refresh the watches moves its clock
+    void checkTraps() { checkTraps(local()); }
+
+    // Number of slots in use
+    unsigned int size() {
+      std::lock_guard<std::mutex> guard(lock);
+      unsigned int n = 0;
+      for (unsigned int i = 0; i < kMaxWatchpoints; i++) n += !!slots[i].addr;
+      return n;
+    }
+
+    // Handles the trap of breakpoint "fd" at "pc", in the thread which
+    // accessed: queues the access for checkTraps. Async-signal-safe.
+    void onTrap(int fd, uintptr_t pc) {
+      ThreadWatches &w = local();
+      for (unsigned int i = 0; i < kMaxWatchpoints; i++) {
+        if (w.fds[i] != fd || !w.addrs[i]) continue;
+        // the load would trap again
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t value = load(w.addrs[i], w.sizes[i]);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+
+        unsigned int head = __atomic_load_n(&w.trapHead, __ATOMIC_RELAXED);
+        if (head - __atomic_load_n(&w.trapTail, __ATOMIC_RELAXED) ==
+            kPendingTraps) {
+          __atomic_fetch_add(&w.trapsLost, 1, __ATOMIC_RELAXED);
+          continue;
+        }
+        Trap &trap = w.traps[head % kPendingTraps];
+        trap.slot  = i;
+        trap.addr  = w.addrs[i];
+        trap.size  = w.sizes[i];
+        trap.name  = w.names[i];
+        trap.value = value;
+        trap.pc    = pc;
+        __atomic_store_n(&w.trapHead, head + 1, __ATOMIC_RELEASE);
+      }
+    }
+
+  private:
+    // An access which trapped, with the value loaded after it
+    struct Trap {
+      unsigned int slot;
+      uintptr_t    addr;
+      size_t       size;
+      const char * name;
+      uint64_t     value;
+      uintptr_t    pc;
+    };
+
+    struct Watch {
+      uintptr_t    addr = 0; // 0 for a free slot
+      size_t       size = 0;
+      const char * name = nullptr;
+      uint64_t     last = 0; // value at the last trap
+    };
+
+    // Breakpoints of one thread, by slot, as last armed
+    struct ThreadWatches {
+      unsigned int generation = 0;
+      int          fds[kMaxWatchpoints];
+      uintptr_t    addrs[kMaxWatchpoints] = {};
+      size_t       sizes[kMaxWatchpoints] = {};
+      const char * names[kMaxWatchpoints] = {};
+
+      // Queue of the traps: the signal handler moves the head, the thread
+      // the tail, see onTrap and checkTraps
+      Trap         traps[kPendingTraps];
+      unsigned int trapHead = 0;
+      unsigned int trapTail = 0;
+      unsigned int trapsLost = 0;
+
+      ThreadWatches() {
+        for (unsigned int i = 0; i < kMaxWatchpoints; i++) fds[i] = -1;
+      }
+      ~ThreadWatches() { disarm(); }
+
+      void disarm() {
+        for (unsigned int i = 0; i < kMaxWatchpoints; i++) {
+          if (fds[i] >= 0) close(fds[i]);
+          fds[i] = -1;
+          addrs[i] = 0;
+        }
+      }
+    };
+
+    static ThreadWatches &local() {
+      static thread_local ThreadWatches watches;
+      return watches;
+    }
+
+    static uint64_t load(uintptr_t addr, size_t size) {
+      uint64_t value = 0;
+      memcpy(&value, reinterpret_cast<const void *>(addr), size);
+      return value;
+    }
+
+    // Checks the accesses queued by the signal handler in the calling
+    // thread, which holds no lock of the runtime
+    void checkTraps(ThreadWatches &w) {
+      while (w.trapTail != __atomic_load_n(&w.trapHead, __ATOMIC_ACQUIRE)) {
+        Trap trap = w.traps[w.trapTail % kPendingTraps];
+        __atomic_store_n(&w.trapTail, w.trapTail + 1, __ATOMIC_RELEASE);
+
+        uint64_t last = trap.value;
+        Watch &slot = slots[trap.slot];
+        if (__atomic_load_n(&slot.addr, __ATOMIC_RELAXED) == trap.addr)
+          last = __atomic_exchange_n(&slot.last, trap.value, __ATOMIC_RELAXED);
+        checkWatchedAccess(reinterpret_cast<const void *>(trap.addr),
+                           trap.size, trap.name, trapLocation(trap.pc),
+                           trap.value != last);
+      }
+      if (__atomic_load_n(&w.trapsLost, __ATOMIC_RELAXED)) {
+        unsigned int lost = __atomic_exchange_n(&w.trapsLost, 0,
+                                                __ATOMIC_RELAXED);
+        fprintf(stderr, "EmbedSanitizer: %u watchpoint traps not checked, "
+                "the queue was full\n", lost);
+      }
+    }
+
+    // Resolves and watches an entry of ETSAN_WATCH
+    int watchEntry(char *entry) {
+      char *colon = strchr(entry, ':');
+      size_t size = 0;
+      if (colon) {
+        *colon = '\0';
+        size = strtoul(colon + 1, nullptr, 0);
+      }
+      if (!strncmp(entry, "0x", 2)) {
+        void *addr = reinterpret_cast<void *>(strtoull(entry, nullptr, 16));
+        return watch(addr, size ? size : sizeof(int), entry);
+      }
+      void *addr = dlsym(RTLD_DEFAULT, entry);
+      if (!addr) return -1;
+      if (!size) {
+        Dl_info info;
+        const ElfW(Sym) *sym = nullptr;
+        if (dladdr1(addr, &info, (void **)&sym, RTLD_DL_SYMENT) && sym)
+          size = sym->st_size;
+      }
+      return watch(addr, size ? size : sizeof(int), entry);
+    }
+
+    // Reopens the breakpoints of "w" for the watches of generation "g"
+    void rearm(ThreadWatches &w, unsigned int g) {
+      std::lock_guard<std::mutex> guard(lock);
+      w.disarm();
+      w.generation = g;
+      for (unsigned int i = 0; i < kMaxWatchpoints; i++) {
+        if (!slots[i].addr) continue;
+        w.fds[i] = openBreakpoint(slots[i].addr, slots[i].size);
+        if (w.fds[i] < 0) continue;
+        w.addrs[i] = slots[i].addr;
+        w.sizes[i] = slots[i].size;
+        w.names[i] = slots[i].name;
+      }
+    }
+
+    // A breakpoint on the calling thread which signals it at each access
+    int openBreakpoint(uintptr_t addr, size_t size) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_BREAKPOINT;
+      attr.bp_type = HW_BREAKPOINT_RW;
+      attr.bp_addr = addr;
+      attr.bp_len = size;
+      attr.sample_period = 1;
+      attr.wakeup_events = 1;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                       PERF_FLAG_FD_CLOEXEC);
+      if (fd < 0) {
+        if (!warned.exchange(true))
+          perror("EmbedSanitizer: cannot arm a watchpoint");
+        return -1;
+      }
+      struct f_owner_ex owner = {F_OWNER_TID, (pid_t)syscall(SYS_gettid)};
+      if (fcntl(fd, F_SETFL, O_ASYNC) < 0 || fcntl(fd, F_SETSIG, signo) < 0 ||
+          fcntl(fd, F_SETOWN_EX, &owner) < 0 ||
+          ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+        close(fd);
+        return -1;
+      }
+      return fd;
+    }
+
+    static void onSignal(int, siginfo_t *info, void *);
+
+    // The signal of the breakpoints, ETSAN_WATCH_SIGNAL (SIGTRAP)
+    void installHandler() {
+      if (signo) return;
+      signo = getFlag("ETSAN_WATCH_SIGNAL", SIGTRAP);
+      struct sigaction action;
+      memset(&action, 0, sizeof(action));
+      action.sa_sigaction = onSignal;
+      action.sa_flags = SA_SIGINFO | SA_RESTART;
+      sigaction(signo, &action, nullptr);
+    }
+
+    std::mutex lock;
+    Watch slots[kMaxWatchpoints];
+    std::atomic<unsigned int> generation{0};
+    std::atomic<bool> warned{false};
+    int signo = 0; // under "lock", 0 until the first watch
+  }; // Watchpoints
+
+  static Watchpoints watchpoints ETSAN_EARLY_INIT;
+
+  void Watchpoints::onSignal(int, siginfo_t *info, void *context) {
+    int saved = errno;
+    watchpoints.onTrap(info->si_fd, contextPc(context));
+    errno = saved;
+  }
+
+} // etsan
+
+#endif // ETSAN_WATCHPOINTS_H_
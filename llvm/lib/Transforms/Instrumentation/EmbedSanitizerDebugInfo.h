@@ -23,6 +23,7 @@
 #include "llvm/Analysis/MemoryBuiltins.h"
 #include "llvm/Analysis/TargetFolder.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
@@ -48,10 +49,15 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm-c/Core.h"
 #include "llvm/Pass.h"
+#include "llvm/ADT/StringMap.h"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <string>
+#include <tuple>
+#include <vector>
 #include <cxxabi.h>
 
 // Implements helper functions for manipulating debugging
@@ -111,7 +117,7 @@ std::string createAbsoluteFileName(
   /**
    * Returns the name of the file which an instruction belongs to.
    */
-  llvm::Value* getFileName(llvm::Instruction *I) {
+  std::string getFileName(llvm::Instruction *I) {
 
     std::string name = "Unknown";
     std::string dirName = "";
@@ -127,10 +133,7 @@ std::string createAbsoluteFileName(
       }
     }
 
-    llvm::Function *F = I->getFunction();
-    llvm::IRBuilder<> IRB(F->getEntryBlock().getFirstNonPHI());
-
-    return IRB.CreateGlobalStringPtr(name, "fName");
+    return name;
   }
 
 /**
@@ -163,40 +166,203 @@ llvm::StringRef getFuncNameStr(llvm::Function &F) {
    * Returns the name of the memory location involved.
    * By object, this refers to the name of the variable.
    */
-  llvm::Value * getObjectName(
-      llvm::Value *V,
-      llvm::Instruction *I,
-      const llvm::DataLayout &DL) {
+  std::string getObjectName(llvm::Value *V, const llvm::DataLayout &DL) {
 
     llvm::Value *obj  = GetUnderlyingObject(V, DL);
-    llvm::Function *F = I->getFunction();
-    llvm::IRBuilder<> IRB( F->getEntryBlock().getFirstNonPHI() );
 
-    if ( !obj ) {
-      return IRB.CreateGlobalStringPtr("unknown", "variable");
-    } else {
-      return IRB.CreateGlobalStringPtr(obj->getName(), "variable");
+    if ( !obj || !obj->hasName() ) {
+      return "unknown";
     }
+    return obj->getName().str();
   }
 
   /**
    * Retrieves the line number of the instruction
    * being instrumented.
    */
-  llvm::Value* getLineNumber(llvm::Instruction *I) {
+  unsigned getLineNumber(llvm::Instruction *I) {
 
     if (auto Loc = I->getDebugLoc()) { // Here I is an LLVM instruction
-      llvm::IRBuilder<> IRB(I);
-      unsigned Line = Loc->getLine();
-      return llvm::ConstantInt::get(
-          llvm::Type::getInt32Ty(I->getContext()),
-          Line);
-    } else {
-      llvm::Constant* zero = llvm::ConstantInt::get(
-          llvm::Type::getInt32Ty(I->getContext()),
-          0);
-      return zero;
+      return Loc->getLine();
+    }
+    return 0;
+  }
+
+  /**
+   * Retrieves the column number of the instruction
+   * being instrumented.
+   */
+  unsigned getColumnNumber(llvm::Instruction *I) {
+
+    if (auto Loc = I->getDebugLoc()) {
+      return Loc->getColumn();
     }
+    return 0;
+  }
+
+/**
+ * Table of the instrumented access sites of a module.
+ *
+ * Every distinct (file, line, column, variable) of an access gets one
+ * entry of a constant table emitted with the module; file names go to a
+ * separate table and each string is stored once. The module constructor
+ * registers both with the runtime, which returns the ID of the first
+ * entry; access callbacks then pass that base plus the entry index as a
+ * single 32-bit site ID. An entry is { i64 loc, i8* variable }, where loc
+ * packs | file index : 16 | line : 32 | column : 16 |, and must match
+ * etsan::SiteInfo in etsan/sites.h.
+ *
+ * The lookups are cached, as they run for every instrumented access: the
+ * file of a debug scope is resolved once per module, the variable of an
+ * address once per function, and the base is loaded once per function,
+ * in its entry block.
+ */
+class SiteTable {
+
+  typedef std::pair<uint64_t, uint32_t> Site; // loc, variable name index
+
+  llvm::DenseMap<Site, uint32_t>    ids;
+  std::vector<Site>                 sites;
+  llvm::StringMap<uint32_t>         nameIds;
+  std::vector<std::string>          names;
+  llvm::StringMap<uint32_t>         fileIds;
+  std::vector<std::string>          files;
+  llvm::DenseMap<const llvm::DIScope *, uint32_t> scopeFiles;
+  llvm::GlobalVariable             *base = nullptr; // set by the module ctor
+
+  // Per function
+  llvm::DenseMap<const llvm::Value *, uint32_t> addrNames;
+  llvm::Value                      *funcBase = nullptr;
+
+  // Returns the index of string "str" in "table", adding it if new
+  static uint32_t intern(llvm::StringMap<uint32_t> &index,
+                         std::vector<std::string> &table, llvm::StringRef str) {
+    auto it = index.insert({str, uint32_t(table.size())});
+    if (it.second) table.push_back(str.str());
+    return it.first->second;
+  }
+
+  // Returns the index of the file of instruction I in the file table
+  uint32_t getFileIdx(llvm::Instruction *I) {
+    const llvm::DebugLoc &location = I->getDebugLoc();
+    const llvm::DIScope *scope =
+        location ? llvm::cast<llvm::DIScope>(location->getScope()) : nullptr;
+    auto it = scopeFiles.find(scope);
+    if (it != scopeFiles.end()) return it->second;
+    uint32_t idx = intern(fileIds, files, getFileName(I));
+    scopeFiles[scope] = idx;
+    return idx;
+  }
+
+  // Returns the index of the name of the variable Addr points to
+  uint32_t getNameIdx(llvm::Value *Addr, const llvm::DataLayout &DL) {
+    auto it = addrNames.find(Addr);
+    if (it != addrNames.end()) return it->second;
+    llvm::Value *obj = GetUnderlyingObject(Addr, DL);
+    uint32_t idx = intern(nameIds, names, obj && obj->hasName()
+                                              ? obj->getName()
+                                              : llvm::StringRef("unknown"));
+    addrNames[Addr] = idx;
+    return idx;
+  }
+
+  // The base of the site IDs, loaded at the entry of the current function
+  llvm::Value *getBase(llvm::Function &F) {
+    if (funcBase) return funcBase;
+    llvm::BasicBlock::iterator pt = F.getEntryBlock().getFirstInsertionPt();
+    while (llvm::isa<llvm::AllocaInst>(*pt)) ++pt;
+    llvm::IRBuilder<> IRB(&*pt);
+    return funcBase = IRB.CreateLoad(base, "etsan.site_base");
+  }
+
+public:
+
+  // Starts the table of module M
+  void init(llvm::Module &M) {
+    ids.clear();
+    sites.clear();
+    nameIds.clear();
+    names.clear();
+    fileIds.clear();
+    files.clear();
+    scopeFiles.clear();
+    beginFunction();
+    llvm::Type *Int32Ty = llvm::Type::getInt32Ty(M.getContext());
+    base = new llvm::GlobalVariable(
+        M, Int32Ty, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantInt::get(Int32Ty, 0), "__etsan_site_base");
+  }
+
+  // Drops the caches of the previous function
+  void beginFunction() {
+    addrNames.clear();
+    funcBase = nullptr;
+  }
+
+  // Returns the site ID of the access of instruction I to Addr, computed
+  // at the insertion point of IRB.
+  llvm::Value *getSiteId(llvm::IRBuilder<> &IRB, llvm::Instruction *I,
+                         llvm::Value *Addr, const llvm::DataLayout &DL) {
+    uint64_t loc = (uint64_t(getFileIdx(I) & 0xFFFF) << 48) |
+                   (uint64_t(getLineNumber(I)) << 16) |
+                   std::min(getColumnNumber(I), 0xFFFFu);
+    Site site(loc, getNameIdx(Addr, DL));
+
+    auto it = ids.insert({site, uint32_t(sites.size())});
+    if (it.second) sites.push_back(site);
+    return IRB.CreateAdd(getBase(*I->getFunction()),
+                         IRB.getInt32(it.first->second));
+  }
+
+  // Emits the tables and registers them from the module constructor Ctor
+  // by calling Register: i32 (i8*, i32, i8**, i32).
+  void emit(llvm::Module &M, llvm::Function *Ctor, llvm::Function *Register) {
+    if (sites.empty()) return;
+
+    llvm::IRBuilder<> IRB(Ctor->getEntryBlock().getTerminator());
+    llvm::StructType *SiteTy = llvm::StructType::get(
+        IRB.getInt64Ty(), IRB.getInt8PtrTy(), nullptr);
+
+    llvm::StringMap<llvm::Constant *> strings; // one global per string
+    auto getString = [&](const std::string &str) {
+      llvm::Constant *&S = strings[str];
+      if (!S) {
+        S = llvm::cast<llvm::Constant>(
+            IRB.CreateGlobalStringPtr(str, "etsan_site_str"));
+      }
+      return S;
+    };
+
+    std::vector<llvm::Constant *> entries;
+    for (const Site &site : sites) {
+      entries.push_back(llvm::ConstantStruct::get(
+          SiteTy, {IRB.getInt64(site.first), getString(names[site.second])}));
+    }
+
+    std::vector<llvm::Constant *> names;
+    for (const std::string &file : files) {
+      names.push_back(getString(file));
+    }
+
+    llvm::ArrayType *TableTy = llvm::ArrayType::get(SiteTy, entries.size());
+    auto *Table = new llvm::GlobalVariable(
+        M, TableTy, true, llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantArray::get(TableTy, entries), "__etsan_sites");
+
+    llvm::ArrayType *FilesTy =
+        llvm::ArrayType::get(IRB.getInt8PtrTy(), names.size());
+    auto *Files = new llvm::GlobalVariable(
+        M, FilesTy, true, llvm::GlobalValue::PrivateLinkage,
+        llvm::ConstantArray::get(FilesTy, names), "__etsan_site_files");
+
+    llvm::Value *first = IRB.CreateCall(
+        Register, {IRB.CreatePointerCast(Table, IRB.getInt8PtrTy()),
+                   IRB.getInt32(entries.size()),
+                   IRB.CreatePointerCast(Files,
+                                         IRB.getInt8PtrTy()->getPointerTo()),
+                   IRB.getInt32(names.size())});
+    IRB.CreateStore(first, base);
   }
+};
 
 } // end EmbedSanitizer
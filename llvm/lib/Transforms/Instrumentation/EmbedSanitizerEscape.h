@@ -0,0 +1,370 @@
+//===-- Extension to ThreadSanitizer.cpp - detecting races, Embeded ARM --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021  Hassan Salehe Matar, Koc University
+//            Email: hassansalehe@gmail.com
+//
+//===----------------------------------------------------------------------===//
+
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include <limits.h>
+
+// Finds the memory accesses that no other thread can make concurrently,
+// over the whole module, so that they need no check.
+namespace EmbedSanitizer {
+
+/**
+ * Thread-escape analysis of a module
+ *
+ * Each function is given the thread that runs it, from the direct calls:
+ *  - pre: main before its first call that may create a thread, and the
+ *    functions called only from there: no other thread exists yet;
+ *  - main: the rest of main and the functions it calls;
+ *  - a start routine that main passes to a single pthread_create call,
+ *    out of any loop, and the functions called only from it;
+ *  - many: functions visible outside the module or whose address is
+ *    taken, routines started more than once, and what they call.
+ * The pre phase happens before every other thread, so threads share
+ * nothing with it. An access cannot race if it runs in the pre phase or
+ * if it is to
+ *  - a global variable of the module whose address is only loaded from
+ *    and stored to, by the pre phase and at most one other thread;
+ *  - a heap block, as a stack variable, whose pointer is not captured;
+ *  - a nocapture parameter of a function of the module only called
+ *    directly, passed such a block, local or parameter at every call.
+ * With -embedsan-whole-program (e.g. on the bitcode of a whole program)
+ * external functions and globals are taken as used in the module only,
+ * and calls out of it as not creating threads.
+ *
+ * Index ranges of a shared array split among threads (e.g. by thread
+ * number) are beyond it: they escape to all threads.
+ */
+class ThreadEscape {
+  // Threads; start routines run in those from kMain + 1 on
+  enum { kUnset = -1 /* never run */, kPre = 0, kMain = 1, kMany = INT_MAX };
+
+  const llvm::TargetLibraryInfo *TLI = nullptr;
+  bool WholeProgram = false;
+  bool Analyzed = false;
+  llvm::Function *Main = nullptr;
+
+  llvm::DenseMap<const llvm::Function *, int> Threads;
+  llvm::SmallPtrSet<const llvm::Function *, 16> MayCreate;
+  llvm::SmallPtrSet<const llvm::Instruction *, 64> PreInstructions;
+  llvm::SmallPtrSet<const llvm::GlobalVariable *, 16> LocalGlobals;
+  llvm::SmallPtrSet<const llvm::Argument *, 16> LocalArgs;
+
+  // Runs a and b in one thread, the pre phase being before either
+  static int merge(int a, int b) {
+    if (a == kUnset || a == kPre) return b == kUnset ? a : b;
+    if (b == kUnset || b == kPre || b == a) return a;
+    return kMany;
+  }
+
+  static bool isThreadCreate(const llvm::Function *F) {
+    return F && (F->getName().startswith("pthread_create") ||
+                 F->getName() == "__etsan_thread_create");
+  }
+
+  // The routine "CS" starts if it is a pthread_create call, else null
+  static const llvm::Value *startRoutine(llvm::ImmutableCallSite CS) {
+    if (!isThreadCreate(CS.getCalledFunction()) || CS.arg_size() < 3)
+      return nullptr;
+    return CS.getArgument(2)->stripPointerCasts();
+  }
+
+  // True if every use of F calls it, or starts it when "Started" is set
+  static bool onlyCalled(const llvm::Function &F, bool Started) {
+    for (const llvm::Use &U : F.uses()) {
+      const llvm::Use *Use = &U;
+      if (const llvm::ConstantExpr *CE =
+              llvm::dyn_cast<llvm::ConstantExpr>(U.getUser())) {
+        if (!CE->isCast() || !CE->hasOneUse()) return false;
+        Use = &*CE->use_begin();
+      }
+      llvm::ImmutableCallSite CS(Use->getUser());
+      if (!CS) return false;
+      if (CS.isCallee(Use)) continue;
+      if (!Started || startRoutine(CS) != &F) return false;
+    }
+    return true;
+  }
+
+  bool isLibraryFunction(const llvm::Function &F) const {
+    llvm::StringRef Name = F.getName();
+    llvm::LibFunc::Func Func;
+    return F.isIntrinsic() || Name.startswith("pthread_") ||
+           Name.startswith("sem_") || Name.startswith("__tsan_") ||
+           Name.startswith("__etsan_") || TLI->getLibFunc(Name, Func);
+  }
+
+  // True if I may create a thread, directly or through its callees
+  bool mayCreateThread(const llvm::Instruction &I) const {
+    llvm::ImmutableCallSite CS(&I);
+    if (!CS || llvm::isa<llvm::IntrinsicInst>(I)) return false;
+    const llvm::Function *Callee = CS.getCalledFunction();
+    if (!Callee) return !llvm::isa<llvm::InlineAsm>(CS.getCalledValue());
+    if (isThreadCreate(Callee)) return true;
+    if (Callee->isDeclaration())
+      return !WholeProgram && !isLibraryFunction(*Callee);
+    return MayCreate.count(Callee);
+  }
+
+  static bool inCycle(const llvm::BasicBlock *BB) {
+    llvm::SmallPtrSet<const llvm::BasicBlock *, 16> Visited;
+    llvm::SmallVector<const llvm::BasicBlock *, 16> Worklist(succ_begin(BB),
+                                                             succ_end(BB));
+    while (!Worklist.empty()) {
+      const llvm::BasicBlock *Succ = Worklist.pop_back_val();
+      if (Succ == BB) return true;
+      if (Visited.insert(Succ).second)
+        Worklist.append(succ_begin(Succ), succ_end(Succ));
+    }
+    return false;
+  }
+
+  void findThreadCreators(llvm::Module &M) {
+    for (llvm::Function &F : M)
+      for (llvm::Instruction &I : llvm::instructions(F))
+        if (!F.isDeclaration() && mayCreateThread(I)) {
+          MayCreate.insert(&F);
+          break;
+        }
+    // callers of creators, up to a fixed point
+    for (bool Changed = true; Changed;) {
+      Changed = false;
+      for (llvm::Function &F : M) {
+        if (F.isDeclaration() || MayCreate.count(&F)) continue;
+        for (llvm::Instruction &I : llvm::instructions(F))
+          if (mayCreateThread(I)) {
+            MayCreate.insert(&F);
+            Changed = true;
+            break;
+          }
+      }
+    }
+  }
+
+  // The instructions of main no thread creation may precede
+  void findPrePhase() {
+    llvm::SmallPtrSet<const llvm::BasicBlock *, 16> After;
+    llvm::SmallVector<const llvm::BasicBlock *, 16> Worklist;
+    for (llvm::BasicBlock &BB : *Main)
+      for (llvm::Instruction &I : BB)
+        if (mayCreateThread(I)) {
+          Worklist.append(succ_begin(&BB), succ_end(&BB));
+          break;
+        }
+    while (!Worklist.empty()) {
+      const llvm::BasicBlock *BB = Worklist.pop_back_val();
+      if (After.insert(BB).second)
+        Worklist.append(succ_begin(BB), succ_end(BB));
+    }
+    for (llvm::BasicBlock &BB : *Main) {
+      if (After.count(&BB)) continue;
+      for (llvm::Instruction &I : BB) {
+        if (mayCreateThread(I)) break;
+        PreInstructions.insert(&I);
+      }
+    }
+  }
+
+  // Gives each function the thread that runs it
+  void findThreads(llvm::Module &M) {
+    llvm::DenseMap<const llvm::Value *, unsigned> Starts;
+    llvm::DenseMap<const llvm::Value *, const llvm::Instruction *> StartedBy;
+    for (llvm::Function &F : M)
+      for (llvm::Instruction &I : llvm::instructions(F))
+        if (const llvm::Value *Routine =
+                startRoutine(llvm::ImmutableCallSite(&I))) {
+          Starts[Routine]++;
+          StartedBy[Routine] = &I;
+        }
+
+    llvm::SmallVector<llvm::Function *, 16> Worklist;
+    int NextThread = kMain + 1;
+    for (llvm::Function &F : M) {
+      if (F.isDeclaration()) continue;
+      int Thread = kUnset;
+      if (&F == Main) {
+        Thread = kMain;
+      } else if (!onlyCalled(F, true) ||
+                 (!F.hasLocalLinkage() && !WholeProgram)) {
+        Thread = kMany;
+      } else if (Starts.count(&F)) {
+        const llvm::Instruction *Create = StartedBy[&F];
+        bool Once = Starts[&F] == 1 && Create->getFunction() == Main &&
+                    !inCycle(Create->getParent());
+        Thread = Once ? NextThread++ : kMany;
+      }
+      if (Thread == kUnset) continue;
+      Threads[&F] = Thread;
+      Worklist.push_back(&F);
+    }
+
+    // callees run in the threads of their callers
+    while (!Worklist.empty()) {
+      llvm::Function *F = Worklist.pop_back_val();
+      for (llvm::Instruction &I : llvm::instructions(*F)) {
+        llvm::ImmutableCallSite CS(&I);
+        const llvm::Function *Callee = CS ? CS.getCalledFunction() : nullptr;
+        if (!Callee || Callee->isDeclaration()) continue;
+        int Caller = threadOf(I);
+        int &Thread = Threads.insert({Callee, kUnset}).first->second;
+        int Merged = merge(Thread, Caller);
+        if (Merged == Thread) continue;
+        Thread = Merged;
+        Worklist.push_back(const_cast<llvm::Function *>(Callee));
+      }
+    }
+  }
+
+  // Merges into "Thread" the threads accessing V, a global or a constant
+  // offset of it. Returns false if its address is used otherwise.
+  bool findAccesses(const llvm::Value *V, int &Thread) const {
+    for (const llvm::User *U : V->users()) {
+      using namespace llvm;
+      if (const ConstantExpr *CE = dyn_cast<ConstantExpr>(U)) {
+        if ((!CE->isCast() && CE->getOpcode() != Instruction::GetElementPtr) ||
+            !findAccesses(CE, Thread))
+          return false;
+      } else if (isa<GetElementPtrInst>(U) || isa<BitCastInst>(U)) {
+        if (!findAccesses(U, Thread)) return false;
+      } else if (const LoadInst *L = dyn_cast<LoadInst>(U)) {
+        Thread = merge(Thread, threadOf(*L));
+      } else if (const StoreInst *S = dyn_cast<StoreInst>(U)) {
+        if (S->getValueOperand() == V) return false; // the address escapes
+        Thread = merge(Thread, threadOf(*S));
+      } else {
+        return false;
+      }
+      if (Thread == kMany) return false;
+    }
+    return true;
+  }
+
+  void findLocalGlobals(llvm::Module &M) {
+    for (llvm::GlobalVariable &GV : M.globals()) {
+      if (GV.isDeclaration() || GV.isConstant() ||
+          (!GV.hasLocalLinkage() && !WholeProgram))
+        continue;
+      int Thread = kUnset;
+      if (findAccesses(&GV, Thread)) LocalGlobals.insert(&GV);
+    }
+  }
+
+  // True if Obj, an underlying object of a function, is private to its
+  // invocation
+  bool isPrivateObject(const llvm::Value *Obj) const {
+    if (const llvm::Argument *A = llvm::dyn_cast<llvm::Argument>(Obj))
+      return LocalArgs.count(A);
+    return (llvm::isa<llvm::AllocaInst>(Obj) || llvm::isNoAliasCall(Obj)) &&
+           !llvm::PointerMayBeCaptured(Obj, true, true);
+  }
+
+  void findLocalArgs(llvm::Module &M) {
+    llvm::SmallVector<llvm::Argument *, 16> Candidates;
+    for (llvm::Function &F : M) {
+      if (F.isDeclaration() || &F == Main || !onlyCalled(F, false) ||
+          (!F.hasLocalLinkage() && !WholeProgram))
+        continue;
+      for (llvm::Argument &A : F.args())
+        if (A.getType()->isPointerTy() && A.hasNoCaptureAttr())
+          Candidates.push_back(&A);
+    }
+    // arguments whose every actual is private, up to a fixed point
+    for (bool Changed = true; Changed;) {
+      Changed = false;
+      for (llvm::Argument *A : Candidates) {
+        if (LocalArgs.count(A)) continue;
+        bool Private = true;
+        for (const llvm::User *U : A->getParent()->users()) {
+          llvm::ImmutableCallSite CS(U); // not through a cast
+          if (!CS ||
+              !isPrivateObject(llvm::GetUnderlyingObject(
+                  CS.getArgument(A->getArgNo()), M.getDataLayout()))) {
+            Private = false;
+            break;
+          }
+        }
+        if (Private) {
+          LocalArgs.insert(A);
+          Changed = true;
+        }
+      }
+    }
+  }
+
+  int threadOf(const llvm::Instruction &I) const {
+    const llvm::Function *F = I.getFunction();
+    if (F == Main && PreInstructions.count(&I)) return kPre;
+    auto It = Threads.find(F);
+    return It == Threads.end() ? kUnset : It->second;
+  }
+
+public:
+
+  bool analyzed() const { return Analyzed; }
+
+  void analyze(llvm::Module &M, const llvm::TargetLibraryInfo &Lib,
+               bool IsWholeProgram) {
+    TLI = &Lib;
+    WholeProgram = IsWholeProgram;
+    Analyzed = true;
+    Main = M.getFunction("main");
+    // main called by the program itself may run anywhere
+    if (Main && (Main->isDeclaration() || !Main->use_empty()))
+      Main = nullptr;
+
+    findThreadCreators(M);
+    if (Main) findPrePhase();
+    findThreads(M);
+    findLocalGlobals(M);
+    findLocalArgs(M);
+  }
+
+  // Called before F is instrumented. The passes run on main since the
+  // analysis may have changed its instructions.
+  void beginFunction(const llvm::Function &F) {
+    if (!Analyzed || &F != Main) return;
+    PreInstructions.clear();
+    findPrePhase();
+  }
+
+  // True if no other thread can access Addr, the address accessed by I,
+  // concurrently with I
+  bool isThreadLocal(const llvm::Instruction &I, const llvm::Value *Addr,
+                     const llvm::DataLayout &DL) const {
+    if (!Analyzed) return false;
+    if (threadOf(I) == kPre) return true;
+    const llvm::Value *Obj = llvm::GetUnderlyingObject(Addr, DL);
+    if (const llvm::GlobalVariable *GV =
+            llvm::dyn_cast<llvm::GlobalVariable>(Obj))
+      return LocalGlobals.count(GV);
+    if (llvm::isa<llvm::AllocaInst>(Obj)) return false; // checked before
+    return isPrivateObject(Obj);
+  }
+};
+
+} // end EmbedSanitizer
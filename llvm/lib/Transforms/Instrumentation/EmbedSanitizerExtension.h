@@ -59,12 +59,54 @@
 // Particularly, it extends ThreadSanitizer to serve the
 // purpose of EmbedSanitizer: race detection for 32-bit ARM.
 namespace EmbedSanitizer {
+
+  // Declares the runtime callback "name" returning "RetTy", whose
+  // parameters are one i8* per pointer in "Args" and "Args" otherwise,
+  // and inserts a call to it at the insertion point of "IRB".
+  llvm::Value *insertSyncCallback(llvm::IRBuilder<> &IRB,
+                                  llvm::StringRef name, llvm::Type *RetTy,
+                                  llvm::ArrayRef<llvm::Value *> Args) {
+    llvm::Module *M = IRB.GetInsertBlock()->getModule();
+    llvm::SmallVector<llvm::Value *, 4> CallArgs;
+    llvm::SmallVector<llvm::Type *, 4> ParamTys;
+    for (llvm::Value *Arg : Args) {
+      if (Arg->getType()->isPointerTy())
+        Arg = IRB.CreatePointerCast(Arg, IRB.getInt8PtrTy());
+      CallArgs.push_back(Arg);
+      ParamTys.push_back(Arg->getType());
+    }
+
+    llvm::Function *Callback = checkSanitizerInterfaceFunction(
+        M->getOrInsertFunction(
+            name, llvm::FunctionType::get(RetTy, ParamTys, false)));
+    return IRB.CreateCall(Callback, CallArgs);
+  }
+
+  // Inserts the acquire callback "name" after the lock call CI, run only
+  // if CI returns 0. Failed try and timed locks, which programs may spin
+  // on, then cost a compare and a branch instead of a clock join.
+  void insertAcquireIfLocked(llvm::CallInst *CI, llvm::StringRef name,
+                             llvm::ArrayRef<llvm::Value *> Args) {
+    llvm::IRBuilder<> IRB(CI->getNextNode());
+    if (CI->getType()->isIntegerTy()) {
+      llvm::Value *Locked = IRB.CreateICmpEQ(
+          CI, llvm::ConstantInt::get(CI->getType(), 0));
+      llvm::TerminatorInst *Then = llvm::SplitBlockAndInsertIfThen(
+          Locked, &*IRB.GetInsertPoint(), false);
+      IRB.SetInsertPoint(Then);
+    }
+    insertSyncCallback(IRB, name, IRB.getVoidTy(), Args);
+  }
+
   //Lan: 决定了哪里是线程开始
   /**
    * Check if the call instruction calls one of the
    * synchronization functions (eg. pthread_create,
-   * pthread_join, pthread_mutex_lock, etc) and inserts
-   * race detection callbacks to capture the HB dependencies.
+   * pthread_join, pthread_mutex_lock, pthread_cond_wait,
+   * pthread_rwlock_*, pthread_barrier_wait, sem_post, etc)
+   * and inserts race detection callbacks to capture the HB
+   * dependencies. Lock callbacks run only if the lock succeeded.
+   * May split the block of Inst.
    */
   void InstrIfSynchronization(llvm::Instruction & Inst) {
 
@@ -80,21 +122,13 @@ namespace EmbedSanitizer {
 
     if (name.startswith("pthread_create")) {
 
-      // get pointer to child id
-      llvm::Value *threadIdPtr = CI->getArgOperand(0);
-
-      // I struggled for 2 hours. Big-up to this SO question:
-      // http://stackoverflow.com/q/33327097/1952879
-      IRB.SetInsertPoint( Inst.getNextNode() );
-
-      // Create callback function
-      llvm::Function *tsan_create = checkSanitizerInterfaceFunction(
-          M->getOrInsertFunction(
-              "__tsan_thread_create", IRB.getVoidTy(),
-              IRB.getInt8PtrTy(), nullptr));
-
-      // insert the callback function
-      IRB.CreateCall(tsan_create, {threadIdPtr} );
+      // The runtime's pthread_create makes the state of the child before
+      // it starts, from the clock of the parent at the call, and has the
+      // child cache it: the call stands for both pthread_create and
+      // __tsan_thread_create.
+      llvm::Constant *etsan_create = M->getOrInsertFunction(
+          "__etsan_thread_create", F->getFunctionType());
+      CI->setCalledFunction(etsan_create);
     } else if (name.startswith("pthread_join")) {
 
       // get pointer to child id
@@ -110,19 +144,11 @@ namespace EmbedSanitizer {
 
       // insert the callback function
       IRB.CreateCall(tsan_join, {childThreadIdAddr} );
-    } else if (name.startswith("pthread_mutex_lock")) {
+    } else if (name.startswith("pthread_mutex_lock") ||
+               name.startswith("pthread_mutex_trylock") ||
+               name.startswith("pthread_mutex_timedlock")) {
 
-      llvm::Value * lockAddr = CI->getArgOperand(0); // lock pointer
-      IRB.SetInsertPoint(Inst.getNextNode());
-
-      // Create callback function
-      llvm::Function *tsan_lock = checkSanitizerInterfaceFunction(
-          M->getOrInsertFunction(
-              "__tsan_thread_lock", IRB.getVoidTy(),
-              IRB.getInt8PtrTy(), nullptr));
-
-      // insert the callback function
-      IRB.CreateCall(tsan_lock, {lockAddr} );
+      insertAcquireIfLocked(CI, "__tsan_thread_lock", {CI->getArgOperand(0)});
     } else if (name.startswith("pthread_mutex_unlock")) {
 
       llvm::Value * lockAddr = CI->getArgOperand(0); // lock pointer
@@ -136,6 +162,93 @@ namespace EmbedSanitizer {
 
       // insert the callback function
       IRB.CreateCall(tsan_unlock, {lockAddr} );
+    } else if (name.startswith("pthread_cond_signal") ||
+               name.startswith("pthread_cond_broadcast")) {
+
+      insertSyncCallback(IRB, "__tsan_cond_signal", IRB.getVoidTy(),
+                         {CI->getArgOperand(0)});
+    } else if (name.startswith("pthread_cond_wait") ||
+               name.startswith("pthread_cond_timedwait")) {
+
+      // the mutex is released while waiting and reacquired on wake up
+      llvm::Value *cond = CI->getArgOperand(0);
+      llvm::Value *mutex = CI->getArgOperand(1);
+      insertSyncCallback(IRB, "__tsan_thread_unlock", IRB.getVoidTy(),
+                         {mutex});
+      IRB.SetInsertPoint(Inst.getNextNode());
+      insertSyncCallback(IRB, "__tsan_cond_wait", IRB.getVoidTy(),
+                         {cond, mutex});
+    } else if (name.startswith("pthread_rwlock_rdlock") ||
+               name.startswith("pthread_rwlock_tryrdlock") ||
+               name.startswith("pthread_rwlock_timedrdlock")) {
+
+      insertAcquireIfLocked(CI, "__tsan_rwlock_rdlock",
+                            {CI->getArgOperand(0)});
+    } else if (name.startswith("pthread_rwlock_wrlock") ||
+               name.startswith("pthread_rwlock_trywrlock") ||
+               name.startswith("pthread_rwlock_timedwrlock")) {
+
+      insertAcquireIfLocked(CI, "__tsan_rwlock_wrlock",
+                            {CI->getArgOperand(0)});
+    } else if (name.startswith("pthread_rwlock_unlock")) {
+
+      insertSyncCallback(IRB, "__tsan_rwlock_unlock", IRB.getVoidTy(),
+                         {CI->getArgOperand(0)});
+    } else if (name.startswith("pthread_barrier_init")) {
+
+      IRB.SetInsertPoint(Inst.getNextNode());
+      insertSyncCallback(IRB, "__tsan_barrier_init", IRB.getVoidTy(),
+                         {CI->getArgOperand(0),
+                          IRB.CreateIntCast(CI->getArgOperand(2),
+                                            IRB.getInt32Ty(), false)});
+    } else if (name.startswith("pthread_barrier_wait")) {
+
+      // one join into the episode clock on arrival, one out of it after
+      llvm::Value *barrier = CI->getArgOperand(0);
+      llvm::Value *episode = insertSyncCallback(
+          IRB, "__tsan_barrier_arrive", IRB.getInt32Ty(), {barrier});
+      IRB.SetInsertPoint(Inst.getNextNode());
+      insertSyncCallback(IRB, "__tsan_barrier_depart", IRB.getVoidTy(),
+                         {barrier, episode});
+    } else if (name.startswith("sem_post")) {
+
+      insertSyncCallback(IRB, "__tsan_sem_post", IRB.getVoidTy(),
+                         {CI->getArgOperand(0)});
+    } else if (name.startswith("sem_wait") ||
+               name.startswith("sem_trywait") ||
+               name.startswith("sem_timedwait")) {
+
+      insertAcquireIfLocked(CI, "__tsan_sem_wait", {CI->getArgOperand(0)});
     } // end if
   } // end function
+
+  /**
+   * Check if the call instruction frees heap memory (free, realloc or
+   * one of the operator delete) and lets the runtime forget the states
+   * of the freed block: __tsan_free goes before free and deletes, and
+   * realloc calls are redirected to __tsan_realloc.
+   */
+  void InstrIfDeallocation(llvm::Instruction & Inst) {
+
+    llvm::CallInst *CI = llvm::dyn_cast<llvm::CallInst>(&Inst);
+    if ( !CI ) return;
+
+    llvm::Function *F = CI->getCalledFunction();
+    if ( !F || CI->getNumArgOperands() == 0 ) return;
+
+    llvm::StringRef name = F->getName();
+    llvm::IRBuilder<> IRB(&Inst);
+
+    if (name == "free" ||
+        name.startswith("_ZdlPv") || name.startswith("_ZdaPv")) {
+
+      insertSyncCallback(IRB, "__tsan_free", IRB.getVoidTy(),
+                         {CI->getArgOperand(0)});
+    } else if (name == "realloc") {
+
+      llvm::Module *M = Inst.getModule();
+      CI->setCalledFunction(checkSanitizerInterfaceFunction(
+          M->getOrInsertFunction("__tsan_realloc", F->getFunctionType())));
+    }
+  } // end function
 } // end namespace
@@ -0,0 +1,171 @@
+//===-- Extension to ThreadSanitizer.cpp - detecting races, Embeded ARM --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021  Hassan Salehe Matar, Koc University
+//            Email: hassansalehe@gmail.com
+//
+//===----------------------------------------------------------------------===//
+
+
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+// Checks inlined before memory accesses, so that the common cases take
+// no call: accesses before the first thread is created, and with the
+// runtime built with ETSAN_INLINE_FASTPATH, accesses already recorded in
+// the current epoch.
+namespace EmbedSanitizer {
+
+/**
+ * Shadow layout of the runtime, see etsan/inline_abi.h and etsan/shadow.h.
+ * Keep in sync with them: the runtime static_asserts its side.
+ */
+struct InlineLayout {
+  static const unsigned kWordShift = 2;
+  static const unsigned kOffsetW = 0;
+  static const unsigned kOffsetR = 4;
+
+  unsigned PageShift;
+  unsigned AddressBits;
+  unsigned SlotSize;
+
+  explicit InlineLayout(const llvm::DataLayout &DL) {
+    bool Is32 = DL.getPointerSize() == 4;
+    PageShift = Is32 ? 12 : 16;
+    AddressBits = Is32 ? 32 : 47;
+    SlotSize = Is32 ? 16 : 24;
+  }
+
+  uint64_t pageSlots() const { return uint64_t(1) << PageShift; }
+  uint64_t dirEntries() const {
+    return uint64_t(1) << (AddressBits - kWordShift - PageShift);
+  }
+};
+
+/**
+ * insertGuard() emits the check of the concurrency flag only:
+ *
+ *   head:  if (__etsan_concurrent == 0) goto done
+ *   then:  <runtime call>
+ *   done:  I
+ *
+ * insertCheck() emits the full same-epoch check. Both return the block
+ * of the runtime call, to be emitted by the caller before its terminator:
+ *
+ *   head:  if (__etsan_concurrent == 0) goto done
+ *   page:  page = shadow dir of addr; if (!page) goto slow
+ *   slot:  if (W or R of the slot == *__etsan_thread_epoch) goto done
+ *   slow:  <runtime call>
+ *   done:  I
+ */
+class InlineFastPath {
+public:
+  // Declares the runtime globals; those of the shadow only if "Check"
+  void initialize(llvm::Module &M, bool Check) {
+    using namespace llvm;
+    LLVMContext &C = M.getContext();
+    Type *Int32Ty = Type::getInt32Ty(C);
+    Concurrent = M.getOrInsertGlobal("__etsan_concurrent", Int32Ty);
+    if (!Check)
+      return;
+    ShadowDir = M.getOrInsertGlobal("__etsan_shadow_dir",
+                                    Type::getInt8PtrTy(C));
+    ThreadEpoch = M.getOrInsertGlobal("__etsan_thread_epoch",
+                                      Type::getInt32PtrTy(C));
+    if (GlobalVariable *GV = dyn_cast<GlobalVariable>(ThreadEpoch))
+      GV->setThreadLocalMode(GlobalValue::InitialExecTLSModel);
+  }
+
+  llvm::BasicBlock *insertGuard(llvm::Instruction *I) {
+    using namespace llvm;
+    IRBuilder<> IRB(I);
+    MDNode *Likely = MDBuilder(I->getContext()).createBranchWeights(1000, 1);
+    TerminatorInst *Then = SplitBlockAndInsertIfThen(
+        IRB.CreateIsNotNull(loadConcurrent(IRB)), I, false, Likely);
+    Then->getParent()->setName("embedsan.concurrent");
+    return Then->getParent();
+  }
+
+  llvm::BasicBlock *insertCheck(llvm::Instruction *I, llvm::Value *Addr,
+                                bool IsWrite, const llvm::DataLayout &DL) {
+    using namespace llvm;
+    InlineLayout Layout(DL);
+    LLVMContext &C = I->getContext();
+    Type *IntptrTy = DL.getIntPtrType(C);
+    Type *Int32Ty = Type::getInt32Ty(C);
+    MDBuilder MDB(C);
+    MDNode *Likely = MDB.createBranchWeights(1000, 1);   // first target
+    MDNode *Unlikely = MDB.createBranchWeights(1, 1000); // second target
+
+    BasicBlock *Head = I->getParent();
+    Function *F = Head->getParent();
+    BasicBlock *Done = Head->splitBasicBlock(I->getIterator(),
+                                             "embedsan.done");
+    BasicBlock *Page = BasicBlock::Create(C, "embedsan.page", F, Done);
+    BasicBlock *Slot = BasicBlock::Create(C, "embedsan.slot", F, Done);
+    BasicBlock *Slow = BasicBlock::Create(C, "embedsan.slow", F, Done);
+    Head->getTerminator()->eraseFromParent();
+
+    IRBuilder<> IRB(Head);
+    IRB.CreateCondBr(IRB.CreateIsNull(loadConcurrent(IRB)), Done, Page,
+                     Unlikely);
+
+    IRB.SetInsertPoint(Page);
+    Value *Word = IRB.CreateLShr(IRB.CreatePtrToInt(Addr, IntptrTy),
+                                 InlineLayout::kWordShift);
+    Value *Idx = IRB.CreateAnd(IRB.CreateLShr(Word, Layout.PageShift),
+                               Layout.dirEntries() - 1);
+    Value *Dir = IRB.CreateLoad(ShadowDir);
+    Value *Entry = IRB.CreateGEP(
+        IRB.CreatePointerCast(Dir, IRB.getInt8PtrTy()->getPointerTo()), Idx);
+    LoadInst *PagePtr = IRB.CreateLoad(Entry);
+    PagePtr->setAtomic(AtomicOrdering::Monotonic);
+    PagePtr->setAlignment(DL.getPointerSize());
+    IRB.CreateCondBr(IRB.CreateIsNull(PagePtr), Slow, Slot, Unlikely);
+
+    IRB.SetInsertPoint(Slot);
+    Value *Offset = IRB.CreateAdd(
+        IRB.CreateMul(IRB.CreateAnd(Word, Layout.pageSlots() - 1),
+                      ConstantInt::get(IntptrTy, Layout.SlotSize)),
+        ConstantInt::get(IntptrTy, IsWrite ? InlineLayout::kOffsetW
+                                           : InlineLayout::kOffsetR));
+    Value *Field = IRB.CreatePointerCast(IRB.CreateGEP(PagePtr, Offset),
+                                         Int32Ty->getPointerTo());
+    LoadInst *Last = IRB.CreateLoad(Field);
+    Last->setAtomic(AtomicOrdering::Monotonic);
+    Last->setAlignment(4);
+    Value *Epoch = IRB.CreateLoad(IRB.CreateLoad(ThreadEpoch));
+    IRB.CreateCondBr(IRB.CreateICmpEQ(Last, Epoch), Done, Slow, Likely);
+
+    IRB.SetInsertPoint(Slow);
+    IRB.CreateBr(Done);
+    return Slow;
+  }
+
+private:
+  // A relaxed load: a thread created later synchronizes with its creator
+  // through the runtime, not through the flag
+  llvm::Value *loadConcurrent(llvm::IRBuilder<> &IRB) {
+    llvm::LoadInst *Flag = IRB.CreateLoad(Concurrent);
+    Flag->setAtomic(llvm::AtomicOrdering::Monotonic);
+    Flag->setAlignment(4);
+    return Flag;
+  }
+
+  llvm::Constant *Concurrent = nullptr;
+  llvm::Constant *ShadowDir = nullptr;
+  llvm::Constant *ThreadEpoch = nullptr;
+};
+
+} // namespace EmbedSanitizer
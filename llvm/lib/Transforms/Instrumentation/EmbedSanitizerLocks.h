@@ -0,0 +1,226 @@
+//===-- Extension to ThreadSanitizer.cpp - detecting races, Embeded ARM --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021  Hassan Salehe Matar, Koc University
+//            Email: hassansalehe@gmail.com
+//
+//===----------------------------------------------------------------------===//
+
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+
+// Finds the global variables that every access of the module makes with
+// the same mutex held, so that their accesses need no check: they are
+// ordered by the mutex, and cannot race.
+namespace EmbedSanitizer {
+
+/**
+ * Lock protection of the global variables of a module
+ *
+ * A global is a candidate as for ThreadEscape: it is defined in the
+ * module, with local linkage unless the module is the whole program,
+ * and its address is only loaded from and stored to. The mutexes are
+ * global variables passed to pthread_mutex_lock and _unlock.
+ *
+ * The mutexes each instruction surely holds are found per function, the
+ * function being entered with none: a block holds those held at the end
+ * of all its predecessors, a lock adds its mutex and an unlock removes
+ * it. A call of a function that may unlock, i.e. that is not a library
+ * function and calls pthread_mutex_unlock or an unknown function, directly
+ * or not, clears them all. A global is protected if one of the mutexes is
+ * held by all its accesses. Helpers called with the mutex held, and the
+ * setup code before the threads, therefore keep their globals checked.
+ */
+class LockProtection {
+  // Mutexes tracked per module: one bit each in a Held set
+  static const unsigned kMaxMutexes = 64;
+  typedef uint64_t Held;
+
+  const llvm::TargetLibraryInfo *TLI = nullptr;
+  bool WholeProgram = false;
+  bool Analyzed = false;
+
+  llvm::DenseMap<const llvm::Value *, unsigned> Mutexes; // to their bit
+  llvm::SmallPtrSet<const llvm::Function *, 16> MayUnlock;
+  llvm::DenseMap<const llvm::Instruction *, Held> HeldAt; // at accesses
+  llvm::SmallPtrSet<const llvm::GlobalVariable *, 16> Protected;
+
+  enum LockOp { kNone, kLock, kUnlock };
+
+  // The operation of the call "CS" on a mutex, and the mutex
+  static LockOp lockOp(llvm::ImmutableCallSite CS,
+                       const llvm::Value *&Mutex) {
+    const llvm::Function *Callee = CS.getCalledFunction();
+    if (!Callee || CS.arg_size() < 1) return kNone;
+    llvm::StringRef Name = Callee->getName();
+    Mutex = CS.getArgument(0)->stripPointerCasts();
+    if (Name == "pthread_mutex_lock") return kLock;
+    if (Name == "pthread_mutex_unlock") return kUnlock;
+    return kNone;
+  }
+
+  bool isLibraryFunction(const llvm::Function &F) const {
+    llvm::StringRef Name = F.getName();
+    llvm::LibFunc::Func Func;
+    return F.isIntrinsic() ||
+           (Name.startswith("pthread_") && Name != "pthread_mutex_unlock") ||
+           Name.startswith("sem_") || Name.startswith("__tsan_") ||
+           Name.startswith("__etsan_") || TLI->getLibFunc(Name, Func);
+  }
+
+  // True if the call "CS" may release a mutex the caller holds
+  bool mayUnlock(llvm::ImmutableCallSite CS) const {
+    if (llvm::isa<llvm::IntrinsicInst>(CS.getInstruction())) return false;
+    const llvm::Function *Callee = CS.getCalledFunction();
+    if (!Callee) return !llvm::isa<llvm::InlineAsm>(CS.getCalledValue());
+    if (Callee->isDeclaration())
+      return Callee->getName() == "pthread_mutex_unlock" ||
+             (!WholeProgram && !isLibraryFunction(*Callee));
+    return MayUnlock.count(Callee);
+  }
+
+  void findMutexes(llvm::Module &M) {
+    for (llvm::Function &F : M)
+      for (llvm::Instruction &I : llvm::instructions(F)) {
+        llvm::ImmutableCallSite CS(&I);
+        const llvm::Value *Mutex;
+        if (!CS || lockOp(CS, Mutex) == kNone ||
+            !llvm::isa<llvm::GlobalVariable>(Mutex))
+          continue;
+        if (!Mutexes.count(Mutex) && Mutexes.size() < kMaxMutexes)
+          Mutexes.insert({Mutex, Mutexes.size()});
+      }
+  }
+
+  // Functions that may unlock, up to a fixed point over the call graph
+  void findUnlockers(llvm::Module &M) {
+    for (bool Changed = true; Changed;) {
+      Changed = false;
+      for (llvm::Function &F : M) {
+        if (F.isDeclaration() || MayUnlock.count(&F)) continue;
+        for (llvm::Instruction &I : llvm::instructions(F)) {
+          llvm::ImmutableCallSite CS(&I);
+          if (CS && mayUnlock(CS)) {
+            MayUnlock.insert(&F);
+            Changed = true;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  Held transfer(const llvm::Instruction &I, Held In) const {
+    llvm::ImmutableCallSite CS(&I);
+    if (!CS) return In;
+    const llvm::Value *Mutex = nullptr;
+    LockOp Op = lockOp(CS, Mutex);
+    auto It = Mutexes.find(Mutex);
+    if (Op != kNone && It != Mutexes.end()) {
+      Held Bit = Held(1) << It->second;
+      return Op == kLock ? In | Bit : In & ~Bit;
+    }
+    return mayUnlock(CS) ? 0 : In;
+  }
+
+  // Records the mutexes held at each load and store of F
+  void findHeld(llvm::Function &F) {
+    using namespace llvm;
+    DenseMap<const BasicBlock *, Held> Out;
+    for (BasicBlock &BB : F) Out[&BB] = ~Held(0); // all, until visited
+    for (bool Changed = true; Changed;) {
+      Changed = false;
+      for (BasicBlock &BB : F) {
+        Held H = ~Held(0);
+        if (&BB == &F.getEntryBlock()) H = 0;
+        for (const BasicBlock *Pred : predecessors(&BB)) H &= Out[Pred];
+        for (Instruction &I : BB) {
+          if (isa<LoadInst>(I) || isa<StoreInst>(I)) HeldAt[&I] = H;
+          H = transfer(I, H);
+        }
+        if (Out[&BB] != H) {
+          Out[&BB] = H;
+          Changed = true;
+        }
+      }
+    }
+  }
+
+  // Intersects into "H" the mutexes held at the accesses of V, a global
+  // or a constant offset of it. Returns false if its address is used
+  // otherwise.
+  bool findAccesses(const llvm::Value *V, Held &H) const {
+    for (const llvm::User *U : V->users()) {
+      using namespace llvm;
+      if (const ConstantExpr *CE = dyn_cast<ConstantExpr>(U)) {
+        if ((!CE->isCast() && CE->getOpcode() != Instruction::GetElementPtr) ||
+            !findAccesses(CE, H))
+          return false;
+      } else if (isa<GetElementPtrInst>(U) || isa<BitCastInst>(U)) {
+        if (!findAccesses(U, H)) return false;
+      } else if (isa<LoadInst>(U) || isa<StoreInst>(U)) {
+        if (isa<StoreInst>(U) && cast<StoreInst>(U)->getValueOperand() == V)
+          return false; // the address escapes
+        auto It = HeldAt.find(cast<Instruction>(U));
+        H &= It == HeldAt.end() ? 0 : It->second;
+      } else {
+        return false;
+      }
+      if (!H) return false;
+    }
+    return true;
+  }
+
+public:
+
+  bool analyzed() const { return Analyzed; }
+
+  void analyze(llvm::Module &M, const llvm::TargetLibraryInfo &Lib,
+               bool IsWholeProgram) {
+    TLI = &Lib;
+    WholeProgram = IsWholeProgram;
+    Analyzed = true;
+
+    findMutexes(M);
+    if (Mutexes.empty()) return;
+    findUnlockers(M);
+    for (llvm::Function &F : M)
+      if (!F.isDeclaration()) findHeld(F);
+    for (llvm::GlobalVariable &GV : M.globals()) {
+      if (GV.isDeclaration() || GV.isConstant() || Mutexes.count(&GV) ||
+          (!GV.hasLocalLinkage() && !WholeProgram))
+        continue;
+      Held H = ~Held(0);
+      if (!GV.use_empty() && findAccesses(&GV, H)) Protected.insert(&GV);
+    }
+    HeldAt.clear(); // the instructions may change from now on
+  }
+
+  // True if Addr is in a global whose accesses all hold the same mutex
+  bool isProtected(const llvm::Value *Addr, const llvm::DataLayout &DL) const {
+    if (Protected.empty()) return false;
+    const llvm::Value *Obj = llvm::GetUnderlyingObject(Addr, DL);
+    const llvm::GlobalVariable *GV = llvm::dyn_cast<llvm::GlobalVariable>(Obj);
+    return GV && Protected.count(GV);
+  }
+};
+
+} // end EmbedSanitizer
@@ -0,0 +1,88 @@
+//===-- Extension to ThreadSanitizer.cpp - detecting races, Embeded ARM --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021  Hassan Salehe Matar, Koc University
+//            Email: hassansalehe@gmail.com
+//
+//===----------------------------------------------------------------------===//
+
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/CallingConv.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Module.h"
+
+// Calls of the memory access callbacks that keep the registers of the
+// caller, so that a loop does not spill and reload its values around
+// each instrumented access. The calls go to trampolines of the runtime,
+// __etsan_pm_<callback> (etsan/trampolines.h), which save the registers
+// the callbacks may clobber under the C convention.
+namespace EmbedSanitizer {
+
+/**
+ * On ARM, where LLVM has no preserve_most convention, the call is an
+ * inline "bl" taking the address in r0 and the site in r1: only r12, lr
+ * and the flags are clobbered. On x86-64 it is a preserve_most call.
+ * Other targets keep the callbacks as they are.
+ */
+class PreservingCalls {
+public:
+  // Returns true if the target of "M" has the trampolines
+  bool initialize(llvm::Module &M) {
+    Triple = llvm::Triple(M.getTargetTriple());
+    Trampolines.clear();
+    return isArm() || isX86_64();
+  }
+
+  // Emits the call of "Callback" (addr, siteId) through its trampoline
+  void emitCall(llvm::IRBuilder<> &IRB, llvm::Function *Callback,
+                llvm::Value *Addr, llvm::Value *SiteId) {
+    using namespace llvm;
+    std::string Name = trampolineName(Callback->getName());
+    if (isArm()) {
+      InlineAsm *Call = InlineAsm::get(
+          Callback->getFunctionType(), "bl " + Name,
+          "{r0},{r1},~{r12},~{lr},~{cc},~{memory}",
+          /*hasSideEffects=*/true);
+      IRB.CreateCall(Call, {Addr, SiteId});
+      return;
+    }
+    Function *&F = Trampolines[Name];
+    if (!F) {
+      Module &M = *Callback->getParent();
+      F = cast<Function>(M.getOrInsertFunction(
+          Name, Callback->getFunctionType(), Callback->getAttributes()));
+      F->setCallingConv(CallingConv::PreserveMost);
+    }
+    IRB.CreateCall(F, {Addr, SiteId})->setCallingConv(
+        CallingConv::PreserveMost);
+  }
+
+private:
+  llvm::Triple Triple;
+  llvm::StringMap<llvm::Function *> Trampolines;
+
+  bool isArm() const {
+    return Triple.getArch() == llvm::Triple::arm ||
+           Triple.getArch() == llvm::Triple::thumb;
+  }
+  bool isX86_64() const { return Triple.getArch() == llvm::Triple::x86_64; }
+
+  // __tsan_read4 -> __etsan_pm_read4
+  static std::string trampolineName(llvm::StringRef Callback) {
+    if (Callback.startswith("__tsan_"))
+      Callback = Callback.drop_front(strlen("__tsan_"));
+    return ("__etsan_pm_" + Callback).str();
+  }
+};
+
+} // namespace EmbedSanitizer
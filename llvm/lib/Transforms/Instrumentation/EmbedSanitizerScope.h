@@ -0,0 +1,129 @@
+//===-- Extension to ThreadSanitizer.cpp - detecting races, Embeded ARM --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021  Hassan Salehe Matar, Koc University
+//            Email: hassansalehe@gmail.com
+//
+//===----------------------------------------------------------------------===//
+
+
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <fnmatch.h>
+#include <string>
+#include <vector>
+
+// Restricts memory access instrumentation to selected functions.
+namespace EmbedSanitizer {
+
+/**
+ * Scope of the memory access checks, read from a file of entries
+ *
+ *   # comment
+ *   fun:<glob>[=<tier>]     functions (demangled names) to check
+ *   src:<glob>[=<tier>]     source files whose functions to check
+ *   !fun:<glob>             functions never to check
+ *   !src:<glob>             source files never to check
+ *
+ * Without any fun: or src: entry every function not denied is in scope.
+ * A tier ranks entries by priority, 1 (default) being the highest; only
+ * functions whose best tier is at most the requested one are in scope,
+ * so a build can start with the most important code and widen later.
+ * Functions out of scope keep their synchronization instrumentation, so
+ * happens-before stays exact for the functions in scope.
+ */
+class Scope {
+
+  struct Entry {
+    bool        isFunction; // fun: or src:
+    bool        deny;
+    unsigned    tier;
+    std::string glob;
+  };
+
+  std::vector<Entry> entries;
+  bool               hasAllowEntries = false;
+
+  static bool matches(const Entry &e, const std::string &fun,
+                      const std::string &src) {
+    const std::string &name = e.isFunction ? fun : src;
+    return fnmatch(e.glob.c_str(), name.c_str(), 0) == 0;
+  }
+
+public:
+
+  // Reads the entries of "path". Returns false and sets "error" if the
+  // file cannot be read or has a malformed line.
+  bool load(const std::string &path, std::string &error) {
+    auto file = llvm::MemoryBuffer::getFile(path);
+    if (!file) {
+      error = "can't open scope file " + path;
+      return false;
+    }
+
+    llvm::SmallVector<llvm::StringRef, 16> lines;
+    (*file)->getBuffer().split(lines, '\n');
+    for (unsigned no = 0; no < lines.size(); no++) {
+      llvm::StringRef line = lines[no].split('#').first.trim();
+      if (line.empty()) continue;
+
+      Entry e;
+      e.deny = line.consume_front("!");
+      if (line.consume_front("fun:")) {
+        e.isFunction = true;
+      } else if (line.consume_front("src:")) {
+        e.isFunction = false;
+      } else {
+        error = path + ":" + std::to_string(no + 1) +
+                ": expected fun: or src: entry";
+        return false;
+      }
+
+      std::pair<llvm::StringRef, llvm::StringRef> globTier = line.split('=');
+      e.glob = globTier.first.trim().str();
+      e.tier = 1;
+      if (!globTier.second.empty() &&
+          (e.deny || globTier.second.trim().getAsInteger(10, e.tier) ||
+           e.tier == 0)) {
+        error = path + ":" + std::to_string(no + 1) + ": bad tier";
+        return false;
+      }
+      hasAllowEntries |= !e.deny;
+      entries.push_back(e);
+    }
+    return true;
+  }
+
+  // Returns true if the accesses of F are checked when instrumenting
+  // tiers up to "maxTier"
+  bool contains(llvm::Function &F, unsigned maxTier) const {
+    if (entries.empty()) return true;
+
+    std::string fun = getFuncNameStr(F).str();
+    std::string src = F.getParent()->getSourceFileName();
+    if (llvm::DISubprogram *SP = F.getSubprogram()) {
+      std::string dir = SP->getDirectory().str();
+      std::string name = SP->getFilename().str();
+      src = createAbsoluteFileName(dir, name);
+    }
+
+    unsigned tier = hasAllowEntries ? 0 : 1; // 0: not listed
+    for (const Entry &e : entries) {
+      if (!matches(e, fun, src)) continue;
+      if (e.deny) return false;
+      if (!tier || e.tier < tier) tier = e.tier;
+    }
+    return tier && tier <= maxTier;
+  }
+};
+
+} // end EmbedSanitizer
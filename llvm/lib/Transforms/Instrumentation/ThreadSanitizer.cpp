@@ -26,10 +26,20 @@
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/Analysis/CaptureTracking.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpander.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicInst.h"
@@ -38,10 +48,12 @@
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
+#include "llvm/Pass.h"
 #include "llvm/ProfileData/InstrProf.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/EscapeEnumerator.h"
@@ -49,6 +61,11 @@
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 #include "EmbedSanitizerExtension.h"
 #include "EmbedSanitizerDebugInfo.h"
+#include "EmbedSanitizerScope.h"
+#include "EmbedSanitizerInline.h"
+#include "EmbedSanitizerEscape.h"
+#include "EmbedSanitizerLocks.h"
+#include "EmbedSanitizerPreserve.h"
 
 using namespace llvm;
 
@@ -70,6 +87,76 @@ static cl::opt<bool> ClInstrumentAtomics(
 static cl::opt<bool> ClInstrumentMemIntrinsics(
     "tsan-instrument-memintrinsics", cl::init(true),
     cl::desc("Instrument memintrinsics (memset/memcpy/memmove)"), cl::Hidden);
+// EmbedSanitizer: debug tracing of every load and store at run time.
+// Off by default: it adds a runtime call before each access.
+static cl::opt<bool> ClTraceAccesses(
+    "embedsan-trace-accesses", cl::init(false),
+    cl::desc("Insert __tsan_print_variables before loads and stores"),
+    cl::Hidden);
+static cl::opt<bool> ClRemoveRedundantChecks(
+    "embedsan-remove-redundant-checks", cl::init(true),
+    cl::desc("Do not check accesses that another check of the same address "
+             "covers since the last synchronization"),
+    cl::Hidden);
+// EmbedSanitizer: functions whose memory accesses are checked, see
+// EmbedSanitizerScope.h for the format
+static cl::opt<std::string> ClScopeFile(
+    "embedsan-scope", cl::init(""),
+    cl::desc("File listing the functions and sources to check for races"),
+    cl::Hidden);
+static cl::opt<unsigned> ClScopeTier(
+    "embedsan-scope-tier", cl::init(~0U),
+    cl::desc("Check the functions of scope tiers up to this one only"),
+    cl::Hidden);
+static cl::opt<bool> ClHoistRangeChecks(
+    "embedsan-hoist-range-checks", cl::init(true),
+    cl::desc("Check the accesses of a loop sweeping an array with one range "
+             "check before the loop"),
+    cl::Hidden);
+static cl::opt<bool> ClResetStackFrames(
+    "embedsan-reset-stack-frames", cl::init(true),
+    cl::desc("Forget the variable states of escaping locals when their "
+             "function returns"),
+    cl::Hidden);
+// EmbedSanitizer: needs the runtime built with ETSAN_INLINE_FASTPATH
+static cl::opt<bool> ClInlineFastPath(
+    "embedsan-inline-fast-path", cl::init(false),
+    cl::desc("Check inline whether an aligned access of at most 4 bytes was "
+             "already recorded in the current epoch, and call the runtime "
+             "only if not"),
+    cl::Hidden);
+static cl::opt<bool> ClConcurrencyGuard(
+    "embedsan-concurrency-guard", cl::init(false),
+    cl::desc("Skip the memory access callbacks inline while the program "
+             "has a single thread"),
+    cl::Hidden);
+static cl::opt<bool> ClSkipThreadLocal(
+    "embedsan-skip-thread-local", cl::init(true),
+    cl::desc("Do not check accesses that a thread-escape analysis of the "
+             "module proves no other thread makes concurrently"),
+    cl::Hidden);
+static cl::opt<bool> ClWholeProgram(
+    "embedsan-whole-program", cl::init(false),
+    cl::desc("The module is the whole program: its external functions and "
+             "globals are not used elsewhere"),
+    cl::Hidden);
+static cl::opt<bool> ClSkipLockProtected(
+    "embedsan-skip-lock-protected", cl::init(true),
+    cl::desc("Do not check accesses to globals of the module that every "
+             "access makes with the same mutex held"),
+    cl::Hidden);
+// EmbedSanitizer: on ARM and x86-64, see EmbedSanitizerPreserve.h
+static cl::opt<bool> ClPreserveRegisters(
+    "embedsan-preserve-registers", cl::init(false),
+    cl::desc("Call the memory access callbacks through trampolines of the "
+             "runtime that keep the registers of the caller"),
+    cl::Hidden);
+// EmbedSanitizer: needs the runtime built with ETSAN_UNWIND_STACKS
+static cl::opt<bool> ClUnwindStacks(
+    "embedsan-unwind-stacks", cl::init(false),
+    cl::desc("Do not call __tsan_func_entry and __tsan_func_exit: the "
+             "runtime unwinds the stack of a race when it reports it"),
+    cl::Hidden);
 
 STATISTIC(NumInstrumentedReads, "Number of instrumented reads");
 STATISTIC(NumInstrumentedWrites, "Number of instrumented writes");
@@ -82,9 +169,36 @@ STATISTIC(NumOmittedReadsFromConstantGlobals,
           "Number of reads from constant globals");
 STATISTIC(NumOmittedReadsFromVtable, "Number of vtable reads");
 STATISTIC(NumOmittedNonCaptured, "Number of accesses ignored due to capturing");
+STATISTIC(NumOmittedThreadLocal,
+          "Number of accesses ignored due to thread-escape analysis");
+STATISTIC(NumOmittedLockProtected,
+          "Number of accesses ignored due to globals protected by a mutex");
+STATISTIC(NumOmittedRedundantChecks,
+          "Number of accesses ignored due to checks of the same address "
+          "since the last synchronization");
+STATISTIC(NumFunctionsOutOfScope,
+          "Number of functions whose accesses are out of the scope");
+STATISTIC(NumOmittedByRangeChecks,
+          "Number of accesses ignored due to range checks before loops");
+STATISTIC(NumInstrumentedRangeChecks, "Number of instrumented range checks");
+STATISTIC(NumResetLocals, "Number of escaping locals reset at function exit");
+STATISTIC(NumInlineFastPaths, "Number of accesses with an inline fast path");
+STATISTIC(NumConcurrencyGuards, "Number of accesses with an inline guard");
+STATISTIC(NumPreservingCalls,
+          "Number of access callbacks called through trampolines");
 
 static const char *const kTsanModuleCtorName = "tsan.module_ctor";
 static const char *const kTsanInitName = "__tsan_init";
+// EmbedSanitizer: after the runtime's structures, constructed at 101 (see
+// ETSAN_EARLY_INIT), and before the program's constructors
+static const int kTsanCtorPriority = 102;
+
+// EmbedSanitizer: phases of the pass, reported with -time-passes
+static TimerGroup &getPhaseTimers()
+{
+  static TimerGroup Timers("embedsan", "EmbedSanitizer instrumentation");
+  return Timers;
+}
 
 namespace
 {
@@ -92,22 +206,45 @@ namespace
   /// ThreadSanitizer: instrument the code in module to find races.
   struct ThreadSanitizer : public FunctionPass
   {
-    ThreadSanitizer() : FunctionPass(ID) {}
+    ThreadSanitizer()
+        : FunctionPass(ID),
+          AnalysisTimer("analysis", "Thread-escape and lock analyses",
+                        getPhaseTimers()),
+          SelectionTimer("selection", "Choosing the accesses to check",
+                         getPhaseTimers()),
+          OptimizationTimer("optimization",
+                            "Redundant and range check elimination",
+                            getPhaseTimers()),
+          InstrumentationTimer("instrumentation", "Inserting the callbacks",
+                               getPhaseTimers()),
+          SiteTableTimer("sites", "Emitting the site table", getPhaseTimers())
+    {
+    }
     StringRef getPassName() const override;
     void getAnalysisUsage(AnalysisUsage &AU) const override;
     bool runOnFunction(Function &F) override;
     bool doInitialization(Module &M) override;
+    bool doFinalization(Module &M) override;
     static char ID; // Pass identification, replacement for typeid.
 
   private:
     void initializeCallbacks(Module &M);
     bool instrumentLoadOrStore(Instruction *I, const DataLayout &DL);
     bool instrumentAtomic(Instruction *I, const DataLayout &DL);
-    bool instrumentMemIntrinsic(Instruction *I);
+    bool instrumentMemIntrinsic(Instruction *I, const DataLayout &DL);
     void chooseInstructionsToInstrument(SmallVectorImpl<Instruction *> &Local,
                                         SmallVectorImpl<Instruction *> &All,
                                         const DataLayout &DL);
     bool addrPointsToConstantData(Value *Addr);
+    bool isCaptured(Value *Addr);
+    bool isSyncBarrier(Instruction *I);
+    bool noSyncBetween(Instruction *From, Instruction *To,
+                       const SmallPtrSetImpl<BasicBlock *> &SyncBlocks);
+    void removeRedundantChecks(Function &F, SmallVectorImpl<Instruction *> &All);
+    bool hoistRangeChecks(Function &F, SmallVectorImpl<Instruction *> &All,
+                          const DataLayout &DL);
+    void insertTraceCall(Instruction *I, Value *Addr, bool IsWrite,
+                         const DataLayout &DL);
     int getMemoryAccessFuncIndex(Value *Addr, const DataLayout &DL);
     void InsertRuntimeIgnores(Function &F);
 
@@ -135,8 +272,36 @@ namespace
     Function *TsanAtomicSignalFence;
     Function *TsanVptrUpdate;
     Function *TsanVptrLoad;
+    Function *TsanReadRange, *TsanWriteRange;
+    Function *TsanStackReset;
     Function *MemmoveFn, *MemcpyFn, *MemsetFn;
     Function *TsanCtorFunction;
+    Function *TsanRegisterSites;
+    // EmbedSanitizer: debug info of the instrumented accesses
+    EmbedSanitizer::SiteTable Sites;
+    // EmbedSanitizer: functions to check, from -embedsan-scope
+    EmbedSanitizer::Scope InstrScope;
+    // EmbedSanitizer: inline same-epoch checks, -embedsan-inline-fast-path
+    EmbedSanitizer::InlineFastPath FastPath;
+    // EmbedSanitizer: checks removed by removeRedundantChecks in the module
+    unsigned NumRedundantChecksInModule;
+    // EmbedSanitizer: memory of a single thread, -embedsan-skip-thread-local
+    EmbedSanitizer::ThreadEscape Escape;
+    // EmbedSanitizer: checks of it removed in the current function
+    unsigned NumThreadLocalInFunction;
+    // EmbedSanitizer: globals under one mutex, -embedsan-skip-lock-protected
+    EmbedSanitizer::LockProtection Locks;
+    unsigned NumLockProtectedInFunction;
+    // EmbedSanitizer: -embedsan-preserve-registers, if the target has them
+    EmbedSanitizer::PreservingCalls Preserving;
+    bool UsePreservingCalls;
+    // EmbedSanitizer: the module whose callbacks are declared
+    Module *CallbacksModule;
+    // EmbedSanitizer: PointerMayBeCaptured of the stack addresses of the
+    // current function
+    DenseMap<Value *, bool> AddrCaptured;
+    Timer AnalysisTimer, SelectionTimer, OptimizationTimer;
+    Timer InstrumentationTimer, SiteTableTimer;
   };
 } // namespace
 
@@ -146,6 +311,10 @@ INITIALIZE_PASS_BEGIN(
     "EmbedSanitizer: detects data races.",
     false, false)
 INITIALIZE_PASS_DEPENDENCY(TargetLibraryInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(PostDominatorTreeWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass)
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolutionWrapperPass)
 INITIALIZE_PASS_END(
     ThreadSanitizer, "tsan",
     "EmbedSanitizer: detects data races.",
@@ -156,6 +325,10 @@ StringRef ThreadSanitizer::getPassName() const { return "EmbedSanitizer"; }
 void ThreadSanitizer::getAnalysisUsage(AnalysisUsage &AU) const
 {
   AU.addRequired<TargetLibraryInfoWrapperPass>();
+  AU.addRequired<DominatorTreeWrapperPass>();
+  AU.addRequired<PostDominatorTreeWrapperPass>();
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<ScalarEvolutionWrapperPass>();
 }
 
 FunctionPass *llvm::createThreadSanitizerPass()
@@ -172,9 +345,9 @@ void ThreadSanitizer::initializeCallbacks(Module &M)
   // Initialize the callbacks.
   // Lan: callback func 的入口
   // 定义在runtime里面 interface.cc
-  auto& context		= M.getContext();
-	auto* helpTy	= FunctionType::get(Type::getVoidTy(context), {Type::getInt32Ty(context), Type::getInt8PtrTy(context)}, false);
-  TsanPrintVariables = dyn_cast<Function>(M.getOrInsertFunction("__tsan_print_variables", helpTy));
+  TsanPrintVariables = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
+      "__tsan_print_variables", Attr, IRB.getVoidTy(), IRB.getInt32Ty(),
+      IRB.getInt8PtrTy(), IRB.getInt32Ty(), nullptr));
 
   TsanMainFuncExit = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
       "__tsan_main_func_exit", Attr, IRB.getVoidTy(), nullptr));
@@ -196,24 +369,24 @@ void ThreadSanitizer::initializeCallbacks(Module &M)
     SmallString<32> ReadName("__tsan_read" + ByteSizeStr);
     TsanRead[i] = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
         ReadName, Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-        IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+        IRB.getInt32Ty(), nullptr));
 
     SmallString<32> WriteName("__tsan_write" + ByteSizeStr);
     TsanWrite[i] = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
         WriteName, Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-        IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+        IRB.getInt32Ty(), nullptr));
 
     SmallString<64> UnalignedReadName("__tsan_unaligned_read" + ByteSizeStr);
     TsanUnalignedRead[i] =
         checkSanitizerInterfaceFunction(M.getOrInsertFunction(
             UnalignedReadName, Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-            IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+            IRB.getInt32Ty(), nullptr));
 
     SmallString<64> UnalignedWriteName("__tsan_unaligned_write" + ByteSizeStr);
     TsanUnalignedWrite[i] =
         checkSanitizerInterfaceFunction(M.getOrInsertFunction(
             UnalignedWriteName, Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-            IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+            IRB.getInt32Ty(), nullptr));
 
     Type *Ty = Type::getIntNTy(M.getContext(), BitSize);
     Type *PtrTy = Ty->getPointerTo();
@@ -259,24 +432,43 @@ void ThreadSanitizer::initializeCallbacks(Module &M)
   TsanVptrUpdate = checkSanitizerInterfaceFunction(
       M.getOrInsertFunction("__tsan_vptr_update", Attr, IRB.getVoidTy(),
                             IRB.getInt8PtrTy(), IRB.getInt8PtrTy(),
-                            IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+                            IRB.getInt32Ty(), nullptr));
   TsanVptrLoad = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
       "__tsan_vptr_read", Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
-      IRB.getInt8Ty(), IRB.getInt8PtrTy(), IRB.getInt8PtrTy(), nullptr));
+      IRB.getInt32Ty(), nullptr));
+  TsanRegisterSites = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
+      "__tsan_register_sites", Attr, IRB.getInt32Ty(), IRB.getInt8PtrTy(),
+      IRB.getInt32Ty(), IRB.getInt8PtrTy()->getPointerTo(), IRB.getInt32Ty(),
+      nullptr));
   TsanAtomicThreadFence = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
       "__tsan_atomic_thread_fence", Attr, IRB.getVoidTy(), OrdTy, nullptr));
   TsanAtomicSignalFence = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
       "__tsan_atomic_signal_fence", Attr, IRB.getVoidTy(), OrdTy, nullptr));
 
+  TsanReadRange = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
+      "__tsan_read_range", Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
+      IntptrTy, IRB.getInt32Ty(), nullptr));
+  TsanWriteRange = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
+      "__tsan_write_range", Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
+      IntptrTy, IRB.getInt32Ty(), nullptr));
+  TsanStackReset = checkSanitizerInterfaceFunction(M.getOrInsertFunction(
+      "__tsan_stack_reset", Attr, IRB.getVoidTy(), IRB.getInt8PtrTy(),
+      IntptrTy, nullptr));
+  if (ClInlineFastPath || ClConcurrencyGuard)
+    FastPath.initialize(M, ClInlineFastPath);
+  UsePreservingCalls = ClPreserveRegisters && Preserving.initialize(M);
+
+  // EmbedSanitizer: the runtime does not intercept libc, so the memory
+  // intrinsics go to checked versions, with the site of the call.
   MemmoveFn = checkSanitizerInterfaceFunction(
-      M.getOrInsertFunction("memmove", Attr, IRB.getInt8PtrTy(), IRB.getInt8PtrTy(),
-                            IRB.getInt8PtrTy(), IntptrTy, nullptr));
+      M.getOrInsertFunction("__tsan_memmove", Attr, IRB.getInt8PtrTy(), IRB.getInt8PtrTy(),
+                            IRB.getInt8PtrTy(), IntptrTy, IRB.getInt32Ty(), nullptr));
   MemcpyFn = checkSanitizerInterfaceFunction(
-      M.getOrInsertFunction("memcpy", Attr, IRB.getInt8PtrTy(), IRB.getInt8PtrTy(),
-                            IRB.getInt8PtrTy(), IntptrTy, nullptr));
+      M.getOrInsertFunction("__tsan_memcpy", Attr, IRB.getInt8PtrTy(), IRB.getInt8PtrTy(),
+                            IRB.getInt8PtrTy(), IntptrTy, IRB.getInt32Ty(), nullptr));
   MemsetFn = checkSanitizerInterfaceFunction(
-      M.getOrInsertFunction("memset", Attr, IRB.getInt8PtrTy(), IRB.getInt8PtrTy(),
-                            IRB.getInt32Ty(), IntptrTy, nullptr));
+      M.getOrInsertFunction("__tsan_memset", Attr, IRB.getInt8PtrTy(), IRB.getInt8PtrTy(),
+                            IRB.getInt32Ty(), IntptrTy, IRB.getInt32Ty(), nullptr));
 }
 
 bool ThreadSanitizer::doInitialization(Module &M)
@@ -287,11 +479,34 @@ bool ThreadSanitizer::doInitialization(Module &M)
       M, kTsanModuleCtorName, kTsanInitName, /*InitArgTypes=*/{},
       /*InitArgs=*/{});
 
-  appendToGlobalCtors(M, TsanCtorFunction, 0);
+  appendToGlobalCtors(M, TsanCtorFunction, kTsanCtorPriority);
+  CallbacksModule = nullptr;
+  Sites.init(M);
+  NumRedundantChecksInModule = 0;
+  Escape = EmbedSanitizer::ThreadEscape();
+  Locks = EmbedSanitizer::LockProtection();
+
+  InstrScope = EmbedSanitizer::Scope();
+  std::string ScopeError;
+  if (!ClScopeFile.empty() && !InstrScope.load(ClScopeFile, ScopeError))
+    report_fatal_error(ScopeError);
 
   return true;
 }
 
+// EmbedSanitizer: emits the table of the sites of all instrumented
+// accesses and registers it in the module constructor.
+bool ThreadSanitizer::doFinalization(Module &M)
+{
+  {
+    TimeRegion Region(TimePassesIsEnabled ? &SiteTableTimer : nullptr);
+    Sites.emit(M, TsanCtorFunction, TsanRegisterSites);
+  }
+  DEBUG(dbgs() << "EmbedSanitizer: " << NumRedundantChecksInModule
+               << " redundant checks removed in " << M.getName() << "\n");
+  return true;
+}
+
 static bool isVtableAccess(Instruction *I)
 {
   if (MDNode *Tag = I->getMetadata(LLVMContext::MD_tbaa))
@@ -362,10 +577,25 @@ bool ThreadSanitizer::addrPointsToConstantData(Value *Addr)
   return false;
 }
 
+// EmbedSanitizer: inserts a __tsan_print_variables debug call before the
+// access I to Addr. The id tells loads (0) from stores (1).
+void ThreadSanitizer::insertTraceCall(Instruction *I, Value *Addr,
+                                      bool IsWrite, const DataLayout &DL)
+{
+  IRBuilder<> IRB(I);
+  IRB.CreateCall(TsanPrintVariables,
+                 {IRB.getInt32(IsWrite),
+                  IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
+                  Sites.getSiteId(IRB, I, Addr, DL)});
+}
+
 // Instrumenting some of the accesses may be proven redundant.
 // Currently handled:
 //  - read-before-write (within same BB, no calls between)
 //  - not captured variables
+//  - memory of a single thread, see EmbedSanitizerEscape.h
+//  - globals always accessed under one mutex, see EmbedSanitizerLocks.h
+//  - across BBs, see removeRedundantChecks
 //
 // We do not handle some of the patterns that should not survive
 // after the classic compiler optimizations.
@@ -384,14 +614,11 @@ void ThreadSanitizer::chooseInstructionsToInstrument(
   {
     // Lan: instruction 是不是store
     // Lan: 我们需要修改么？得看看是不是能准确得判断是不是读写
-    IRBuilder<> IRB(I);
     if (StoreInst *Store = dyn_cast<StoreInst>(I))
     {
       Value *Addr = Store->getPointerOperand();
-      IRB.CreateCall(TsanPrintVariables, {IRB.getInt32(391),
-                                  IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
-                                  IRB.CreateIntCast(EmbedSanitizer::getLineNumber(I), IRB.getInt8Ty(), false),
-                                  EmbedSanitizer::getObjectName(Addr, I, DL)});
+      if (ClTraceAccesses)
+        insertTraceCall(I, Addr, /*IsWrite=*/true, DL);
       if (!shouldInstrumentReadWriteFromAddress(Addr))
         continue;
       WriteTargets.insert(Addr);
@@ -400,10 +627,8 @@ void ThreadSanitizer::chooseInstructionsToInstrument(
     {
       LoadInst *Load = cast<LoadInst>(I);
       Value *Addr = Load->getPointerOperand();
-      IRB.CreateCall(TsanPrintVariables, {IRB.getInt32(403),
-                                  IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
-                                  IRB.CreateIntCast(EmbedSanitizer::getLineNumber(I), IRB.getInt8Ty(), false),
-                                  EmbedSanitizer::getObjectName(Addr, I, DL)});
+      if (ClTraceAccesses)
+        insertTraceCall(I, Addr, /*IsWrite=*/false, DL);
       if (!shouldInstrumentReadWriteFromAddress(Addr))
         continue;
       if (WriteTargets.count(Addr))
@@ -422,7 +647,7 @@ void ThreadSanitizer::chooseInstructionsToInstrument(
                       ? cast<StoreInst>(I)->getPointerOperand()
                       : cast<LoadInst>(I)->getPointerOperand();
     if (isa<AllocaInst>(GetUnderlyingObject(Addr, DL)) &&
-        !PointerMayBeCaptured(Addr, true, true))
+        !isCaptured(Addr))
     {
       // The variable is addressable but not captured, so it cannot be
       // referenced from a different thread and participate in a data race
@@ -430,11 +655,40 @@ void ThreadSanitizer::chooseInstructionsToInstrument(
       NumOmittedNonCaptured++;
       continue;
     }
+    if (ClSkipThreadLocal && Escape.isThreadLocal(*I, Addr, DL))
+    {
+      // No other thread accesses the variable concurrently, see
+      // EmbedSanitizerEscape.h
+      NumOmittedThreadLocal++;
+      NumThreadLocalInFunction++;
+      continue;
+    }
+    if (ClSkipLockProtected && Locks.isProtected(Addr, DL))
+    {
+      // Every access to the global holds the same mutex, which orders
+      // them, see EmbedSanitizerLocks.h
+      NumOmittedLockProtected++;
+      NumLockProtectedInFunction++;
+      continue;
+    }
     All.push_back(I);
   }
   Local.clear();
 }
 
+// EmbedSanitizer: PointerMayBeCaptured walks all the uses of Addr, so it
+// is asked once per address and function. The trace calls capture the
+// addresses they print, hence are not cached.
+bool ThreadSanitizer::isCaptured(Value *Addr)
+{
+  if (ClTraceAccesses)
+    return PointerMayBeCaptured(Addr, true, true);
+  auto It = AddrCaptured.find(Addr);
+  if (It != AddrCaptured.end())
+    return It->second;
+  return AddrCaptured[Addr] = PointerMayBeCaptured(Addr, true, true);
+}
+
 static bool isAtomic(Instruction *I)
 {
   if (LoadInst *LI = dyn_cast<LoadInst>(I))
@@ -450,6 +704,240 @@ static bool isAtomic(Instruction *I)
   return false;
 }
 
+// EmbedSanitizer: returns true if I may synchronize with another thread,
+// which ends the epoch of the accesses before it: any call that is not an
+// intrinsic (pthread_*, unknown calls) and atomics. The calls of access
+// tracing are not synchronization.
+bool ThreadSanitizer::isSyncBarrier(Instruction *I)
+{
+  if (isAtomic(I))
+    return true;
+  if (isa<IntrinsicInst>(I))
+    return false;
+  CallSite CS(I);
+  if (!CS)
+    return false;
+  return CS.getCalledFunction() != TsanPrintVariables;
+}
+
+// EmbedSanitizer: returns true if no path from From to To (up to the
+// first To after From) crosses a synchronization. SyncBlocks are the
+// blocks with a synchronization.
+bool ThreadSanitizer::noSyncBetween(
+    Instruction *From, Instruction *To,
+    const SmallPtrSetImpl<BasicBlock *> &SyncBlocks)
+{
+  BasicBlock *FromBB = From->getParent();
+  BasicBlock *ToBB = To->getParent();
+
+  // Rest of From's block; To right after From in the same block ends it.
+  for (auto It = ++From->getIterator(); It != FromBB->end(); ++It)
+  {
+    if (&*It == To)
+      return true;
+    if (isSyncBarrier(&*It))
+      return false;
+  }
+  // Head of To's block
+  for (Instruction &Inst : *ToBB)
+  {
+    if (&Inst == To)
+      break;
+    if (isSyncBarrier(&Inst))
+      return false;
+  }
+
+  // Blocks in between: reachable from FromBB without passing ToBB and
+  // reaching ToBB without passing FromBB.
+  SmallPtrSet<BasicBlock *, 16> Forward;
+  SmallVector<BasicBlock *, 16> Worklist(succ_begin(FromBB), succ_end(FromBB));
+  while (!Worklist.empty())
+  {
+    BasicBlock *BB = Worklist.pop_back_val();
+    if (BB == ToBB || BB == FromBB || !Forward.insert(BB).second)
+      continue;
+    Worklist.append(succ_begin(BB), succ_end(BB));
+  }
+
+  SmallPtrSet<BasicBlock *, 16> Visited;
+  Worklist.append(pred_begin(ToBB), pred_end(ToBB));
+  while (!Worklist.empty())
+  {
+    BasicBlock *BB = Worklist.pop_back_val();
+    // Entering FromBB or ToBB runs From or To first: neither is in between
+    if (!Forward.count(BB) || !Visited.insert(BB).second)
+      continue;
+    if (SyncBlocks.count(BB))
+      return false;
+    Worklist.append(pred_begin(BB), pred_end(BB));
+  }
+  return true;
+}
+
+// EmbedSanitizer: removes from All the accesses whose check is redundant
+// because another check of the same address runs in the same epoch, i.e.
+// with no synchronization in between on any path:
+//  - an access dominated by a write, or a read dominated by a read;
+//  - a read post-dominated by a write.
+// A write check reports every race a later or earlier read or write of
+// the same address would in that epoch, and a read check the races of
+// another read. Removed checks are always covered by a check that is
+// kept, possibly through a chain of removed ones.
+void ThreadSanitizer::removeRedundantChecks(
+    Function &F, SmallVectorImpl<Instruction *> &All)
+{
+  DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  PostDominatorTree &PDT =
+      getAnalysis<PostDominatorTreeWrapperPass>().getPostDomTree();
+
+  SmallPtrSet<BasicBlock *, 16> SyncBlocks;
+  for (auto &BB : F)
+    for (auto &Inst : BB)
+      if (isSyncBarrier(&Inst))
+      {
+        SyncBlocks.insert(&BB);
+        break;
+      }
+
+  MapVector<Value *, SmallVector<Instruction *, 4>> AccessesByAddr;
+  for (Instruction *I : All)
+  {
+    Value *Addr = isa<StoreInst>(*I)
+                      ? cast<StoreInst>(I)->getPointerOperand()
+                      : cast<LoadInst>(I)->getPointerOperand();
+    AccessesByAddr[Addr].push_back(I);
+  }
+
+  SmallPtrSet<Instruction *, 16> Redundant;
+  for (auto &Entry : AccessesByAddr)
+  {
+    SmallVectorImpl<Instruction *> &Accesses = Entry.second;
+    if (Accesses.size() < 2)
+      continue;
+    for (Instruction *J : Accesses)
+    {
+      bool IsWrite = isa<StoreInst>(J);
+      for (Instruction *I : Accesses)
+      {
+        if (I == J)
+          continue;
+        // A read check only covers reads
+        if (IsWrite && !isa<StoreInst>(I))
+          continue;
+        bool Before = DT.dominates(I, J);
+        bool After = false;
+        if (!Before && !IsWrite && isa<StoreInst>(I))
+        {
+          BasicBlock *IBB = I->getParent(), *JBB = J->getParent();
+          After = IBB == JBB ? DT.dominates(J, I) : PDT.dominates(IBB, JBB);
+        }
+        if (Before ? noSyncBetween(I, J, SyncBlocks)
+                   : After && noSyncBetween(J, I, SyncBlocks))
+        {
+          Redundant.insert(J);
+          break;
+        }
+      }
+    }
+  }
+
+  if (Redundant.empty())
+    return;
+  All.erase(std::remove_if(All.begin(), All.end(),
+                           [&](Instruction *I) { return Redundant.count(I); }),
+            All.end());
+  NumOmittedRedundantChecks += Redundant.size();
+  NumRedundantChecksInModule += Redundant.size();
+}
+
+// EmbedSanitizer: replaces the checks of loop accesses that sweep
+// contiguous memory with one range check in the loop preheader. An access
+// qualifies when its address is an affine recurrence of its innermost
+// loop with a loop-invariant start and a step of its own size, it runs in
+// every iteration, and the trip count is known on loop entry. The loop
+// must not synchronize, so all its accesses run in the epoch of the
+// preheader and checking them up front reports the same races.
+bool ThreadSanitizer::hoistRangeChecks(
+    Function &F, SmallVectorImpl<Instruction *> &All, const DataLayout &DL)
+{
+  LoopInfo &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  ScalarEvolution &SE = getAnalysis<ScalarEvolutionWrapperPass>().getSE();
+  DominatorTree &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+
+  SmallDenseMap<Loop *, bool, 8> SyncFree;
+  auto isSyncFree = [&](Loop *L) {
+    auto It = SyncFree.find(L);
+    if (It != SyncFree.end())
+      return It->second;
+    bool Free = true;
+    for (BasicBlock *BB : L->blocks())
+      for (Instruction &Inst : *BB)
+        Free &= !isSyncBarrier(&Inst);
+    return SyncFree[L] = Free;
+  };
+
+  SCEVExpander Expander(SE, DL, "etsan.range");
+  SmallPtrSet<Instruction *, 16> Hoisted;
+  for (Instruction *I : All)
+  {
+    Loop *L = LI.getLoopFor(I->getParent());
+    if (!L || isVtableAccess(I))
+      continue;
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Latch = L->getLoopLatch();
+    // A single exit at the latch: the access runs trip count times
+    if (!Preheader || !Latch || L->getExitingBlock() != Latch ||
+        !DT.dominates(I->getParent(), Latch) || !isSyncFree(L))
+      continue;
+
+    bool IsWrite = isa<StoreInst>(*I);
+    Value *Addr = IsWrite ? cast<StoreInst>(I)->getPointerOperand()
+                          : cast<LoadInst>(I)->getPointerOperand();
+    if (getMemoryAccessFuncIndex(Addr, DL) < 0)
+      continue;
+    uint64_t Size = DL.getTypeStoreSize(
+        cast<PointerType>(Addr->getType())->getElementType());
+
+    auto *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(Addr));
+    if (!AR || AR->getLoop() != L || !AR->isAffine())
+      continue;
+    auto *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+    if (!Step || Step->getAPInt() != Size)
+      continue; // strided or backwards
+    const SCEV *Start = AR->getStart();
+    const SCEV *BackedgeCount = SE.getBackedgeTakenCount(L);
+    if (isa<SCEVCouldNotCompute>(BackedgeCount) ||
+        !SE.isLoopInvariant(Start, L) || !SE.isLoopInvariant(BackedgeCount, L))
+      continue;
+
+    // Bytes = (backedge count + 1) * size
+    const SCEV *Bytes = SE.getMulExpr(
+        SE.getAddExpr(SE.getZeroExtendExpr(BackedgeCount, IntptrTy),
+                      SE.getOne(IntptrTy)),
+        SE.getConstant(IntptrTy, Size));
+    if (!isSafeToExpand(Start, SE) || !isSafeToExpand(Bytes, SE))
+      continue;
+
+    Instruction *InsertPt = Preheader->getTerminator();
+    IRBuilder<> IRB(InsertPt);
+    Value *StartV = Expander.expandCodeFor(Start, Addr->getType(), InsertPt);
+    Value *BytesV = Expander.expandCodeFor(Bytes, IntptrTy, InsertPt);
+    IRB.CreateCall(IsWrite ? TsanWriteRange : TsanReadRange,
+                   {IRB.CreatePointerCast(StartV, IRB.getInt8PtrTy()), BytesV,
+                    Sites.getSiteId(IRB, I, Addr, DL)});
+    Hoisted.insert(I);
+    NumInstrumentedRangeChecks++;
+  }
+
+  if (Hoisted.empty())
+    return false;
+  All.erase(std::remove_if(All.begin(), All.end(),
+                           [&](Instruction *I) { return Hoisted.count(I); }),
+            All.end());
+  NumOmittedByRangeChecks += Hoisted.size();
+  return true;
+}
+
 void ThreadSanitizer::InsertRuntimeIgnores(Function &F)
 {
   IRBuilder<> IRB(F.getEntryBlock().getFirstNonPHI());
@@ -468,39 +956,65 @@ bool ThreadSanitizer::runOnFunction(Function &F)
   // the module constructor.
   if (&F == TsanCtorFunction)
     return false;
-  initializeCallbacks(*F.getParent());
+  // EmbedSanitizer: once per module, not per function
+  if (CallbacksModule != F.getParent())
+  {
+    initializeCallbacks(*F.getParent());
+    CallbacksModule = F.getParent();
+  }
+  Sites.beginFunction();
+  AddrCaptured.clear();
   SmallVector<Instruction *, 8> AllLoadsAndStores;
   SmallVector<Instruction *, 8> LocalLoadsAndStores;
   SmallVector<Instruction *, 8> AtomicAccesses;
   SmallVector<Instruction *, 8> MemIntrinCalls;
+  SmallVector<Instruction *, 8> SyncCalls;
   bool Res = false;
   bool HasCalls = false;
   bool SanitizeFunction = F.hasFnAttribute(Attribute::SanitizeThread);
+  // EmbedSanitizer: out-of-scope functions only keep their
+  // synchronization and function entry/exit instrumentation
+  if (SanitizeFunction && !InstrScope.contains(F, ClScopeTier))
+  {
+    NumFunctionsOutOfScope++;
+    SanitizeFunction = false;
+  }
   const DataLayout &DL = F.getParent()->getDataLayout();
   const TargetLibraryInfo *TLI =
       &getAnalysis<TargetLibraryInfoWrapperPass>().getTLI();
+  // EmbedSanitizer: before any function is instrumented
+  {
+    TimeRegion Region(TimePassesIsEnabled ? &AnalysisTimer : nullptr);
+    if (ClSkipThreadLocal && !Escape.analyzed())
+      Escape.analyze(*F.getParent(), *TLI, ClWholeProgram);
+    Escape.beginFunction(F);
+    if (ClSkipLockProtected && !Locks.analyzed())
+      Locks.analyze(*F.getParent(), *TLI, ClWholeProgram);
+  }
+  NumThreadLocalInFunction = 0;
+  NumLockProtectedInFunction = 0;
 
   // Traverse all instructions, collect loads/stores/returns, check for calls.
+  if (TimePassesIsEnabled)
+    SelectionTimer.startTimer();
   for (auto &BB : F)
   {
     for (auto &Inst : BB)
     {
 
       if (isAtomic(&Inst)) {
-        llvm::errs() << Inst <<" is atomic \n";
         AtomicAccesses.push_back(&Inst);
       } else if (isa<LoadInst>(Inst) || isa<StoreInst>(Inst)) {
-        llvm::errs() << Inst <<" is load or store \n";
         LocalLoadsAndStores.push_back(&Inst);
       } else if (isa<CallInst>(Inst) || isa<InvokeInst>(Inst))
       {
-        llvm::errs() << Inst <<" is call or invoke \n";
         // EmbedSanitizer modification:
         if (CallInst *CI = dyn_cast<CallInst>(&Inst))
         {
-          // EmbedSanitizer: check for synchronizations
+          // EmbedSanitizer: check for synchronizations, once the
+          // analyses are used, as lock instrumentation splits blocks
           // Lan: 决定了哪里是线程开始
-          EmbedSanitizer::InstrIfSynchronization(Inst);
+          SyncCalls.push_back(&Inst);
 
           maybeMarkSanitizerLibraryCallNoBuiltin(CI, TLI);
         }
@@ -515,21 +1029,56 @@ bool ThreadSanitizer::runOnFunction(Function &F)
     }
     chooseInstructionsToInstrument(LocalLoadsAndStores, AllLoadsAndStores, DL);
   }
+  if (TimePassesIsEnabled)
+    SelectionTimer.stopTimer();
+
+  {
+    TimeRegion Region(TimePassesIsEnabled ? &OptimizationTimer : nullptr);
+    // EmbedSanitizer: across blocks, up to the next synchronization
+    if (ClRemoveRedundantChecks)
+      removeRedundantChecks(F, AllLoadsAndStores);
+    // EmbedSanitizer: one check per array a loop sweeps
+    if (ClHoistRangeChecks && ClInstrumentMemoryAccesses && SanitizeFunction)
+      Res |= hoistRangeChecks(F, AllLoadsAndStores, DL);
+  }
 
   // We have collected all loads and stores.
   // FIXME: many of these accesses do not need to be checked for races
   // (e.g. variables that do not escape, etc).
-  // TODO Lan: 我们可以通过func名字 来确定哪些func可能race 比如irq;或者划定不同的优先级
+  // Functions to check (e.g. IRQ handlers first) are selected with
+  // -embedsan-scope and -embedsan-scope-tier.
 
   // Instrument memory accesses only if we want to report bugs in the function.
   // Lan: 这里不知道值怎么修改的 SanitizeFunction=1
-  //llvm::errs() << ClInstrumentMemoryAccesses <<" looking for "<<SanitizeFunction<<" \n";
+  if (TimePassesIsEnabled)
+    InstrumentationTimer.startTimer();
   if (ClInstrumentMemoryAccesses && SanitizeFunction)
     for (auto Inst : AllLoadsAndStores)
     {
       Res |= instrumentLoadOrStore(Inst, DL);
     }
 
+  // EmbedSanitizer: shown with -Rpass=tsan
+  if (ClInstrumentMemoryAccesses && SanitizeFunction &&
+      NumThreadLocalInFunction)
+  {
+    DEBUG(dbgs() << "EmbedSanitizer: " << NumThreadLocalInFunction
+                 << " thread-local checks removed in " << F.getName() << "\n");
+    emitOptimizationRemark(F.getContext(), DEBUG_TYPE, F, DebugLoc(),
+                           Twine(NumThreadLocalInFunction) +
+                               " checks of thread-local memory removed");
+  }
+  if (ClInstrumentMemoryAccesses && SanitizeFunction &&
+      NumLockProtectedInFunction)
+  {
+    DEBUG(dbgs() << "EmbedSanitizer: " << NumLockProtectedInFunction
+                 << " lock-protected checks removed in " << F.getName()
+                 << "\n");
+    emitOptimizationRemark(F.getContext(), DEBUG_TYPE, F, DebugLoc(),
+                           Twine(NumLockProtectedInFunction) +
+                               " checks of mutex-protected globals removed");
+  }
+
   // Instrument atomic memory accesses in any case (they can be used to
   // implement synchronization).
   if (ClInstrumentAtomics)
@@ -541,20 +1090,35 @@ bool ThreadSanitizer::runOnFunction(Function &F)
   if (ClInstrumentMemIntrinsics && SanitizeFunction)
     for (auto Inst : MemIntrinCalls)
     {
-      Res |= instrumentMemIntrinsic(Inst);
+      Res |= instrumentMemIntrinsic(Inst, DL);
     }
 
+  for (auto Inst : SyncCalls) {
+    EmbedSanitizer::InstrIfDeallocation(*Inst);
+    EmbedSanitizer::InstrIfSynchronization(*Inst);
+  }
+
+  // EmbedSanitizer: locals whose address escapes keep their accesses
+  // checked, so their states must go when the frame does: the next frame
+  // at the same stack addresses would inherit stale epochs otherwise.
+  SmallVector<AllocaInst *, 4> EscapingLocals;
+  if (ClResetStackFrames && SanitizeFunction)
+    for (auto &Inst : F.getEntryBlock())
+      if (AllocaInst *AI = dyn_cast<AllocaInst>(&Inst))
+        if (AI->isStaticAlloca() && PointerMayBeCaptured(AI, true, true))
+          EscapingLocals.push_back(AI);
+
   // Lan: 不知道这些Attribute怎么定义的
   if (F.hasFnAttribute("sanitize_thread_no_checking_at_run_time"))
   {
-    llvm::errs() << EmbedSanitizer::getFuncName(F) << " " << F.hasFnAttribute("sanitize_thread_no_checking_at_run_time")<<"\n";
+    DEBUG(dbgs() << "no checking at run time: " << F.getName() << "\n");
     assert(!F.hasFnAttribute(Attribute::SanitizeThread));
     if (HasCalls)
       InsertRuntimeIgnores(F);
   }
 
   // Instrument function entry/exit points if there were instrumented accesses.
-  if ((Res || HasCalls) && ClInstrumentFuncEntryExit)
+  if ((Res || HasCalls || !EscapingLocals.empty()) && ClInstrumentFuncEntryExit)
   {
     IRBuilder<> IRB(F.getEntryBlock().getFirstNonPHI());
     // Value *ReturnAddress = IRB.CreateCall(
@@ -564,12 +1128,30 @@ bool ThreadSanitizer::runOnFunction(Function &F)
     // IRB.CreateCall(TsanFuncEntry, ReturnAddress);
     //  Save function name as string into function body
     Value *func_name = EmbedSanitizer::getFuncName(F);
-    IRB.CreateCall(TsanFuncEntry, {IRB.CreatePointerCast(func_name, IRB.getInt8PtrTy())});
+    // EmbedSanitizer: with -embedsan-unwind-stacks no shadow stack is
+    // kept; the runtime unwinds the stack of a race from the unwind
+    // tables, which every instrumented function gets
+    bool TrackFrames = !ClUnwindStacks;
+    if (TrackFrames)
+      IRB.CreateCall(TsanFuncEntry, {IRB.CreatePointerCast(func_name, IRB.getInt8PtrTy())});
+    else
+      F.addFnAttr(Attribute::UWTable);
 
     EscapeEnumerator EE(F, "tsan_cleanup", ClHandleCxxExceptions);
-    while (IRBuilder<> *AtExit = EE.Next())
+    while (IRBuilder<> *AtExit =
+               TrackFrames || !EscapingLocals.empty() ? EE.Next() : nullptr)
     {
-      AtExit->CreateCall(TsanFuncExit, {IRB.CreatePointerCast(func_name, IRB.getInt8PtrTy())});
+      for (auto AI : EscapingLocals)
+      {
+        uint64_t Size = DL.getTypeAllocSize(AI->getAllocatedType()) *
+                        cast<ConstantInt>(AI->getArraySize())->getZExtValue();
+        AtExit->CreateCall(TsanStackReset,
+                           {AtExit->CreatePointerCast(AI, AtExit->getInt8PtrTy()),
+                            ConstantInt::get(IntptrTy, Size)});
+        NumResetLocals++;
+      }
+      if (TrackFrames)
+        AtExit->CreateCall(TsanFuncExit, {IRB.CreatePointerCast(func_name, IRB.getInt8PtrTy())});
     }
     Res = true;
 
@@ -585,6 +1167,8 @@ bool ThreadSanitizer::runOnFunction(Function &F)
       }
     }
   }
+  if (TimePassesIsEnabled)
+    InstrumentationTimer.stopTimer();
   return Res;
 }
 
@@ -609,7 +1193,11 @@ bool ThreadSanitizer::instrumentLoadOrStore(Instruction *I,
     return false;
   if (IsWrite && isVtableAccess(I))
   {
-    DEBUG(dbgs() << "  VPTR : " << *I << "\n");
+    if (ClConcurrencyGuard)
+    {
+      IRB.SetInsertPoint(FastPath.insertGuard(I)->getTerminator());
+      NumConcurrencyGuards++;
+    }
     Value *StoredValue = cast<StoreInst>(I)->getValueOperand();
     // StoredValue may be a vector type if we are storing several vptrs at once.
     // In this case, just take the first element of the vector since this is
@@ -625,19 +1213,20 @@ bool ThreadSanitizer::instrumentLoadOrStore(Instruction *I,
     IRB.CreateCall(TsanVptrUpdate,
                    {IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
                     IRB.CreatePointerCast(StoredValue, IRB.getInt8PtrTy()),
-                    IRB.CreateIntCast(EmbedSanitizer::getLineNumber(I), IRB.getInt8Ty(), false),
-                    EmbedSanitizer::getObjectName(Addr, I, DL),
-                    EmbedSanitizer::getFileName(I)});
+                    Sites.getSiteId(IRB, I, Addr, DL)});
     NumInstrumentedVtableWrites++;
     return true;
   }
   if (!IsWrite && isVtableAccess(I))
   {
+    if (ClConcurrencyGuard)
+    {
+      IRB.SetInsertPoint(FastPath.insertGuard(I)->getTerminator());
+      NumConcurrencyGuards++;
+    }
     IRB.CreateCall(TsanVptrLoad,
                    {IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
-                    IRB.CreateIntCast(EmbedSanitizer::getLineNumber(I), IRB.getInt8Ty(), false),
-                    EmbedSanitizer::getObjectName(Addr, I, DL),
-                    EmbedSanitizer::getFileName(I)});
+                    Sites.getSiteId(IRB, I, Addr, DL)});
     NumInstrumentedVtableReads++;
     return true;
   }
@@ -651,10 +1240,30 @@ bool ThreadSanitizer::instrumentLoadOrStore(Instruction *I,
     OnAccessFunc = IsWrite ? TsanWrite[Idx] : TsanRead[Idx];
   else
     OnAccessFunc = IsWrite ? TsanUnalignedWrite[Idx] : TsanUnalignedRead[Idx];
-  IRB.CreateCall(OnAccessFunc, {IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
-                                IRB.CreateIntCast(EmbedSanitizer::getLineNumber(I), IRB.getInt8Ty(), false),
-                                EmbedSanitizer::getObjectName(Addr, I, DL),
-                                EmbedSanitizer::getFileName(I)});
+  // EmbedSanitizer: an aligned access within one shadow word may skip
+  // the call, see EmbedSanitizerInline.h
+  if (ClInlineFastPath && Idx <= 2 &&
+      (OnAccessFunc == TsanRead[Idx] || OnAccessFunc == TsanWrite[Idx]))
+  {
+    IRB.SetInsertPoint(FastPath.insertCheck(I, Addr, IsWrite, DL)
+                           ->getTerminator());
+    NumInlineFastPaths++;
+  }
+  // EmbedSanitizer: no call at all while the program has one thread
+  else if (ClConcurrencyGuard)
+  {
+    IRB.SetInsertPoint(FastPath.insertGuard(I)->getTerminator());
+    NumConcurrencyGuards++;
+  }
+  Value *Args[] = {IRB.CreatePointerCast(Addr, IRB.getInt8PtrTy()),
+                   Sites.getSiteId(IRB, I, Addr, DL)};
+  if (UsePreservingCalls)
+  {
+    Preserving.emitCall(IRB, cast<Function>(OnAccessFunc), Args[0], Args[1]);
+    NumPreservingCalls++;
+  }
+  else
+    IRB.CreateCall(OnAccessFunc, Args);
 
   if (IsWrite)
     NumInstrumentedWrites++;
@@ -702,7 +1311,8 @@ static ConstantInt *createOrdering(IRBuilder<> *IRB, AtomicOrdering ord)
 // replaced back with intrinsics. If that becomes wrong at some point,
 // we will need to call e.g. __tsan_memset to avoid the intrinsics.
 // Lan: Free after use 的例子应该怎么做？
-bool ThreadSanitizer::instrumentMemIntrinsic(Instruction *I)
+bool ThreadSanitizer::instrumentMemIntrinsic(Instruction *I,
+                                             const DataLayout &DL)
 {
   IRBuilder<> IRB(I);
   if (MemSetInst *M = dyn_cast<MemSetInst>(I))
@@ -711,7 +1321,8 @@ bool ThreadSanitizer::instrumentMemIntrinsic(Instruction *I)
         MemsetFn,
         {IRB.CreatePointerCast(M->getArgOperand(0), IRB.getInt8PtrTy()),
          IRB.CreateIntCast(M->getArgOperand(1), IRB.getInt32Ty(), false),
-         IRB.CreateIntCast(M->getArgOperand(2), IntptrTy, false)});
+         IRB.CreateIntCast(M->getArgOperand(2), IntptrTy, false),
+         Sites.getSiteId(IRB, I, M->getArgOperand(0), DL)});
     I->eraseFromParent();
   }
   else if (MemTransferInst *M = dyn_cast<MemTransferInst>(I))
@@ -720,7 +1331,8 @@ bool ThreadSanitizer::instrumentMemIntrinsic(Instruction *I)
         isa<MemCpyInst>(M) ? MemcpyFn : MemmoveFn,
         {IRB.CreatePointerCast(M->getArgOperand(0), IRB.getInt8PtrTy()),
          IRB.CreatePointerCast(M->getArgOperand(1), IRB.getInt8PtrTy()),
-         IRB.CreateIntCast(M->getArgOperand(2), IntptrTy, false)});
+         IRB.CreateIntCast(M->getArgOperand(2), IntptrTy, false),
+         Sites.getSiteId(IRB, I, M->getArgOperand(0), DL)});
     I->eraseFromParent();
   }
   return false;
@@ -3270,6 +3270,22 @@ static void linkSanitizerRuntimeDeps(const ToolChain &TC,
     CmdArgs.push_back("-ldl");
 }
 
+// EmbedSanitizer: the race detection runtime variant, see etsan/CMakeLists.txt.
+// -flto links the bitcode runtime, so that the linker inlines the callbacks,
+// if it was installed: only a clang build of the runtime has one;
+// EMBEDSAN_RUNTIME=debug the runtime with debug information.
+static StringRef getEmbedSanitizerRuntime(const ToolChain &TC,
+                                          const ArgList &Args) {
+  const char *Variant = ::getenv("EMBEDSAN_RUNTIME");
+  if (Variant && StringRef(Variant) == "debug")
+    return "tsan_cxx_debug";
+  if (Args.hasFlag(options::OPT_flto, options::OPT_flto_EQ,
+                   options::OPT_fno_lto, false) &&
+      llvm::sys::fs::exists(TC.getCompilerRT(Args, "tsan_cxx_lto")))
+    return "tsan_cxx_lto";
+  return "tsan_cxx";
+}
+
 static void
 collectSanitizerRuntimes(const ToolChain &TC, const ArgList &Args,
                          SmallVectorImpl<StringRef> &SharedRuntimes,
@@ -3314,7 +3330,7 @@ collectSanitizerRuntimes(const ToolChain &TC, const ArgList &Args,
      TC.getTriple().str() == "arm-none-linux-gnueabi") { // for 32-bit ARM
     StaticRuntimes.push_back("tsan");
     if (SanArgs.linkCXXRuntimes())
-      StaticRuntimes.push_back("tsan_cxx");
+      StaticRuntimes.push_back(getEmbedSanitizerRuntime(TC, Args));
   }
   if (SanArgs.needsUbsanRt()) {
     StaticRuntimes.push_back("ubsan_standalone");
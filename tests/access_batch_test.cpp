@@ -0,0 +1,113 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the batched checking of memory accesses.
+// Built with ETSAN_BATCHED_ACCESSES.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "etsan/fasttrack.h"
+
+// Races found by ft_flush_accesses, as (site, is write)
+static std::vector<std::pair<unsigned int, bool>> races;
+
+void reportBatchedRace(unsigned int siteId, bool isWrite) {
+  races.push_back(std::make_pair(siteId, isWrite));
+}
+
+class AccessBatchTestFixture : public ::testing::Test {
+protected:
+  AccessBatchTestFixture() {
+    TS.clear();
+    VS.Vstates.clear();
+    races.clear();
+  }
+};
+
+TEST_F(AccessBatchTestFixture, repeatedAccessesAreCheckedOnce) {
+  etsan::AccessBatch batch;
+  int a[2];
+
+  batch.push(&a[1], 4, false, 1);
+  batch.push(&a[0], 4, true, 2);
+  batch.push(&a[1], 4, false, 3);
+  batch.push(&a[1], 4, true, 4);
+  batch.push(&a[0], 4, true, 5);
+  batch.push(&a[1], 2, false, 6);
+
+  ASSERT_EQ(4U, batch.sortUnique());
+  // by address, the first access of each kind in program order
+  EXPECT_EQ(&a[0], batch[0].addr);
+  EXPECT_EQ(2U, batch[0].siteId);
+  EXPECT_EQ(1U, batch[1].siteId);
+  EXPECT_EQ(4U, batch[2].siteId);
+  EXPECT_EQ(6U, batch[3].siteId);
+}
+
+TEST_F(AccessBatchTestFixture, accessesAreCheckedAtTheNextRelease) {
+  static int shared;
+  ThreadState & t = getThreadState();
+  Epoch epoch = t.epoch;
+
+  ft_batch_access(&shared, sizeof(shared), true, 1, t);
+  EXPECT_EQ(VS.Vstates.end(), VS.Vstates.find(&shared));
+
+  LockState lock;
+  ft_release(t, lock);
+  ASSERT_NE(VS.Vstates.end(), VS.Vstates.find(&shared));
+  EXPECT_EQ(epoch, VS.Vstates[&shared].W); // in the epoch of the access
+  EXPECT_TRUE(t.batch.empty());
+}
+
+TEST_F(AccessBatchTestFixture, fullBatchIsChecked) {
+  static int shared[etsan::AccessBatch::kCapacity];
+  ThreadState & t = getThreadState();
+
+  for (unsigned i = 0; i < etsan::AccessBatch::kCapacity; i++) {
+    ft_batch_access(&shared[i], sizeof(int), false, 1, t);
+  }
+  EXPECT_TRUE(t.batch.empty());
+  EXPECT_EQ(etsan::AccessBatch::kCapacity, VS.Vstates.size());
+}
+
+TEST_F(AccessBatchTestFixture, racesAreReportedWithTheirSite) {
+  static int shared;
+  ThreadState & t = getThreadState();
+  ft_batch_access(&shared, sizeof(shared), true, 1, t);
+  ft_flush_accesses(t);
+
+  std::thread([] {
+    ThreadState & u = getThreadState(); // never synchronized with us
+    ft_batch_access(&shared, sizeof(shared), false, 2, u);
+    ft_flush_accesses(u);
+  }).join();
+
+  ASSERT_EQ(1U, races.size());
+  EXPECT_EQ(2U, races[0].first);
+  EXPECT_FALSE(races[0].second);
+}
+
+TEST_F(AccessBatchTestFixture, joinChecksTheAccessesOfTheChild) {
+  static int shared;
+  ThreadState & parent = getThreadState();
+  ThreadState & child = getState(12345, &parent);
+  ft_fork(parent, child);
+
+  ft_batch_access(&shared, sizeof(shared), true, 1, child);
+  ft_join(parent, child);
+  EXPECT_TRUE(child.batch.empty());
+  ASSERT_NE(VS.Vstates.end(), VS.Vstates.find(&shared));
+
+  // ordered after the child's write by the join
+  ft_batch_access(&shared, sizeof(shared), true, 2, parent);
+  ft_flush_accesses(parent);
+  EXPECT_TRUE(races.empty());
+}
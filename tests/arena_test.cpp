@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the metadata arena.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "etsan/arena.h"
+
+using etsan::MetadataArena;
+using etsan::metadataArena;
+
+TEST(ArenaTestFixture, blocksAreAlignedToTheirClass) {
+  void *small = metadataArena.allocate(4);
+  void *medium = metadataArena.allocate(24);
+  EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(small) % 8);
+  EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(medium) % 16);
+  metadataArena.deallocate(small, 4);
+  metadataArena.deallocate(medium, 24);
+}
+
+TEST(ArenaTestFixture, freedBlockIsReusedBySameClass) {
+  void *block = metadataArena.allocate(100);
+  metadataArena.deallocate(block, 100);
+  EXPECT_EQ(block, metadataArena.allocate(120)); // both 128 bytes
+  metadataArena.deallocate(block, 120);
+}
+
+TEST(ArenaTestFixture, largeBlocksAreUnmapped) {
+  size_t before = metadataArena.bytes();
+  size_t size = 4 * MetadataArena::kMaxSmall;
+  void *block = metadataArena.allocate(size);
+  EXPECT_EQ(before + size, metadataArena.bytes());
+  metadataArena.deallocate(block, size);
+  EXPECT_EQ(before, metadataArena.bytes());
+}
+
+TEST(ArenaTestFixture, blocksOfExitedThreadAreShared) {
+  void *block = nullptr;
+  std::thread worker([&] {
+    block = metadataArena.allocate(512);
+    metadataArena.deallocate(block, 512); // into the thread's list
+  });
+  worker.join();
+
+  // the other threads take the blocks of the exited thread
+  EXPECT_EQ(block, metadataArena.allocate(512));
+  metadataArena.deallocate(block, 512);
+}
+
+TEST(ArenaTestFixture, containersUseTheArena) {
+  size_t before = metadataArena.bytes();
+  std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                     etsan::ArenaAllocator<std::pair<const int, int>>> map;
+  std::vector<int, etsan::ArenaAllocator<int>> clock(100000, 7);
+  for (int i = 0; i < 1000; i++) map[i] = i;
+  EXPECT_EQ(1000U, map.size());
+  EXPECT_EQ(7, clock.back());
+  EXPECT_LT(before, metadataArena.bytes());
+}
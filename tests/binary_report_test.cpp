@@ -0,0 +1,119 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the binary race report stream and its decoder.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <sstream>
+#include <string>
+
+#include "etsan/binary_decoder.h"
+
+class BinaryReportTestFixture : public ::testing::Test {
+protected:
+  FILE *file;
+
+  void SetUp() { file = tmpfile(); }
+  void TearDown() { fclose(file); }
+
+  // Decodes what was written to "file"
+  bool decode(std::string &out, std::string &error) {
+    rewind(file);
+    std::stringstream ss;
+    etsan::BinaryDecoder decoder;
+    bool ok = decoder.decode(file, ss, error);
+    out = ss.str();
+    return ok;
+  }
+
+  char func_name1[13] = "main_func_1";
+  char func_name2[13] = "main_func_2";
+  char obj_name[10] = "shared";
+  char file_name[10] = "main.cpp";
+};
+
+TEST_F(BinaryReportTestFixture, racesDecodeToTheTextReport) {
+  const etsan::SiteLoc loc = etsan::makeSiteLoc(3, 42, 7);
+  char *frames[] = {func_name1, func_name2};
+  {
+    etsan::BinaryWriter writer(fileno(file), false);
+    writer.race(5, loc, obj_name, file_name, true, 77, frames, 2);
+    writer.summary(1, 0);
+  }
+
+  etsan::Site site = {loc, obj_name, file_name};
+  Race race(77, site, true);
+  race.trace = frames;
+  race.numFrames = 2;
+  std::string expected;
+  race.createRaceMessage(expected);
+  expected += "EmbedSanitizer: 1 unique data races\n";
+
+  std::string out, error;
+  ASSERT_TRUE(decode(out, error)) << error;
+  EXPECT_EQ(expected, out);
+}
+
+TEST_F(BinaryReportTestFixture, sitesAndNamesAreSentOnce) {
+  const etsan::SiteLoc loc = etsan::makeSiteLoc(0, 10, 0);
+  char *frames[] = {func_name1};
+  {
+    etsan::BinaryWriter writer(fileno(file), false);
+    writer.race(9, loc, obj_name, file_name, false, 1, frames, 1);
+    writer.flush();
+    const long first = ftell(file);
+    writer.race(9, loc, obj_name, file_name, true, 2, frames, 1);
+    writer.flush();
+
+    // site ID, access type, thread, stack: no strings
+    EXPECT_GT(10, ftell(file) - first);
+  }
+
+  std::string out, error;
+  ASSERT_TRUE(decode(out, error)) << error;
+  EXPECT_NE(std::string::npos, out.find("Thread (tid=1) read \"shared\""));
+  EXPECT_NE(std::string::npos, out.find("Thread (tid=2) write \"shared\""));
+  EXPECT_NE(std::string::npos, out.find(file_name));
+}
+
+TEST_F(BinaryReportTestFixture, traceEventsDecode) {
+  {
+    etsan::BinaryWriter writer(fileno(file), false);
+    writer.event(4, etsan::TraceFuncEntry, nullptr, 0, func_name1);
+    writer.event(4, etsan::TraceWrite, (void *)0x1000, 12, obj_name);
+  }
+
+  std::string out, error;
+  ASSERT_TRUE(decode(out, error)) << error;
+  EXPECT_EQ("EmbedSanitizer: [4] func_entry (nil) line 0 main_func_1\n"
+            "EmbedSanitizer: [4] write 0x1000 line 12 shared\n",
+            out);
+}
+
+TEST_F(BinaryReportTestFixture, truncatedStreamIsAnError) {
+  char *frames[] = {func_name1};
+  {
+    etsan::BinaryWriter writer(fileno(file), false);
+    writer.race(1, etsan::makeSiteLoc(0, 1, 0), obj_name, file_name, true, 1,
+                frames, 1);
+  }
+  fflush(file);
+  ASSERT_EQ(0, ftruncate(fileno(file), ftell(file) - 1));
+
+  std::string out, error;
+  EXPECT_FALSE(decode(out, error));
+  EXPECT_NE(std::string::npos, error.find("malformed"));
+}
+
+TEST_F(BinaryReportTestFixture, otherStreamsAreRejected) {
+  fputs("EMBEDSANITIZER Race report\n", file);
+
+  std::string out, error;
+  EXPECT_FALSE(decode(out, error));
+}
@@ -10,6 +10,7 @@
 
 #include <gtest/gtest.h>
 
+#include <chrono>
 #include <thread>
 
 #include "etsan/defs.h"
@@ -20,9 +21,10 @@ protected:
   const int num_threads = 5;
 
   DefsTestFixture() {
-    TS.C.clear();
+    TS.clear();
     VS.Vstates.clear();
-    LS.L.clear();
+    VS.setBudget(0);
+    LS.clear();
   }
 
   ~DefsTestFixture() {}
@@ -48,6 +50,7 @@ TEST_F(DefsTestFixture, checkUpdateThreadClocks) {
     TS.C[tid].epoch = tid << 24;
     TS.C[tid].tid = tid;
   }
+  TS.slots = num_threads + 1; // tids 1 ... num_threads
 
   EXPECT_EQ(num_threads, TS.C.size());
 
@@ -55,7 +58,7 @@ TEST_F(DefsTestFixture, checkUpdateThreadClocks) {
 
   for (const auto & thread_state : TS.C) {
     for (const auto & clock : thread_state.second.C) {
-      if (thread_state.second.tid == TID(clock)) {
+      if (thread_state.second.tid == (unsigned int)TID(clock)) {
         // clock of a given thread has been incremented
         EXPECT_EQ(1, CLOCK(clock));
       }
@@ -82,7 +85,7 @@ TEST_F(DefsTestFixture, checkGetStateNewThread) {
 
   for (const auto & thread_state : TS.C) {
     for (const auto & clock : thread_state.second.C) {
-      if (thread_state.second.tid == TID(clock)) {
+      if (thread_state.second.tid == (unsigned int)TID(clock)) {
         // clock of a given thread has been incremented
         EXPECT_EQ(1, CLOCK(clock));
       }
@@ -94,6 +97,21 @@ TEST_F(DefsTestFixture, checkGetStateNewThread) {
   }
 }
 
+TEST_F(DefsTestFixture, checkNewThreadLeavesOtherClocks) {
+  auto& first = getState(1);
+  for (ThreadID tid = 2; tid <= 50; tid++) getState(tid, &first);
+
+  // each clock ends at its own slot, the others grow when they join
+  EXPECT_EQ(1U, first.C.size());
+  EXPECT_EQ(50U, getState(50).C.size());
+  EXPECT_EQ(EPOCH(49, 0), clockEntry(first.C, 49));
+
+  auto& last = getState(50);
+  ExtendVectorClocks(first.C, last.C);
+  EXPECT_EQ(50U, first.C.size());
+  EXPECT_EQ(EPOCH(49, 0), first.C[49]);
+}
+
 TEST_F(DefsTestFixture, checkGetStateExistingThread) {
   auto& thread_state = getThreadState();
   auto this_thread_id = TS.C.begin()->first;
@@ -103,6 +121,210 @@ TEST_F(DefsTestFixture, checkGetStateExistingThread) {
   EXPECT_EQ(&thread_state, &another_state);
 }
 
+TEST_F(DefsTestFixture, checkReserveMetadataPresizesMapsAndClocks) {
+  reserveMetadata(16, 4096, 64);
+  EXPECT_GE(TS.C.bucket_count() * TS.C.max_load_factor(), 16);
+  EXPECT_GE(VS.Vstates.bucket_count() * VS.Vstates.max_load_factor(), 4096);
+  EXPECT_GE(LS.L.bucket_count() * LS.L.max_load_factor(), 64);
+
+  auto buckets = VS.Vstates.bucket_count();
+  static int variables[1000];
+  for (auto & v : variables) getVarState(&v, true);
+  EXPECT_EQ(buckets, VS.Vstates.bucket_count()); // no rehash
+
+#ifndef ETSAN_FIXED_VECTOR_CLOCKS
+  EXPECT_GE(getState(12345).C.capacity(), 16U);
+#endif
+}
+
+TEST_F(DefsTestFixture, checkGetThreadStateIsCachedPerThread) {
+  auto& thread_state = getThreadState();
+  EXPECT_EQ(&thread_state, &getThreadState());
+  EXPECT_EQ(1, TS.C.size());
+
+  // another thread gets its own state
+  ThreadState* other_state = nullptr;
+  std::thread other([&]() { other_state = &getThreadState(); });
+  other.join();
+  EXPECT_NE(&thread_state, other_state);
+  EXPECT_EQ(1, TS.C.size()); // the other one has exited
+  EXPECT_EQ(1, TS.exited.size());
+
+  // discarding thread states invalidates the cached state
+  TS.clear();
+  getThreadState();
+  EXPECT_EQ(1, TS.C.size());
+}
+
+TEST_F(DefsTestFixture, checkJoinedThreadSlotIsReused) {
+  auto& parent = getState(1);
+  auto& child = getState(2, &parent);
+  const auto child_tid = child.tid;
+  child.stats.inc(etsan::StatWrites);
+
+  // the parent joins the child, as ft_join does
+  ExtendVectorClocks(parent.C, child.C);
+  parent.C[child_tid] = child.epoch;
+  child.increment();
+  retireThread(2);
+  EXPECT_EQ(1, TS.C.size());
+  EXPECT_EQ(1U, TS.retired.get(etsan::StatWrites));
+
+  // the parent has seen the joined thread: its slot is reused and the
+  // clock of the slot keeps growing
+  auto& next = getState(3, &parent);
+  EXPECT_EQ(child_tid, next.tid);
+  EXPECT_GT(CLOCK(next.epoch), CLOCK(parent.C[child_tid]));
+  EXPECT_EQ(2U, TS.slots);
+  EXPECT_EQ(2U, parent.C.size());
+  EXPECT_EQ(3U, TS.created);
+}
+
+TEST_F(DefsTestFixture, checkSlotIsNotReusedWithoutJoin) {
+  auto& parent = getState(1);
+  auto& sibling = getState(2, &parent);
+  auto& child = getState(3, &parent);
+  const auto child_tid = child.tid;
+
+  ExtendVectorClocks(parent.C, child.C);
+  parent.C[child_tid] = child.epoch;
+  child.increment();
+  retireThread(3); // joined by the parent only
+
+  // the sibling has not seen the joined thread
+  auto& other = getState(4, &sibling);
+  EXPECT_NE(child_tid, other.tid);
+  EXPECT_EQ(4U, TS.slots);
+
+  // a thread first seen without its parent never reuses a slot
+  auto& orphan = getState(5);
+  EXPECT_EQ(4U, orphan.tid);
+}
+
+TEST_F(DefsTestFixture, checkRetiredThreadStackIsReset) {
+  int onMainStack = 0;
+  int *local = nullptr;
+  ThreadID child = 0;
+  std::thread worker([&] {
+    int onStack = 0;
+    local = &onStack;
+    child = (ThreadID)pthread_self();
+    EXPECT_NE(0U, getThreadState().stackSize);
+    getVarState(&onStack, true);
+    getVarState(&onMainStack, true);
+  });
+  worker.join(); // reset as it exits
+  EXPECT_EQ(0, VS.Vstates.count(local));
+  EXPECT_EQ(1, VS.Vstates.count(&onMainStack));
+
+  retireThread(child);
+  EXPECT_EQ(1, VS.Vstates.count(&onMainStack));
+}
+
+TEST_F(DefsTestFixture, checkExitedThreadWaitsForItsJoin) {
+  getThreadState();
+  ThreadID child = 0;
+  unsigned int slot = 0;
+  std::thread worker([&] {
+    ThreadState & t = getThreadState();
+    t.stats.inc(etsan::StatWrites);
+    child = (ThreadID)pthread_self();
+    slot = t.tid;
+  });
+  worker.join();
+
+  // only running threads are in TS.C
+  EXPECT_EQ(1, TS.C.size());
+  EXPECT_EQ(0, TS.C.count(child));
+  ASSERT_EQ(1, TS.exited.count(child));
+  EXPECT_EQ(1U, TS.retired.get(etsan::StatWrites));
+
+  ThreadState & exited = getJoinedState(child);
+  EXPECT_EQ(&TS.exited[child], &exited);
+  EXPECT_EQ(slot, exited.tid);
+  EXPECT_EQ(1, TS.C.size()); // not made anew
+
+  retireThread(child);
+  EXPECT_EQ(0, TS.exited.size());
+  ASSERT_EQ(1U, TS.freeSlots.size());
+  EXPECT_EQ(slot, TS.freeSlots[0].tid);
+  EXPECT_EQ(1U, TS.retired.get(etsan::StatWrites)); // counted once
+}
+
+TEST_F(DefsTestFixture, checkDetachedThreadIsRetiredAtExit) {
+  getThreadState();
+  pthread_t child;
+  auto routine = [](void *) -> void * {
+    getThreadState();
+    return nullptr;
+  };
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  ASSERT_EQ(0, pthread_create(&child, &attr, routine, nullptr));
+  pthread_attr_destroy(&attr);
+
+  bool retired = false;
+  for (int i = 0; i < 5000 && !retired; i++) {
+    TS.mGuard.lock();
+    retired = TS.freeSlots.size() == 1;
+    TS.mGuard.unlock();
+    if (!retired) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(retired);
+  EXPECT_EQ(1, TS.C.size());
+  EXPECT_EQ(0, TS.exited.size());
+}
+
+TEST_F(DefsTestFixture, checkExitOfTheLastThreadEndsTheConcurrentPhase) {
+  ThreadState & parent = getThreadState();
+  static std::atomic<bool> go;
+  go = false;
+  pthread_t child;
+  auto routine = [](void *) -> void * {
+    while (!go) std::this_thread::yield();
+    getThreadState(); // the state of its fork
+    return nullptr;
+  };
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  ASSERT_EQ(0, pthread_create(&child, &attr, routine, nullptr));
+  pthread_attr_destroy(&attr);
+
+  ThreadState & u = getState((ThreadID)child, &parent); // as its fork
+  TS.mGuard.lock();
+  startRunning(u);
+  TS.mGuard.unlock();
+  EXPECT_TRUE(bool(isConcurrent));
+  EXPECT_EQ(1, __etsan_concurrent);
+  go = true;
+
+  // never joined: single-threaded again once it exits
+  bool single = false;
+  for (int i = 0; i < 5000 && !single; i++) {
+    single = !isConcurrent;
+    if (!single) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_TRUE(single);
+  EXPECT_EQ(0, __etsan_concurrent);
+}
+
+TEST_F(DefsTestFixture, checkNewThreadWithTheIdOfAnExitedOneFreesItsSlot) {
+  auto& parent = getState(1);
+  ThreadState & exited = TS.exited[2]; // not joined through the runtime
+  exited.tid = 7;
+  exited.epoch = EPOCH(7, 3);
+  ExtendVectorClock(exited.C, 8);
+
+  auto& next = getState(2, &parent);
+  EXPECT_EQ(0, TS.exited.size());
+  ASSERT_EQ(1U, TS.freeSlots.size());
+  EXPECT_EQ(7U, TS.freeSlots[0].tid);
+  EXPECT_EQ(EPOCH(7, 4), TS.freeSlots[0].last);
+  EXPECT_NE(7U, next.tid);
+}
+
 TEST_F(DefsTestFixture, checkGetVarStateWhenDoesNotExistIsRead) {
   Address address = (void *)(0x001);
   auto isWrite = false;
@@ -139,6 +361,46 @@ TEST_F(DefsTestFixture, checkGetVarStateWhenExists) {
   EXPECT_EQ(thread_state.tid << 24, variable_state.R);
 }
 
+TEST_F(DefsTestFixture, checkResetVarStatesErasesRange) {
+  getVarState((void *)(0x100), true);
+  getVarState((void *)(0x104), false);
+  getVarState((void *)(0x10f), true);
+  getVarState((void *)(0x110), true);
+  EXPECT_EQ(4, VS.Vstates.size());
+
+  resetVarStates((void *)(0x104), 12); // lookups of its bytes
+  EXPECT_EQ(2, VS.Vstates.size());
+  EXPECT_EQ(1, VS.Vstates.count((void *)(0x100)));
+  EXPECT_EQ(1, VS.Vstates.count((void *)(0x110)));
+
+  resetVarStates((void *)(0x0), 0x1000); // one sweep of the table
+  EXPECT_EQ(0, VS.Vstates.size());
+}
+
+TEST_F(DefsTestFixture, checkBudgetEvictsColdVarStates) {
+  VS.setBudget(1); // exceeded already
+  ThreadState & t = getThreadState();
+  Address hot = (void *)(0x8);
+  VarState & x = getVarState(hot, true);
+
+  for (uintptr_t a = 0x1000; a < 0x1000 + 4 * 4096; a += 4) {
+    getVarState((void *)a, true);
+    getVarState(hot, false); // looked up at every sweep
+  }
+  EXPECT_LE(VS.Vstates.size(), VStates::kMinStates);
+  EXPECT_GT(t.stats.get(etsan::StatEvictions), 0U);
+  EXPECT_EQ(1, VS.Vstates.count(hot));
+  EXPECT_EQ(&x, &getVarState(hot, false));
+}
+
+TEST_F(DefsTestFixture, checkNoEvictionWithoutBudget) {
+  for (uintptr_t a = 0x1000; a < 0x1000 + 4 * 1024; a += 4) {
+    getVarState((void *)a, true);
+  }
+  EXPECT_EQ(1024, VS.Vstates.size());
+  EXPECT_EQ(0U, getThreadState().stats.get(etsan::StatEvictions));
+}
+
 // VectorClock related tests
 TEST_F(DefsTestFixture, checkCreationOfNewVectorClock) {
   VectorClock VC;
@@ -212,3 +474,19 @@ TEST_F(DefsTestFixture, checkGetExistingLockState) {
     EXPECT_EQ(i << 24, lock_state.L.at(i)); // 0 clock values
   }
 }
+
+TEST_F(DefsTestFixture, checkExistingLockStateLookupIsLockFree) {
+  Address lock = (void *)(0x0400);
+  NumThreads = num_threads;
+  auto & lock_state = getLockState(lock);
+
+  // a known lock is found without the LS lock, even while it is held
+  LS.mGuard.lock();
+  EXPECT_EQ(&lock_state, &getLockState(lock));
+  LS.mGuard.unlock();
+
+  LS.clear();
+  EXPECT_EQ(0, LS.L.size());
+  getLockState(lock);
+  EXPECT_EQ(1, LS.L.size());
+}
@@ -0,0 +1,94 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for epoch layouts. Built once per layout.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/fasttrack.h"
+
+using Epoch32 = etsan::EpochLayout<int32_t, 8>;
+using Epoch64 = etsan::EpochLayout<int64_t, 16>;
+
+TEST(EpochTestFixture, layout32MatchesOriginalPacking) {
+  EXPECT_EQ(24U, Epoch32::kClockBits);
+  EXPECT_EQ((3 << 24) + 7, Epoch32::make(3, 7));
+  EXPECT_EQ(3, Epoch32::tid((3 << 24) + 7));
+  EXPECT_EQ(7, Epoch32::clock((3 << 24) + 7));
+  EXPECT_EQ(int32_t(0XEFFFFFFF), Epoch32::kReadShared);
+
+  // tids from 128 on set the sign bit
+  EXPECT_EQ(200, Epoch32::tid(Epoch32::make(200, 5)));
+  EXPECT_EQ(5, Epoch32::clock(Epoch32::make(200, 5)));
+}
+
+TEST(EpochTestFixture, layout64HasWideTidsAndClocks) {
+  EXPECT_EQ(48U, Epoch64::kClockBits);
+  const int64_t e = Epoch64::make(40000, (int64_t(1) << 40) + 3);
+  EXPECT_EQ(40000, Epoch64::tid(e));
+  EXPECT_EQ((int64_t(1) << 40) + 3, Epoch64::clock(e));
+  EXPECT_EQ(65519, Epoch64::tid(Epoch64::kReadShared));
+}
+
+// The tests below use the layout selected for this build
+
+TEST(EpochTestFixture, incrementKeepsTid) {
+  ThreadState t;
+  t.tid = 1;
+  t.C = {EPOCH(0, 0), EPOCH(1, etsan::Epochs::kClockMask - 1)};
+  t.updateEpoch();
+
+  t.increment();
+  EXPECT_EQ(1, TID(t.epoch));
+  EXPECT_EQ(etsan::Epochs::kClockMask, CLOCK(t.epoch));
+}
+
+TEST(EpochTestFixture, ftWriteDetectsRaceOnLargeClocks) {
+  // a tid past the 8-bit range when the build allows it
+  const Epoch tid2 = std::min<Epoch>(300, etsan::Epochs::kTidMask - 0x20);
+  const Epoch big = etsan::Epochs::kClockMask - 8;
+
+  ThreadState t;
+  t.tid = 0;
+  newVectorClock(t.C, tid2 + 1);
+  t.C[0] = t.epoch = EPOCH(0, 1);
+  t.C[tid2] = EPOCH(tid2, big - 1);
+
+  VarState x;
+  x.Racy = false;
+  x.W = EPOCH(tid2, big);
+  x.R = EPOCH(0, 0);
+  EXPECT_TRUE(ft_write(x, t));
+
+  EXPECT_TRUE(x.Racy);
+
+  t.C[tid2] = EPOCH(tid2, big);
+  x.Racy = false;
+  x.W = EPOCH(tid2, big);
+  EXPECT_FALSE(ft_write(x, t));
+  EXPECT_EQ(t.epoch, x.W);
+}
+
+TEST(EpochTestFixture, ftReadSharesAcrossLargeTids) {
+  const Epoch tid2 = std::min<Epoch>(300, etsan::Epochs::kTidMask - 0x20);
+  NumThreads = tid2 + 1;
+
+  ThreadState t;
+  t.tid = 0;
+  newVectorClock(t.C, tid2 + 1);
+  t.C[0] = t.epoch = EPOCH(0, 2);
+
+  VarState x;
+  x.Racy = false;
+  x.W = EPOCH(0, 0);
+  x.R = EPOCH(tid2, 5); // concurrent read by tid2
+  EXPECT_FALSE(ft_read(x, t));
+  EXPECT_EQ(READ_SHARED, x.R);
+  EXPECT_EQ(EPOCH(tid2, 5), x.Rvc[tid2]);
+  EXPECT_EQ(t.epoch, x.Rvc[0]);
+}
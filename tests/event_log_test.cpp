@@ -0,0 +1,238 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the event logs of ETSAN_RECORD and their analysis on
+// the host. The logs of a run are written here with one writer per
+// device thread, in the order the run would append to them.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <sstream>
+#include <string>
+
+#include "etsan/event_replay.h"
+
+static const char *const files[] = {"main.c"};
+static const etsan::SiteInfo siteInfo[] = {
+  {etsan::makeSiteLoc(0, 10, 3), "x"},
+  {etsan::makeSiteLoc(0, 20, 5), "x"}};
+
+class EventLogTestFixture : public ::testing::Test {
+protected:
+  EventLogTestFixture() {
+    TS.clear();
+    VS.Vstates.clear();
+    char pattern[] = "/tmp/etsan-log-XXXXXX";
+    dir = mkdtemp(pattern);
+    if (!firstSite) firstSite = etsan::registerSites(siteInfo, 2, files, 1);
+  }
+
+  ~EventLogTestFixture() {
+    for (auto & p : paths) unlink(p.c_str());
+    rmdir(dir.c_str());
+  }
+
+  // Opens the log of device thread "tid"
+  void open(etsan::EventLogWriter &log, uint64_t tid) {
+    paths.push_back(dir + "/" + std::to_string(paths.size()) + ".log");
+    ASSERT_TRUE(log.open(paths.back().c_str(), tid));
+  }
+
+  // Replays the logs closed so far; returns the races found
+  size_t analyze(std::string *report = nullptr) {
+    etsan::Replayer replayer;
+    std::string error;
+    for (auto & p : paths) {
+      EXPECT_TRUE(replayer.addLog(p.c_str(), error)) << error;
+    }
+    replayer.run();
+    if (report) {
+      std::stringstream out;
+      replayer.print(out);
+      *report = out.str();
+    }
+    return replayer.numRaces();
+  }
+
+  std::string dir;
+  std::vector<std::string> paths;
+  static unsigned int firstSite;
+};
+
+unsigned int EventLogTestFixture::firstSite = 0;
+
+static int x;
+static int lock;
+
+TEST_F(EventLogTestFixture, recordsAreReadBack) {
+  etsan::EventLogWriter log;
+  open(log, 77);
+  int a[64];
+  log.access(true, &a[0], 4, firstSite);
+  log.access(false, &a[63], 2, firstSite + 1);
+  log.access(true, &a[1], 100, firstSite, true);
+  log.sync(etsan::LogAcquire, 0x1234);
+  log.reset(&a[2], 16);
+  log.sync(etsan::LogBarrierInit, 0x5678, 3);
+  log.close();
+
+  etsan::EventLogReader reader;
+  std::string error;
+  ASSERT_TRUE(reader.open(paths[0].c_str(), error)) << error;
+  EXPECT_EQ(77U, reader.threadId());
+
+  std::unordered_map<unsigned int, etsan::LoggedSite> sites;
+  etsan::LogEvent e;
+  ASSERT_TRUE(reader.next(e, sites));
+  EXPECT_EQ(etsan::LogWrite, e.tag);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(&a[0]), e.addr);
+  EXPECT_EQ(4U, e.size);
+  EXPECT_FALSE(e.isRange);
+  EXPECT_EQ(firstSite, e.siteId);
+  ASSERT_EQ(1U, sites.count(firstSite));
+  EXPECT_EQ(10U, sites[firstSite].line);
+  EXPECT_EQ(3U, sites[firstSite].column);
+  EXPECT_EQ("main.c", sites[firstSite].fileName);
+
+  ASSERT_TRUE(reader.next(e, sites));
+  EXPECT_EQ(etsan::LogRead, e.tag);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(&a[63]), e.addr);
+  EXPECT_EQ(2U, e.size);
+  EXPECT_EQ(firstSite + 1, e.siteId);
+
+  ASSERT_TRUE(reader.next(e, sites));
+  EXPECT_TRUE(e.isRange);
+  EXPECT_EQ(100U, e.size);
+
+  ASSERT_TRUE(reader.next(e, sites));
+  EXPECT_EQ(etsan::LogAcquire, e.tag);
+  EXPECT_EQ(0x1234U, e.addr);
+  uint64_t seq = e.seq;
+
+  ASSERT_TRUE(reader.next(e, sites));
+  EXPECT_EQ(etsan::LogReset, e.tag);
+  EXPECT_EQ(16U, e.size);
+
+  ASSERT_TRUE(reader.next(e, sites));
+  EXPECT_EQ(etsan::LogBarrierInit, e.tag);
+  EXPECT_EQ(3U, e.size);
+  EXPECT_GT(e.seq, seq);
+
+  EXPECT_FALSE(reader.next(e, sites));
+}
+
+TEST_F(EventLogTestFixture, logsLargerThanTheWindowAreKept) {
+  etsan::EventLogWriter log;
+  open(log, 1);
+  const size_t n = etsan::EventLogWriter::kWindowSize; // > 1 byte each
+  for (size_t i = 0; i < n; i++) log.access(i & 1, &x, 4, 0);
+  log.close();
+
+  etsan::EventLogReader reader;
+  std::string error;
+  ASSERT_TRUE(reader.open(paths[0].c_str(), error)) << error;
+  std::unordered_map<unsigned int, etsan::LoggedSite> sites;
+  etsan::LogEvent e;
+  size_t count = 0;
+  while (reader.next(e, sites)) count++;
+  EXPECT_EQ(n, count);
+}
+
+TEST_F(EventLogTestFixture, unorderedAccessesRace) {
+  etsan::EventLogWriter parent, child;
+  open(parent, 1);
+  open(child, 2);
+
+  parent.sync(etsan::LogFork, 2);
+  parent.access(true, &x, 4, firstSite);
+  child.access(true, &x, 4, firstSite + 1);
+  parent.sync(etsan::LogJoin, 2);
+  parent.close();
+  child.close();
+
+  std::string report;
+  EXPECT_EQ(1U, analyze(&report));
+  EXPECT_NE(std::string::npos, report.find("main.c"));
+  EXPECT_NE(std::string::npos, report.find("1 unique data races"));
+}
+
+TEST_F(EventLogTestFixture, lockOrderedAccessesDoNotRace) {
+  etsan::EventLogWriter parent, child;
+  open(parent, 1);
+  open(child, 2);
+
+  parent.access(true, &x, 4, firstSite); // before the fork
+  parent.sync(etsan::LogFork, 2);
+  parent.sync(etsan::LogAcquire, (uintptr_t)&lock);
+  parent.access(true, &x, 4, firstSite);
+  parent.sync(etsan::LogRelease, (uintptr_t)&lock);
+  child.sync(etsan::LogAcquire, (uintptr_t)&lock);
+  child.access(true, &x, 4, firstSite + 1);
+  child.sync(etsan::LogRelease, (uintptr_t)&lock);
+  parent.sync(etsan::LogJoin, 2);
+  parent.access(false, &x, 4, firstSite); // after the join
+  parent.close();
+  child.close();
+
+  EXPECT_EQ(0U, analyze());
+}
+
+TEST_F(EventLogTestFixture, freedMemoryIsForgotten) {
+  etsan::EventLogWriter parent, child;
+  open(parent, 1);
+  open(child, 2);
+
+  parent.sync(etsan::LogFork, 2);
+  child.access(true, &x, 4, firstSite + 1);
+  child.sync(etsan::LogFree, (uintptr_t)&x, sizeof(x));
+  // a new block at the address, after a sync record of the parent that
+  // orders nothing but the replay
+  parent.sync(etsan::LogAcquire, (uintptr_t)&lock);
+  parent.access(true, &x, 4, firstSite);
+  parent.close();
+  child.close();
+
+  EXPECT_EQ(0U, analyze());
+}
+
+TEST_F(EventLogTestFixture, parallelAnalysisFindsTheSameRaces) {
+  static int a[4096]; // 4 pages
+  etsan::EventLogWriter parent, child;
+  open(parent, 1);
+  open(child, 2);
+
+  parent.sync(etsan::LogFork, 2);
+  for (int i = 0; i < 4096; i += 64) parent.access(true, &a[i], 4, firstSite);
+  parent.sync(etsan::LogRelease, (uintptr_t)&lock);
+  child.sync(etsan::LogAcquire, (uintptr_t)&lock);
+  // ordered after the parent's writes
+  for (int i = 0; i < 4096; i += 64) child.access(false, &a[i], 4, firstSite);
+  // not ordered with the parent's next writes
+  child.access(true, &a[100], 8, firstSite + 1, true);
+  child.sync(etsan::LogFree, (uintptr_t)&a[1024], 1024 * sizeof(int));
+  parent.sync(etsan::LogAcquire, (uintptr_t)&x);
+  parent.access(true, &a[100], 4, firstSite);
+  parent.access(false, &a[101], 4, firstSite + 1);
+  parent.access(false, &a[1024], 4, firstSite); // freed: forgotten
+  parent.close();
+  child.close();
+
+  std::string serial, parallel;
+  EXPECT_EQ(2U, analyze(&serial));
+  TS.clear();
+  VS.Vstates.clear();
+
+  etsan::Replayer replayer;
+  std::string error;
+  for (auto & p : paths) ASSERT_TRUE(replayer.addLog(p.c_str(), error));
+  replayer.run(3);
+  std::stringstream out;
+  replayer.print(out);
+  EXPECT_EQ(serial, out.str());
+}
@@ -0,0 +1,229 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Google Benchmark microbenchmarks of the FastTrack primitives: ns/op of
+// ft_read and ft_write in each of their cases, of getVarState lookups
+// and of ft_acquire/ft_release with clocks of 2 to 128 threads, alone
+// and handing a lock over among a pool of threads, and of the
+// registration of threads.
+//
+// Each case is set up anew in every iteration by one or two stores
+// (e.g. the read epoch of an exclusive read), which are measured with
+// it; the write to a shared variable also refills its read clock.
+//
+// Usage: fasttrack_microbench [--benchmark_filter=<regex>] ...
+//
+////////////////////////////////////////////////////
+
+#include <benchmark/benchmark.h>
+
+#include "etsan/fasttrack.h"
+
+// A thread whose clock has "n" entries, as after "n" threads were forked
+static ThreadState & threadOfClockSize(unsigned int n) {
+  TS.clear();
+  ThreadState & t = getThreadState();
+  for (unsigned int i = 1; i < n; i++) ft_fork(t, getState(i, &t));
+  return t;
+}
+
+// Another thread, never synchronized with the calling one
+static ThreadState & concurrentThread() {
+  ThreadState & t = getThreadState();
+  ThreadState & u = getState(1);
+  ExtendVectorClocks(t.C, u.C);
+  return u;
+}
+
+static void BM_ReadSameEpoch(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(1);
+  VarState x;
+  x.W = EPOCH(t.tid, 0);
+  x.R = t.epoch;
+  for (auto _ : state) benchmark::DoNotOptimize(ft_read(x, t));
+}
+BENCHMARK(BM_ReadSameEpoch);
+
+static void BM_ReadExclusive(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(1);
+  VarState x;
+  x.W = EPOCH(t.tid, 0);
+  for (auto _ : state) {
+    x.R = EPOCH(t.tid, 0); // an earlier epoch of the reader
+    benchmark::DoNotOptimize(ft_read(x, t));
+  }
+}
+BENCHMARK(BM_ReadExclusive);
+
+static void BM_ReadShared(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(1);
+  ThreadState & u = concurrentThread();
+  VarState x;
+  x.W = EPOCH(t.tid, 0);
+  x.R = READ_SHARED;
+  x.Rvc.set(u.tid, u.epoch);
+  for (auto _ : state) benchmark::DoNotOptimize(ft_read(x, t));
+}
+BENCHMARK(BM_ReadShared);
+
+static void BM_ReadShareTransition(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(1);
+  ThreadState & u = concurrentThread();
+  VarState x;
+  x.W = EPOCH(t.tid, 0);
+  for (auto _ : state) {
+    x.R = u.epoch; // read by a concurrent thread: becomes shared
+    x.Rvc.clear();
+    benchmark::DoNotOptimize(ft_read(x, t));
+  }
+}
+BENCHMARK(BM_ReadShareTransition);
+
+static void BM_WriteSameEpoch(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(1);
+  VarState x;
+  x.W = t.epoch;
+  x.R = EPOCH(t.tid, 0);
+  for (auto _ : state) benchmark::DoNotOptimize(ft_write(x, t));
+}
+BENCHMARK(BM_WriteSameEpoch);
+
+static void BM_WriteExclusive(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(1);
+  VarState x;
+  x.R = EPOCH(t.tid, 0);
+  for (auto _ : state) {
+    x.W = EPOCH(t.tid, 0); // an earlier epoch of the writer
+    benchmark::DoNotOptimize(ft_write(x, t));
+  }
+}
+BENCHMARK(BM_WriteExclusive);
+
+static void BM_WriteShared(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(3);
+  VarState x;
+  x.W = EPOCH(t.tid, 0);
+  for (auto _ : state) {
+    x.R = READ_SHARED; // read by the two forked threads before
+    x.Rvc.set(1, EPOCH(1, 0));
+    x.Rvc.set(2, EPOCH(2, 0));
+    benchmark::DoNotOptimize(ft_write(x, t));
+  }
+}
+BENCHMARK(BM_WriteShared);
+
+static void BM_GetVarStateHit(benchmark::State & state) {
+  threadOfClockSize(1);
+  static int variable;
+  getVarState(&variable, false);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(&getVarState(&variable, false));
+  }
+}
+BENCHMARK(BM_GetVarStateHit);
+
+#ifndef ETSAN_SHADOW_MEMORY
+// A new state each time, at addresses never accessed, as a thread
+// touching fresh memory
+static void BM_GetVarStateMiss(benchmark::State & state) {
+  threadOfClockSize(1);
+  const uintptr_t base = 0x10000000;
+  const uintptr_t words = 1 << 20;
+  uintptr_t i = 0;
+  VS.Vstates.clear();
+  for (auto _ : state) {
+    if (i == words) {
+      state.PauseTiming();
+      VS.Vstates.clear();
+      i = 0;
+      state.ResumeTiming();
+    }
+    Address addr = reinterpret_cast<Address>(base + 4 * i++);
+    benchmark::DoNotOptimize(&getVarState(addr, true));
+  }
+  VS.Vstates.clear();
+}
+BENCHMARK(BM_GetVarStateMiss);
+#endif
+
+// Iterations of the sync benchmarks: each release takes a new epoch,
+// and clocks have 24 bits by default
+static const int kSyncIterations = 1 << 20;
+
+static void BM_Acquire(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(state.range(0));
+  ThreadState & u = getState(1);
+  LockState lock;
+  ft_release(u, lock);
+  for (auto _ : state) ft_acquire(t, lock);
+}
+BENCHMARK(BM_Acquire)->Arg(2)->Arg(8)->Arg(32)->Arg(128)
+                     ->Iterations(kSyncIterations);
+
+static void BM_Release(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(state.range(0));
+  LockState lock;
+  for (auto _ : state) ft_release(t, lock);
+}
+BENCHMARK(BM_Release)->Arg(2)->Arg(8)->Arg(32)->Arg(128)
+                     ->Iterations(kSyncIterations);
+
+// An acquire and a release by each of "active" threads of a clock of
+// "n", in turn, as a lock handed over in a pool: each acquire gains the
+// epochs of the other active threads only. Compare the builds with flat
+// and tree clocks (fasttrack_microbench_tree_clocks) for the crossover.
+static void BM_LockHandOff(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(state.range(0));
+  std::vector<ThreadState *> pool;
+  for (int i = 0; i < state.range(1); i++) {
+    pool.push_back(i ? &getState(i) : &t);
+  }
+  LockState lock;
+  size_t next = 0;
+  for (auto _ : state) {
+    ThreadState & u = *pool[next];
+    ft_acquire(u, lock);
+    ft_release(u, lock);
+    next = next + 1 == pool.size() ? 0 : next + 1;
+  }
+}
+BENCHMARK(BM_LockHandOff)->ArgsProduct({{4, 16, 32, 64, 128}, {2, 4}})
+                         ->Iterations(kSyncIterations);
+BENCHMARK(BM_LockHandOff)->Args({16, 16})->Args({64, 64})->Args({128, 128})
+                         ->Iterations(kSyncIterations);
+
+// Thread churn: a thread created, forked, joined and retired by a parent
+// while "n" threads are registered, as a pool recycling its workers.
+// The fork and the join copy clocks of "n" entries; the registration
+// itself touches no other thread.
+static void BM_ThreadChurn(benchmark::State & state) {
+  ThreadState & t = threadOfClockSize(state.range(0));
+  ThreadID next = 1 << 20;
+  for (auto _ : state) {
+    ThreadState & u = getState(next, &t);
+    ft_fork(t, u);
+    ft_join(t, u);
+    retireThread(next++);
+  }
+}
+BENCHMARK(BM_ThreadChurn)->Arg(2)->Arg(16)->Arg(64)->Arg(200)
+                         ->Iterations(kSyncIterations / 4);
+
+// Registration of "n" threads at startup, as a server spawning its
+// workers: linear in "n", as no thread extends the clocks of the others
+static void BM_ThreadStartup(benchmark::State & state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    TS.clear();
+    state.ResumeTiming();
+    for (ThreadID tid = 1; tid <= ThreadID(state.range(0)); tid++) {
+      benchmark::DoNotOptimize(&getState(tid));
+    }
+  }
+}
+BENCHMARK(BM_ThreadStartup)->Arg(16)->Arg(64)->Arg(200);
+
+BENCHMARK_MAIN();
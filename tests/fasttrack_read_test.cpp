@@ -14,7 +14,6 @@
 #include "etsan/fasttrack.h"
 
 TEST(FasttrackReadTestFixture, ftReadCheckReadsCountIncremented) {
-  VS.reads = 0;
   constexpr bool no_race_found = false;
 
   VarState variable_state;
@@ -22,12 +21,11 @@ TEST(FasttrackReadTestFixture, ftReadCheckReadsCountIncremented) {
   ThreadState thread_state;
 
   EXPECT_EQ(no_race_found, ft_read(variable_state, thread_state));
-  EXPECT_EQ(1, VS.reads);
-  EXPECT_EQ(0, VS.writes);
+  EXPECT_EQ(1, thread_state.stats.get(etsan::StatReads));
+  EXPECT_EQ(0, thread_state.stats.get(etsan::StatWrites));
 }
 
 TEST(FasttrackReadTestFixture, ftReadCheckNoRaceSameEpoch) {
-  VS.reads = 0;
   constexpr bool no_race_found = false;
 
   VarState variable_state;
@@ -40,12 +38,11 @@ TEST(FasttrackReadTestFixture, ftReadCheckNoRaceSameEpoch) {
   thread_state.epoch = variable_state.R;
 
   EXPECT_EQ(no_race_found, ft_read(variable_state, thread_state));
-  EXPECT_EQ(1, VS.reads);
-  EXPECT_EQ(0, VS.writes);
+  EXPECT_EQ(1, thread_state.stats.get(etsan::StatReads));
+  EXPECT_EQ(0, thread_state.stats.get(etsan::StatWrites));
 }
 
 TEST(FasttrackReadTestFixture, ftReadDetectNewRace) {
-  VS.reads = 0;
   constexpr bool race_found = true;
   constexpr unsigned int num_threads = 5;
   constexpr int tid1 = 3;
@@ -66,18 +63,16 @@ TEST(FasttrackReadTestFixture, ftReadDetectNewRace) {
   thread_state.epoch = ~variable_state.R ;
 
   EXPECT_EQ(race_found, ft_read(variable_state, thread_state));
-  EXPECT_EQ(1, VS.reads);
-  EXPECT_EQ(0, VS.writes);
+  EXPECT_EQ(1, thread_state.stats.get(etsan::StatReads));
+  EXPECT_EQ(0, thread_state.stats.get(etsan::StatWrites));
 }
 
 TEST(FasttrackReadTestFixture, ftReadCheckUpdateOnSharedRead) {
-  VS.reads = 0;
   constexpr unsigned int num_threads = 5;
   constexpr int tid = 3;
 
   VarState variable_state;
   variable_state.R = READ_SHARED;
-  variable_state.Rvc.reserve(num_threads);
 
   ThreadState thread_state;
   thread_state.tid = tid;
@@ -90,7 +85,6 @@ TEST(FasttrackReadTestFixture, ftReadCheckUpdateOnSharedRead) {
 }
 
 TEST(FasttrackReadTestFixture, ftReadCheckExclusive) {
-  VS.reads = 0;
   constexpr unsigned int num_threads = 5;
   constexpr int tid = 3;
   constexpr int tid2 = 1;
@@ -109,3 +103,18 @@ TEST(FasttrackReadTestFixture, ftReadCheckExclusive) {
   EXPECT_EQ(thread_state.epoch, variable_state.R);
 }
 
+
+TEST(FasttrackReadTestFixture, ftReadRangeChecksEveryWord) {
+  constexpr bool no_race_found = false;
+  double array[4];
+
+  ThreadState &thread_state = getThreadState();
+  const auto reads = thread_state.stats.get(etsan::StatReads);
+  const auto writes = thread_state.stats.get(etsan::StatWrites);
+
+  EXPECT_EQ(no_race_found,
+            ft_read_range(array, sizeof(array), thread_state));
+  EXPECT_EQ(reads + sizeof(array) / 4,
+            thread_state.stats.get(etsan::StatReads));
+  EXPECT_EQ(writes, thread_state.stats.get(etsan::StatWrites));
+}
@@ -0,0 +1,78 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Measures how ft_read/ft_write scale from 1 to N threads.
+// Each thread repeatedly touches its own slice of an array and a
+// table shared read-only by all threads, so almost every access is
+// a same-epoch hit, as in blackscholes and swaptions workers.
+//
+// Usage: fasttrack_scaling_bench [max_threads] [accesses_per_thread]
+//
+////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "etsan/fasttrack.h"
+
+constexpr int SLICE = 256; // words per thread
+constexpr int TABLE = 64;  // words of the shared table
+
+static int shared_table[TABLE];
+
+static void worker(int *slice, long accesses) {
+  ThreadState &t = getThreadState();
+  for (long i = 0; i < accesses; i++) {
+    int *own = &slice[i % SLICE];
+    ft_read(getVarState(&shared_table[i % TABLE], false), t);
+    ft_read(getVarState(own, false), t);
+    ft_write(getVarState(own, true), t);
+  }
+}
+
+static double run(int nThreads, long accesses) {
+  std::vector<int> data(nThreads * SLICE);
+  std::vector<std::thread> threads;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < nThreads; i++) {
+    threads.push_back(std::thread(worker, &data[i * SLICE], accesses));
+  }
+  for (auto &thread : threads) thread.join();
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char *argv[]) {
+  int maxThreads = argc > 1 ? atoi(argv[1])
+                            : (int)std::thread::hardware_concurrency();
+  long accesses = argc > 2 ? atol(argv[2]) : 1000000;
+  if (maxThreads < 1) maxThreads = 1;
+
+#ifdef ETSAN_LOCKFREE_FASTPATH
+  printf("mode: lock-free fast path\n");
+#else
+  printf("mode: global lock\n");
+#endif
+  printf("%8s %12s %14s %8s\n", "threads", "seconds", "Maccesses/s", "speedup");
+
+  // the powers of two below N, then N
+  std::vector<int> series;
+  for (int n = 1; n < maxThreads; n *= 2) series.push_back(n);
+  series.push_back(maxThreads);
+
+  double base = 0;
+  for (int n : series) {
+    double secs = run(n, accesses);
+    double rate = 3.0 * accesses * n / secs / 1e6;
+    if (n == 1) base = rate;
+    printf("%8d %12.3f %14.2f %8.2f\n", n, secs, rate, rate / base);
+  }
+  return 0;
+}
@@ -10,6 +10,8 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+
 #include "etsan/fasttrack.h"
 
 TEST(FasttrackSyncTestFixture, ftAcquire) {
@@ -63,6 +65,32 @@ TEST(FasttrackSyncTestFixture, ftRelease) {
   }
 }
 
+TEST(FasttrackSyncTestFixture, ftAcquireOfKnownReleaseSkipsTheJoin) {
+  ThreadState t1, t2;
+  t1.C = {(0 << 24), (1 << 24) + 5, (2 << 24)};
+  t1.tid = 1;
+  t1.epoch = t1.C[1];
+  t2.C = {(0 << 24), (1 << 24), (2 << 24) + 7};
+  t2.tid = 2;
+  t2.epoch = t2.C[2];
+
+  LockState lock;
+  ft_release(t1, lock);
+  ft_acquire(t1, lock); // its own release
+  EXPECT_EQ(1U, t1.stats.get(etsan::StatAcquireKnown));
+
+  ft_acquire(t2, lock); // joins, then knows it
+  EXPECT_EQ((1U << 24) + 5, t2.C[1]);
+  ft_acquire(t2, lock);
+  EXPECT_EQ(1U, t2.stats.get(etsan::StatAcquireKnown));
+
+  // a join of another thread's clock makes the lock new to t1 again
+  ft_release_join(t2, lock);
+  ft_acquire(t1, lock);
+  EXPECT_EQ(1U, t1.stats.get(etsan::StatAcquireKnown));
+  EXPECT_EQ((2U << 24) + 7, t1.C[2]);
+}
+
 TEST(FasttrackSyncTestFixture, ftForkMaxClocksForChildThread) {
   constexpr int num_threads = 5;
   ThreadState parent_state;
@@ -106,3 +134,164 @@ TEST(FasttrackSyncTestFixture, ftJoinMaxClocksForParentThread) {
     EXPECT_EQ((i << 24) + i, parent_state.C.at(i)) << "value of i = " << i;
   }
 }
+
+TEST(FasttrackSyncTestFixture, ftJoinOfAnExitedThreadOrdersItsAccesses) {
+  static int shared;
+  ThreadState & parent = getThreadState();
+  ThreadID child = 0;
+  std::thread worker([&] {
+    ThreadState & t = getThreadState();
+    child = (ThreadID)pthread_self();
+    EXPECT_FALSE(ft_write(getVarState(&shared, true, &t), t));
+  });
+  worker.join();
+
+  // the final clock of the child waits for the join in TS.exited
+  ft_join(parent, getJoinedState(child));
+  retireThread(child);
+  EXPECT_FALSE(ft_write(getVarState(&shared, true, &parent), parent));
+}
+
+TEST(FasttrackSyncTestFixture, ftForkAndJoinPublishConcurrency) {
+  TS.clear(); // forgets the threads forked by the other tests
+  ThreadState parent;
+  parent.C = {(0 << 24) + 1};
+  parent.tid = 0;
+  ThreadState child;
+  child.C = {(0 << 24), (1 << 24) + 1};
+  child.tid = 1;
+
+  // read by the accesses instrumented with -embedsan-concurrency-guard
+  EXPECT_EQ(0, __etsan_concurrent);
+  ft_fork(parent, child);
+  EXPECT_EQ(1, __etsan_concurrent);
+  EXPECT_TRUE(bool(isConcurrent));
+  ft_join(parent, child);
+  EXPECT_EQ(0, __etsan_concurrent);
+  EXPECT_FALSE(bool(isConcurrent));
+}
+
+TEST(FasttrackSyncTestFixture, ftConcurrencyFollowsTheRunningThreads) {
+  TS.clear(); // forgets the threads forked by the other tests
+  ThreadState parent;
+  parent.C = {(0 << 24) + 1};
+  parent.tid = 0;
+  ThreadState child, grandchild;
+  child.C = {(0 << 24), (1 << 24) + 1};
+  child.tid = 1;
+  grandchild.C = {(0 << 24), (1 << 24), (2 << 24) + 1};
+  grandchild.tid = 2;
+
+  ft_fork(parent, child);
+  ft_fork(child, grandchild);
+  TS.mGuard.lock();
+  stopRunning(child); // exited before its join, as finishThread does
+  TS.mGuard.unlock();
+  EXPECT_TRUE(bool(isConcurrent)); // the grandchild still runs
+
+  ft_join(parent, child);
+  EXPECT_TRUE(bool(isConcurrent));
+  ft_join(parent, grandchild);
+  EXPECT_FALSE(bool(isConcurrent));
+  ft_join(parent, grandchild); // joined twice: counted once
+  EXPECT_FALSE(bool(isConcurrent));
+}
+
+TEST(FasttrackSyncTestFixture, ftReleaseJoinKeepsEarlierReleases) {
+  ThreadState t1, t2, waiter;
+  t1.C = {(0 << 24), (1 << 24) + 5, (2 << 24)};
+  t1.tid = 1;
+  t2.C = {(0 << 24), (1 << 24), (2 << 24) + 7};
+  t2.tid = 2;
+  waiter.C = {(0 << 24) + 1, (1 << 24), (2 << 24)};
+  waiter.tid = 0;
+
+  LockState sem;
+  ft_release_join(t1, sem);
+  ft_release_join(t2, sem);
+  ft_acquire(waiter, sem);
+
+  EXPECT_EQ((1U << 24) + 5, waiter.C[1]);
+  EXPECT_EQ((2U << 24) + 7, waiter.C[2]);
+}
+
+TEST(FasttrackSyncTestFixture, ftRwLockReadersAreNotOrdered) {
+  ThreadState reader1, reader2, writer;
+  writer.C = {(0 << 24) + 1, (1 << 24), (2 << 24)};
+  writer.tid = 0;
+  reader1.C = {(0 << 24), (1 << 24) + 4, (2 << 24)};
+  reader1.tid = 1;
+  reader2.C = {(0 << 24), (1 << 24), (2 << 24) + 6};
+  reader2.tid = 2;
+
+  LockState rwlock;
+  ft_acquire(reader1, rwlock);
+  ft_acquire(reader2, rwlock);
+  ft_rw_release(reader1, rwlock);
+  ft_rw_release(reader2, rwlock);
+
+  // a new read lock does not get the clocks of earlier readers
+  ft_acquire(reader2, rwlock);
+  EXPECT_EQ((1U << 24), reader2.C[1]);
+
+  // but the next writer gets all of them
+  ft_write_acquire(writer, rwlock);
+  EXPECT_EQ((1U << 24) + 4, writer.C[1]);
+  EXPECT_EQ((2U << 24) + 6, writer.C[2]);
+  EXPECT_EQ(writer.epoch, writer.C[writer.tid]);
+}
+
+TEST(FasttrackSyncTestFixture, ftRwLockWriterReleasesToReaders) {
+  ThreadState reader, writer;
+  writer.C = {(0 << 24) + 3, (1 << 24)};
+  writer.tid = 0;
+  reader.C = {(0 << 24), (1 << 24) + 1};
+  reader.tid = 1;
+
+  LockState rwlock;
+  ft_write_acquire(writer, rwlock);
+  EXPECT_EQ(1U, rwlock.writer);
+  ft_rw_release(writer, rwlock);
+  EXPECT_EQ(0U, rwlock.writer);
+
+  ft_acquire(reader, rwlock);
+  EXPECT_EQ((0U << 24) + 3, reader.C[0]);
+}
+
+TEST(FasttrackSyncTestFixture, ftBarrierJoinsAllArrivalsOnce) {
+  constexpr int num_threads = 3;
+  ThreadState threads[num_threads];
+  for (int t = 0; t < num_threads; t++) {
+    threads[t].tid = t;
+    threads[t].C = {(0 << 24), (1 << 24), (2 << 24)};
+    SetVectorClock(threads[t].C, t, threads[t].C[t] + 10 + t);
+    threads[t].updateEpoch();
+  }
+
+  BarrierState barrier;
+  barrier.count = num_threads;
+
+  unsigned int episodes[num_threads];
+  for (int t = 0; t < num_threads; t++) {
+    episodes[t] = ft_barrier_arrive(threads[t], barrier);
+    EXPECT_EQ(0U, episodes[t]);
+  }
+  EXPECT_EQ(1U, barrier.episode);
+
+  for (int t = 0; t < num_threads; t++) {
+    ft_barrier_depart(threads[t], barrier, episodes[t]);
+  }
+
+  // everyone has what the others did before the barrier
+  for (int t = 0; t < num_threads; t++) {
+    for (int u = 0; u < num_threads; u++) {
+      if (u != t) {
+        EXPECT_EQ(Epoch((u << 24) + 10 + u), threads[t].C[u]);
+      }
+    }
+    EXPECT_EQ(threads[t].epoch, threads[t].C[t]);
+  }
+
+  // the next episode uses the other clock
+  EXPECT_EQ(1U, ft_barrier_arrive(threads[0], barrier));
+}
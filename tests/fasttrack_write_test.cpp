@@ -13,8 +13,6 @@
 #include "etsan/fasttrack.h"
 
 TEST(FasttrackWriteTestFixture, ftWriteCheckWritesCountIncremented) {
-  VS.reads = 0;
-  VS.writes = 0;
   constexpr bool no_race_found = false;
 
   VarState variable_state;
@@ -22,13 +20,11 @@ TEST(FasttrackWriteTestFixture, ftWriteCheckWritesCountIncremented) {
   ThreadState thread_state;
 
   EXPECT_EQ(no_race_found, ft_write(variable_state, thread_state));
-  EXPECT_EQ(0, VS.reads);
-  EXPECT_EQ(1, VS.writes);
+  EXPECT_EQ(0, thread_state.stats.get(etsan::StatReads));
+  EXPECT_EQ(1, thread_state.stats.get(etsan::StatWrites));
 }
 
 TEST(FasttrackWriteTestFixture, ftWriteCheckNoRaceSameEpoch) {
-  VS.reads = 0;
-  VS.writes = 0;
   constexpr bool no_race_found = false;
 
   VarState variable_state;
@@ -41,13 +37,11 @@ TEST(FasttrackWriteTestFixture, ftWriteCheckNoRaceSameEpoch) {
   thread_state.epoch = variable_state.W;
 
   EXPECT_EQ(no_race_found, ft_write(variable_state, thread_state));
-  EXPECT_EQ(1, VS.writes);
-  EXPECT_EQ(0, VS.reads);
+  EXPECT_EQ(1, thread_state.stats.get(etsan::StatWrites));
+  EXPECT_EQ(0, thread_state.stats.get(etsan::StatReads));
 }
 
 TEST(FasttrackWriteTestFixture, ftWriteDetectNewRace) {
-  VS.reads = 0;
-  VS.writes = 0;
   constexpr bool race_found = true;
   constexpr unsigned int num_threads = 5;
   constexpr int tid1 = 3;
@@ -64,19 +58,17 @@ TEST(FasttrackWriteTestFixture, ftWriteDetectNewRace) {
   thread_state.C[tid2] = 123;
 
   EXPECT_EQ(race_found, ft_write(variable_state, thread_state));
-  EXPECT_EQ(0, VS.reads);
-  EXPECT_EQ(1, VS.writes);
+  EXPECT_EQ(0, thread_state.stats.get(etsan::StatReads));
+  EXPECT_EQ(1, thread_state.stats.get(etsan::StatWrites));
   // EXPECT_EQ(num_threads, variable_state.Rvc.size());
 }
 
 TEST(FasttrackWriteTestFixture, ftWriteCheckUpdateOnSharedRead) {
-  VS.reads = 0;
   constexpr unsigned int num_threads = 5;
   constexpr int tid = 3;
 
   VarState variable_state;
   variable_state.R = READ_SHARED;
-  variable_state.Rvc.reserve(num_threads);
 
   ThreadState thread_state;
   thread_state.tid = tid;
@@ -89,7 +81,6 @@ TEST(FasttrackWriteTestFixture, ftWriteCheckUpdateOnSharedRead) {
 }
 
 TEST(FasttrackWriteTestFixture, ftWriteCheckExclusive) {
-  VS.reads = 0;
   constexpr bool race_found = true;
   constexpr unsigned int num_threads = 5;
   constexpr int tid = 3;
@@ -109,3 +100,60 @@ TEST(FasttrackWriteTestFixture, ftWriteCheckExclusive) {
   EXPECT_EQ(race_found, ft_write(variable_state, thread_state));
   EXPECT_EQ(thread_state.epoch, variable_state.W);
 }
+
+TEST(FasttrackWriteTestFixture, ftWriteDetectRaceWithSharedReadersPastItsClock) {
+  constexpr bool race_found = true;
+  constexpr unsigned int tid = 1;
+
+  // readers 2 and 3, which the writer's clock does not cover yet
+  VarState variable_state = VarState(); // zero-filled, as in the shadow memory
+  variable_state.R = READ_SHARED;
+  variable_state.Rvc.set(2, EPOCH(2, 1));
+  variable_state.Rvc.set(3, EPOCH(3, 1));
+
+  ThreadState thread_state;
+  thread_state.tid = tid;
+  ExtendVectorClock(thread_state.C, tid + 1);
+  thread_state.C[tid] = EPOCH(tid, 1);
+  thread_state.epoch = thread_state.C[tid];
+  ASSERT_LE(thread_state.C.size(), 2U);
+
+  EXPECT_EQ(race_found, ft_write(variable_state, thread_state));
+  EXPECT_EQ(1, thread_state.stats.get(etsan::StatWriteShared));
+  EXPECT_EQ(thread_state.epoch, variable_state.W);
+}
+
+TEST(FasttrackWriteTestFixture, ftWriteRangeChecksEveryWord) {
+  constexpr bool no_race_found = false;
+  int array[8];
+
+  ThreadState &thread_state = getThreadState();
+  const auto writes = thread_state.stats.get(etsan::StatWrites);
+
+  EXPECT_EQ(no_race_found,
+            ft_write_range(&array[1], 3 * sizeof(int), thread_state));
+  EXPECT_EQ(writes + 3, thread_state.stats.get(etsan::StatWrites));
+
+  // an unaligned range covers the words it overlaps
+  EXPECT_EQ(no_race_found,
+            ft_write_range((char *)&array[4] + 2, 4, thread_state));
+  EXPECT_EQ(writes + 5, thread_state.stats.get(etsan::StatWrites));
+  EXPECT_EQ(thread_state.epoch, getVarState(&array[5], true).W);
+}
+
+TEST(FasttrackWriteTestFixture, ftWriteRangeDetectRaceOnOneWord) {
+  constexpr bool race_found = true;
+  int array[4];
+
+  ThreadState &thread_state = getThreadState();
+  const auto writes = thread_state.stats.get(etsan::StatWrites);
+
+  // a write of another thread the current one has not seen
+  const int other_tid = thread_state.tid + 1;
+  ExtendVectorClock(thread_state.C, other_tid + 1);
+  getVarState(&array[2], true).W = EPOCH(other_tid, 1);
+
+  EXPECT_EQ(race_found,
+            ft_write_range(array, sizeof(array), thread_state));
+  EXPECT_EQ(writes + 4, thread_state.stats.get(etsan::StatWrites));
+}
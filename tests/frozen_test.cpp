@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the frozen read-only lines of frozen.h.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/fasttrack.h"
+
+// Two threads, never synchronized with each other
+static void concurrentThreads(ThreadState & t, ThreadState & u) {
+  NumThreads = 2;
+  t.tid = 1;
+  t.C = {0, (1 << 24) + 1};
+  t.updateEpoch();
+  u.tid = 0;
+  u.C = {1, 1 << 24};
+  u.updateEpoch();
+}
+
+TEST(FrozenTestFixture, readsOfMarkedLinesAreSkipped) {
+  alignas(64) static int table[32];
+  ThreadState t, u;
+  concurrentThreads(t, u);
+
+  // only whole lines are frozen
+  etsan::frozenRegions.freeze(&table[1], sizeof(table) - sizeof(int));
+  EXPECT_TRUE(etsan::frozenRegions.active());
+  EXPECT_FALSE(etsan::frozenRegions.isFrozen(&table[1], sizeof(int)));
+  EXPECT_TRUE(etsan::frozenRegions.isFrozen(&table[16], 16 * sizeof(int)));
+
+  EXPECT_FALSE(ft_read_access(&table[20], sizeof(int), t));
+  EXPECT_FALSE(ft_read_access(&table[20], sizeof(int), u));
+  EXPECT_EQ(1U, t.stats.get(etsan::StatReadFrozen));
+  EXPECT_EQ(1U, u.stats.get(etsan::StatReadFrozen));
+  EXPECT_EQ(0U, t.stats.get(etsan::StatReads));
+}
+
+TEST(FrozenTestFixture, writesThawLines) {
+  alignas(64) static int table[16];
+  ThreadState t, u;
+  concurrentThreads(t, u);
+
+  etsan::frozenRegions.freeze(table, sizeof(table));
+  EXPECT_FALSE(ft_write_access(&table[2], sizeof(int), t));
+  EXPECT_FALSE(etsan::frozenRegions.isFrozen(&table[9], sizeof(int)));
+
+  // the line is checked again: u races with the write of t
+  EXPECT_TRUE(ft_read_access(&table[2], sizeof(int), u));
+  EXPECT_EQ(0U, u.stats.get(etsan::StatReadFrozen));
+}
+
+TEST(FrozenTestFixture, automaticModeFreezesUnwrittenLines) {
+  alignas(64) static int input[16], output[16];
+  ThreadState t, u;
+  concurrentThreads(t, u);
+  etsan::frozenRegions.setAutomatic(true);
+
+  EXPECT_FALSE(ft_read_access(&input[0], sizeof(int), t)); // checked
+  EXPECT_TRUE(etsan::frozenRegions.isFrozen(&input[3], sizeof(int)));
+  EXPECT_FALSE(ft_read_access(&input[3], sizeof(int), u));
+  EXPECT_EQ(1U, t.stats.get(etsan::StatReads));
+  EXPECT_EQ(1U, u.stats.get(etsan::StatReadFrozen));
+
+  // a written line stays checked
+  EXPECT_FALSE(ft_write_access(&output[0], sizeof(int), t));
+  EXPECT_FALSE(ft_read_access(&output[1], sizeof(int), t));
+  EXPECT_FALSE(etsan::frozenRegions.isFrozen(&output[1], sizeof(int)));
+
+  etsan::frozenRegions.setAutomatic(false);
+}
+
+TEST(FrozenTestFixture, resetThawsLines) {
+  alignas(64) static int block[32];
+  etsan::frozenRegions.freeze(block, sizeof(block));
+  resetVarStates(&block[16], 16 * sizeof(int));
+  EXPECT_TRUE(etsan::frozenRegions.isFrozen(&block[0], sizeof(int)));
+  EXPECT_FALSE(etsan::frozenRegions.isFrozen(&block[16], sizeof(int)));
+}
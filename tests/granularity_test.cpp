@@ -0,0 +1,94 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the tracking granularities (ETSAN_GRANULARITY), built
+// once per granularity.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "etsan/fasttrack.h"
+
+// Two cache lines, static since fixtures are not allocated aligned
+alignas(64) static char buffer[128];
+
+class GranularityTestFixture : public ::testing::Test {
+protected:
+  GranularityTestFixture() {
+    TS.clear();
+    VS.Vstates.clear();
+  }
+
+  // True if a write of "size1" bytes at "addr1" by this thread races
+  // with an access of "size2" bytes at "addr2" by a concurrent one
+  bool races(char *addr1, size_t size1, char *addr2, size_t size2,
+             bool isWrite2) {
+    EXPECT_FALSE(ft_write_access(addr1, size1, getThreadState()));
+    bool isRace = false;
+    std::thread other([&] {
+      ThreadState &t = getThreadState(); // never synchronized with us
+      isRace = isWrite2 ? ft_write_access(addr2, size2, t)
+                        : ft_read_access(addr2, size2, t);
+    });
+    other.join();
+    return isRace;
+  }
+
+  char *line = buffer;
+};
+
+TEST_F(GranularityTestFixture, overlappingAccessesOfDifferentSizesRace) {
+  EXPECT_TRUE(races(&line[0], 4, &line[1], 1, false));
+}
+
+TEST_F(GranularityTestFixture, wideAccessCoversAllItsBytes) {
+  EXPECT_TRUE(races(&line[12], 4, &line[0], 16, false));
+}
+
+TEST_F(GranularityTestFixture, accessAcrossGranulesChecksBoth) {
+  EXPECT_TRUE(races(&line[64], 1, &line[63], 2, true));
+}
+
+TEST_F(GranularityTestFixture, distantAccessesDoNotRace) {
+  EXPECT_FALSE(races(&line[0], 4, &line[64], 4, true));
+}
+
+#if ETSAN_GRANULARITY == 1
+TEST_F(GranularityTestFixture, adjacentBytesDoNotRace) {
+  EXPECT_FALSE(races(&line[0], 1, &line[1], 1, true));
+  EXPECT_FALSE(races(&line[4], 2, &line[6], 2, true));
+}
+#elif ETSAN_GRANULARITY == 4
+TEST_F(GranularityTestFixture, bytesOfOneWordShareItsState) {
+  EXPECT_TRUE(races(&line[0], 1, &line[3], 1, true));
+  EXPECT_FALSE(races(&line[8], 4, &line[12], 4, true));
+}
+#elif ETSAN_GRANULARITY == 64
+TEST_F(GranularityTestFixture, wordsOfOneLineShareItsState) {
+  EXPECT_TRUE(races(&line[0], 4, &line[60], 4, true));
+  EXPECT_EQ(1U, VS.Vstates.size()); // one state for the whole line
+}
+#endif
+
+// The callbacks check accesses of a size and alignment known at compile
+// time, see ft_read_sized
+TEST_F(GranularityTestFixture, sizedAccessesCheckEveryGranuleTheyTouch) {
+  ThreadState &t = getThreadState();
+  EXPECT_FALSE((ft_write_sized<2, 1>(&line[63], t)));
+  EXPECT_FALSE((ft_write_sized<16, 8>(&line[8], t)));
+  bool isRace[2] = {false, false};
+  std::thread other([&] {
+    ThreadState &u = getThreadState();
+    isRace[0] = ft_read_sized<1, 1>(&line[64], u); // second half
+    isRace[1] = ft_read_sized<4, 4>(&line[20], u); // last word
+  });
+  other.join();
+  EXPECT_TRUE(isRace[0]);
+  EXPECT_TRUE(isRace[1]);
+}
@@ -0,0 +1,86 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for what the inline fast path of the pass reads from the
+// runtime. Built with ETSAN_INLINE_FASTPATH, ETSAN_SHADOW_MEMORY and
+// ETSAN_LOCKFREE_FASTPATH.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "etsan/fasttrack.h"
+
+typedef ShadowMemory<VarState> Shadow;
+
+// The check the pass emits (EmbedSanitizerInline.h): true if the access
+// needs the runtime call
+static bool needsCall(const void *addr, bool isWrite) {
+  if (!__etsan_concurrent) return false;
+
+  uintptr_t word = reinterpret_cast<uintptr_t>(addr) >> 2;
+  size_t idx = (word >> Shadow::kPageShift) & (Shadow::kDirEntries - 1);
+  char *const *dir = static_cast<char *const *>(__etsan_shadow_dir);
+  char *page = dir[idx];
+  if (!page) return true;
+
+  char *slot = page + (word & (Shadow::kPageSlots - 1)) *
+                      etsan::kInlineSlotSize;
+  const Epoch *last = reinterpret_cast<const Epoch *>(
+      slot + (isWrite ? etsan::kInlineOffsetW : etsan::kInlineOffsetR));
+  return *last != *__etsan_thread_epoch;
+}
+
+static int variable;
+
+TEST(InlineFastPathTestFixture, slotIsTheOneOfTheRuntime) {
+  VarState & x = getVarState(&variable, true);
+
+  uintptr_t word = reinterpret_cast<uintptr_t>(&variable) >> 2;
+  size_t idx = (word >> Shadow::kPageShift) & (Shadow::kDirEntries - 1);
+  char *const *dir = static_cast<char *const *>(__etsan_shadow_dir);
+  char *slot = dir[idx] + (word & (Shadow::kPageSlots - 1)) *
+                          etsan::kInlineSlotSize;
+
+  EXPECT_EQ(reinterpret_cast<char *>(&x), slot);
+}
+
+TEST(InlineFastPathTestFixture, epochIsPublishedPerThread) {
+  std::thread([] {
+    // before the runtime knows the thread: an epoch no slot holds
+    EXPECT_EQ(-1, *__etsan_thread_epoch);
+
+    ThreadState & t = getThreadState();
+    EXPECT_EQ(&t.epoch, __etsan_thread_epoch);
+  }).join();
+}
+
+TEST(InlineFastPathTestFixture, sameEpochAccessesSkipTheCall) {
+  static int shared;
+  ThreadState & t = getThreadState();
+  ThreadState other;
+  other.tid = 1;
+  ExtendVectorClock(other.C, 2);
+  ft_fork(t, other);
+
+  EXPECT_TRUE(needsCall(&shared, true));
+  ft_write_access(&shared, sizeof(shared), t);
+  EXPECT_FALSE(needsCall(&shared, true));
+  EXPECT_TRUE(needsCall(&shared, false));
+
+  ft_read_access(&shared, sizeof(shared), t);
+  EXPECT_FALSE(needsCall(&shared, false));
+
+  // a new epoch, e.g. after a release, checks again
+  t.increment();
+  EXPECT_TRUE(needsCall(&shared, true));
+  EXPECT_TRUE(needsCall(&shared, false));
+
+  ft_join(t, other);
+  EXPECT_FALSE(needsCall(&shared, true));
+}
@@ -0,0 +1,75 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the live statistics page of live_stats.h.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+#include <string>
+
+#include "etsan/live_stats.h"
+
+static std::atomic<uint64_t> collected{0};
+
+static void countCollections(etsan::LiveStatsPage &page) {
+  page.reads = ++collected;
+  page.writes = 2 * page.reads;
+  page.threads = 3;
+}
+
+static std::string pagePath() {
+  return "/tmp/etsan_live_stats_test." + std::to_string(getpid());
+}
+
+TEST(LiveStatsTestFixture, pageIsPublishedAndRemoved) {
+  std::string path = pagePath();
+  etsan::LiveStats stats;
+  ASSERT_TRUE(stats.start(path.c_str(), 1, countCollections));
+
+  const etsan::LiveStatsPage *page = etsan::mapLiveStats(path.c_str());
+  ASSERT_NE(nullptr, page);
+  etsan::LiveStatsPage first, later;
+  ASSERT_TRUE(etsan::readLiveStats(page, first));
+  EXPECT_EQ(uint32_t(getpid()), first.pid);
+  EXPECT_EQ(3U, first.threads);
+  EXPECT_EQ(2 * first.reads, first.writes);
+
+  // republished by the thread
+  do {
+    usleep(1000);
+    ASSERT_TRUE(etsan::readLiveStats(page, later));
+  } while (later.reads == first.reads);
+  EXPECT_GT(later.timeNs, first.timeNs);
+  EXPECT_EQ(0U, later.seq & 1);
+
+  stats.stop();
+  EXPECT_NE(0, access(path.c_str(), F_OK));
+  ASSERT_TRUE(etsan::readLiveStats(page, later)); // still mapped
+  munmap(const_cast<etsan::LiveStatsPage *>(page), sizeof(*page));
+}
+
+TEST(LiveStatsTestFixture, pagesBeingRewrittenOrForeignAreRejected) {
+  etsan::LiveStatsPage page = etsan::LiveStatsPage(), snapshot;
+  page.magic = etsan::kLiveStatsMagic;
+  page.version = etsan::kLiveStatsVersion;
+  EXPECT_TRUE(etsan::readLiveStats(&page, snapshot));
+
+  page.seq = 1; // never finished
+  EXPECT_FALSE(etsan::readLiveStats(&page, snapshot));
+
+  page.seq = 2;
+  page.version = etsan::kLiveStatsVersion + 1;
+  EXPECT_FALSE(etsan::readLiveStats(&page, snapshot));
+}
+
+TEST(LiveStatsTestFixture, unwritableFileIsReported) {
+  etsan::LiveStats stats;
+  EXPECT_FALSE(stats.start("/nonexistent/etsan", 1, countCollections));
+  EXPECT_EQ(nullptr, stats.published());
+}
@@ -0,0 +1,96 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the profile of the runtime's locks of ETSAN_LOCK_PROFILE.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "etsan/fasttrack.h"
+#include "etsan/race_report.h"
+
+// The profile as printed
+static std::string printed() {
+  char *buffer = nullptr;
+  size_t size = 0;
+  FILE *out = open_memstream(&buffer, &size);
+  etsan::printLockProfile(out);
+  fclose(out);
+  std::string s(buffer, size);
+  free(buffer);
+  return s;
+}
+
+static unsigned long holds(const etsan::LockProfile *p) {
+  unsigned long n = 0;
+  for (unsigned int b = 0; b < etsan::LockProfile::kBuckets; b++)
+    n += p->holds[b];
+  return n;
+}
+
+TEST(LockProfileTestFixture, countsAcquisitionsAndHolds) {
+  etsan::ProfiledMutex m("test.uncontended");
+  for (int i = 0; i < 3; i++) {
+    std::lock_guard<etsan::ProfiledMutex> guard(m);
+  }
+  EXPECT_TRUE(m.try_lock());
+  m.unlock();
+
+  const etsan::LockProfile *p = etsan::lockProfileOf("test.uncontended");
+  ASSERT_NE(nullptr, p);
+  EXPECT_EQ(4UL, p->acquired);
+  EXPECT_EQ(0UL, p->contended);
+  EXPECT_EQ(4UL, holds(p));
+}
+
+TEST(LockProfileTestFixture, countsWaitsAndLongHolds) {
+  etsan::ProfiledMutex m("test.contended");
+  m.lock();
+  std::thread waiter([&] {
+    m.lock();
+    m.unlock();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  m.unlock();
+  waiter.join();
+
+  const etsan::LockProfile *p = etsan::lockProfileOf("test.contended");
+  ASSERT_NE(nullptr, p);
+  EXPECT_EQ(2UL, p->acquired);
+  EXPECT_EQ(1UL, p->contended);
+  EXPECT_GT(p->waitNs, 0U);
+  EXPECT_GE(p->maxHoldNs, 5000000U);
+  EXPECT_EQ(1UL, p->holds[etsan::LockProfile::kBuckets - 1]); // >= 524us
+}
+
+TEST(LockProfileTestFixture, locksOfOneNameShareAProfile) {
+  etsan::ProfiledMutex a("test.shared"), b("test.shared");
+  a.lock();
+  a.unlock();
+  b.lock();
+  b.unlock();
+  EXPECT_EQ(2UL, etsan::lockProfileOf("test.shared")->acquired);
+}
+
+TEST(LockProfileTestFixture, runtimeLocksArePrinted) {
+  int shared = 0;
+  ThreadState &t = getThreadState();
+  ft_write(getVarState(&shared, true, &t), t);
+  ft_acquire(t, getLockState(&shared));
+
+  std::string s = printed();
+  EXPECT_NE(std::string::npos, s.find("TS.mGuard"));
+  EXPECT_NE(std::string::npos, s.find("VS.mGuard"));
+  EXPECT_NE(std::string::npos, s.find("LS.mGuard"));
+  EXPECT_EQ(std::string::npos, s.find("BS.mGuard")); // never taken
+}
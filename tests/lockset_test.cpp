@@ -0,0 +1,114 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the lockset pre-filter of ETSAN_LOCKSET.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/fasttrack.h"
+
+constexpr unsigned int num_threads = 4;
+
+// Thread "tid" at clock "clock", knowing nothing of the others
+static void makeThread(ThreadState &t, unsigned int tid, unsigned int clock) {
+  NumThreads = num_threads;
+  t.tid = tid;
+  ExtendVectorClock(t.C, num_threads);
+  t.C[tid] = EPOCH(tid, clock);
+  t.epoch = t.C[tid];
+}
+
+TEST(LocksetTestFixture, locksGetDistinctBitsUntilTheyRunOut) {
+  etsan::Lockset all = 0;
+  for (unsigned int i = 0; i < etsan::kLocksetBits; i++) {
+    etsan::Lockset bit = etsan::newLockBit();
+    EXPECT_EQ(0U, all & bit);
+    all |= bit;
+  }
+  EXPECT_EQ(etsan::kAllLocks, all);
+  EXPECT_EQ(0U, etsan::newLockBit()); // guards nothing
+}
+
+TEST(LocksetTestFixture, accessesUnderACommonLockSkipTheChecks) {
+  ThreadState t1, t2;
+  makeThread(t1, 1, 5);
+  makeThread(t2, 2, 7);
+  t1.held = 0x1 | 0x4;
+  t2.held = 0x4;
+
+  VarState x = VarState(); // zero-filled, as in the shadow memory
+  EXPECT_FALSE(ft_write(x, t1));
+  EXPECT_FALSE(ft_read(x, t2)); // t2 knows nothing of t1: still ordered
+  EXPECT_FALSE(ft_write(x, t2));
+  EXPECT_EQ(etsan::Lockset(~0x4U), x.Unguarded);
+  EXPECT_EQ(t2.epoch, x.W);
+  EXPECT_EQ(1, t1.stats.get(etsan::StatWriteLocked));
+  EXPECT_EQ(1, t2.stats.get(etsan::StatReadLocked));
+  EXPECT_EQ(1, t2.stats.get(etsan::StatWriteLocked));
+}
+
+TEST(LocksetTestFixture, unguardedAccessIsCheckedAgainstTheLastOne) {
+  ThreadState t1, t2, t3;
+  makeThread(t1, 1, 5);
+  makeThread(t2, 2, 7);
+  makeThread(t3, 3, 9);
+  t1.held = 0x2;
+  t2.held = 0x2;
+
+  VarState x = VarState();
+  EXPECT_FALSE(ft_write(x, t1));
+  EXPECT_FALSE(ft_write(x, t2));
+  t3.C[2] = t2.epoch; // t3 joined t2 only, without the lock
+  EXPECT_FALSE(ft_read(x, t3));
+  EXPECT_EQ(etsan::kAllLocks, x.Unguarded);
+  EXPECT_EQ(0, t3.stats.get(etsan::StatReadLocked));
+
+  ThreadState t0;
+  makeThread(t0, 0, 3);
+  t0.held = 0x2; // the lock does not guard x any more
+  EXPECT_TRUE(ft_write(x, t0));
+}
+
+TEST(LocksetTestFixture, lockTakenAfterAnUnguardedAccessGuardsNothing) {
+  ThreadState t1, t2, t3;
+  makeThread(t1, 1, 5);
+  makeThread(t2, 2, 7);
+  makeThread(t3, 3, 9);
+
+  VarState x = VarState();
+  EXPECT_FALSE(ft_read(x, t1)); // no lock: checked
+  t2.C[1] = t1.epoch;
+  t2.held = 0x8;
+  EXPECT_FALSE(ft_read(x, t2)); // t1 did not hold it
+  t3.held = 0x8;
+  EXPECT_FALSE(ft_read(x, t3)); // unordered with t2: shared
+
+  EXPECT_EQ(READ_SHARED, x.R);
+  EXPECT_EQ(0, t3.stats.get(etsan::StatReadLocked));
+}
+
+TEST(LocksetTestFixture, lockedReadAfterSharedReadsOwnsTheVariable) {
+  ThreadState t1, t2, t3;
+  makeThread(t1, 1, 5);
+  makeThread(t2, 2, 7);
+  makeThread(t3, 3, 9);
+  t1.held = t2.held = t3.held = 0x10;
+
+  VarState x = VarState();
+  x.R = READ_SHARED; // left by readers under the lock
+  x.Rvc.set(1, t1.epoch);
+  x.Rvc.set(2, t2.epoch);
+  EXPECT_FALSE(ft_read(x, t3));
+  EXPECT_EQ(t3.epoch, x.R);
+
+  x.R = READ_SHARED;
+  x.Rvc.set(1, t1.epoch);
+  EXPECT_FALSE(ft_write(x, t2));
+  EXPECT_EQ(EPOCH(2, 0), x.R);
+  EXPECT_EQ(t2.epoch, x.W);
+}
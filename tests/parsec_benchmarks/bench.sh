@@ -0,0 +1,124 @@
+#!/bin/bash
+
+#########################################################################
+#
+# Copyright (c) 2017 - 2021  Hassan Salehe Matar
+#
+#  License: Follows License of LLVM/Clang. Read the licence file LICENSE.md
+#
+#
+# Benchmark harness: runs each benchmark without and with EmbedSanitizer
+# over thread counts, input sizes and repetitions, and appends one CSV
+# row per run with its times, peak memory and runtime statistics.
+# Compare the files of two runtime versions with compare.sh.
+#
+#   ./bench.sh [results.csv]
+#
+# Environment:
+#   BENCH_PROGRAMS  benchmarks to run (default: all four)
+#   BENCH_THREADS   thread counts (default: "1 2 4")
+#   BENCH_SIZES     input sizes, small and/or medium (default: "small")
+#   BENCH_REPS      repetitions of each run (default: 3)
+#   BENCH_LABEL     runtime version of the rows (default: git describe)
+#
+#########################################################################
+
+home=`cd $(dirname $0) && pwd`
+results=${1:-$home/etsan_bench.csv}
+
+programs=${BENCH_PROGRAMS:-"blackscholes fluidanimate streamcluster swaptions"}
+threads=${BENCH_THREADS:-"1 2 4"}
+sizes=${BENCH_SIZES:-"small"}
+reps=${BENCH_REPS:-3}
+label=${BENCH_LABEL:-`git -C $home describe --always --dirty 2>/dev/null`}
+label=${label:-unknown}
+
+# qemu-arm unless on the ARM target itself
+emulator=""
+if [ -z "`uname -m | grep -i arm`" ]; then
+  emulator="qemu-arm"
+fi
+
+# Arguments of benchmark $1 with $2 threads on input size $3
+inputArgs() {
+  case "$1-$3" in
+    blackscholes-small)  echo "$2 input/simsmall_4K.txt out.txt" ;;
+    blackscholes-medium) echo "$2 input/bench_16K.txt out.txt" ;;
+    fluidanimate-small)  echo "$2 2 input/in_5K.fluid out.txt" ;;
+    fluidanimate-medium) echo "$2 10 input/in_5K.fluid out.txt" ;;
+    streamcluster-small) echo "5 10 16 256 256 125 none output.txt $2" ;;
+    streamcluster-medium) echo "10 20 32 4096 4096 1000 none output.txt $2" ;;
+    swaptions-small)     echo "-ns 16 -sm 400 -nt $2" ;;
+    swaptions-medium)    echo "-ns 32 -sm 4000 -nt $2" ;;
+  esac
+}
+
+# The medium blackscholes input: the small one four times
+mediumInputs() {
+  local small=$home/blackscholes/input/simsmall_4K.txt
+  local medium=$home/blackscholes/input/bench_16K.txt
+  [ -f $medium ] && return
+  awk 'NR == 1 { next } { opts[n++] = $0 }
+       END { print 4 * n; for (r = 0; r < 4; r++)
+               for (i = 0; i < n; i++) print opts[i] }' $small > $medium
+}
+
+# Value of runtime statistic $1 in stats.txt, 0 if not printed
+stat() {
+  local value=`egrep -m 1 "^$1: " stats.txt | awk -F': ' '{ print $2 }'`
+  echo ${value:-0}
+}
+
+# Runs $1 with arguments $2; sets seconds and rss (peak KB)
+timedRun() {
+  /usr/bin/time -f "%e %M" -o time.txt ${emulator} ./$1 $2 > stats.txt 2>&1
+  read seconds rss < <(tail -1 time.txt)
+}
+
+header="label,benchmark,threads,input,rep,native_s,instrumented_s,slowdown"
+header="$header,native_rss_kb,instrumented_rss_kb,metadata_bytes,addresses"
+header="$header,reads,writes,read_same_epoch,read_exclusive,read_shared"
+header="$header,read_share,write_same_epoch,write_exclusive,write_shared"
+header="$header,fast_path_pct,races"
+[ -s $results ] || echo "$header" > $results
+
+mediumInputs
+
+for benchmark in $programs; do
+  cd $home/$benchmark
+  if ! make arm arm_instr > /dev/null; then
+    echo "$benchmark: build failed" >&2
+    exit 1
+  fi
+
+  for size in $sizes; do
+    for t in $threads; do
+      args=`inputArgs $benchmark $t $size`
+      for rep in `seq 1 $reps`; do
+        echo "$benchmark threads=$t input=$size run $rep/$reps"
+
+        timedRun ${benchmark}_arm.exe "$args"
+        native=$seconds
+        native_rss=$rss
+
+        timedRun ${benchmark}_arm_instrumented.exe "$args"
+        reads=`stat "Reads"`
+        writes=`stat "Writes"`
+        rse=`stat "Read same epoch"`
+        wse=`stat "Write same epoch"`
+
+        row="$label,$benchmark,$t,$size,$rep,$native,$seconds"
+        row="$row,`awk -v a=$seconds -v b=$native 'BEGIN { printf "%.3f", b ? a / b : 0 }'`"
+        row="$row,$native_rss,$rss,`stat "Metadata bytes"`,`stat "Addresses"`"
+        row="$row,$reads,$writes,$rse,`stat "Read exclusive"`"
+        row="$row,`stat "Read shared"`,`stat "Read share transitions"`"
+        row="$row,$wse,`stat "Write exclusive"`,`stat "Write shared"`"
+        row="$row,`awk -v f=$((rse + wse)) -v n=$((reads + writes)) 'BEGIN { printf "%.1f", n ? 100 * f / n : 0 }'`"
+        row="$row,`stat "Races"`"
+        echo "$row" >> $results
+      done
+    done
+  done
+done
+
+echo "Results appended to $results"
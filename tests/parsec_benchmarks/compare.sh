@@ -0,0 +1,61 @@
+#!/bin/bash
+
+#########################################################################
+#
+# Copyright (c) 2017 - 2021  Hassan Salehe Matar
+#
+#  License: Follows License of LLVM/Clang. Read the licence file LICENSE.md
+#
+#
+# Compares the results of bench.sh for two runtime versions: the median
+# slowdown, peak memory and metadata of each benchmark, thread count and
+# input size. Fails if any of them grew by more than BENCH_TOLERANCE
+# percent (default 5).
+#
+#   ./compare.sh old.csv new.csv
+#
+#########################################################################
+
+if [ $# -ne 2 ]; then
+  echo "usage: $0 old.csv new.csv"
+  exit 2
+fi
+
+awk -F, -v tolerance=${BENCH_TOLERANCE:-5} '
+  # median of the values of key k, "|"-separated
+  function median(list,    n, v, i, j, t) {
+    n = split(substr(list, 2), v, "|")
+    for (i = 2; i <= n; i++)
+      for (j = i; j > 1 && v[j - 1] + 0 > v[j] + 0; j--) {
+        t = v[j]; v[j] = v[j - 1]; v[j - 1] = t
+      }
+    return n % 2 ? v[(n + 1) / 2] : (v[n / 2] + v[n / 2 + 1]) / 2
+  }
+  FNR == 1 {
+    for (i = 1; i <= NF; i++) col[$i] = i
+    file++
+    next
+  }
+  {
+    k = $col["benchmark"] " " $col["threads"] " " $col["input"]
+    keys[k] = 1
+    slowdown[file, k] = slowdown[file, k] "|" $col["slowdown"]
+    rss[file, k] = rss[file, k] "|" $col["instrumented_rss_kb"]
+    meta[file, k] = meta[file, k] "|" $col["metadata_bytes"]
+  }
+  function change(name, a, b) {
+    d = a ? 100 * (b - a) / a : 0
+    flag = d > tolerance ? "  REGRESSION" : ""
+    if (flag) regressions++
+    printf "  %-16s %12s -> %12s  %+6.1f%%%s\n", name, a, b, d, flag
+  }
+  END {
+    for (k in keys) {
+      if (!((1, k) in slowdown) || !((2, k) in slowdown)) continue
+      print k
+      change("slowdown", median(slowdown[1, k]), median(slowdown[2, k]))
+      change("peak RSS (KB)", median(rss[1, k]), median(rss[2, k]))
+      change("metadata bytes", median(meta[1, k]), median(meta[2, k]))
+    }
+    exit regressions > 0
+  }' "$1" "$2"
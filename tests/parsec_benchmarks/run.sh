@@ -55,6 +55,17 @@ reportBenchStats() {
 
   threads=`egrep "Threads: " stats.txt`
   echo " - # of $threads" >> $home/BenchmarkReports.txt
+
+  metadata=`egrep "Metadata bytes: " stats.txt`
+  echo " - $metadata" >> $home/BenchmarkReports.txt
+
+  # FastTrack case breakdown
+  for case in "Read same epoch" "Read exclusive" "Read shared" \
+              "Read share transitions" "Write same epoch" \
+              "Write exclusive" "Write shared"; do
+    count=`egrep "^${case}: " stats.txt`
+    echo "   * $count" >> $home/BenchmarkReports.txt
+  done
 }
 
 input_set=""
@@ -0,0 +1,103 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the database of known races of ETSAN_RACE_DB.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#include "etsan/race_db.h"
+
+static const char *const files[] = {"src/queue.c"};
+static const etsan::SiteInfo sites[] = {
+  {etsan::makeSiteLoc(0, 20, 3), "head"},
+  {etsan::makeSiteLoc(0, 21, 3), "tail"}};
+
+class RaceDbTestFixture : public ::testing::Test {
+protected:
+  RaceDbTestFixture() {
+    char name[] = "/tmp/etsan-race-db-XXXXXX";
+    int fd = mkstemp(name);
+    close(fd);
+    unlink(name); // a missing file is an empty database
+    path = name;
+  }
+  ~RaceDbTestFixture() { unlink(path.c_str()); }
+
+  std::string path;
+};
+
+TEST_F(RaceDbTestFixture, keysDependOnLocationAndAccessType) {
+  uint64_t key = etsan::raceKey("a.c", 10, 2, "x", true);
+  EXPECT_EQ(key, etsan::raceKey("a.c", 10, 2, "x", true));
+  EXPECT_NE(key, etsan::raceKey("a.c", 10, 2, "x", false));
+  EXPECT_NE(key, etsan::raceKey("a.c", 11, 2, "x", true));
+  EXPECT_NE(key, etsan::raceKey("a.c", 10, 3, "x", true));
+  EXPECT_NE(key, etsan::raceKey("b.c", 10, 2, "x", true));
+  EXPECT_NE(key, etsan::raceKey("a.c", 10, 2, "y", true));
+}
+
+TEST_F(RaceDbTestFixture, newRacesAreAppendedAndLoadedNextRun) {
+  {
+    etsan::RaceDb db(path.c_str());
+    EXPECT_EQ(0U, db.numKnown());
+    db.add(1);
+    db.add(2);
+    db.add(2);
+    EXPECT_TRUE(db.isKnown(2));
+    EXPECT_EQ(0U, db.numKnown()); // none from before this run
+    EXPECT_TRUE(db.save());
+  }
+  {
+    etsan::RaceDb db(path.c_str());
+    EXPECT_EQ(2U, db.numKnown());
+    db.add(2); // known: not appended again
+    db.add(3);
+    EXPECT_TRUE(db.save());
+  }
+  etsan::RaceDb db(path.c_str());
+  EXPECT_EQ(3U, db.numKnown());
+  EXPECT_TRUE(db.isKnown(1));
+  EXPECT_TRUE(db.isKnown(3));
+  EXPECT_FALSE(db.isKnown(4));
+
+  FILE *in = fopen(path.c_str(), "r");
+  ASSERT_NE(nullptr, in);
+  fseek(in, 0, SEEK_END);
+  EXPECT_EQ(long(etsan::kRaceDbHeader + 3 * sizeof(uint64_t)), ftell(in));
+  fclose(in);
+}
+
+TEST_F(RaceDbTestFixture, sitesOfKnownRacesAreSuppressed) {
+  {
+    etsan::RaceDb db(path.c_str());
+    db.add(etsan::raceKey("src/queue.c", 21, 3, "tail", true));
+    EXPECT_TRUE(db.save());
+  }
+  etsan::RaceDb db(path.c_str());
+  unsigned int base = etsan::registerSites(sites, 2, files, 1);
+  EXPECT_EQ(1U, db.suppressKnownSites(base, 2));
+  EXPECT_FALSE(etsan::isSuppressed(base));
+  EXPECT_TRUE(etsan::isSuppressed(base + 1));
+}
+
+TEST_F(RaceDbTestFixture, otherFilesAreNoDatabase) {
+  FILE *out = fopen(path.c_str(), "w");
+  fputs("not a race database", out);
+  fclose(out);
+  etsan::RaceDb db(path.c_str());
+  EXPECT_FALSE(db.load());
+
+  etsan::RaceDb none(nullptr);
+  EXPECT_FALSE(none.enabled());
+  EXPECT_TRUE(none.save());
+}
@@ -25,7 +25,7 @@ protected:
   const char *write_access_type = "write";
   int line_number = 42;
 
-  RaceReportTestFixture() { etsan::callStack.clear(); }
+  RaceReportTestFixture() { etsan::shadowStack.clear(); }
 
   ~RaceReportTestFixture() {}
 };
@@ -33,55 +33,76 @@ protected:
 TEST_F(RaceReportTestFixture, pushFunction) {
   etsan::pushFunction(func_name1);
 
-  // const auto tid = std::this_thread::get_id();
-  const auto tid = static_cast<unsigned int>(pthread_self());
-  const auto c_back = etsan::callStack.find(tid);
-
-  ASSERT_NE(etsan::callStack.end(), c_back);
-  ASSERT_EQ(1U, c_back->second.size());
-  ASSERT_EQ(func_name1, c_back->second.at(0));
+  auto stack = etsan::getStack();
+  ASSERT_EQ(1U, stack.size());
+  ASSERT_EQ(func_name1, stack.at(0));
 
   etsan::pushFunction(func_name2);
-  ASSERT_EQ(2U, c_back->second.size());
-  ASSERT_EQ(func_name2, c_back->second.at(1));
+  stack = etsan::getStack();
+  ASSERT_EQ(2U, stack.size());
+  ASSERT_EQ(func_name2, stack.at(1));
 }
 
 TEST_F(RaceReportTestFixture, popFunction) {
   etsan::pushFunction(func_name1);
   etsan::pushFunction(func_name2);
-
-  const auto tid = static_cast<unsigned int>(pthread_self());
-  const auto c_back = etsan::callStack.find(tid);
-  EXPECT_EQ(2U, c_back->second.size());
+  EXPECT_EQ(2U, etsan::shadowStack.size());
 
   // poping inner function fails
   etsan::popFunction(func_name1);
-  EXPECT_EQ(2U, c_back->second.size());
+  EXPECT_EQ(2U, etsan::shadowStack.size());
 
   // popping the top function works
   etsan::popFunction(func_name2);
-  EXPECT_EQ(1U, c_back->second.size());
-  ASSERT_EQ(func_name1, c_back->second.at(0));
+  EXPECT_EQ(1U, etsan::shadowStack.size());
+  ASSERT_EQ(func_name1, etsan::getStack().at(0));
 }
 
 TEST_F(RaceReportTestFixture, getStack) {
-  // initially no entry for a thread before calling getStack
-  const auto tid = static_cast<unsigned int>(pthread_self());
-  const auto c_back = etsan::callStack.find(tid);
-  ASSERT_EQ(etsan::callStack.end(), c_back);
-
-  // getStack puts an empty entry to callStack
-  auto stack = etsan::getStack(tid);
+  // a thread starts with an empty stack
+  auto stack = etsan::getStack();
   EXPECT_EQ(0U, stack.size());
-  ASSERT_NE(etsan::callStack.end(), etsan::callStack.find(tid));
 
   // put one function and get stack
   etsan::pushFunction(func_name1);
-  stack = etsan::getStack(tid);
+  stack = etsan::getStack();
   EXPECT_EQ(1U, stack.size());
   ASSERT_EQ(func_name1, stack.at(0));
 }
 
+TEST_F(RaceReportTestFixture, getStackIsPerThread) {
+  etsan::pushFunction(func_name1);
+
+  size_t other_size = 1;
+  std::thread other([&]() { other_size = etsan::getStack().size(); });
+  other.join();
+
+  EXPECT_EQ(0U, other_size);
+  EXPECT_EQ(1U, etsan::getStack().size());
+}
+
+TEST_F(RaceReportTestFixture, deepStackKeepsInnermostFrames) {
+  constexpr unsigned capacity = etsan::ShadowStack::kCapacity;
+  std::vector<std::string> names;
+  for (unsigned i = 0; i < capacity + 3; i++) {
+    names.push_back("f" + std::to_string(i));
+  }
+  for (auto &name : names) etsan::pushFunction(&name[0]);
+
+  auto stack = etsan::getStack();
+  ASSERT_EQ(capacity + 1, stack.size()); // lost frames marker + capacity
+  EXPECT_STREQ(etsan::ShadowStack::kLostFrames, stack.front());
+  EXPECT_EQ(&names[3][0], stack.at(1));
+  EXPECT_EQ(&names.back()[0], stack.back());
+
+  // even the overwritten frames pop cleanly
+  for (unsigned i = names.size(); i-- > 0;) {
+    EXPECT_TRUE(etsan::shadowStack.pop(&names[i][0]));
+  }
+  EXPECT_EQ(0U, etsan::shadowStack.size());
+  EXPECT_TRUE(etsan::getStack().empty());
+}
+
 TEST_F(RaceReportTestFixture, printStack) {
   etsan::pushFunction(func_name1);
   etsan::pushFunction(func_name2);
@@ -103,6 +124,7 @@ TEST_F(RaceReportTestFixture, reportRaceOnRead) {
   std::cout.rdbuf(input_capture.rdbuf());
 
   etsan::reportRaceOnRead(line_number, obj_name, file_name);
+  etsan::flushRaceReports();
 
   EXPECT_NE(std::string::npos, input_capture.str().find(func_name1));
   EXPECT_NE(std::string::npos, input_capture.str().find(func_name2));
@@ -126,6 +148,7 @@ TEST_F(RaceReportTestFixture, reportRaceOnWrite) {
   std::cout.rdbuf(input_capture.rdbuf());
 
   etsan::reportRaceOnWrite(line_number, obj_name, file_name);
+  etsan::flushRaceReports();
 
   EXPECT_NE(std::string::npos, input_capture.str().find(func_name1));
   EXPECT_NE(std::string::npos, input_capture.str().find(func_name2));
@@ -136,3 +159,182 @@ TEST_F(RaceReportTestFixture, reportRaceOnWrite) {
   // return back std::cout buffer
   std::cout.rdbuf(cout_read_buffer);
 }
+
+TEST_F(RaceReportTestFixture, getSiteResolvesRegisteredTables) {
+  static const char *const files1[] = {"a.cpp", "b.cpp"};
+  static const etsan::SiteInfo module1[] = {
+    {etsan::makeSiteLoc(0, 10, 3), "x"}, {etsan::makeSiteLoc(1, 11, 0), "y"}};
+  static const char *const files2[] = {"a.cpp"};
+  static const etsan::SiteInfo module2[] = {{etsan::makeSiteLoc(0, 7, 5), "z"}};
+
+  const unsigned int base1 = etsan::registerSites(module1, 2, files1, 2);
+  const unsigned int base2 = etsan::registerSites(module2, 1, files2, 1);
+  EXPECT_NE(0U, base1);
+  EXPECT_EQ(base1 + 2, base2);
+
+  const etsan::Site x = etsan::getSite(base1);
+  EXPECT_STREQ("x", x.objName);
+  EXPECT_STREQ("a.cpp", x.fileName);
+  EXPECT_EQ(10U, x.line());
+  EXPECT_EQ(3U, x.column());
+
+  const etsan::Site y = etsan::getSite(base1 + 1);
+  EXPECT_STREQ("b.cpp", y.fileName);
+  EXPECT_EQ(11U, y.line());
+
+  // file indices are of the process, not per module: a file shared by
+  // two modules has one, and its name is stored once
+  const etsan::Site z = etsan::getSite(base2);
+  EXPECT_STREQ("a.cpp", z.fileName);
+  EXPECT_NE(etsan::siteFile(x.loc), etsan::siteFile(y.loc));
+  EXPECT_EQ(etsan::siteFile(x.loc), etsan::siteFile(z.loc));
+  EXPECT_EQ(x.fileName, z.fileName);
+
+  // IDs of no table resolve to the unknown site
+  EXPECT_EQ(0U, etsan::getSite(0).loc);
+  EXPECT_STREQ("Unknown", etsan::getSite(base2 + 1).fileName);
+}
+
+TEST_F(RaceReportTestFixture, siteLocationKeepsLargeLinesAndColumns) {
+  const etsan::SiteLoc loc = etsan::makeSiteLoc(0xFFFF, 100000, 300);
+
+  EXPECT_EQ(0xFFFFU, etsan::siteFile(loc));
+  EXPECT_EQ(100000U, etsan::siteLine(loc));
+  EXPECT_EQ(300U, etsan::siteColumn(loc));
+}
+
+TEST_F(RaceReportTestFixture, reportRaceOnWriteBySiteId) {
+  static const char *const files[] = {file_name};
+  static const etsan::SiteInfo sites[] = {
+    {etsan::makeSiteLoc(0, line_number + 1, 9), obj_name}};
+  const unsigned int site_id = etsan::registerSites(sites, 1, files, 1);
+
+  // redirect cout to a stream to capture output string
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  etsan::reportRaceOnWrite(site_id);
+  etsan::flushRaceReports();
+
+  EXPECT_NE(std::string::npos, input_capture.str().find(obj_name));
+  EXPECT_NE(std::string::npos, input_capture.str().find(file_name));
+  EXPECT_NE(std::string::npos,
+            input_capture.str().find("At line number: 43, column 9"));
+
+  // return back std::cout buffer
+  std::cout.rdbuf(cout_read_buffer);
+}
+
+TEST_F(RaceReportTestFixture, racesOnSitesAboveLine255AreKeptApart) {
+  static const char *const files[] = {file_name};
+  static const etsan::SiteInfo sites[] = {
+    {etsan::makeSiteLoc(0, 300, 1), obj_name},
+    {etsan::makeSiteLoc(0, 300 + 256, 1), obj_name},
+    {etsan::makeSiteLoc(0, 300, 1), obj_name}};
+  const unsigned int base = etsan::registerSites(sites, 3, files, 1);
+
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  const size_t before = etsan::races.size();
+  etsan::reportRaceOnWrite(base);
+  etsan::reportRaceOnWrite(base + 1);
+  etsan::flushRaceReports();
+  EXPECT_EQ(before + 2, etsan::races.size());
+
+  // same location and access type: the same race
+  etsan::reportRaceOnWrite(base + 2);
+  etsan::flushRaceReports();
+  EXPECT_EQ(before + 2, etsan::races.size());
+
+  // same location, other access type: another race
+  etsan::reportRaceOnRead(base);
+  etsan::flushRaceReports();
+  EXPECT_EQ(before + 3, etsan::races.size());
+
+  std::cout.rdbuf(cout_read_buffer);
+}
+
+TEST_F(RaceReportTestFixture, eachRaceIsPrintedOnce) {
+  static const char *const files[] = {file_name};
+  static const etsan::SiteInfo sites[] = {
+    {etsan::makeSiteLoc(0, 700, 2), obj_name}};
+  const unsigned int site_id = etsan::registerSites(sites, 1, files, 1);
+
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  for (int i = 0; i < 10; i++) {
+    etsan::reportRaceOnRead(site_id);
+  }
+  etsan::printRaces();
+
+  const std::string out = input_capture.str();
+  const std::string report = "At line number: 700, column 2";
+  const size_t first = out.find(report);
+  EXPECT_NE(std::string::npos, first);
+  EXPECT_EQ(std::string::npos, out.find(report, first + 1));
+  EXPECT_NE(std::string::npos, out.find("unique data races"));
+
+  std::cout.rdbuf(cout_read_buffer);
+}
+
+TEST_F(RaceReportTestFixture, racesFromManyThreadsAreAllPrinted) {
+  static const char *const files[] = {file_name};
+  static etsan::SiteInfo sites[8];
+  for (unsigned int i = 0; i < 8; i++) {
+    sites[i] = {etsan::makeSiteLoc(0, 800 + i, 1), obj_name};
+  }
+  const unsigned int base = etsan::registerSites(sites, 8, files, 1);
+
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < 4; t++) {
+    threads.emplace_back([base] {
+      for (unsigned int i = 0; i < 8; i++) etsan::reportRaceOnWrite(base + i);
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  etsan::flushRaceReports();
+
+  const std::string out = input_capture.str();
+  for (unsigned int i = 0; i < 8; i++) {
+    EXPECT_NE(std::string::npos,
+              out.find("At line number: " + std::to_string(800 + i)));
+  }
+
+  std::cout.rdbuf(cout_read_buffer);
+}
+
+TEST_F(RaceReportTestFixture, sitesAreDemotedAfterTheirRaceLimit) {
+  static const char *const files[] = {file_name};
+  static const etsan::SiteInfo sites[] = {
+      {etsan::makeSiteLoc(0, 900, 1), obj_name},
+      {etsan::makeSiteLoc(0, 901, 1), obj_name}};
+  const unsigned int base = etsan::registerSites(sites, 2, files, 1);
+
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  etsan::raceReporter.setSiteRaceLimit(2);
+  etsan::reportRaceOnWrite(base);
+  EXPECT_FALSE(etsan::isSuppressed(base));
+  etsan::reportRaceOnRead(base);
+  EXPECT_TRUE(etsan::isSuppressed(base));
+  EXPECT_FALSE(etsan::isSuppressed(base + 1));
+
+  etsan::raceReporter.setSiteRaceLimit(0);
+  etsan::reportRaceOnWrite(base + 1);
+  etsan::reportRaceOnWrite(base + 1);
+  EXPECT_FALSE(etsan::isSuppressed(base + 1));
+  etsan::flushRaceReports();
+
+  std::cout.rdbuf(cout_read_buffer);
+}
@@ -29,12 +29,18 @@ class RaceTestFixture : public ::testing::Test {
      char * file_name = "some_file.cpp";
 
      race_obj_ptr = std::make_shared<Race>(
-       Race(tid, lineNo, access_type, obj_name, file_name));
+       Race(tid, lineNo, access_type.c_str(), obj_name, file_name));
    }
 
   ~RaceTestFixture() override {
 
   }
+
+  // the fixture race at another line or with another access type
+  Race otherRace(int lineNo, std::string access_type) const {
+    return Race(race_obj_ptr->tid, lineNo, access_type.c_str(), "DummyClassObj",
+                "some_file.cpp");
+  }
 };
 
 TEST_F(RaceTestFixture, IsMessageCreatedIsSetToFalse) {
@@ -51,7 +57,7 @@ TEST_F(RaceTestFixture, CheckRaceMessageIsCreated) {
   // true --> message was already created before
   ASSERT_TRUE(race_obj_ptr->createRaceMessage(msg));
 
-  ASSERT_NE(std::string::npos, msg.find(race_obj_ptr->accessType));
+  ASSERT_NE(std::string::npos, msg.find(race_obj_ptr->accessType()));
   ASSERT_NE(std::string::npos, msg.find(race_obj_ptr->objName));
   ASSERT_NE(std::string::npos, msg.find(race_obj_ptr->fileName));
 }
@@ -66,7 +72,8 @@ TEST_F(RaceTestFixture, CheckPrintStackWhenNoTraces) {
 TEST_F(RaceTestFixture, CheckPrintStackWithTraces) {
   char * rand_func_signature("void get_current_balance");
 
-  race_obj_ptr->trace.push_back(rand_func_signature);
+  race_obj_ptr->trace = &rand_func_signature;
+  race_obj_ptr->numFrames = 1;
   auto msg = race_obj_ptr->printStack();
 
   ASSERT_NE(std::string::npos, msg.find(rand_func_signature));
@@ -81,35 +88,75 @@ TEST_F(RaceTestFixture, CheckComparisonEqualRaces) {
 }
 
 TEST_F(RaceTestFixture, CheckComparisonRacesLHSwithSmallerLineNum) {
-  auto lhs = *race_obj_ptr;
-  lhs.lineNo -= 1;
+  const auto lhs = otherRace(race_obj_ptr->line() - 1, "read");
   const auto rhs = *race_obj_ptr;
 
   ASSERT_TRUE(functor.operator()(lhs, rhs));
+  ASSERT_FALSE(functor.operator()(rhs, lhs));
 }
 
 
 TEST_F(RaceTestFixture, CheckComparisonRacesLHSwithBiggerLineNum) {
-  auto lhs = *race_obj_ptr;
-  lhs.lineNo += 1;
+  const auto lhs = otherRace(race_obj_ptr->line() + 1, "read");
   const auto rhs = *race_obj_ptr;
 
-  ASSERT_TRUE(functor.operator()(lhs, rhs));
+  ASSERT_FALSE(functor.operator()(lhs, rhs));
+  ASSERT_TRUE(functor.operator()(rhs, lhs));
+}
+
+TEST_F(RaceTestFixture, CheckComparisonRacesLinesAbove255AreDistinct) {
+  const auto lhs = otherRace(race_obj_ptr->line() + 256, "read");
+  const auto rhs = *race_obj_ptr;
+
+  ASSERT_TRUE(functor.operator()(lhs, rhs) || functor.operator()(rhs, lhs));
 }
 
 
 TEST_F(RaceTestFixture, CheckComparisonRacesLHSwithDifferentAccessTypes) {
-  auto lhs = *race_obj_ptr;
-  lhs.accessType = "write";
+  const auto lhs = otherRace(race_obj_ptr->line(), "write");
   const auto rhs = *race_obj_ptr;
 
-  ASSERT_TRUE(functor.operator()(lhs, rhs));
+  // reads order before writes
+  ASSERT_FALSE(functor.operator()(lhs, rhs));
+  ASSERT_TRUE(functor.operator()(rhs, lhs));
 }
 
 TEST_F(RaceTestFixture, CheckComparisonRacesLHSwithDifferentFileNames) {
-  auto lhs = *race_obj_ptr;
-  lhs.fileName = "some_other_file.cpp";
+  const Race lhs(race_obj_ptr->tid, race_obj_ptr->line(), "read",
+                 "DummyClassObj", "some_other_file.cpp");
   const auto rhs = *race_obj_ptr;
 
-  ASSERT_FALSE(functor.operator()(lhs, rhs));
+  ASSERT_TRUE(functor.operator()(lhs, rhs) || functor.operator()(rhs, lhs));
+}
+
+// Names are stored once: races of the same file share its ID and string
+TEST_F(RaceTestFixture, CheckFileNamesAreInterned) {
+  std::string copy("some_file.cpp");
+  const Race other(7, 99, "write", "DummyClassObj", &copy[0]);
+
+  EXPECT_EQ(etsan::siteFile(race_obj_ptr->loc), etsan::siteFile(other.loc));
+  EXPECT_NE(0U, etsan::siteFile(other.loc));
+  EXPECT_EQ(race_obj_ptr->fileName, other.fileName);
+  EXPECT_EQ(race_obj_ptr->objName, other.objName);
+  EXPECT_STREQ("some_file.cpp",
+               etsan::fileDictionary.fileName(etsan::siteFile(other.loc)));
+}
+
+TEST(FileDictionaryTest, internsFilesAndModules) {
+  etsan::FileDictionary dictionary;
+  EXPECT_EQ(0U, dictionary.internFile(nullptr));
+  EXPECT_EQ(0U, dictionary.internFile(""));
+  unsigned int a = dictionary.internFile("a.c");
+  unsigned int b = dictionary.internFile("b.c");
+  EXPECT_NE(0U, a);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(a, dictionary.internFile("a.c"));
+  EXPECT_STREQ("b.c", dictionary.fileName(b));
+  EXPECT_STREQ("Unknown", dictionary.fileName(0));
+  EXPECT_STREQ("Unknown", dictionary.fileName(b + 1));
+  EXPECT_EQ(3U, dictionary.size());
+
+  unsigned int m = dictionary.saveModule("/lib/libfoo.so");
+  EXPECT_EQ(m, dictionary.saveModule("/lib/libfoo.so"));
+  EXPECT_STREQ("/lib/libfoo.so", dictionary.modulePath(m));
 }
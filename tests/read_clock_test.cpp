@@ -0,0 +1,103 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the read clocks of read-shared variables.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/fasttrack.h"
+
+using Clock = etsan::ReadClock<etsan::Epochs>;
+
+TEST(ReadClockTestFixture, fewReadersStayPairs) {
+  Clock clock;
+  EXPECT_TRUE(clock.empty());
+
+  clock.set(7, EPOCH(7, 3));
+  clock.set(2, EPOCH(2, 1));
+  clock.set(7, EPOCH(7, 4)); // same reader again
+  EXPECT_FALSE(clock.isFull());
+  EXPECT_EQ(2U, clock.size());
+  EXPECT_EQ(EPOCH(7, 4), clock[7]);
+  EXPECT_EQ(EPOCH(2, 1), clock[2]);
+  EXPECT_EQ(0U, clock[5]);
+}
+
+TEST(ReadClockTestFixture, oneMoreReaderPromotesToFullClock) {
+  Clock clock;
+  for (unsigned tid = 1; tid <= Clock::kSmallReaders; tid++) {
+    clock.set(tid * 2, EPOCH(tid * 2, 1));
+  }
+  EXPECT_FALSE(clock.isFull());
+
+  clock.set(3, EPOCH(3, 9));
+  EXPECT_TRUE(clock.isFull());
+  EXPECT_EQ(Clock::kSmallReaders * 2 + 1, clock.size()); // up to tid 8
+  EXPECT_EQ(EPOCH(3, 9), clock[3]);
+  for (unsigned tid = 1; tid <= Clock::kSmallReaders; tid++) {
+    EXPECT_EQ(EPOCH(tid * 2, 1), clock[tid * 2]);
+  }
+
+  clock.set(20, EPOCH(20, 1)); // thread created after the promotion
+  EXPECT_EQ(21U, clock.size());
+  EXPECT_EQ(EPOCH(20, 1), clock[20]);
+  EXPECT_EQ(EPOCH(3, 9), clock[3]);
+}
+
+TEST(ReadClockTestFixture, forEachVisitsReaders) {
+  Clock clock;
+  for (unsigned tid = 0; tid < 6; tid += 2) clock.set(tid, EPOCH(tid, 5));
+
+  unsigned readers = 0;
+  clock.forEach([&](unsigned tid, Epoch e) {
+    EXPECT_EQ(EPOCH(tid, 5), e);
+    readers++;
+  });
+  EXPECT_EQ(3U, readers);
+}
+
+TEST(ReadClockTestFixture, copiesAreIndependent) {
+  Clock clock;
+  clock.set(1, EPOCH(1, 1));
+  Clock copy = clock;
+  copy.set(1, EPOCH(1, 2));
+  EXPECT_EQ(EPOCH(1, 1), clock[1]);
+  EXPECT_EQ(EPOCH(1, 2), copy[1]);
+}
+
+TEST(ReadClockTestFixture, writeReleasesTheReadClock) {
+  NumThreads = 3;
+  ThreadState t;
+  t.tid = 2;
+  t.C = {EPOCH(0, 5), EPOCH(1, 5), EPOCH(2, 1)};
+  t.updateEpoch();
+
+  VarState x;
+  x.W = EPOCH(0, 0);
+  x.R = READ_SHARED;
+  x.Rvc.set(0, EPOCH(0, 4));
+  x.Rvc.set(1, EPOCH(1, 5));
+
+  EXPECT_FALSE(ft_write(x, t)); // both reads happen before
+  EXPECT_TRUE(x.Rvc.empty());
+  EXPECT_EQ(EPOCH(2, 0), x.R);
+}
+
+TEST(ReadClockTestFixture, writeAfterUnorderedReadRaces) {
+  ThreadState t;
+  t.tid = 2;
+  t.C = {EPOCH(0, 5), EPOCH(1, 4), EPOCH(2, 1)};
+  t.updateEpoch();
+
+  VarState x;
+  x.W = EPOCH(0, 0);
+  x.R = READ_SHARED;
+  x.Rvc.set(1, EPOCH(1, 5)); // not seen by t
+
+  EXPECT_TRUE(ft_write(x, t));
+}
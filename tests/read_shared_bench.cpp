@@ -0,0 +1,86 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Measures the read clocks of a read-mostly table shared by worker
+// threads, as the option tables of swaptions and the point blocks of
+// streamcluster: every word is read by "readers" of the threads, then
+// rewritten by the main thread. Compares them with clocks of every
+// thread, as read-shared variables used to get.
+//
+// Usage: read_shared_bench [threads] [readers_per_word] [words]
+//
+////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "etsan/fasttrack.h"
+
+// Bytes of the read clocks of "table"
+static size_t readClockBytes(std::vector<int> &table) {
+  size_t bytes = 0;
+  for (auto &word : table) bytes += getVarState(&word, false).Rvc.memory();
+  return bytes;
+}
+
+static void reader(std::vector<int> *table, int self, int nThreads,
+                   int readers) {
+  ThreadState &t = getThreadState();
+  for (size_t w = 0; w < table->size(); w++) {
+    // word w is read by threads w, w + 1, ..., w + readers - 1
+    int first = w % nThreads;
+    if ((self - first + nThreads) % nThreads < readers) {
+      ft_read(getVarState(&(*table)[w], false), t);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int nThreads = argc > 1 ? atoi(argv[1]) : 8;
+  int readers = argc > 2 ? atoi(argv[2]) : 2;
+  size_t words = argc > 3 ? atol(argv[3]) : 100000;
+  if (nThreads < 1) nThreads = 1;
+  if (readers < 1 || readers > nThreads) readers = nThreads;
+
+  std::vector<int> table(words);
+  ThreadState &main = getThreadState();
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < nThreads; i++) {
+    ft_fork(main, getState(i + 1, &main));
+  }
+  for (int i = 0; i < nThreads; i++) {
+    threads.push_back(std::thread([&, i] {
+      // runs as thread state i + 1, forked above
+      cachedThreadState.state = &getState(i + 1);
+      cachedThreadState.generation = TS.generation;
+      reader(&table, i, nThreads, readers);
+    }));
+  }
+  for (auto &thread : threads) thread.join();
+  size_t shared = readClockBytes(table);
+
+  for (int i = 0; i < nThreads; i++) ft_join(main, getState(i + 1));
+  for (size_t w = 0; w < words; w++) ft_write(getVarState(&table[w], true), main);
+  size_t exclusive = readClockBytes(table);
+
+  // a vector of NumThreads epochs per shared word, never released
+  size_t full = readers > 1 ? words * (sizeof(std::vector<Epoch>) +
+                                       NumThreads * sizeof(Epoch))
+                            : 0;
+
+  printf("threads: %d, readers per word: %d, words: %zu\n",
+         nThreads, readers, words);
+  printf("%-28s %12s %10s\n", "read clocks", "bytes", "per word");
+  printf("%-28s %12zu %10.1f\n", "clocks of every thread", full,
+         (double)full / words);
+  printf("%-28s %12zu %10.1f\n", "adaptive, after the reads", shared,
+         (double)shared / words);
+  printf("%-28s %12zu %10.1f\n", "adaptive, after the writes", exclusive,
+         (double)exclusive / words);
+  return 0;
+}
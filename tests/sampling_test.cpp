@@ -0,0 +1,58 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for sampling of access checks.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/sampling.h"
+
+using etsan::Sampler;
+
+// Number of the next "n" accesses at "site" that are checked
+static unsigned countChecked(Sampler &sampler, unsigned site, unsigned n) {
+  unsigned checked = 0;
+  for (unsigned i = 0; i < n; i++) checked += sampler.sample(site);
+  return checked;
+}
+
+TEST(SamplingTestFixture, coldSiteIsFullyChecked) {
+  Sampler sampler(1);
+  EXPECT_EQ(Sampler::kBurst, countChecked(sampler, 7, Sampler::kBurst));
+}
+
+TEST(SamplingTestFixture, rateDropsTenfoldPerBurst) {
+  Sampler sampler(1);
+  countChecked(sampler, 7, Sampler::kBurst); // 100%
+
+  // 10%: one burst, then nine skipped
+  EXPECT_EQ(Sampler::kBurst, countChecked(sampler, 7, 10 * Sampler::kBurst));
+  // 1%
+  EXPECT_EQ(Sampler::kBurst, countChecked(sampler, 7, 100 * Sampler::kBurst));
+}
+
+TEST(SamplingTestFixture, hotSiteConvergesToConfiguredRate) {
+  Sampler sampler(10);
+  countChecked(sampler, 3, 100 * Sampler::kBurst); // warm up
+
+  const unsigned n = 1000 * Sampler::kBurst;
+  EXPECT_EQ(n / 10, countChecked(sampler, 3, n));
+}
+
+TEST(SamplingTestFixture, sitesAreSampledIndependently) {
+  Sampler sampler(1);
+  countChecked(sampler, 1, 100 * Sampler::kBurst);
+
+  // a hot site does not slow down the sampling of a cold one
+  EXPECT_EQ(Sampler::kBurst, countChecked(sampler, 2, Sampler::kBurst));
+}
+
+TEST(SamplingTestFixture, fullRateChecksEverything) {
+  Sampler sampler(100);
+  EXPECT_EQ(500U, countChecked(sampler, 5, 500));
+}
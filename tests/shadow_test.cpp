@@ -0,0 +1,101 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the direct-mapped shadow memory.
+// Built with ETSAN_SHADOW_MEMORY.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "etsan/fasttrack.h"
+
+TEST(ShadowTestFixture, sameWordSharesSlot) {
+  ShadowMemory<VarState> shadow;
+  int word[2];
+
+  char *base = reinterpret_cast<char *>(&word[0]);
+  EXPECT_EQ(shadow.slot(base), shadow.slot(base + 3));
+  EXPECT_NE(shadow.slot(&word[0]), shadow.slot(&word[1]));
+  EXPECT_EQ(shadow.slot(&word[0]) + 1, shadow.slot(&word[1]));
+}
+
+TEST(ShadowTestFixture, pagesAreCommittedLazily) {
+  ShadowMemory<VarState> shadow;
+  const char *addr = reinterpret_cast<const char *>(0x10000000);
+
+  EXPECT_EQ(0U, shadow.pages());
+  EXPECT_EQ(nullptr, shadow.find(addr));
+
+  VarState *slot = shadow.slot(addr);
+  EXPECT_EQ(1U, shadow.pages());
+  EXPECT_EQ(slot, shadow.find(addr));
+
+  // fresh slots are in the initial state
+  EXPECT_EQ(0, slot->W);
+  EXPECT_EQ(0, slot->R);
+  EXPECT_FALSE(slot->Racy);
+  EXPECT_TRUE(slot->Rvc.empty());
+
+  // another word in the same page does not commit more shadow
+  shadow.slot(addr + 64);
+  EXPECT_EQ(1U, shadow.pages());
+
+  // a word one page away does
+  auto page_bytes = ShadowMemory<VarState>::kPageSlots
+                    << ShadowMemory<VarState>::kWordShift;
+  shadow.slot(addr + page_bytes);
+  EXPECT_EQ(2U, shadow.pages());
+}
+
+TEST(ShadowTestFixture, concurrentCommitInstallsOnePage) {
+  ShadowMemory<VarState> shadow;
+  const char *addr = reinterpret_cast<const char *>(0x20000000);
+  constexpr int num_threads = 4;
+
+  std::vector<std::thread> threads;
+  std::vector<VarState *> slots(num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    threads.push_back(std::thread([&, i]() { slots[i] = shadow.slot(addr); }));
+  }
+  for (auto &thread : threads) thread.join();
+
+  EXPECT_EQ(1U, shadow.pages());
+  for (auto slot : slots) EXPECT_EQ(slots.front(), slot);
+}
+
+TEST(ShadowTestFixture, getVarStateUsesShadowSlot) {
+  int variable = 0;
+  VarState &x = getVarState(&variable, true);
+  EXPECT_EQ(VS.shadow.find(&variable), &x);
+
+  ThreadState thread_state;
+  thread_state.tid = 1;
+  thread_state.C = {0, (1 << 24) + 1};
+  thread_state.updateEpoch();
+
+  EXPECT_FALSE(ft_write(x, thread_state));
+  EXPECT_EQ(thread_state.epoch, getVarState(&variable, false).W);
+}
+
+TEST(ShadowTestFixture, resetVarStatesClearsSlots) {
+  int block[8];
+  ThreadState thread_state;
+  thread_state.tid = 1;
+  thread_state.C = {0, (1 << 24) + 1};
+  thread_state.updateEpoch();
+  for (auto & word : block) EXPECT_FALSE(ft_write(getVarState(&word, true),
+                                                  thread_state));
+
+  resetVarStates(&block[2], 4 * sizeof(int));
+  for (int i = 0; i < 8; i++) {
+    bool reset = i >= 2 && i < 6;
+    EXPECT_EQ(reset ? 0U : thread_state.epoch, VS.shadow.find(&block[i])->W);
+  }
+}
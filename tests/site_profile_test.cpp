@@ -0,0 +1,100 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the per-site profile of ETSAN_SITE_PROFILE.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+
+#include "etsan/fasttrack.h"
+#include "etsan/site_profile.h"
+
+static const char *const files[] = {"loop.c"};
+static const etsan::SiteInfo siteInfo[] = {
+  {etsan::makeSiteLoc(0, 7, 9), "hot"},
+  {etsan::makeSiteLoc(0, 12, 3), "cold"}};
+
+// The profile as printed, with the "top" sites
+static std::string printed(unsigned long top) {
+  char *buffer = nullptr;
+  size_t size = 0;
+  FILE *out = open_memstream(&buffer, &size);
+  etsan::printSiteProfile(out, top);
+  fclose(out);
+  std::string s(buffer, size);
+  free(buffer);
+  return s;
+}
+
+static unsigned int firstSite;
+
+TEST(SiteProfileTestFixture, sitesAreSortedByChecks) {
+  firstSite = etsan::registerSites(siteInfo, 2, files, 1);
+  static int hot, cold;
+  ThreadState & t = getThreadState();
+
+  for (int i = 0; i < 10; i++) {
+    if (i == 5) t.increment(); // e.g. a release: a new epoch
+    etsan::ProfiledAccess profiled(firstSite, t.stats,
+                                   etsan::StatWriteSameEpoch);
+    ft_write_access(&hot, sizeof(hot), t);
+  }
+  {
+    etsan::ProfiledAccess profiled(firstSite + 1, t.stats,
+                                   etsan::StatReadSameEpoch);
+    ft_read_access(&cold, sizeof(cold), t);
+  }
+
+  std::unordered_map<unsigned int, etsan::SiteCount> counts;
+  etsan::siteProfile.addTo(counts);
+  EXPECT_EQ(10UL, counts[firstSite].calls);
+  EXPECT_EQ(1UL, counts[firstSite].slow); // the first write of the epoch
+  EXPECT_EQ(1UL, counts[firstSite + 1].calls);
+
+  std::string s = printed(20);
+  EXPECT_NE(std::string::npos, s.find("top 2 of 2 sites, 11 checks"));
+  size_t hotLine = s.find("loop.c:7:9 hot");
+  size_t coldLine = s.find("loop.c:12:3 cold");
+  ASSERT_NE(std::string::npos, hotLine);
+  ASSERT_NE(std::string::npos, coldLine);
+  EXPECT_LT(hotLine, coldLine);
+
+  EXPECT_EQ(std::string::npos, printed(1).find("cold"));
+}
+
+TEST(SiteProfileTestFixture, countsOfExitedThreadsAreKept) {
+  std::thread([] {
+    ThreadState & t = getThreadState();
+    static int local;
+    for (int i = 0; i < 5; i++) {
+      etsan::ProfiledAccess profiled(firstSite + 1, t.stats,
+                                     etsan::StatReadSameEpoch);
+      ft_read_access(&local, sizeof(local), t);
+    }
+  }).join();
+
+  EXPECT_NE(std::string::npos, printed(20).find("top 2 of 2 sites, 16 checks"));
+}
+
+TEST(SiteProfileTestFixture, sitesBeyondTheTableAreCountedTogether) {
+  etsan::SiteProfile profile;
+  for (unsigned int id = 1; id <= 2 * etsan::SiteProfile::kSlots; id++) {
+    profile.count(id, false);
+  }
+  std::unordered_map<unsigned int, etsan::SiteCount> counts;
+  profile.addTo(counts);
+
+  unsigned long total = 0;
+  for (auto & c : counts) total += c.second.calls;
+  EXPECT_EQ(2UL * etsan::SiteProfile::kSlots, total);
+  ASSERT_EQ(1U, counts.count(etsan::SiteProfile::kOtherSites));
+}
@@ -0,0 +1,94 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for per-thread statistics counters.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/fasttrack.h"
+
+TEST(StatsTestFixture, countersArePaddedAndCleared) {
+  etsan::ThreadStats stats;
+  EXPECT_GE(sizeof(stats), 2 * etsan::kCacheLineSize +
+                           sizeof(stats.counter));
+  for (int c = 0; c < etsan::NumStatCounters; c++) {
+    EXPECT_EQ(0U, stats.get(static_cast<etsan::StatCounter>(c)));
+  }
+}
+
+TEST(StatsTestFixture, addSumsCounters) {
+  etsan::ThreadStats total, one;
+  one.inc(etsan::StatReads);
+  one.inc(etsan::StatReads);
+  one.inc(etsan::StatJoins);
+
+  total.add(one);
+  total.add(one);
+  EXPECT_EQ(4U, total.get(etsan::StatReads));
+  EXPECT_EQ(2U, total.get(etsan::StatJoins));
+  EXPECT_EQ(0U, total.get(etsan::StatWrites));
+
+  total.clear();
+  EXPECT_EQ(0U, total.get(etsan::StatReads));
+}
+
+TEST(StatsTestFixture, readCategoriesAreCounted) {
+  NumThreads = 2;
+  ThreadState t;
+  t.tid = 1;
+  t.C = {0, (1 << 24) + 1};
+  t.updateEpoch();
+
+  ThreadState u;
+  u.tid = 0;
+  u.C = {1, 1 << 24}; // has not seen t's clock
+  u.updateEpoch();
+
+  VarState x;
+  x.W = 0;
+  x.R = 0;
+
+  ft_read(x, t);  // exclusive
+  ft_read(x, t);  // same epoch
+  ft_read(x, u);  // share: t's read is concurrent with u
+  ft_read(x, t);  // shared
+
+  EXPECT_EQ(3U, t.stats.get(etsan::StatReads));
+  EXPECT_EQ(1U, t.stats.get(etsan::StatReadExclusive));
+  EXPECT_EQ(1U, t.stats.get(etsan::StatReadSameEpoch));
+  EXPECT_EQ(1U, t.stats.get(etsan::StatReadShared));
+  EXPECT_EQ(1U, u.stats.get(etsan::StatReadShare));
+}
+
+TEST(StatsTestFixture, writeAndSyncCategoriesAreCounted) {
+  ThreadState t;
+  t.tid = 1;
+  t.C = {0, (1 << 24) + 1};
+  t.updateEpoch();
+
+  VarState x;
+  x.W = 0;
+  x.R = 0;
+
+  ft_write(x, t); // exclusive
+  ft_write(x, t); // same epoch
+  EXPECT_EQ(2U, t.stats.get(etsan::StatWrites));
+  EXPECT_EQ(1U, t.stats.get(etsan::StatWriteExclusive));
+  EXPECT_EQ(1U, t.stats.get(etsan::StatWriteSameEpoch));
+
+  x.R = READ_SHARED;
+  t.increment();
+  ft_write(x, t); // shared
+  EXPECT_EQ(1U, t.stats.get(etsan::StatWriteShared));
+
+  LockState lock;
+  ft_acquire(t, lock);
+  ft_release(t, lock);
+  EXPECT_EQ(1U, t.stats.get(etsan::StatAcquires));
+  EXPECT_EQ(1U, t.stats.get(etsan::StatReleases));
+}
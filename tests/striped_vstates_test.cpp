@@ -0,0 +1,112 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the striped variable states store.
+// Built with ETSAN_STRIPED_VSTATES.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+#include <thread>
+
+#include "etsan/fasttrack.h"
+
+class StripedVStatesTestFixture : public ::testing::Test {
+protected:
+  const unsigned int num_shards = 8;
+
+  StripedVStatesTestFixture() {
+    TS.clear();
+    VS.setShards(num_shards);
+    VS.setBudget(0);
+  }
+};
+
+TEST_F(StripedVStatesTestFixture, defaultShardCount) {
+  const unsigned int default_shards = VStates::kDefaultShards;
+  VStates states;
+  EXPECT_EQ(default_shards, states.numShards);
+}
+
+TEST_F(StripedVStatesTestFixture, nearbyAddressesShareShard) {
+  alignas(64) int line[16];
+  EXPECT_EQ(num_shards, VS.numShards);
+  EXPECT_EQ(VS.shardOf(&line[0]), VS.shardOf(&line[15]));
+  EXPECT_NE(VS.shardOf(&line[0]), VS.shardOf(&line[16]));
+  EXPECT_LT(VS.shardOf(&line[0]), num_shards);
+}
+
+TEST_F(StripedVStatesTestFixture, getVarStateStoresInOwnShard) {
+  Address addr = (void *)(0x1000);
+  Address other = (void *)(0x1040);
+
+  VarState & x = getVarState(addr, true);
+  getVarState(other, false);
+  EXPECT_EQ(&x, &getVarState(addr, false));
+
+  auto shard = VS.shardOf(addr);
+  EXPECT_EQ(shard, x.Shard);
+  EXPECT_EQ(1U, VS.shards[shard].Vstates.count(addr));
+  EXPECT_EQ(0U, VS.shards[shard].Vstates.count(other));
+  EXPECT_EQ(1U, VS.shards[VS.shardOf(other)].Vstates.count(other));
+}
+
+TEST_F(StripedVStatesTestFixture, resetVarStatesErasesFromEachShard) {
+  for (uintptr_t a = 0x3000; a < 0x3200; a += 4) {
+    getVarState((void *)a, true);
+  }
+  resetVarStates((void *)(0x3010), 0x100);
+
+  for (uintptr_t a = 0x3000; a < 0x3200; a += 4) {
+    auto & states = VS.shards[VS.shardOf((void *)a)].Vstates;
+    bool reset = a >= 0x3010 && a < 0x3110;
+    EXPECT_EQ(reset ? 0U : 1U, states.count((void *)a));
+  }
+
+  resetVarStates((void *)(0x0), 0x10000); // one sweep of every shard
+  for (unsigned int i = 0; i < num_shards; i++) {
+    EXPECT_EQ(0U, VS.shards[i].Vstates.size());
+  }
+}
+
+TEST_F(StripedVStatesTestFixture, budgetCapsEachShard) {
+  VS.setBudget(1); // exceeded already
+  for (uintptr_t a = 0x10000; a < 0x10000 + 4 * 8192; a += 4) {
+    getVarState((void *)a, true);
+  }
+  for (unsigned int i = 0; i < num_shards; i++) {
+    EXPECT_LE(VS.shards[i].Vstates.size(), VStates::kMinStates);
+  }
+  EXPECT_GT(getThreadState().stats.get(etsan::StatEvictions), 0U);
+}
+
+TEST_F(StripedVStatesTestFixture, ftWriteLocksShard) {
+  Address addr = (void *)(0x2000);
+  VarState & x = getVarState(addr, false);
+  auto acquired = VS.shards[x.Shard].acquired;
+
+  ft_write(x, getThreadState());
+  EXPECT_EQ(acquired + 1, VS.shards[x.Shard].acquired);
+}
+
+TEST_F(StripedVStatesTestFixture, contentionIsCounted) {
+  VStates::Shard & stripe = VS.shards[0];
+  EXPECT_EQ(0U, stripe.contended);
+
+  stripe.lock();
+  std::thread waiter([&]() {
+    stripe.lock();
+    stripe.unlock();
+  });
+  usleep(10000);
+  stripe.unlock();
+  waiter.join();
+
+  EXPECT_EQ(2U, stripe.acquired);
+  EXPECT_EQ(1U, stripe.contended);
+}
@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the suppressions of ETSAN_SUPPRESSIONS.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/suppressions.h"
+
+static const char *const files[] = {"src/net/stats.c", "src/main.c"};
+static const etsan::SiteInfo sites[] = {
+  {etsan::makeSiteLoc(0, 10, 1), "rx_count"},
+  {etsan::makeSiteLoc(1, 42, 5), "ready"},
+  {etsan::makeSiteLoc(1, 43, 5), "ready"},
+  {etsan::makeSiteLoc(1, 50, 2), "hit_count_total"}};
+
+TEST(SuppressionsTestFixture, rulesAreParsed) {
+  etsan::Suppressions rules;
+  EXPECT_EQ(2U, rules.parse("# benign\n"
+                            "\n"
+                            "  src:*/stats.c  \n"
+                            "bogus:x\n"
+                            "src:\n"
+                            "var:hit_count*\r\n"));
+  EXPECT_FALSE(rules.empty());
+
+  etsan::Site stats = {etsan::makeSiteLoc(1, 3, 1), "any", "src/net/stats.c"};
+  etsan::Site hits = {etsan::makeSiteLoc(1, 3, 1), "hit_count_a", "a.c"};
+  etsan::Site other = {etsan::makeSiteLoc(1, 3, 1), "hits", "a.c"};
+  EXPECT_TRUE(rules.matches(stats));
+  EXPECT_TRUE(rules.matches(hits));
+  EXPECT_FALSE(rules.matches(other));
+}
+
+TEST(SuppressionsTestFixture, sitesAreSuppressedByBit) {
+  etsan::Suppressions rules;
+  rules.parse("src:*/stats.c\n"
+              "src:*main.c:42\n"
+              "var:hit_count*\n");
+
+  unsigned int base = etsan::registerSites(sites, 4, files, 2);
+  EXPECT_EQ(3U, etsan::suppressSites(base, 4, rules));
+
+  EXPECT_TRUE(etsan::isSuppressed(base));      // file
+  EXPECT_TRUE(etsan::isSuppressed(base + 1));  // line
+  EXPECT_FALSE(etsan::isSuppressed(base + 2)); // next line
+  EXPECT_TRUE(etsan::isSuppressed(base + 3));  // variable
+  EXPECT_FALSE(etsan::isSuppressed(base + 4)); // not registered
+
+  // a later module keeps the sites of the earlier ones
+  unsigned int next = etsan::registerSites(sites, 1, files, 1);
+  EXPECT_EQ(1U, etsan::suppressSites(next, 1, rules));
+  EXPECT_TRUE(etsan::isSuppressed(next));
+  EXPECT_TRUE(etsan::isSuppressed(base + 1));
+}
+
+TEST(SuppressionsTestFixture, noRulesSuppressNothing) {
+  etsan::Suppressions rules;
+  unsigned int base = etsan::registerSites(sites, 4, files, 2);
+  EXPECT_EQ(0U, etsan::suppressSites(base, 4, rules));
+  EXPECT_FALSE(etsan::isSuppressed(base + 2));
+}
+
+TEST(SuppressionsTestFixture, demotedSitesAreSuppressed) {
+  etsan::Suppressions rules;
+  rules.parse("var:rx_count\n");
+  unsigned int base = etsan::registerSites(sites, 4, files, 2);
+  EXPECT_EQ(1U, etsan::suppressSites(base, 4, rules));
+
+  etsan::demoteSite(base + 2); // in the bitmap
+  EXPECT_TRUE(etsan::isSuppressed(base + 2));
+  EXPECT_FALSE(etsan::isSuppressed(base + 1));
+
+  unsigned int next = etsan::registerSites(sites, 4, files, 2);
+  etsan::demoteSite(next + 3); // beyond it
+  EXPECT_TRUE(etsan::isSuppressed(next + 3));
+  EXPECT_TRUE(etsan::isSuppressed(base));
+  EXPECT_TRUE(etsan::isSuppressed(base + 2));
+}
@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Measures the data TLB misses of the metadata: each thread reads and
+// writes random words of its own slice of a large array, as the workers
+// of canneal and streamcluster, so nearly every check touches another
+// page of metadata. Run it with ETSAN_HUGE_PAGES=0, 1 and 2 (and
+// ETSAN_NUMA=1 on a multi-socket host) and compare the misses per
+// thousand checks. The misses are counted with perf_event_open, "n/a"
+// where the kernel does not expose the counter.
+//
+// Usage: tlb_bench [threads] [words_per_thread] [accesses_per_thread]
+//
+////////////////////////////////////////////////////
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "etsan/fasttrack.h"
+
+// Counter of the data TLB read misses of this process and of the threads
+// it creates from now on, or -1
+static int openTlbCounter() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Runs with the state its parent forked under the provisional id "key",
+// as the threads of __etsan_thread_create
+static void worker(ThreadID key, int *slice, long words, long accesses,
+                   unsigned seed) {
+  ThreadState &t = adoptThreadState(key, (ThreadID)pthread_self());
+  installThreadState(t);
+  for (long i = 0; i < accesses; i++) {
+    seed = seed * 1103515245 + 12345;
+    int *word = &slice[(seed >> 8) % words];
+    if (i & 1) {
+      ft_write(getVarState(word, true), t);
+    } else {
+      ft_read(getVarState(word, false), t);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int nThreads = argc > 1 ? atoi(argv[1]) : 4;
+  long words = argc > 2 ? atol(argv[2]) : 1 << 20;
+  long accesses = argc > 3 ? atol(argv[3]) : 4000000;
+  if (nThreads < 1) nThreads = 1;
+  if (words < 1) words = 1;
+
+  printf("huge pages: %s, NUMA: %s\n",
+         etsan::hugePages() == etsan::HugePagesHugetlb ? "hugetlb"
+         : etsan::hugePages() ? "transparent" : "off",
+         etsan::numaAware() ? "on" : "off");
+
+  std::vector<int> data(nThreads * words);
+  int counter = openTlbCounter();
+  std::vector<std::thread> threads;
+  ThreadState &parent = getThreadState();
+  ThreadID key = 1; // odd, unlike the pthread_t of a thread
+
+  // create the metadata of every word first, then measure the checks.
+  // Both passes are forked and joined, so the second one does not race
+  // with the first.
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1 && counter >= 0) {
+      ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < nThreads; i++, key += 2) {
+      ft_fork(parent, getState(key, &parent));
+      threads.push_back(std::thread(worker, key, &data[i * words], words,
+                                    pass ? accesses : words * 4, i + 1));
+    }
+    for (auto &thread : threads) {
+      ThreadID tid = (ThreadID)thread.native_handle();
+      thread.join();
+      ft_join(parent, getJoinedState(tid));
+      retireThread(tid);
+    }
+    threads.clear();
+    auto end = std::chrono::steady_clock::now();
+    if (pass == 0) continue;
+
+    double secs = std::chrono::duration<double>(end - start).count();
+    long checks = accesses * nThreads;
+    printf("%8s %12s %14s %16s %12s\n", "threads", "seconds", "Maccesses/s",
+           "dTLB misses/1k", "meta MiB");
+    printf("%8d %12.3f %14.2f ", nThreads, secs, checks / secs / 1e6);
+    uint64_t misses;
+    if (counter >= 0 && read(counter, &misses, sizeof(misses)) ==
+                            sizeof(misses)) {
+      printf("%16.2f ", 1000.0 * misses / checks);
+    } else {
+      printf("%16s ", "n/a");
+    }
+    printf("%12.1f\n", etsan::metadataArena.bytes() / 1048576.0);
+  }
+  return 0;
+}
@@ -0,0 +1,84 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the buffered debug trace.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+#include "etsan/trace.h"
+
+class TraceTestFixture : public ::testing::Test {
+protected:
+  // The trace output is opened once per process, so the whole suite
+  // shares one file and each test starts by truncating it.
+  static std::string path;
+
+  static void SetUpTestSuite() {
+    char name[] = "/tmp/etsan_trace_XXXXXX";
+    close(mkstemp(name));
+    path = name;
+    setenv("ETSAN_TRACE_FILE", path.c_str(), 1);
+  }
+
+  static void TearDownTestSuite() { unlink(path.c_str()); }
+
+  void SetUp() {
+    std::ofstream(path, std::ios::trunc);
+    etsan::traceBuffer.size = 0;
+  }
+
+  void TearDown() { etsan::verbosity = 0; }
+
+  std::string output() {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+  }
+};
+
+std::string TraceTestFixture::path;
+
+TEST_F(TraceTestFixture, eventsAreBufferedUntilFlush) {
+  etsan::verbosity = etsan::kTraceAccess;
+  int x = 0;
+  trace_event(etsan::kTraceAccess, etsan::TraceWrite, &x, 12, "x");
+  EXPECT_EQ(1, etsan::traceBuffer.size);
+  EXPECT_EQ("", output());
+
+  etsan::traceBuffer.flush();
+  EXPECT_EQ(0, etsan::traceBuffer.size);
+  std::string out = output();
+  EXPECT_NE(std::string::npos, out.find("write"));
+  EXPECT_NE(std::string::npos, out.find("line 12 x"));
+}
+
+TEST_F(TraceTestFixture, verbosityFiltersEvents) {
+  etsan::verbosity = etsan::kTraceSync;
+  int m = 0;
+  trace_event(etsan::kTraceSync, etsan::TraceLock, &m, 3, nullptr);
+  trace_event(etsan::kTraceFunc, etsan::TraceFuncEntry, nullptr, 0, "f");
+  trace_event(etsan::kTraceAccess, etsan::TraceRead, &m, 4, "m");
+  EXPECT_EQ(1, etsan::traceBuffer.size);
+  EXPECT_EQ(etsan::TraceLock, etsan::traceBuffer.events[0].kind);
+}
+
+TEST_F(TraceTestFixture, fullBufferIsFlushed) {
+  etsan::verbosity = etsan::kTraceAccess;
+  int x;
+  const int capacity = etsan::TraceBuffer::kCapacity;
+  for (int i = 0; i <= capacity; i++) {
+    trace_event(etsan::kTraceAccess, etsan::TraceRead, &x, i, "x");
+  }
+  EXPECT_EQ(1, etsan::traceBuffer.size);
+  EXPECT_NE(std::string::npos, output().find("line 0 x"));
+}
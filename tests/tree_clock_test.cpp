@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for tree clocks.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "etsan/fasttrack.h"
+#include "etsan/tree_clock.h"
+
+using Clock = etsan::TreeClock<etsan::Epochs>;
+using Flat = std::vector<Epoch>;
+
+static void expectSame(const Flat & flat, const Clock & tree) {
+  ASSERT_EQ(flat.size(), tree.size());
+  for (size_t t = 0; t < flat.size(); t++) EXPECT_EQ(flat[t], tree[t]);
+}
+
+TEST(TreeClockTestFixture, joinTakesMaxOfEachThread) {
+  Clock a = {(0 << 24) + 1, (1 << 24) + 8, (2 << 24) + 3};
+  Clock b = {(0 << 24) + 4, (1 << 24) + 2, (2 << 24) + 3, (3 << 24) + 6};
+
+  a.join(b);
+  expectSame({(0 << 24) + 4, (1 << 24) + 8, (2 << 24) + 3, (3 << 24) + 6}, a);
+  EXPECT_TRUE(b.leq(a));
+  EXPECT_FALSE(a.leq(b));
+
+  a.reset();
+  expectSame({0 << 24, 1 << 24, 2 << 24, 3 << 24}, a);
+}
+
+TEST(TreeClockTestFixture, ownerIncrementsInPlace) {
+  Clock a;
+  a.resize(3);
+  a.set(1, (1 << 24) + 1);
+  a.own(1);
+  a.set(1, (1 << 24) + 2);
+
+  Clock lock;
+  lock.resize(3);
+  lock.join(a);
+  expectSame({0 << 24, (1 << 24) + 2, 2 << 24}, lock);
+}
+
+// Threads synchronizing at random through locks, as FastTrack does: every
+// clock a thread hands out is followed by an increment. Tree clocks must
+// always hold the same epochs as flat vector clocks.
+TEST(TreeClockTestFixture, randomSynchronizationMatchesVectorClocks) {
+  const unsigned kThreads = 12, kLocks = 5;
+  std::mt19937 random(42);
+
+  std::vector<Flat> flatT(kThreads), flatL(kLocks);
+  std::vector<Clock> treeT(kThreads), treeL(kLocks);
+  for (unsigned t = 0; t < kThreads; t++) {
+    for (unsigned u = 0; u < kThreads; u++) {
+      flatT[t].push_back(EPOCH(u, u == t ? 1 : 0));
+    }
+    treeT[t].assign(flatT[t].begin(), flatT[t].end());
+    treeT[t].own(t);
+  }
+  for (unsigned l = 0; l < kLocks; l++) {
+    flatL[l] = Flat(flatT[0].size());
+    for (unsigned u = 0; u < kThreads; u++) flatL[l][u] = EPOCH(u, 0);
+    treeL[l].resize(kThreads);
+  }
+  auto increment = [&](unsigned t) {
+    flatT[t][t]++;
+    treeT[t].set(t, flatT[t][t]);
+  };
+  auto join = [](Flat & a, const Flat & b) {
+    for (size_t i = 0; i < a.size(); i++) a[i] = std::max(a[i], b[i]);
+  };
+  auto leq = [](const Flat & a, const Flat & b) {
+    for (size_t i = 0; i < a.size(); i++) {
+      if (a[i] > b[i]) return false;
+    }
+    return true;
+  };
+
+  for (int step = 0; step < 20000; step++) {
+    unsigned t = random() % kThreads, l = random() % kLocks;
+    switch (random() % 4) {
+    case 0: // acquire
+      join(flatT[t], flatL[l]);
+      treeT[t].join(treeL[l]);
+      break;
+    case 1: // release
+      if (leq(flatL[l], flatT[t])) treeL[l].copyLess(treeT[t]);
+      else treeL[l].copy(treeT[t]);
+      flatL[l] = flatT[t];
+      increment(t);
+      break;
+    case 2: // release of a read-modify-write
+      join(flatL[l], flatT[t]);
+      treeL[l].join(treeT[t]);
+      increment(t);
+      break;
+    case 3: { // join of another thread, which goes on
+      unsigned u = random() % kThreads;
+      if (u == t) break;
+      join(flatT[t], flatT[u]);
+      treeT[t].join(treeT[u]);
+      increment(u);
+      break;
+    }
+    }
+    expectSame(flatT[t], treeT[t]);
+    expectSame(flatL[l], treeL[l]);
+    if (HasFailure()) {
+      FAIL() << "at step " << step;
+    }
+  }
+  for (unsigned t = 0; t < kThreads; t++) expectSame(flatT[t], treeT[t]);
+}
@@ -0,0 +1,121 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the atomic operation callbacks.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+
+#include "etsan/tsan_interface.h"
+
+namespace {
+
+// entry of a site table as emitted by the compiler pass
+struct site_t
+{
+  uint64_t loc;
+  const char * obj_name;
+};
+
+const site_t atomic_sites[] = {{uint64_t(501) << 16, "published"},
+                               {uint64_t(502) << 16, "published"}};
+const char * const atomic_files[] = {"atomic_file"};
+
+// Writes "data" in the main thread and in a child thread, ordered, if
+// at all, by the release store and acquire load of a flag with memory
+// order "mo". Returns the race reports printed.
+std::string publish(__tsan_memory_order store_mo, __tsan_memory_order load_mo,
+                    unsigned int site_id) {
+  static __tsan_atomic32 flag;
+  static int data;
+  flag = 0;
+  std::atomic<bool> forked(false); // not seen by the race detector
+
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  std::thread child([&] {
+    while (!forked) {}
+    while (!__tsan_atomic32_load(&flag, load_mo)) {}
+    __tsan_write4(&data, site_id);
+  });
+  auto child_id = child.get_id();
+  __tsan_thread_create((void*)(&child_id));
+  forked = true;
+
+  __tsan_write4(&data, site_id);
+  __tsan_atomic32_store(&flag, 1, store_mo);
+
+  child.join();
+  __tsan_thread_join((void*)(&child_id));
+  __tsan_main_func_exit(); // prints the reports
+
+  std::cout.rdbuf(cout_read_buffer);
+  return input_capture.str();
+}
+
+} // namespace
+
+TEST(TsanInterfaceAtomicTest, operationsReturnTheirValues) {
+  __tsan_atomic32 x = 5;
+  EXPECT_EQ(5, __tsan_atomic32_load(&x, __tsan_memory_order_acquire));
+  __tsan_atomic32_store(&x, 7, __tsan_memory_order_release);
+  EXPECT_EQ(7, x);
+
+  EXPECT_EQ(7, __tsan_atomic32_fetch_add(&x, 3, __tsan_memory_order_acq_rel));
+  EXPECT_EQ(10, __tsan_atomic32_fetch_sub(&x, 4, __tsan_memory_order_relaxed));
+  EXPECT_EQ(6, __tsan_atomic32_fetch_or(&x, 1, __tsan_memory_order_seq_cst));
+  EXPECT_EQ(7, __tsan_atomic32_fetch_and(&x, 3, __tsan_memory_order_relaxed));
+  EXPECT_EQ(3, __tsan_atomic32_fetch_xor(&x, 1, __tsan_memory_order_relaxed));
+  EXPECT_EQ(2, __tsan_atomic32_fetch_nand(&x, 3, __tsan_memory_order_relaxed));
+  EXPECT_EQ(~2, x);
+
+  __tsan_atomic8 c = 1;
+  EXPECT_EQ(1, __tsan_atomic8_exchange(&c, 9, __tsan_memory_order_relaxed));
+  EXPECT_EQ(9, c);
+
+  __tsan_atomic64 l = 1LL << 40;
+  EXPECT_EQ(1LL << 40, __tsan_atomic64_fetch_add(&l, 1,
+                                                 __tsan_memory_order_relaxed));
+  EXPECT_EQ((1LL << 40) + 1, l);
+}
+
+TEST(TsanInterfaceAtomicTest, compareExchangeReturnsTheValueFound) {
+  __tsan_atomic16 x = 4;
+  EXPECT_EQ(4, __tsan_atomic16_compare_exchange_val(
+                   &x, 4, 8, __tsan_memory_order_acq_rel,
+                   __tsan_memory_order_acquire));
+  EXPECT_EQ(8, x);
+
+  EXPECT_EQ(8, __tsan_atomic16_compare_exchange_val(
+                   &x, 4, 1, __tsan_memory_order_acq_rel,
+                   __tsan_memory_order_acquire));
+  EXPECT_EQ(8, x);
+}
+
+TEST(TsanInterfaceAtomicTest, releaseAcquireOrdersPlainAccesses) {
+  const unsigned int base = __tsan_register_sites(atomic_sites, 2,
+                                                  atomic_files, 1);
+
+  std::string out = publish(__tsan_memory_order_release,
+                            __tsan_memory_order_acquire, base);
+  EXPECT_EQ(std::string::npos, out.find("At line number: 501\n")) << out;
+}
+
+TEST(TsanInterfaceAtomicTest, relaxedOperationsDoNotSynchronize) {
+  const unsigned int base = __tsan_register_sites(atomic_sites, 2,
+                                                  atomic_files, 1);
+
+  std::string out = publish(__tsan_memory_order_relaxed,
+                            __tsan_memory_order_relaxed, base + 1);
+  EXPECT_NE(std::string::npos, out.find("At line number: 502\n")) << out;
+}
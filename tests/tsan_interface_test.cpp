@@ -16,10 +16,37 @@
 #include <vector>
 #include <unordered_map>
 #include <thread>
+#include <array>
+#include <atomic>
 
 #include "etsan/tsan_interface.h"
 
-using func_t = std::function<void(void*, int, void*, void*)>;
+using func_t = std::function<void(void*, unsigned int)>;
+
+// the register-preserving entries of etsan/trampolines.h
+#if defined(__x86_64__) || defined(__arm__)
+#define HAS_TRAMPOLINES 1
+extern "C" {
+void __etsan_pm_read1(void *addr, unsigned int siteId);
+void __etsan_pm_read2(void *addr, unsigned int siteId);
+void __etsan_pm_read4(void *addr, unsigned int siteId);
+void __etsan_pm_read8(void *addr, unsigned int siteId);
+void __etsan_pm_read16(void *addr, unsigned int siteId);
+void __etsan_pm_write1(void *addr, unsigned int siteId);
+void __etsan_pm_write2(void *addr, unsigned int siteId);
+void __etsan_pm_write4(void *addr, unsigned int siteId);
+void __etsan_pm_write8(void *addr, unsigned int siteId);
+void __etsan_pm_write16(void *addr, unsigned int siteId);
+}
+#endif
+
+// entry of a site table as emitted by the compiler pass: the packed
+// location | file : 16 | line : 32 | column : 16 | and the variable name
+struct site_t
+{
+  uint64_t loc;
+  const char * obj_name;
+};
 
 // function-related data definitions
 struct data_t
@@ -28,6 +55,7 @@ struct data_t
   func_t ft_write_func;
   void* addr;
   int line_no;
+  unsigned int site_id;
 
   char * func_name = "some_function";
   char * file_name = "some_file";
@@ -35,8 +63,8 @@ struct data_t
 
 void threadFunction(data_t & data) {
   usleep(400);
-  data.ft_read_func(data.addr, data.line_no, data.func_name, data.file_name);
-  data.ft_write_func(data.addr, data.line_no, data.func_name, data.file_name);
+  data.ft_read_func(data.addr, data.site_id);
+  data.ft_write_func(data.addr, data.site_id);
 }
 
 constexpr int NUM_THREADS = 4;
@@ -73,6 +101,24 @@ protected:
     {16, __tsan_unaligned_write16},
   };
 
+#ifdef HAS_TRAMPOLINES
+  std::unordered_map<int, func_t> preserving_read_functions = {
+    {1, __etsan_pm_read1},
+    {2, __etsan_pm_read2},
+    {4, __etsan_pm_read4},
+    {8, __etsan_pm_read8},
+    {16, __etsan_pm_read16},
+  };
+
+  std::unordered_map<int, func_t> preserving_write_functions = {
+    {1, __etsan_pm_write1},
+    {2, __etsan_pm_write2},
+    {4, __etsan_pm_write4},
+    {8, __etsan_pm_write8},
+    {16, __etsan_pm_write16},
+  };
+#endif
+
   void simulate_parallel_threads_exections(func_t& read_func, func_t& write_func, void* addr, int line_num) {
     std::vector<std::thread> threads;
     std::array<data_t, NUM_THREADS> data;
@@ -82,12 +128,18 @@ protected:
     auto cout_read_buffer = std::cout.rdbuf();
     std::cout.rdbuf(input_capture.rdbuf());
 
+    // a one-site table, kept for the whole process like a module's
+    auto site = new site_t{uint64_t(line_num) << 16, data.front().func_name};
+    auto files = new const char *[1]{data.front().file_name};
+    unsigned int site_id = __tsan_register_sites(site, 1, files, 1);
+
     // create threads
     for (int i = 0; i < NUM_THREADS; i++) {
       data[i].ft_read_func = read_func;
       data[i].ft_write_func = write_func;
       data[i].addr = addr;
       data[i].line_no = line_num;
+      data[i].site_id = site_id;
 
       threads.push_back(std::thread(threadFunction, std::ref(data[i])));
       usleep(200);
@@ -127,6 +179,99 @@ TEST(TsanInterfaceTestFixture, CallingTsanInit) {
   ASSERT_TRUE(true);
 }
 
+extern "C" int __etsan_concurrent;
+
+// Races of the accesses made in sync-only mode are not reported, while
+// the synchronization done in it still orders the accesses checked later
+TEST(TsanInterfaceModeTest, syncOnlyModeKeepsHappensBefore) {
+  EXPECT_EQ(-1, __etsan_set_mode(7));
+  EXPECT_EQ(__etsan_mode_full, __etsan_get_mode());
+
+  static int x, y, lock;
+  auto sites = new site_t[2]{{uint64_t(901) << 16, "x"},
+                             {uint64_t(902) << 16, "y"}};
+  auto files = new const char *[1]{"mode.c"};
+  unsigned int site_id = __tsan_register_sites(sites, 2, files, 1);
+
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  std::atomic<int> step{0};
+  auto waitFor = [&step](int s) {
+    while (step != s) std::this_thread::yield();
+  };
+  std::thread child([&] {
+    waitFor(1);
+    __tsan_write4(&x, site_id);
+    __tsan_thread_lock(&lock);
+    __tsan_write4(&y, site_id + 1);
+    step = 2;
+    waitFor(3);
+    __tsan_thread_unlock(&lock); // in sync-only mode
+    step = 4;
+    waitFor(5); // running, so the program is multithreaded
+  });
+  auto child_id = child.get_id();
+  __tsan_thread_create((void*)(&child_id));
+  step = 1;
+
+  waitFor(2);
+  EXPECT_EQ(__etsan_mode_full, __etsan_set_mode(__etsan_mode_sync_only));
+  EXPECT_EQ(0, __etsan_concurrent);
+  __tsan_write4(&x, site_id); // racy, not checked
+  step = 3;
+  waitFor(4);
+  __tsan_thread_lock(&lock);
+  EXPECT_EQ(__etsan_mode_sync_only, __etsan_set_mode(__etsan_mode_full));
+  EXPECT_NE(0, __etsan_concurrent);
+  __tsan_write4(&y, site_id + 1); // ordered by the lock
+  __tsan_thread_unlock(&lock);
+  step = 5;
+
+  child.join();
+  __tsan_thread_join((void*)(&child_id));
+  __tsan_main_func_exit();
+
+  EXPECT_EQ(std::string::npos, input_capture.str().find("mode.c"));
+  std::cout.rdbuf(cout_read_buffer);
+}
+
+// A child created by __etsan_thread_create is ordered after what its
+// parent did before the call, even when it runs first, and races with
+// what the parent does after it
+TEST(TsanInterfaceThreadTest, threadCreateOrdersTheChildFromTheStart) {
+  static int before, after;
+  auto sites = new site_t[2]{{uint64_t(951) << 16, "before"},
+                             {uint64_t(952) << 16, "after"}};
+  auto files = new const char *[1]{"create.c"};
+  static unsigned int site_id;
+  site_id = __tsan_register_sites(sites, 2, files, 1);
+
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  __tsan_write4(&before, site_id);
+  pthread_t child;
+  auto routine = [](void *) -> void * {
+    __tsan_write4(&before, site_id);
+    __tsan_write4(&after, site_id + 1);
+    return nullptr;
+  };
+  ASSERT_EQ(0, __etsan_thread_create(&child, nullptr, routine, nullptr));
+  __tsan_write4(&after, site_id + 1);
+  pthread_join(child, nullptr);
+  __tsan_thread_join((void *)child);
+  __tsan_write4(&before, site_id); // ordered by the join
+  __tsan_main_func_exit();
+
+  std::string report = input_capture.str();
+  std::cout.rdbuf(cout_read_buffer);
+  EXPECT_EQ(std::string::npos, report.find("At line number: 951"));
+  EXPECT_NE(std::string::npos, report.find("At line number: 952"));
+}
+
 TEST_P(TsanInterfaceTestFixture, CheckTsanRreadWithConcurrencyAndRace) {
   int func_id = GetParam();
   void* addr = (void*)(0x03 + func_id);
@@ -149,9 +294,101 @@ TEST_P(TsanInterfaceTestFixture, CheckTsanUNALIGNEDreadWithConcurrencyAndRace) {
   }
 }
 
-///'''
-//INSTANTIATE_TEST_SUITE_P(ParamTest,
-//                         TsanInterfaceTestFixture,
-//                         ::testing::ValuesIn({1, 2, 4, 8, 16}),
-//                         testing::PrintToStringParamName());
-///'''
+#ifdef HAS_TRAMPOLINES
+TEST_P(TsanInterfaceTestFixture, CheckPreservingTrampolinesWithConcurrencyAndRace) {
+  int func_id = GetParam();
+  void* addr = (void*)(size_t)(0x240 + func_id);
+  int line_num = 203 + func_id;
+  simulate_parallel_threads_exections(preserving_read_functions[func_id],
+                                      preserving_write_functions[func_id],
+                                      addr,
+                                      line_num);
+}
+#endif
+
+#ifdef __x86_64__
+// The caller-saved registers but r11 survive the call, as preserve_most
+// has it: the inputs are in callee-saved registers, only clobbered here.
+TEST(TsanInterfaceTrampolineTest, callerSavedRegistersArePreserved) {
+  static int variable;
+  uint64_t saved[8];
+  asm volatile("movq $1, %%rax\n\t"
+               "movq $2, %%rcx\n\t"
+               "movq $3, %%rdx\n\t"
+               "movq $8, %%r8\n\t"
+               "movq $9, %%r9\n\t"
+               "movq $10, %%r10\n\t"
+               "movq %[addr], %%rdi\n\t"
+               "movl $0, %%esi\n\t"
+               "call __etsan_pm_write4\n\t"
+               "movq %%rax, 0(%[saved])\n\t"
+               "movq %%rcx, 8(%[saved])\n\t"
+               "movq %%rdx, 16(%[saved])\n\t"
+               "movq %%rsi, 24(%[saved])\n\t"
+               "movq %%rdi, 32(%[saved])\n\t"
+               "movq %%r8, 40(%[saved])\n\t"
+               "movq %%r9, 48(%[saved])\n\t"
+               "movq %%r10, 56(%[saved])"
+               :
+               : [addr] "b"(&variable), [saved] "r"(saved)
+               : "rax", "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11",
+                 "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+                 "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13",
+                 "xmm14", "xmm15", "cc", "memory");
+  EXPECT_EQ(1U, saved[0]);
+  EXPECT_EQ(2U, saved[1]);
+  EXPECT_EQ(3U, saved[2]);
+  EXPECT_EQ(0U, saved[3]);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(&variable), saved[4]);
+  EXPECT_EQ(8U, saved[5]);
+  EXPECT_EQ(9U, saved[6]);
+  EXPECT_EQ(10U, saved[7]);
+}
+#endif
+
+INSTANTIATE_TEST_SUITE_P(ParamTest,
+                         TsanInterfaceTestFixture,
+                         ::testing::ValuesIn({1, 2, 4, 8, 16}),
+                         testing::PrintToStringParamName());
+
+// A watched variable is checked at each access, in sync-only mode and
+// from code without callbacks: here plain accesses of another thread
+TEST(TsanInterfaceWatchTest, watchedVariableIsCheckedWithoutCallbacks) {
+  static volatile int watched;
+  static volatile int ordered;
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  EXPECT_EQ(__etsan_mode_full, __etsan_set_mode(__etsan_mode_sync_only));
+  int slot = __etsan_watch((const void *)&watched, sizeof(watched),
+                           "watched_counter");
+  if (slot < 0) {
+    __etsan_set_mode(__etsan_mode_full);
+    std::cout.rdbuf(cout_read_buffer);
+    GTEST_SKIP() << "no hardware breakpoints on this host";
+  }
+  EXPECT_EQ(-1, __etsan_watch(nullptr, 4, "none"));
+
+  ordered = 1; // before the thread: not watched
+  pthread_t child;
+  auto routine = [](void *) -> void * {
+    watched = watched + 1;
+    (void)ordered;
+    return nullptr;
+  };
+  ASSERT_EQ(0, __etsan_thread_create(&child, nullptr, routine, nullptr));
+  watched = 7; // unordered with the child's increment
+  pthread_join(child, nullptr);
+  __tsan_thread_join((void *)child);
+
+  EXPECT_EQ(1, __etsan_unwatch((const void *)&watched));
+  EXPECT_EQ(0, __etsan_unwatch((const void *)&watched));
+  EXPECT_EQ(__etsan_mode_sync_only, __etsan_set_mode(__etsan_mode_full));
+  __tsan_main_func_exit();
+
+  std::string report = input_capture.str();
+  std::cout.rdbuf(cout_read_buffer);
+  EXPECT_NE(std::string::npos, report.find("watched_counter"));
+  EXPECT_NE(std::string::npos, report.find("tsan_interface_test+0x"));
+}
@@ -19,23 +19,39 @@
 
 #include "etsan/tsan_interface.h"
 
-void** addr = (void**)(0x03);
+// __tsan_vptr_update reads the vptr, which the instrumented store then
+// changes: it stays null here, so every update is of a new value
+void *vptr = nullptr;
+void** addr = &vptr;
 void *new_val = (void*)(0x001);
 int line_num = 123;
 char * func_name = "some_function";
 char * file_name = "some_file";
 
+// entry of a site table as emitted by the compiler pass: the packed
+// location | file : 16 | line : 32 | column : 16 | and the variable name
+struct site_t
+{
+  uint64_t loc;
+  const char * obj_name;
+};
+
+const site_t sites[] = {{uint64_t(line_num) << 16, func_name}};
+const char * const files[] = {file_name};
+unsigned int site_id = 0;
+
 void threadFunction() {
 
   usleep(400);
-  __tsan_vptr_read(addr, line_num, func_name, file_name);
-  __tsan_vptr_update(addr, new_val, line_num, func_name, file_name);
+  __tsan_vptr_read(addr, site_id);
+  __tsan_vptr_update(addr, new_val, site_id);
 }
 
 constexpr int NUM_THREADS = 4;
 
 TEST(TsanInterfaceTestFixture, CheckTsanRreadWriteVptrWithConcurrencyAndRace) {
   std::vector<std::thread> threads;
+  site_id = __tsan_register_sites(sites, 1, files, 1);
 
   // redirect cout to a stream to capture output string
   std::stringstream input_capture;
@@ -75,3 +91,41 @@ TEST(TsanInterfaceTestFixture, CheckTsanRreadWriteVptrWithConcurrencyAndRace) {
   std::cout.rdbuf(cout_read_buffer);
   std::cout << input_capture.str() << std::endl;
 }
+
+// Loads and stores of the value a vptr already has, as constructors of
+// a class hierarchy make, are reads only: they cannot race
+TEST(TsanInterfaceTestFixture, CheckVptrStoresOfTheSameValueDoNotRace) {
+  static void *table = (void *)(0x100);
+  static void *object = table;
+  static const site_t same_sites[] = {{uint64_t(456) << 16, "object"}};
+  static unsigned int same_site;
+  same_site = __tsan_register_sites(same_sites, 1, files, 1);
+
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < NUM_THREADS; i++) {
+    threads.push_back(std::thread([] {
+      usleep(400);
+      __tsan_vptr_read(&object, same_site);
+      __tsan_vptr_update(&object, table, same_site);
+    }));
+    usleep(200);
+
+    auto child_id = threads[i].get_id();
+    __tsan_thread_create((void*)(&child_id));
+  }
+
+  for (auto& thread : threads) {
+    auto child_id = thread.get_id();
+    thread.join();
+    __tsan_thread_join((void*)(&child_id));
+  }
+
+  __tsan_main_func_exit();
+
+  std::cout.rdbuf(cout_read_buffer);
+  EXPECT_EQ(std::string::npos, input_capture.str().find("At line number: 456"));
+}
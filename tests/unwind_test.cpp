@@ -0,0 +1,106 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for the call stacks of races taken by unwinding, of
+// ETSAN_UNWIND_STACKS.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "etsan/race_report.h"
+
+// The frames of these are looked up by name: exported, see CMakeLists.txt
+extern "C" {
+
+__attribute__((noinline)) unsigned int
+unwind_test_callback(uintptr_t *pcs, unsigned int max) {
+  return etsan::unwindStack(__builtin_return_address(0), pcs, max);
+}
+
+__attribute__((noinline)) unsigned int
+unwind_test_caller(uintptr_t *pcs, unsigned int max) {
+  unsigned int n = unwind_test_callback(pcs, max);
+  asm volatile("" ::: "memory"); // not a tail call
+  return n;
+}
+
+// Reports a race as an access callback does
+__attribute__((noinline)) void unwind_test_report(unsigned int site) {
+  etsan::reportRaceOnWrite(site, __builtin_return_address(0));
+}
+
+__attribute__((noinline)) void unwind_test_writer(unsigned int site) {
+  unwind_test_report(site);
+  asm volatile("" ::: "memory");
+}
+
+}
+
+static std::string symbolOf(uintptr_t pc) {
+  std::string frame = etsan::formatFrame(pc);
+  return frame.substr(0, frame.find('+'));
+}
+
+TEST(UnwindTestFixture, stackStartsAtTheCaller) {
+  uintptr_t pcs[64];
+  unsigned int n = unwind_test_caller(pcs, 64);
+  ASSERT_GE(n, 2U);
+  EXPECT_EQ("unwind_test_caller", symbolOf(pcs[n - 1])); // innermost
+  for (unsigned int i = 0; i < n; i++)
+    EXPECT_NE("unwind_test_callback", symbolOf(pcs[i]));
+}
+
+TEST(UnwindTestFixture, innermostFramesAreKept) {
+  uintptr_t pcs[1];
+  EXPECT_EQ(1U, unwind_test_caller(pcs, 1));
+  EXPECT_EQ("unwind_test_caller", symbolOf(pcs[0]));
+}
+
+TEST(UnwindTestFixture, allFramesWithoutTheCallback) {
+  uintptr_t pcs[64];
+  unsigned int n = etsan::unwindStack(nullptr, pcs, 64);
+  EXPECT_GE(n, 2U);
+  n = etsan::unwindStack(reinterpret_cast<void *>(1), pcs, 64); // not found
+  EXPECT_GE(n, 2U);
+}
+
+TEST(UnwindTestFixture, framesNameTheirModule) {
+  uintptr_t pcs[64];
+  unsigned int n = unwind_test_caller(pcs, 64);
+  ASSERT_GE(n, 1U);
+  const char *interned = etsan::formatFrame(pcs[n - 1]);
+  EXPECT_EQ(interned, etsan::formatFrame(pcs[n - 1]));
+  std::string frame = interned;
+  EXPECT_EQ(0U, frame.find("unwind_test_caller+0x")) << frame;
+  EXPECT_NE(std::string::npos,
+            frame.find(std::string("(") + etsan::executablePath() + "+0x"))
+      << frame;
+}
+
+TEST(UnwindTestFixture, raceReportsShowTheUnwoundStack) {
+  static const char *const files[] = {"unwind.c"};
+  static const etsan::SiteInfo sites[] = {
+    {etsan::makeSiteLoc(0, 77, 5), "shared"}};
+  const unsigned int site_id = etsan::registerSites(sites, 1, files, 1);
+
+  std::stringstream input_capture;
+  auto cout_read_buffer = std::cout.rdbuf();
+  std::cout.rdbuf(input_capture.rdbuf());
+
+  unwind_test_writer(site_id);
+  etsan::flushRaceReports();
+
+  std::string report = input_capture.str();
+  std::cout.rdbuf(cout_read_buffer);
+  EXPECT_NE(std::string::npos, report.find("At line number: 77"));
+  EXPECT_NE(std::string::npos, report.find("unwind_test_writer+0x"));
+  EXPECT_EQ(std::string::npos, report.find("unwind_test_report"));
+}
@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////
+//
+// Copyright (c) 2017 - 2021  Hassan Salehe Matar
+//
+// See LICENSE file for information about the license.
+//
+// Unit tests for fixed-width vector clocks.
+//
+////////////////////////////////////////////////////
+
+#include <gtest/gtest.h>
+
+#include "etsan/fasttrack.h"
+
+using Clock = etsan::FixedVectorClock<etsan::Epochs, 16>;
+
+TEST(VectorClockTestFixture, unusedSlotsHoldZeroEpochs) {
+  Clock vc = {(0 << 24) + 5, (1 << 24) + 7};
+  EXPECT_EQ(2U, vc.size());
+  for (unsigned t = 2; t < Clock::kCapacity; t++) {
+    EXPECT_EQ(int(t << 24), vc[t]);
+  }
+
+  vc.resize(4);
+  EXPECT_EQ(2 << 24, vc.at(2));
+  vc[3] = (3 << 24) + 9;
+  vc.resize(1);
+  EXPECT_EQ(3 << 24, vc[3]); // shrinking resets the dropped slots
+  EXPECT_THROW(vc.at(1), std::out_of_range);
+}
+
+TEST(VectorClockTestFixture, joinTakesMaxOfEachThread) {
+  Clock a = {(0 << 24) + 1, (1 << 24) + 8, (2 << 24) + 3};
+  Clock b = {(0 << 24) + 4, (1 << 24) + 2, (2 << 24) + 3, (3 << 24) + 6};
+
+  a.join(b);
+  EXPECT_EQ(4U, a.size());
+  EXPECT_EQ((0 << 24) + 4, a[0]);
+  EXPECT_EQ((1 << 24) + 8, a[1]);
+  EXPECT_EQ((2 << 24) + 3, a[2]);
+  EXPECT_EQ((3 << 24) + 6, a[3]);
+  for (unsigned t = 4; t < Clock::kCapacity; t++) {
+    EXPECT_EQ(int(t << 24), a[t]);
+  }
+}
+
+TEST(VectorClockTestFixture, copyReplacesAllSlots) {
+  Clock a = {(0 << 24) + 9, (1 << 24) + 9};
+  Clock b = {(0 << 24) + 1};
+  b[12] = (12 << 24) + 2; // beyond the size, still copied
+
+  a.copy(b);
+  EXPECT_EQ(2U, a.size());
+  EXPECT_EQ((0 << 24) + 1, a[0]);
+  EXPECT_EQ(1 << 24, a[1]);
+  EXPECT_EQ((12 << 24) + 2, a[12]);
+}
+
+TEST(VectorClockTestFixture, leqComparesEveryThread) {
+  Clock a = {(0 << 24) + 1, (1 << 24) + 2};
+  Clock b = {(0 << 24) + 1, (1 << 24) + 3};
+  EXPECT_TRUE(a.leq(b));
+  EXPECT_FALSE(b.leq(a));
+  EXPECT_TRUE(a.leq(a));
+
+  a[15] = (15 << 24) + 1; // last slot of the widest kernel
+  EXPECT_FALSE(a.leq(b));
+}
+
+TEST(VectorClockTestFixture, syncJoinsUseFixedClocks) {
+  ThreadState t;
+  t.tid = 0;
+  t.C = {(0 << 24) + 2, (1 << 24) + 1};
+  t.updateEpoch();
+
+  LockState lock;
+  lock.L = {(0 << 24) + 1, (1 << 24) + 5, (2 << 24) + 4};
+
+  ft_acquire(t, lock);
+  EXPECT_EQ(3U, t.C.size());
+  EXPECT_EQ((0 << 24) + 2, t.C[0]);
+  EXPECT_EQ((1 << 24) + 5, t.C[1]);
+  EXPECT_EQ((2 << 24) + 4, t.C[2]);
+
+  ft_release(t, lock);
+  EXPECT_EQ((0 << 24) + 2, lock.L[0]);
+  EXPECT_EQ((0 << 24) + 3, t.epoch);
+}
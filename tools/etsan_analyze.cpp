@@ -0,0 +1,53 @@
+//===-- etsan-analyze: host analyzer of EmbedSanitizer event logs ---------===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Detects the races of a run of a program built with ETSAN_RECORD from
+// the logs of all its threads, with the reports the runtime prints.
+//
+//   etsan-analyze [-j workers] etsan-<pid>-*.log
+//
+// The accesses are checked by "workers" threads (default: one per core),
+// each over a share of the address space.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <thread>
+#include "etsan/event_replay.h"
+
+int main(int argc, char **argv)
+{
+  unsigned int workers = std::thread::hardware_concurrency();
+  int first = 1;
+  if (argc > 2 && !strcmp(argv[1], "-j")) {
+    workers = atoi(argv[2]);
+    first = 3;
+  }
+  if (argc <= first) {
+    fprintf(stderr, "usage: %s [-j workers] log...\n", argv[0]);
+    return 2;
+  }
+
+  etsan::Replayer replayer;
+  for (int i = first; i < argc; i++) {
+    std::string error;
+    if (!replayer.addLog(argv[i], error)) {
+      fprintf(stderr, "etsan-analyze: %s\n", error.c_str());
+      return 1;
+    }
+  }
+
+  replayer.run(workers);
+  replayer.print(std::cout);
+  return 0;
+}
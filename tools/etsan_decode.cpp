@@ -0,0 +1,45 @@
+//===-- etsan-decode: host decoder of EmbedSanitizer binary reports -------===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Renders the binary race reports or trace of a program built with
+// ETSAN_BINARY_REPORTS as the text the runtime prints otherwise.
+//
+//   etsan-decode [report.bin]     (default: standard input)
+
+#include <stdio.h>
+#include <iostream>
+#include "etsan/binary_decoder.h"
+
+int main(int argc, char **argv)
+{
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [report.bin]\n", argv[0]);
+    return 2;
+  }
+
+  FILE *in = argc == 2 ? fopen(argv[1], "rb") : stdin;
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  etsan::BinaryDecoder decoder;
+  std::string error;
+  bool ok = decoder.decode(in, std::cout, error);
+  if (in != stdin) fclose(in);
+
+  if (!ok) {
+    fprintf(stderr, "etsan-decode: %s\n", error.c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,144 @@
+//===-- etsan-symbolize: host symbolizer of EmbedSanitizer call stacks ----===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Resolves the frames of races reported by a runtime built with
+// ETSAN_UNWIND_STACKS, "(module+0x8a4)", to their function and source
+// line with addr2line, and copies the rest of the report as it is. The
+// offsets are return addresses: the call before them is looked up.
+//
+//   etsan-symbolize [-s sysroot] [report.txt]     (default: standard input)
+//
+// The modules are read from "sysroot" when given, e.g. the target's root
+// file system; ETSAN_ADDR2LINE names the addr2line to run, e.g.
+// arm-linux-gnueabi-addr2line.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+#include <map>
+#include <string>
+
+// The single-quoted "s", for the shell
+static std::string quoted(const std::string &s)
+{
+  std::string q = "'";
+  for (char c : s) q += c == '\'' ? std::string("'\\''") : std::string(1, c);
+  return q + "'";
+}
+
+class Symbolizer {
+public:
+  explicit Symbolizer(const std::string &sysroot) : sysroot(sysroot) {
+    const char *tool = getenv("ETSAN_ADDR2LINE");
+    addr2line = tool && *tool ? tool : "addr2line";
+  }
+
+  // "function file:line" of return address "offset" in "module", or an
+  // empty string if unknown
+  const std::string &lookup(const std::string &module, unsigned long offset) {
+    std::string key = module + '+' + std::to_string(offset);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+
+    std::string command = addr2line + " -f -C -e " +
+                          quoted(sysroot + module) + " 0x";
+    char address[32];
+    snprintf(address, sizeof(address), "%lx", offset ? offset - 1 : 0);
+    command += address;
+    command += " 2>/dev/null";
+
+    std::string result;
+    if (FILE *out = popen(command.c_str(), "r")) {
+      char function[4096], line[4096];
+      if (fgets(function, sizeof(function), out) &&
+          fgets(line, sizeof(line), out)) {
+        function[strcspn(function, "\n")] = '\0';
+        line[strcspn(line, "\n")] = '\0';
+        if (strcmp(function, "??") || strncmp(line, "??", 2))
+          result = std::string(function) + " " + line;
+      }
+      pclose(out);
+    }
+    return cache[key] = result;
+  }
+
+private:
+  std::string sysroot;
+  std::string addr2line;
+  std::map<std::string, std::string> cache;
+};
+
+// Copies "line" with its frames resolved
+static std::string symbolize(const std::string &line, Symbolizer &symbolizer)
+{
+  std::string out;
+  size_t pos = 0;
+  while (pos < line.size()) {
+    size_t open = line.find('(', pos);
+    size_t close = open == std::string::npos ? open : line.find(')', open);
+    if (close == std::string::npos) break;
+
+    std::string frame = line.substr(open + 1, close - open - 1);
+    size_t plus = frame.rfind("+0x");
+    std::string symbol;
+    if (plus != std::string::npos && plus && frame.find('(') == frame.npos) {
+      char *end = nullptr;
+      unsigned long offset = strtoul(frame.c_str() + plus + 3, &end, 16);
+      if (end && !*end)
+        symbol = symbolizer.lookup(frame.substr(0, plus), offset);
+    }
+    out.append(line, pos, open + 1 - pos);
+    out += symbol.empty() ? frame : symbol;
+    out += ')';
+    pos = close + 1;
+  }
+  if (pos < line.size()) out.append(line, pos, std::string::npos);
+  return out;
+}
+
+int main(int argc, char **argv)
+{
+  std::string sysroot;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:")) != -1) {
+    if (opt != 's') {
+      fprintf(stderr, "usage: %s [-s sysroot] [report.txt]\n", argv[0]);
+      return 2;
+    }
+    sysroot = optarg;
+  }
+  if (argc - optind > 1) {
+    fprintf(stderr, "usage: %s [-s sysroot] [report.txt]\n", argv[0]);
+    return 2;
+  }
+
+  FILE *in = optind < argc ? fopen(argv[optind], "r") : stdin;
+  if (!in) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  Symbolizer symbolizer(sysroot);
+  std::string line;
+  char buffer[4096];
+  while (fgets(buffer, sizeof(buffer), in)) {
+    line += buffer;
+    if (line.back() != '\n' && !feof(in)) continue; // longer than the buffer
+    std::cout << symbolize(line, symbolizer);
+    line.clear();
+  }
+  if (!line.empty()) std::cout << symbolize(line, symbolizer);
+  if (in != stdin) fclose(in);
+  return 0;
+}
@@ -0,0 +1,76 @@
+//===-- etsan-top: live statistics of a program under EmbedSanitizer ------===//
+//
+//
+// This file is distributed under the BSD 3-clause "New" or "Revised" License
+// License. See LICENSE.md for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// (c) 2017 - 2021 Hassan Salehe Matar, Koc University
+//            Email: hmatar@ku.edu.tr
+//===----------------------------------------------------------------------===//
+
+// Prints one line per interval with the rates of the live statistics a
+// program run with ETSAN_LIVE_STATS=<file> publishes, see
+// etsan/live_stats.h. Only reads the page: the program is not stopped.
+//
+//   etsan-top <file> [interval ms] [count]
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include "etsan/live_stats.h"
+
+int main(int argc, char **argv)
+{
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr, "usage: %s <file> [interval ms] [count]\n", argv[0]);
+    return 2;
+  }
+  unsigned long interval = argc > 2 ? strtoul(argv[2], nullptr, 0) : 1000;
+  unsigned long count = argc > 3 ? strtoul(argv[3], nullptr, 0) : 0;
+  if (!interval) interval = 1000;
+
+  const etsan::LiveStatsPage *page = etsan::mapLiveStats(argv[1]);
+  etsan::LiveStatsPage last;
+  if (!page || !etsan::readLiveStats(page, last)) {
+    fprintf(stderr, "etsan-top: %s: no live statistics\n", argv[1]);
+    return 1;
+  }
+
+  for (unsigned long line = 0; !count || line < count; line++) {
+    usleep(interval * 1000);
+    etsan::LiveStatsPage now;
+    if (!etsan::readLiveStats(page, now)) {
+      fprintf(stderr, "etsan-top: %s: unreadable page\n", argv[1]);
+      return 1;
+    }
+    if (line % 20 == 0) {
+      printf("%8s %8s %6s %12s %12s %6s %10s %8s %10s\n", "pid", "threads",
+             "locks", "reads/s", "writes/s", "fast%", "meta KiB", "races",
+             "evicted");
+    }
+
+    double seconds = (now.timeNs - last.timeNs) / 1e9;
+    uint64_t reads = now.reads - last.reads;
+    uint64_t writes = now.writes - last.writes;
+    uint64_t fast = now.sameEpoch - last.sameEpoch;
+    printf("%8u %8llu %6llu %12.0f %12.0f %6.1f %10llu %8llu %10llu\n",
+           now.pid, (unsigned long long)now.threads,
+           (unsigned long long)now.locks, seconds > 0 ? reads / seconds : 0,
+           seconds > 0 ? writes / seconds : 0,
+           reads + writes ? 100.0 * fast / (reads + writes) : 0.0,
+           (unsigned long long)(now.metadataBytes >> 10),
+           (unsigned long long)now.races, (unsigned long long)now.evictions);
+    fflush(stdout);
+    last = now;
+
+    if (kill(now.pid, 0) && errno == ESRCH) {
+      printf("etsan-top: process %u has exited\n", now.pid);
+      return 0;
+    }
+  }
+  return 0;
+}